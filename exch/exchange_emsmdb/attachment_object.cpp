@@ -134,6 +134,7 @@ gxerr_t ATTACHMENT_OBJECT::save()
 	pattachment->b_new = FALSE;
 	pattachment->b_touched = FALSE;
 	pattachment->pparent->b_touched = TRUE;
+	pattachment->pparent->prop_cache.clear();
 	proptag_array_append(pattachment->pparent->pchanged_proptags, PR_MESSAGE_ATTACHMENTS);
 	return GXERR_SUCCESS;
 }
@@ -4,6 +4,7 @@
 #include <gromox/proc_common.h>
 #include "common_util.h"
 #include "aux_ext.h"
+#include "rop_ext.h"
 #include <cstring>
 #define AUX_ALIGN_SIZE									4
 #define TRY(expr) do { int v = (expr); if (v != EXT_ERR_SUCCESS) return v; } while (false)
@@ -1094,10 +1095,13 @@ int aux_ext_push_aux_info(EXT_PUSH *pext, AUX_INFO *r)
 	rpc_header_ext.size_actual = subext.m_offset;
 	rpc_header_ext.size = rpc_header_ext.size_actual;
 	if (rpc_header_ext.flags & RHE_FLAG_COMPRESSED) {
-		if (rpc_header_ext.size_actual < MINIMUM_COMPRESS_SIZE) {
+		if (rpc_header_ext.size_actual < MINIMUM_COMPRESS_SIZE ||
+		    0 == g_rpc_compress_level) {
 			rpc_header_ext.flags &= ~RHE_FLAG_COMPRESSED;
 		} else {
-			uint32_t compressed_len = lzxpress_compress(ext_buff, subext.m_offset, tmp_buff);
+			uint32_t compressed_len = lzxpress_compress(ext_buff,
+			         subext.m_offset, tmp_buff, subext.m_offset,
+			         g_rpc_compress_level);
 			if (compressed_len == 0 || compressed_len >= subext.m_offset) {
 				/* if we can not get benefit from the
 					compression, unmask the compress bit */
@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 #include <atomic>
+#include <condition_variable>
 #include <csignal>
+#include <cstddef>
 #include <cstdint>
 #include <mutex>
 #include <libHX/string.h>
@@ -15,6 +17,7 @@
 #include <gromox/scope.hpp>
 #include <gromox/str_hash.hpp>
 #include "aux_ext.h"
+#include "exmdb_client.h"
 #include <gromox/util.hpp>
 #include <gromox/guid.hpp>
 #include <ctime>
@@ -37,7 +40,8 @@
 
 #define MAX_NOTIFY_RESPONSE_NUM			128
 
-#define MAX_CONTENT_ROW_DELETED			6
+/* row events per table before they are collapsed into TABLE_CHANGED */
+#define MAX_TABLE_ROW_EVENTS			6
 
 #define FLAG_PRIVILEGE_ADMIN			0x00000001
 
@@ -45,6 +49,9 @@
 
 #define MAX_HANDLE_PER_USER				100
 
+/* pooled buffers unused for this long are returned to the system */
+#define RPCBUF_IDLE_INTERVAL			60
+
 using namespace gromox;
 
 namespace {
@@ -54,7 +61,6 @@ struct HANDLE_DATA {
 	GUID guid;
 	char username[UADDR_SIZE];
 	uint16_t cxr;
-	uint32_t last_handle;
 	EMSMDB_INFO info;
 	BOOL b_processing;	/* if the handle is processing rops */
 	BOOL b_occupied;	/* if the notify list is locked */
@@ -62,6 +68,7 @@ struct HANDLE_DATA {
 	int rop_num;
 	uint16_t rop_left;	/* size left in rop response buffer */
 	time_t last_time;
+	EMSMDB_SESSION_STATS stats;
 };
 
 struct NOTIFY_ITEM {
@@ -70,17 +77,28 @@ struct NOTIFY_ITEM {
 	GUID guid;
 };
 
+struct RPC_BUFFER {
+	RPC_BUFFER *next;
+	time_t last_used;
+	alignas(std::max_align_t) uint8_t data[EMSMDB_RPCBUF_SIZE];
+};
+
 }
 
 static constexpr size_t TAG_SIZE = 256;
 static time_t g_start_time;
 static pthread_t g_scan_id;
 static std::mutex g_lock, g_notify_lock;
+/* signalled with g_lock when some b_occupied gets cleared */
+static std::condition_variable g_occupied_cond;
 static std::atomic<bool> g_notify_stop{true};
 static pthread_key_t g_handle_key;
 static STR_HASH_TABLE *g_user_hash;
 static STR_HASH_TABLE *g_handle_hash;
 static STR_HASH_TABLE *g_notify_hash;
+static std::mutex g_rpcbuf_lock;
+/* most recently returned first, so that warm buffers get reused */
+static RPC_BUFFER *g_rpcbuf_free;
 
 static void *emsi_scanwork(void *);
 
@@ -173,10 +191,17 @@ static HANDLE_DATA* emsmdb_interface_get_handle_data(CXH *pcxh)
 	}
 }
 
-static void emsmdb_interface_put_handle_data(HANDLE_DATA *phandle)
+static void emsmdb_interface_put_handle_data(HANDLE_DATA *phandle,
+	const EMSMDB_SESSION_STATS *pstats = nullptr)
 {
 	std::lock_guard gl_hold(g_lock);
 	phandle->b_processing = FALSE;
+	if (NULL != pstats) {
+		phandle->stats.rops += pstats->rops;
+		phandle->stats.usec += pstats->usec;
+		phandle->stats.exmdb_usec += pstats->exmdb_usec;
+		phandle->stats.slow_rops += pstats->slow_rops;
+	}
 }
 
 static HANDLE_DATA* emsmdb_interface_get_handle_notify_list(CXH *pcxh)
@@ -188,26 +213,26 @@ static HANDLE_DATA* emsmdb_interface_get_handle_notify_list(CXH *pcxh)
 		return NULL;
 	}
 	guid_to_string(&pcxh->guid, guid_string, sizeof(guid_string));
+	std::unique_lock gl_hold(g_lock);
 	while (true) {
-		std::unique_lock gl_hold(g_lock);
 		phandle = static_cast<HANDLE_DATA *>(str_hash_query(g_handle_hash, guid_string));
 		if (NULL == phandle) {
 			return NULL;
 		}
-		if (TRUE == phandle->b_occupied) {
-			gl_hold.unlock();
-			usleep(100000);
-		} else {
+		if (FALSE == phandle->b_occupied) {
 			phandle->b_occupied = TRUE;
 			return phandle;
 		}
+		g_occupied_cond.wait(gl_hold);
 	}
 }
 
 static void emsmdb_interface_put_handle_notify_list(HANDLE_DATA *phandle)
 {
-	std::lock_guard gl_hold(g_lock);
+	std::unique_lock gl_hold(g_lock);
 	phandle->b_occupied = FALSE;
+	gl_hold.unlock();
+	g_occupied_cond.notify_all();
 }
 
 static BOOL emsmdb_interface_alloc_cxr(DOUBLE_LIST *plist,
@@ -254,6 +279,8 @@ static BOOL emsmdb_interface_create_handle(const char *username,
 	memcpy(temp_handle.info.client_version, client_version, 4);
 	temp_handle.info.client_mode = client_mode;
 	temp_handle.info.upctx_ref = 0;
+	temp_handle.info.rpc_seq = 0;
+	temp_handle.stats = {};
 	time(&temp_handle.last_time);
 	gx_strlcpy(temp_handle.username, username, GX_ARRAY_SIZE(temp_handle.username));
 	HX_strlower(temp_handle.username);
@@ -268,7 +295,6 @@ static BOOL emsmdb_interface_create_handle(const char *username,
 		return false;
 	phandle->node.pdata = phandle;
 	
-	phandle->last_handle = 0;
 	plogmap = rop_processor_create_logmap();
 	if (NULL == plogmap) {
 		str_hash_remove(g_handle_hash, guid_string);
@@ -340,12 +366,10 @@ static void emsmdb_interface_remove_handle(CXH *pcxh)
 			   rpc connection, can not be released! */
 			return;
 		}
-		if (TRUE == phandle->b_occupied) {
-			gl_hold.unlock();
-			usleep(100000);
-		} else {
+		if (FALSE == phandle->b_occupied) {
 			break;
 		}
+		g_occupied_cond.wait(gl_hold);
 	}
 	plist = static_cast<DOUBLE_LIST *>(str_hash_query(g_user_hash, phandle->username));
 	if (NULL != plist) {
@@ -427,9 +451,60 @@ void emsmdb_interface_stop()
 	}
 }
 
+/*
+ * Response buffers for EcDoRpcExt2 and mh Execute, sized for the largest
+ * cb_out a client can negotiate. They are kept across calls instead of
+ * allocating (and, in mh, zeroing) 256K per call.
+ */
+uint8_t *emsmdb_interface_get_rpcbuf()
+{
+	std::unique_lock rb_hold(g_rpcbuf_lock);
+	auto pbuf = g_rpcbuf_free;
+	if (NULL != pbuf) {
+		g_rpcbuf_free = pbuf->next;
+		return pbuf->data;
+	}
+	rb_hold.unlock();
+	pbuf = me_alloc<RPC_BUFFER>();
+	return pbuf != nullptr ? pbuf->data : nullptr;
+}
+
+void emsmdb_interface_put_rpcbuf(uint8_t *pdata)
+{
+	if (NULL == pdata) {
+		return;
+	}
+	auto pbuf = reinterpret_cast<RPC_BUFFER *>(pdata - offsetof(RPC_BUFFER, data));
+	time(&pbuf->last_used);
+	std::lock_guard rb_hold(g_rpcbuf_lock);
+	pbuf->next = g_rpcbuf_free;
+	g_rpcbuf_free = pbuf;
+}
+
+static void emsmdb_interface_trim_rpcbufs(time_t cur_time)
+{
+	RPC_BUFFER *pidle = nullptr;
+	std::unique_lock rb_hold(g_rpcbuf_lock);
+	for (auto pprev = &g_rpcbuf_free; NULL != *pprev; pprev = &(*pprev)->next) {
+		if (cur_time - (*pprev)->last_used > RPCBUF_IDLE_INTERVAL) {
+			/* anything after this was returned even earlier */
+			pidle = *pprev;
+			*pprev = nullptr;
+			break;
+		}
+	}
+	rb_hold.unlock();
+	while (NULL != pidle) {
+		auto pnext = pidle->next;
+		free(pidle);
+		pidle = pnext;
+	}
+}
+
 void emsmdb_interface_free()
 {
 	pthread_key_delete(g_handle_key);
+	emsmdb_interface_trim_rpcbufs(INT64_MAX);
 }
 
 int emsmdb_interface_disconnect(CXH *pcxh)
@@ -499,6 +574,7 @@ int emsmdb_interface_connect_ex(uint64_t hrpc, CXH *pcxh,
 	EXT_PUSH ext_push;
 	char username[UADDR_SIZE];
 	AUX_HEADER *pheader;
+	char maildir[256];
 	char temp_buff[1024];
 	uint16_t client_mode;
 	AUX_HEADER header_cap;
@@ -636,6 +712,10 @@ int emsmdb_interface_connect_ex(uint64_t hrpc, CXH *pcxh,
 		cpid, lcid_string, lcid_sort, pcxr, pcxh)) {
 		return ecLoginFailure;
 	}
+	/* RopLogon follows shortly; have exmdb load the store meanwhile */
+	if (TRUE == common_util_get_maildir(rpc_info.username, maildir)) {
+		exmdb_client_prewarm_store(maildir);
+	}
 	is_success = true;
 	return ecSuccess;
 }
@@ -662,6 +742,9 @@ int emsmdb_interface_rpc_ext2(CXH *pcxh, uint32_t *pflags,
 	HANDLE_DATA *phandle;
 	struct timeval first_time;
 	
+	/* mh does not range-check cb_out itself */
+	if (*pcb_out > EMSMDB_RPCBUF_SIZE)
+		*pcb_out = EMSMDB_RPCBUF_SIZE;
 	/* ms-oxcrpc 3.1.4.2 */
 	if (cb_in < 0x00000008 || *pcb_out < 0x00000008) {
 		*pflags = 0;
@@ -718,11 +801,14 @@ int emsmdb_interface_rpc_ext2(CXH *pcxh, uint32_t *pflags,
 				"auxiliary buffer in emsmdb_interface_rpc_ext2\n");
 		}
 	}
+	phandle->info.rpc_seq ++;
 	result = rop_processor_proc(*pflags, pin, cb_in, pout, pcb_out);
+	EMSMDB_SESSION_STATS rpc_stats;
+	rop_processor_get_rpc_stats(&rpc_stats);
 	gx_strlcpy(username, phandle->username, GX_ARRAY_SIZE(username));
 	cxr = phandle->cxr;
 	BOOL b_wakeup = double_list_get_nodes_num(&phandle->notify_list) == 0 ? false : TRUE;
-	emsmdb_interface_put_handle_data(phandle);
+	emsmdb_interface_put_handle_data(phandle, &rpc_stats);
 	if (TRUE == b_wakeup) {
 		asyncemsmdb_interface_wakeup(username, cxr);
 	}
@@ -775,6 +861,33 @@ EMSMDB_INFO* emsmdb_interface_get_emsmdb_info()
 	return &phandle->info;
 }
 
+std::vector<EMSMDB_SESSION_INFO> emsmdb_interface_get_sessions()
+{
+	char guid_string[64];
+	std::vector<EMSMDB_SESSION_INFO> sessions;
+	
+	std::lock_guard gl_hold(g_lock);
+	auto iter = str_hash_iter_init(g_handle_hash);
+	if (NULL == iter) {
+		return sessions;
+	}
+	auto cl_0 = make_scope_exit([&]() { str_hash_iter_free(iter); });
+	try {
+		sessions.reserve(g_handle_hash->item_num);
+		for (str_hash_iter_begin(iter); !str_hash_iter_done(iter);
+		     str_hash_iter_forward(iter)) {
+			auto phandle = static_cast<HANDLE_DATA *>(str_hash_iter_get_value(iter, guid_string));
+			auto &s = sessions.emplace_back();
+			gx_strlcpy(s.username, phandle->username, GX_ARRAY_SIZE(s.username));
+			s.cxr = phandle->cxr;
+			memcpy(s.client_version, phandle->info.client_version, sizeof(s.client_version));
+			s.stats = phandle->stats;
+		}
+	} catch (const std::bad_alloc &) {
+	}
+	return sessions;
+}
+
 DOUBLE_LIST* emsmdb_interface_get_notify_list()
 {
 	HANDLE_DATA *phandle;
@@ -783,16 +896,11 @@ DOUBLE_LIST* emsmdb_interface_get_notify_list()
 	if (NULL == phandle) {
 		return NULL;
 	}
-	while (true) {
-		std::unique_lock gl_hold(g_lock);
-		if (TRUE == phandle->b_occupied) {
-			gl_hold.unlock();
-			usleep(100000);
-		} else {
-			phandle->b_occupied = TRUE;
-			return &phandle->notify_list;
-		}
-	}
+	std::unique_lock gl_hold(g_lock);
+	while (TRUE == phandle->b_occupied)
+		g_occupied_cond.wait(gl_hold);
+	phandle->b_occupied = TRUE;
+	return &phandle->notify_list;
 }
 
 void emsmdb_interface_put_notify_list()
@@ -818,19 +926,6 @@ BOOL emsmdb_interface_get_cxr(uint16_t *pcxr)
 	return TRUE;
 }
 
-BOOL emsmdb_interface_alloc_hanlde_number(uint32_t *pnum)
-{
-	HANDLE_DATA *phandle;
-	
-	phandle = (HANDLE_DATA*)pthread_getspecific(g_handle_key);
-	if (NULL == phandle) {
-		return FALSE;
-	}
-	*pnum = phandle->last_handle;
-	phandle->last_handle ++;
-	return TRUE;
-}
-
 BOOL emsmdb_interface_get_cxh(CXH *pcxh)
 {
 	HANDLE_DATA *phandle;
@@ -979,136 +1074,135 @@ void emsmdb_interface_remove_subscription_notify(
 	str_hash_remove(g_notify_hash, tag_buff);
 }
 
-static BOOL emsmdb_interface_merge_content_row_deleted(
-	uint32_t obj_handle, uint8_t logon_id, DOUBLE_LIST *pnotify_list)
+static inline NOTIFY_RESPONSE *emsmdb_interface_node_notify(DOUBLE_LIST_NODE *pnode)
 {
-	int count;
-	DOUBLE_LIST_NODE *pnode;
-	NOTIFY_RESPONSE *pnotify;
-	NOTIFICATION_DATA *pnotification_data;
-	
-	count = 1;
-	for (pnode=double_list_get_head(pnotify_list); NULL!=pnode;
-		pnode=double_list_get_after(pnotify_list, pnode)) {
-		pnotify = static_cast<NOTIFY_RESPONSE *>(static_cast<ROP_RESPONSE *>(pnode->pdata)->ppayload);
-		pnotification_data = &pnotify->notification_data;
-		if (pnotify->handle != obj_handle ||
-			pnotify->logon_id != logon_id) {
-			continue;
-		}
-		if (NULL == pnotification_data->ptable_event) {
-			continue;
-		}
-		if (TABLE_EVENT_ROW_DELETED ==
-			*pnotification_data->ptable_event) {
-			count ++;
-			if (MAX_CONTENT_ROW_DELETED == count) {
-				notify_response_content_table_row_event_to_change(pnotify);
-				return TRUE;
-			}
-		} else if (TABLE_EVENT_TABLE_CHANGED ==
-			*pnotification_data->ptable_event) {
-			return TRUE;
-		}
+	return static_cast<NOTIFY_RESPONSE *>(static_cast<ROP_RESPONSE *>(pnode->pdata)->ppayload);
+}
+
+static void emsmdb_interface_free_notify_node(DOUBLE_LIST_NODE *pnode)
+{
+	notify_response_free(emsmdb_interface_node_notify(pnode));
+	free(pnode->pdata);
+	free(pnode);
+}
+
+static bool emsmdb_interface_is_row_event(const NOTIFICATION_DATA *pdata)
+{
+	if (NULL == pdata->ptable_event) {
+		return false;
+	}
+	switch (*pdata->ptable_event) {
+	case TABLE_EVENT_ROW_ADDED:
+	case TABLE_EVENT_ROW_DELETED:
+	case TABLE_EVENT_ROW_MODIFIED:
+		return true;
+	default:
+		return false;
 	}
-	return FALSE;
 }
 
-static BOOL emsmdb_interface_merge_hierarchy_row_modified(
-	const DB_NOTIFY_HIERARCHY_TABLE_ROW_MODIFIED *pmodified_row,
-	uint32_t obj_handle, uint8_t logon_id, DOUBLE_LIST *pnotify_list)
+static bool emsmdb_interface_same_id(const uint64_t *a, const uint64_t *b)
 {
-	DOUBLE_LIST_NODE *pnode;
-	NOTIFY_RESPONSE *pnotify;
-	NOTIFICATION_DATA *pnotification_data;
-	uint64_t row_folder_id = (pmodified_row->row_folder_id & 0xFF00000000000000ULL) == 0 ?
-	                         rop_util_make_eid_ex(1, pmodified_row->row_folder_id) :
-	                         rop_util_make_eid_ex(pmodified_row->row_folder_id >> 48, pmodified_row->row_folder_id & 0x00FFFFFFFFFFFFFFULL);
+	return a == nullptr ? b == nullptr : b != nullptr && *a == *b;
+}
+
+static bool emsmdb_interface_same_row(const NOTIFICATION_DATA *a,
+	const NOTIFICATION_DATA *b)
+{
+	if (!emsmdb_interface_same_id(a->prow_folder_id, b->prow_folder_id) ||
+	    !emsmdb_interface_same_id(a->prow_message_id, b->prow_message_id)) {
+		return false;
+	}
+	if (NULL == a->prow_instance || NULL == b->prow_instance) {
+		return a->prow_instance == b->prow_instance;
+	}
+	return *a->prow_instance == *b->prow_instance;
+}
+
+/*
+ * Row events of one table. A queued TABLE_CHANGED absorbs them, a newer
+ * ROW_MODIFIED replaces an older one of the same row, and once
+ * MAX_TABLE_ROW_EVENTS pile up (or with @b_force, once there is any
+ * other) they are all replaced by a single TABLE_CHANGED, upon which the
+ * client re-reads the table rather than having every row pushed.
+ */
+static BOOL emsmdb_interface_merge_row_event(const NOTIFY_RESPONSE *pnew,
+	DOUBLE_LIST *pnotify_list, BOOL b_force)
+{
+	size_t count = 1;
+	DOUBLE_LIST_NODE *pnode, *pnext, *pfirst = nullptr;
+	auto pnew_data = &pnew->notification_data;
 	
-	for (pnode=double_list_get_head(pnotify_list); NULL!=pnode;
-		pnode=double_list_get_after(pnotify_list, pnode)) {
-		pnotify = static_cast<NOTIFY_RESPONSE *>(static_cast<ROP_RESPONSE *>(pnode->pdata)->ppayload);
-		pnotification_data = &pnotify->notification_data;
-		if (pnotify->handle != obj_handle ||
-			pnotify->logon_id != logon_id) {
-			continue;
-		}
-		if (NULL == pnotification_data->ptable_event) {
+	for (pnode = double_list_get_head(pnotify_list); NULL != pnode; pnode = pnext) {
+		pnext = double_list_get_after(pnotify_list, pnode);
+		auto pnotify = emsmdb_interface_node_notify(pnode);
+		auto pdata = &pnotify->notification_data;
+		if (pnotify->handle != pnew->handle ||
+		    pnotify->logon_id != pnew->logon_id ||
+		    NULL == pdata->ptable_event) {
 			continue;
 		}
-		if (TABLE_EVENT_ROW_MODIFIED ==
-			*pnotification_data->ptable_event &&
-			*pnotification_data->prow_folder_id
-			== row_folder_id) {
+		if (TABLE_EVENT_TABLE_CHANGED == *pdata->ptable_event) {
 			double_list_remove(pnotify_list, pnode);
 			double_list_append_as_tail(pnotify_list, pnode);
 			return TRUE;
 		}
-	}
-	return FALSE;
-}
-
-static BOOL emsmdb_interface_merge_message_modified(
-	const DB_NOTIFY_MESSAGE_MODIFIED *pmodified_message,
-	uint32_t obj_handle, uint8_t logon_id,
-	DOUBLE_LIST *pnotify_list)
-{
-	uint64_t folder_id;
-	uint64_t message_id;
-	DOUBLE_LIST_NODE *pnode;
-	NOTIFY_RESPONSE *pnotify;
-	NOTIFICATION_DATA *pnotification_data;
-	
-	folder_id = rop_util_make_eid_ex(
-		1, pmodified_message->folder_id);
-	message_id = rop_util_make_eid_ex(
-		1, pmodified_message->message_id);
-	for (pnode=double_list_get_head(pnotify_list); NULL!=pnode;
-		pnode=double_list_get_after(pnotify_list, pnode)) {
-		pnotify = static_cast<NOTIFY_RESPONSE *>(static_cast<ROP_RESPONSE *>(pnode->pdata)->ppayload);
-		pnotification_data = &pnotify->notification_data;
-		if (pnotify->handle != obj_handle ||
-			pnotify->logon_id != logon_id) {
+		if (!emsmdb_interface_is_row_event(pdata)) {
 			continue;
 		}
-		if ((NOTIFICATION_FLAG_OBJECTMODIFIED |
-			NOTIFICATION_FLAG_MOST_MESSAGE) ==
-			pnotification_data->notification_flags &&
-			folder_id == *pnotification_data->pfolder_id &&
-			message_id == *pnotification_data->pmessage_id
-			&& 0 == pnotification_data->pproptags->count) {
-			return TRUE;
+		if (TABLE_EVENT_ROW_MODIFIED == *pnew_data->ptable_event &&
+		    TABLE_EVENT_ROW_MODIFIED == *pdata->ptable_event &&
+		    emsmdb_interface_same_row(pdata, pnew_data)) {
+			double_list_remove(pnotify_list, pnode);
+			emsmdb_interface_free_notify_node(pnode);
+			continue;
+		}
+		count ++;
+		if (NULL == pfirst) {
+			pfirst = pnode;
 		}
 	}
-	return FALSE;
+	if (NULL == pfirst || (count < MAX_TABLE_ROW_EVENTS && FALSE == b_force)) {
+		return FALSE;
+	}
+	for (pnode = double_list_get_after(pnotify_list, pfirst); NULL != pnode; pnode = pnext) {
+		pnext = double_list_get_after(pnotify_list, pnode);
+		auto pnotify = emsmdb_interface_node_notify(pnode);
+		if (pnotify->handle != pnew->handle ||
+		    pnotify->logon_id != pnew->logon_id ||
+		    !emsmdb_interface_is_row_event(&pnotify->notification_data)) {
+			continue;
+		}
+		double_list_remove(pnotify_list, pnode);
+		emsmdb_interface_free_notify_node(pnode);
+	}
+	notify_response_row_event_to_change(emsmdb_interface_node_notify(pfirst));
+	double_list_remove(pnotify_list, pfirst);
+	double_list_append_as_tail(pnotify_list, pfirst);
+	return TRUE;
 }
 
-static BOOL emsmdb_interface_merge_folder_modified(
-	const DB_NOTIFY_FOLDER_MODIFIED *pmodified_folder,
-	uint32_t obj_handle, uint8_t logon_id,
-	DOUBLE_LIST *pnotify_list)
+/* repeated OBJECTMODIFIED events of one folder or message become one */
+static BOOL emsmdb_interface_merge_object_modified(
+	const NOTIFY_RESPONSE *pnew, DOUBLE_LIST *pnotify_list)
 {
-	DOUBLE_LIST_NODE *pnode;
-	NOTIFY_RESPONSE *pnotify;
-	NOTIFICATION_DATA *pnotification_data;
-	uint64_t folder_id = (pmodified_folder->folder_id & 0xFF00000000000000ULL) == 0 ?
-	                     rop_util_make_eid_ex(1, pmodified_folder->folder_id) :
-	                     rop_util_make_eid_ex(pmodified_folder->folder_id >> 48, pmodified_folder->folder_id & 0x00FFFFFFFFFFFFFFULL);
+	static constexpr uint16_t kind_mask = ~(NOTIFICATION_FLAG_MOST_TOTAL |
+		NOTIFICATION_FLAG_MOST_UNREAD);
+	auto pnew_data = &pnew->notification_data;
 	
-	for (pnode=double_list_get_head(pnotify_list); NULL!=pnode;
-		pnode=double_list_get_after(pnotify_list, pnode)) {
-		pnotify = static_cast<NOTIFY_RESPONSE *>(static_cast<ROP_RESPONSE *>(pnode->pdata)->ppayload);
-		pnotification_data = &pnotify->notification_data;
-		if (pnotify->handle != obj_handle ||
-			pnotify->logon_id != logon_id) {
+	for (auto pnode = double_list_get_head(pnotify_list); NULL != pnode;
+	     pnode = double_list_get_after(pnotify_list, pnode)) {
+		auto pnotify = emsmdb_interface_node_notify(pnode);
+		auto pdata = &pnotify->notification_data;
+		if (pnotify->handle != pnew->handle ||
+		    pnotify->logon_id != pnew->logon_id ||
+		    (pdata->notification_flags & kind_mask) !=
+		    (pnew_data->notification_flags & kind_mask) ||
+		    !emsmdb_interface_same_id(pdata->pfolder_id, pnew_data->pfolder_id) ||
+		    !emsmdb_interface_same_id(pdata->pmessage_id, pnew_data->pmessage_id)) {
 			continue;
 		}
-		if (NOTIFICATION_FLAG_OBJECTMODIFIED
-			== pnotification_data->notification_flags &&
-			folder_id == *pnotification_data->pfolder_id
-			&& 0 == pnotification_data->pproptags->count) {
-			return TRUE;
-		}
+		return notify_response_merge_modified(pnotify, pnew);
 	}
 	return FALSE;
 }
@@ -1119,6 +1213,7 @@ void emsmdb_interface_event_proc(const char *dir, BOOL b_table,
 	CXH cxh;
 	uint16_t cxr;
 	uint8_t logon_id;
+	BOOL b_merged;
 	BOOL b_processing;
 	char username[UADDR_SIZE];
 	uint32_t obj_handle;
@@ -1141,62 +1236,17 @@ void emsmdb_interface_event_proc(const char *dir, BOOL b_table,
 	if (NULL == phandle) {
 		return;
 	}
-	switch (pdb_notify->type) {
-	case DB_NOTIFY_TYPE_CONTENT_TABLE_ROW_DELETED:
-		if (TRUE == emsmdb_interface_merge_content_row_deleted(
-			obj_handle, logon_id, &phandle->notify_list)) {
-			emsmdb_interface_put_handle_notify_list(phandle);
-			return;
-		}
-		break;
-	case DB_NOTIFY_TYPE_HIERARCHY_TABLE_ROW_MODIFIED:
-		if (emsmdb_interface_merge_hierarchy_row_modified(
-		    static_cast<DB_NOTIFY_HIERARCHY_TABLE_ROW_MODIFIED *>(pdb_notify->pdata),
-		    obj_handle, logon_id, &phandle->notify_list)) {
-			b_processing = phandle->b_processing;
-			if (FALSE == b_processing) {
-				cxr = phandle->cxr;
-				gx_strlcpy(username, phandle->username, GX_ARRAY_SIZE(username));
-			}
-			emsmdb_interface_put_handle_notify_list(phandle);
-			if (FALSE == b_processing) {
-				asyncemsmdb_interface_wakeup(username, cxr);
-			}
-			return;
-		}
-		break;
-	case DB_NOTIFY_TYPE_MESSAGE_MODIFIED:
-		if (emsmdb_interface_merge_message_modified(
-		    static_cast<DB_NOTIFY_MESSAGE_MODIFIED *>(pdb_notify->pdata),
-		    obj_handle, logon_id, &phandle->notify_list)) {
-			emsmdb_interface_put_handle_notify_list(phandle);
-			return;
-		}
-		break;
-	case DB_NOTIFY_TYPE_FOLDER_MODIFIED:
-		if (emsmdb_interface_merge_folder_modified(
-		    static_cast<DB_NOTIFY_FOLDER_MODIFIED *>(pdb_notify->pdata),
-		    obj_handle, logon_id, &phandle->notify_list)) {
+	auto cl_0 = make_scope_exit([&]() {
+		if (NULL != phandle) {
 			emsmdb_interface_put_handle_notify_list(phandle);
-			return;
 		}
-		break;
-	}
-	if (double_list_get_nodes_num(&phandle->notify_list)
-		>= MAX_NOTIFY_RESPONSE_NUM) {
-		emsmdb_interface_put_handle_notify_list(phandle);
-		return;
-	}
-	cxr = phandle->cxr;
-	gx_strlcpy(username, phandle->username, GX_ARRAY_SIZE(username));
+	});
 	pnode = me_alloc<DOUBLE_LIST_NODE>();
 	if (NULL == pnode) {
-		emsmdb_interface_put_handle_notify_list(phandle);
 		return;
 	}
 	pnode->pdata = me_alloc<ROP_RESPONSE>();
 	if (NULL == pnode->pdata) {
-		emsmdb_interface_put_handle_notify_list(phandle);
 		free(pnode);
 		return;
 	}
@@ -1206,25 +1256,49 @@ void emsmdb_interface_event_proc(const char *dir, BOOL b_table,
 	((ROP_RESPONSE*)pnode->pdata)->ppayload =
 			notify_response_init(obj_handle, logon_id);
 	if (NULL == ((ROP_RESPONSE*)pnode->pdata)->ppayload) {
-		emsmdb_interface_put_handle_notify_list(phandle);
 		free(pnode->pdata);
 		free(pnode);
 		return;
 	}
+	auto pnotify = emsmdb_interface_node_notify(pnode);
 	BOOL b_cache = phandle->info.client_mode == CLIENT_MODE_CACHED ? TRUE : false;
-	if (notify_response_retrieve(
-	    static_cast<NOTIFY_RESPONSE *>(static_cast<ROP_RESPONSE *>(pnode->pdata)->ppayload),
-	    b_cache, pdb_notify)) {
-		double_list_append_as_tail(&phandle->notify_list, pnode);
-		b_processing = phandle->b_processing;
-		emsmdb_interface_put_handle_notify_list(phandle);
+	if (!notify_response_retrieve(pnotify, b_cache, pdb_notify)) {
+		emsmdb_interface_free_notify_node(pnode);
+		return;
+	}
+	auto plist = &phandle->notify_list;
+	bool b_row_event = emsmdb_interface_is_row_event(&pnotify->notification_data);
+	if (b_row_event) {
+		b_merged = emsmdb_interface_merge_row_event(pnotify, plist, FALSE);
+	} else if (pnotify->notification_data.notification_flags &
+	    NOTIFICATION_FLAG_OBJECTMODIFIED) {
+		b_merged = emsmdb_interface_merge_object_modified(pnotify, plist);
 	} else {
-		b_processing = phandle->b_processing;
-		emsmdb_interface_put_handle_notify_list(phandle);
-		notify_response_free(static_cast<NOTIFY_RESPONSE *>(static_cast<ROP_RESPONSE *>(pnode->pdata)->ppayload));
-		free(pnode->pdata);
-		free(pnode);
+		b_merged = FALSE;
+	}
+	if (FALSE == b_merged && double_list_get_nodes_num(plist) >=
+	    MAX_NOTIFY_RESPONSE_NUM) {
+		/*
+		 * The queue is full. A table can still be told to reload
+		 * itself; anything else is lost, as before.
+		 */
+		if (!b_row_event || FALSE == emsmdb_interface_merge_row_event(
+		    pnotify, plist, TRUE)) {
+			emsmdb_interface_free_notify_node(pnode);
+			return;
+		}
+		b_merged = TRUE;
+	}
+	if (TRUE == b_merged) {
+		emsmdb_interface_free_notify_node(pnode);
+	} else {
+		double_list_append_as_tail(plist, pnode);
 	}
+	b_processing = phandle->b_processing;
+	cxr = phandle->cxr;
+	gx_strlcpy(username, phandle->username, GX_ARRAY_SIZE(username));
+	emsmdb_interface_put_handle_notify_list(phandle);
+	phandle = nullptr;
 	if (FALSE == b_processing) {
 		asyncemsmdb_interface_wakeup(username, cxr);
 	}
@@ -1268,6 +1342,7 @@ static void *emsi_scanwork(void *pparam)
 		}
 		str_hash_iter_free(iter);
 		gl_hold.unlock();
+		emsmdb_interface_trim_rpcbufs(cur_time);
 		while ((pnode = double_list_pop_front(&temp_list)) != nullptr) {
 			cxh.handle_type = HANDLE_EXCHANGE_EMSMDB;
 			guid_from_string(&cxh.guid, static_cast<char *>(pnode->pdata));
@@ -1,6 +1,8 @@
 #pragma once
 #include <cstdint>
+#include <vector>
 #include <gromox/common_types.hpp>
+#include <gromox/defs.h>
 #include <gromox/proc_common.h>
 #include <gromox/mapi_types.hpp>
 #include <gromox/ndr_stack.hpp>
@@ -13,8 +15,24 @@ struct EMSMDB_INFO {
 	uint16_t client_mode;
 	void *plogmap;
 	int upctx_ref;
+	uint32_t rpc_seq; /* bumped per EcDoRpcExt2; tags per-RPC caches */
 };
 
+/* ROPs processed for a session, summed over its EcDoRpcExt2 calls */
+struct EMSMDB_SESSION_STATS {
+	uint64_t rops, usec, exmdb_usec, slow_rops;
+};
+
+struct EMSMDB_SESSION_INFO {
+	char username[UADDR_SIZE];
+	uint16_t cxr;
+	uint16_t client_version[4];
+	EMSMDB_SESSION_STATS stats;
+};
+
+/* maximum cb_out of EcDoRpcExt2 and mh Execute */
+#define EMSMDB_RPCBUF_SIZE 0x40000
+
 typedef CONTEXT_HANDLE CXH;
 typedef CONTEXT_HANDLE ACXH;
 
@@ -23,6 +41,8 @@ extern void emsmdb_interface_init();
 extern int emsmdb_interface_run();
 extern void emsmdb_interface_stop();
 extern void emsmdb_interface_free();
+extern uint8_t *emsmdb_interface_get_rpcbuf();
+extern void emsmdb_interface_put_rpcbuf(uint8_t *);
 int emsmdb_interface_disconnect(CXH *pcxh);
 int emsmdb_interface_register_push_notification(CXH *pcxh, uint32_t rpc,
 	uint8_t *pctx, uint16_t cb_ctx, uint32_t advise_bits, uint8_t *paddr,
@@ -49,10 +69,10 @@ BOOL emsmdb_interface_check_notify(ACXH *pacxh);
 extern void emsmdb_interface_touch_handle(CXH *);
 extern const GUID *emsmdb_interface_get_handle();
 extern EMSMDB_INFO *emsmdb_interface_get_emsmdb_info();
+extern std::vector<EMSMDB_SESSION_INFO> emsmdb_interface_get_sessions();
 extern DOUBLE_LIST *emsmdb_interface_get_notify_list();
 extern void emsmdb_interface_put_notify_list();
 BOOL emsmdb_interface_get_cxr(uint16_t *pcxr);
-BOOL emsmdb_interface_alloc_hanlde_number(uint32_t *pnum);
 BOOL emsmdb_interface_get_cxh(CXH *pcxh);
 BOOL emsmdb_interface_get_rop_left(uint16_t *psize);
 BOOL emsmdb_interface_set_rop_left(uint16_t size);
@@ -74,7 +74,7 @@ struct ECDORPCEXT2_IN {
 struct ECDORPCEXT2_OUT {
 	CXH cxh;
 	uint32_t flags;
-	uint8_t pout[0x40000];
+	uint8_t *pout;
 	uint32_t cb_out;
 	uint8_t pauxout[0x1008];
 	uint32_t cb_auxout;
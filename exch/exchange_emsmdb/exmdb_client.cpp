@@ -1,4 +1,5 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+#include <chrono>
 #include <cstdint>
 #include "emsmdb_interface.h"
 #include "exmdb_client.h"
@@ -44,6 +45,64 @@ E(remove_message_property)
 #include <gromox/exmdb_idef.hpp>
 #undef EXMIDL
 #undef IDLOUT
+/* the functions exported by exmdb_provider, behind the timing wrappers */
+#define EXMIDL(n, p) static decltype(exmdb_client_ ## n) exmdb_real_ ## n; \
+	static constexpr char exmdb_name_ ## n[] = #n;
+#define IDLOUT
+#include <gromox/exmdb_idef.hpp>
+#undef EXMIDL
+#undef IDLOUT
+
+/* exmdb time spent by the ROP currently being processed on this thread */
+static thread_local EXMDB_CALL_STATS g_call_stats;
+
+static void exmdb_client_account(const char *name, uint64_t usec)
+{
+	auto &st = g_call_stats;
+	st.count ++;
+	st.usec += usec;
+	EXMDB_CALL_STAT *pmin = nullptr;
+	for (auto &e : st.calls) {
+		if (e.name == name || e.name == nullptr) {
+			e.name = name;
+			e.count ++;
+			e.usec += usec;
+			return;
+		}
+		if (pmin == nullptr || e.usec < pmin->usec)
+			pmin = &e;
+	}
+	/* keep the costliest kinds of calls; the rest only make the totals */
+	if (usec > pmin->usec) {
+		pmin->name = name;
+		pmin->count = 1;
+		pmin->usec = usec;
+	}
+}
+
+namespace {
+template<typename F> struct exmdb_timed;
+template<typename... A> struct exmdb_timed<BOOL (*)(A...)> {
+	template<BOOL (**real)(A...), const char *name> static BOOL call(A... args)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto ret = (*real)(args...);
+		exmdb_client_account(name, std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count());
+		return ret;
+	}
+};
+}
+
+void exmdb_client_reset_call_stats()
+{
+	g_call_stats = {};
+}
+
+const EXMDB_CALL_STATS *exmdb_client_get_call_stats()
+{
+	return &g_call_stats;
+}
 
 int exmdb_client_run()
 {
@@ -51,11 +110,12 @@ int exmdb_client_run()
 	void (*pass_service)(int, void*);
 	
 #define EXMIDL(n, p) do { \
-	query_service2("exmdb_client_" #n, exmdb_client_ ## n); \
-	if ((exmdb_client_ ## n) == nullptr) { \
+	query_service2("exmdb_client_" #n, exmdb_real_ ## n); \
+	if ((exmdb_real_ ## n) == nullptr) { \
 		printf("[%s]: failed to get the \"%s\" service\n", "exchange_emsmdb", "exmdb_client_" #n); \
 		return -1; \
 	} \
+	exmdb_client_ ## n = exmdb_timed<decltype(exmdb_client_ ## n)>::call<&exmdb_real_ ## n, exmdb_name_ ## n>; \
 } while (false);
 #define IDLOUT
 #include <gromox/exmdb_idef.hpp>
@@ -4,10 +4,27 @@
 #include <gromox/mapi_types.hpp>
 #include <gromox/element_data.hpp>
 
+#define EXMDB_CALL_KINDS 6
+
+struct EXMDB_CALL_STAT {
+	const char *name;
+	uint32_t count;
+	uint64_t usec;
+};
+
+/* exmdb requests made for one ROP, with the costliest kinds broken out */
+struct EXMDB_CALL_STATS {
+	uint32_t count;
+	uint64_t usec;
+	EXMDB_CALL_STAT calls[EXMDB_CALL_KINDS];
+};
+
 extern void exmdb_client_init();
 extern int exmdb_client_run();
 extern void exmdb_client_stop();
 extern void exmdb_client_free();
+extern void exmdb_client_reset_call_stats();
+extern const EXMDB_CALL_STATS *exmdb_client_get_call_stats();
 extern BOOL exmdb_client_get_named_propid(const char *dir, BOOL create, const PROPERTY_NAME *, uint16_t *ppropid);
 extern BOOL exmdb_client_get_named_propname(const char *dir, uint16_t propid, PROPERTY_NAME *);
 extern BOOL exmdb_client_get_store_property(const char *dir, uint32_t cpid, uint32_t proptag, void **ppval);
@@ -409,7 +409,8 @@ static BOOL fastdownctx_object_get_buffer_internal(
 			} else {
 				common_util_remove_propvals(&pmsgctnt->proplist, PR_ENTRYID);
 			}
-			if (!pctx->pstream->write_message(pmsgctnt)) {
+			if (!pctx->pstream->write_message(pmsgctnt,
+			    *static_cast<uint64_t *>(pflow->pparam))) {
 				free(pnode->pdata);
 				return FALSE;
 			}
@@ -970,6 +970,9 @@ gxerr_t FASTUPCTX_OBJECT::write_buffer(const BINARY *ptransfer_data)
 	}
 	if (!pstream->write_buffer(ptransfer_data))
 		return GXERR_CALL_FAILED;
+	/* the stream writes to the message instance behind its back */
+	if (ROOT_ELEMENT_MESSAGECONTENT == pctx->root_element)
+		static_cast<MESSAGE_OBJECT *>(pctx->pobject)->prop_cache.clear();
 	return pstream->process(fastupctx_object_record_marker,
 	       fastupctx_object_record_propval, pctx);
 }
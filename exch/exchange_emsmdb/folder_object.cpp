@@ -500,6 +500,43 @@ static BOOL folder_object_get_calculated_property(
 	return FALSE;
 }
 
+/*
+ * Properties that exmdb keeps up to date by itself as messages and
+ * subfolders come and go; the property cache must not hold on to them.
+ */
+static bool folder_object_check_volatile(uint32_t proptag)
+{
+	switch (PROP_ID(proptag)) {
+	case PROP_ID(PROP_TAG_CONTENTCOUNT):
+	case PROP_ID(PROP_TAG_CONTENTUNREADCOUNT):
+	case PROP_ID(PR_ASSOC_CONTENT_COUNT):
+	case PROP_ID(PROP_TAG_FOLDERCHILDCOUNT):
+	case PROP_ID(PROP_TAG_SUBFOLDERS):
+	case PROP_ID(PROP_TAG_HASRULES):
+	case PROP_ID(PR_MESSAGE_SIZE):
+	case PROP_ID(PROP_TAG_NORMALMESSAGESIZEEXTENDED):
+	case PROP_ID(PR_ASSOC_MESSAGE_SIZE):
+	case PROP_ID(PR_DELETED_MSG_COUNT):
+	case PROP_ID(PR_DELETED_FOLDER_COUNT):
+	case PROP_ID(PR_DELETED_ASSOC_MSG_COUNT):
+	case PROP_ID(PR_DELETED_MESSAGE_SIZE):
+	case PROP_ID(PR_DELETED_NORMAL_MESSAGE_SIZE):
+	case PROP_ID(PR_DELETED_ASSOC_MESSAGE_SIZE):
+	case PROP_ID(PR_DELETED_COUNT_TOTAL):
+	case PROP_ID(PROP_TAG_CHANGENUMBER):
+	case PROP_ID(PR_CHANGE_KEY):
+	case PROP_ID(PR_PREDECESSOR_CHANGE_LIST):
+	case PROP_ID(PR_LAST_MODIFICATION_TIME):
+	case PROP_ID(PROP_TAG_HIERARCHYCHANGENUMBER):
+	case PROP_ID(PROP_TAG_LOCALCOMMITTIME):
+	case PROP_ID(PROP_TAG_LOCALCOMMITTIMEMAX):
+	case PROP_ID(PROP_TAG_HIERREV):
+		return true;
+	default:
+		return false;
+	}
+}
+
 BOOL FOLDER_OBJECT::get_properties(const PROPTAG_ARRAY *pproptags,
     TPROPVAL_ARRAY *ppropvals)
 {
@@ -508,6 +545,7 @@ BOOL FOLDER_OBJECT::get_properties(const PROPTAG_ARRAY *pproptags,
 	PROPTAG_ARRAY tmp_proptags;
 	TPROPVAL_ARRAY tmp_propvals;
 	static const uint32_t err_code = ecError;
+	static constexpr uint32_t computed_tags[] = {PR_SOURCE_KEY};
 	
 	auto pinfo = emsmdb_interface_get_emsmdb_info();
 	if (NULL == pinfo) {
@@ -524,6 +562,10 @@ BOOL FOLDER_OBJECT::get_properties(const PROPTAG_ARRAY *pproptags,
 	}
 	ppropvals->count = 0;
 	auto pfolder = this;
+	if (pfolder->cache_seq != pinfo->rpc_seq) {
+		pfolder->prop_cache.clear();
+		pfolder->cache_seq = pinfo->rpc_seq;
+	}
 	for (i=0; i<pproptags->count; i++) {
 		auto &pv = ppropvals->ppropval[ppropvals->count];
 		if (TRUE == folder_object_get_calculated_property(
@@ -536,23 +578,30 @@ BOOL FOLDER_OBJECT::get_properties(const PROPTAG_ARRAY *pproptags,
 				pv.pvalue = deconst(&err_code);
 			}
 			ppropvals->count ++;
-		} else {
+		} else if (!pfolder->prop_cache.lookup(pproptags->pproptag[i],
+		    0, ppropvals)) {
 			tmp_proptags.pproptag[tmp_proptags.count] =
 											pproptags->pproptag[i];
 			tmp_proptags.count ++;
 		}
 	}
-	if (0 == tmp_proptags.count) {
-		return TRUE;
-	}
-	if (!exmdb_client_get_folder_properties(pfolder->plogon->get_dir(),
-	    pinfo->cpid, pfolder->folder_id, &tmp_proptags, &tmp_propvals))
-		return FALSE;	
-	if (tmp_propvals.count > 0) {
-		memcpy(ppropvals->ppropval + ppropvals->count,
-			tmp_propvals.ppropval,
-			sizeof(TAGGED_PROPVAL)*tmp_propvals.count);
-		ppropvals->count += tmp_propvals.count;
+	/* as with messages, the source key fallback also runs for cached reads */
+	if (tmp_proptags.count > 0) {
+		if (!exmdb_client_get_folder_properties(pfolder->plogon->get_dir(),
+		    pinfo->cpid, pfolder->folder_id, &tmp_proptags, &tmp_propvals))
+			return FALSE;
+		auto pend = std::remove_if(tmp_proptags.pproptag,
+		            tmp_proptags.pproptag + tmp_proptags.count,
+		            folder_object_check_volatile);
+		tmp_proptags.count = pend - tmp_proptags.pproptag;
+		pfolder->prop_cache.store(&tmp_proptags, &tmp_propvals,
+			computed_tags, gromox::arsizeof(computed_tags));
+		if (tmp_propvals.count > 0) {
+			memcpy(ppropvals->ppropval + ppropvals->count,
+				tmp_propvals.ppropval,
+				sizeof(TAGGED_PROPVAL)*tmp_propvals.count);
+			ppropvals->count += tmp_propvals.count;
+		}
 	}
 	if (common_util_index_proptags(pproptags, PR_SOURCE_KEY) >= 0 &&
 	    common_util_get_propvals(ppropvals, PR_SOURCE_KEY) == nullptr) {
@@ -617,6 +666,7 @@ BOOL FOLDER_OBJECT::set_properties(const TPROPVAL_ARRAY *ppropvals,
 	if (0 == tmp_propvals.count) {
 		return TRUE;
 	}
+	pfolder->prop_cache.clear();
 	if (!exmdb_client_allocate_cn(pfolder->plogon->get_dir(), &change_num))
 		return FALSE;
 	tmp_propvals.ppropval[tmp_propvals.count].proptag =
@@ -709,6 +759,7 @@ BOOL FOLDER_OBJECT::remove_properties(const PROPTAG_ARRAY *pproptags,
 	if (0 == tmp_proptags.count) {
 		return TRUE;
 	}
+	pfolder->prop_cache.clear();
 	if (!exmdb_client_remove_folder_properties(pfolder->plogon->get_dir(),
 	    pfolder->folder_id, &tmp_proptags))
 		return FALSE;	
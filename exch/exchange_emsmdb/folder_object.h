@@ -3,6 +3,7 @@
 #include <memory>
 #include <gromox/mapi_types.hpp>
 #include "logon_object.h"
+#include "property_cache.h"
 
 struct FOLDER_OBJECT {
 	BOOL get_all_proptags(PROPTAG_ARRAY *);
@@ -15,6 +16,9 @@ struct FOLDER_OBJECT {
 	uint64_t folder_id = 0;
 	uint8_t type = 0;
 	uint32_t tag_access = 0;
+	/* entries are only good for the EcDoRpcExt2 call that read them */
+	uint32_t cache_seq = 0;
+	PROP_CACHE prop_cache;
 };
 
 extern std::unique_ptr<FOLDER_OBJECT> folder_object_create(LOGON_OBJECT *, uint64_t folder_id, uint8_t type, uint32_t tag_access);
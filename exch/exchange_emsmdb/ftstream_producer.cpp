@@ -1,29 +1,35 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+#include <algorithm>
 #include <cerrno>
 #include <cstdint>
+#include <iconv.h>
 #include <memory>
 #include <string>
 #include <gromox/mapidefs.h>
+#include <gromox/proptags.hpp>
 #include "ftstream_producer.h"
 #include "emsmdb_interface.h"
+#include "exmdb_client.h"
 #include "common_util.h"
 #include <gromox/ext_buffer.hpp>
 #include <gromox/util.hpp>
-#include <sys/stat.h>
 #include <cstring>
-#include <unistd.h>
 #include <cstdlib>
-#include <fcntl.h>
 #include <cstdio>
 
-using namespace std::string_literals;
-
 enum {
 	POINT_TYPE_NORMAL_BREAK,
 	POINT_TYPE_LONG_VAR,
 	POINT_TYPE_WSTRING
 };
 
+enum {
+	SOURCE_NONE, /* no deferral below this point */
+	SOURCE_MESSAGE,
+	SOURCE_ATTACHMENT,
+	SOURCE_EMBEDDED,
+};
+
 namespace {
 
 struct POINT_NODE {
@@ -151,35 +157,151 @@ static BOOL ftstream_producer_write_internal(
 	FTSTREAM_PRODUCER *pstream,
 	const void *pbuff, uint32_t size)
 {	
-	if (size >= FTSTREAM_PRODUCER_BUFFER_LENGTH
-		|| FTSTREAM_PRODUCER_BUFFER_LENGTH -
-		pstream->buffer_offset < size) {
-		if (-1 == pstream->fd) {
-			pstream->fd = open(pstream->path.c_str(),
-				O_CREAT|O_RDWR|O_TRUNC, 0666);
-			if (-1 == pstream->fd) {
-				fprintf(stderr, "E-1338: open %s: %s\n",
-				        pstream->path.c_str(), strerror(errno));
-				return FALSE;
+	if (size > UINT32_MAX - pstream->offset) {
+		return FALSE;
+	}
+	try {
+		pstream->buffer.append(static_cast<const char *>(pbuff), size);
+	} catch (const std::bad_alloc &) {
+		fprintf(stderr, "E-1528: ENOMEM\n");
+		return FALSE;
+	}
+	pstream->offset += size;
+	return TRUE;
+}
+
+static BOOL ftstream_producer_push_source(FTSTREAM_PRODUCER *pstream,
+	uint8_t type, uint64_t id)
+{
+	try {
+		pstream->sources.push_back(FTSTREAM_SOURCE{type, id, 0});
+	} catch (const std::bad_alloc &) {
+		fprintf(stderr, "E-1532: ENOMEM\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Instance of the object whose values are being written, loading the
+ * instances from the outermost message inwards on first use; 0 if there
+ * is none.
+ */
+static uint32_t ftstream_producer_source_instance(FTSTREAM_PRODUCER *pstream)
+{
+	BOOL b_ok;
+	uint32_t instance_id = 0;
+	auto dir = pstream->plogon->get_dir();
+	
+	for (auto &src : pstream->sources) {
+		if (0 != src.instance_id) {
+			instance_id = src.instance_id;
+			continue;
+		}
+		switch (src.type) {
+		case SOURCE_MESSAGE: {
+			auto pinfo = emsmdb_interface_get_emsmdb_info();
+			if (NULL == pinfo) {
+				return 0;
 			}
+			if (pstream->plogon->check_private()) {
+				b_ok = exmdb_client_load_message_instance(dir, nullptr,
+				       pinfo->cpid, false, 0, src.id, &src.instance_id);
+			} else {
+				auto rpc_info = get_rpc_info();
+				b_ok = exmdb_client_load_message_instance(dir,
+				       rpc_info.username, pinfo->cpid, false, 0,
+				       src.id, &src.instance_id);
+			}
+			break;
 		}
-		if (0 != pstream->buffer_offset &&
-			pstream->buffer_offset != write(pstream->fd,
-			pstream->buffer, pstream->buffer_offset)) {
-			return FALSE;	
+		case SOURCE_ATTACHMENT:
+			b_ok = exmdb_client_load_attachment_instance(dir,
+			       instance_id, src.id, &src.instance_id);
+			break;
+		case SOURCE_EMBEDDED:
+			b_ok = exmdb_client_load_embedded_instance(dir,
+			       false, instance_id, &src.instance_id);
+			break;
+		default:
+			return 0;
+		}
+		if (!b_ok || 0 == src.instance_id) {
+			/* do not try again for the other values */
+			src.type = SOURCE_NONE;
+			src.instance_id = 0;
+			return 0;
+		}
+		try {
+			pstream->instances.push_back(src.instance_id);
+		} catch (const std::bad_alloc &) {
+			exmdb_client_unload_instance(dir, src.instance_id);
+			src.type = SOURCE_NONE;
+			src.instance_id = 0;
+			return 0;
 		}
-		pstream->buffer_offset = 0;
-		pstream->read_offset = 0;
+		instance_id = src.instance_id;
 	}
-	if (size >= FTSTREAM_PRODUCER_BUFFER_LENGTH) {
-		if (size != write(pstream->fd, pbuff, size)) {
+	return instance_id;
+}
+
+/*
+ * Leave a value of @length bytes in the stream (@src_length bytes as
+ * stored) to a segment, if exmdb can serve @proptag of the current
+ * source by range. FALSE means the caller has to write it out.
+ */
+static BOOL ftstream_producer_defer(FTSTREAM_PRODUCER *pstream,
+	uint32_t proptag, uint32_t src_length, uint32_t length)
+{
+	BOOL b_found;
+	uint32_t total;
+	BINARY tmp_bin;
+	
+	if (length < FTSTREAM_PRODUCER_DEFER_LENGTH ||
+	    pstream->sources.empty() || length > UINT32_MAX - pstream->offset) {
+		return FALSE;
+	}
+	auto type = pstream->sources.back().type;
+	switch (proptag) {
+	case PR_BODY_W:
+	case PR_HTML:
+	case PR_RTF_COMPRESSED:
+		if (SOURCE_MESSAGE != type && SOURCE_EMBEDDED != type) {
 			return FALSE;
 		}
-	} else {
-		memcpy(pstream->buffer + pstream->buffer_offset, pbuff, size);
-		pstream->buffer_offset += size;
+		break;
+	case PR_ATTACH_DATA_BIN:
+	case PR_ATTACH_DATA_OBJ:
+		if (SOURCE_ATTACHMENT != type) {
+			return FALSE;
+		}
+		break;
+	default:
+		return FALSE;
 	}
-	pstream->offset += size;
+	auto instance_id = ftstream_producer_source_instance(pstream);
+	if (0 == instance_id) {
+		return FALSE;
+	}
+	/* what exmdb has must be the value that was passed in */
+	if (!exmdb_client_read_instance_property_range(pstream->plogon->get_dir(),
+	    instance_id, proptag, 0, 0, &b_found, &total, &tmp_bin) ||
+	    FALSE == b_found || total != src_length) {
+		return FALSE;
+	}
+	try {
+		FTSTREAM_SEGMENT seg;
+		seg.offset = pstream->offset;
+		seg.length = length;
+		seg.instance_id = instance_id;
+		seg.proptag = proptag;
+		seg.src_offset = 0;
+		seg.src_length = src_length;
+		pstream->segments.push_back(std::move(seg));
+	} catch (const std::bad_alloc &) {
+		return FALSE;
+	}
+	pstream->offset += length;
 	return TRUE;
 }
 
@@ -236,7 +358,7 @@ static BOOL ftstream_producer_write_double(
 }
 
 static BOOL ftstream_producer_write_wstring(
-	FTSTREAM_PRODUCER *pstream, const char *pstr)
+	FTSTREAM_PRODUCER *pstream, const char *pstr, uint32_t proptag = 0)
 {
 	int len;
 	uint32_t position;
@@ -257,8 +379,8 @@ static BOOL ftstream_producer_write_wstring(
 		return FALSE;
 	}
 	position = pstream->offset;
-	if (FALSE == ftstream_producer_write_internal(
-		pstream, pbuff, len)) {
+	if (!ftstream_producer_defer(pstream, proptag, strlen(pstr), len) &&
+	    !ftstream_producer_write_internal(pstream, pbuff, len)) {
 		free(pbuff);
 		return FALSE;
 	}
@@ -311,16 +433,16 @@ static BOOL ftstream_producer_write_guid(
 }
 
 static BOOL ftstream_producer_write_binary(
-	FTSTREAM_PRODUCER *pstream, const BINARY *pbin)
+	FTSTREAM_PRODUCER *pstream, const BINARY *pbin, uint32_t proptag = 0)
 {
 	uint32_t position;
 	
 	if (!pstream->write_uint32(pbin->cb))
 		return FALSE;
 	position = pstream->offset;
-	if (0 != pbin->cb && FALSE ==
-		ftstream_producer_write_internal(
-		pstream, pbin->pb, pbin->cb)) {
+	if (0 != pbin->cb &&
+	    !ftstream_producer_defer(pstream, proptag, pbin->cb, pbin->cb) &&
+	    !ftstream_producer_write_internal(pstream, pbin->pb, pbin->cb)) {
 		return FALSE;
 	}
 	if (pbin->cb >= FTSTREAM_PRODUCER_POINT_LENGTH) {
@@ -474,7 +596,8 @@ static BOOL ftstream_producer_write_propvalue(
 	case PT_STRING8:
 		return ftstream_producer_write_string(pstream, static_cast<char *>(ppropval->pvalue));
 	case PT_UNICODE:
-		return ftstream_producer_write_wstring(pstream, static_cast<char *>(ppropval->pvalue));
+		return ftstream_producer_write_wstring(pstream,
+		       static_cast<char *>(ppropval->pvalue), ppropval->proptag);
 	case PT_CLSID:
 		return ftstream_producer_write_guid(pstream, static_cast<GUID *>(ppropval->pvalue));
 	/*
@@ -484,7 +607,8 @@ static BOOL ftstream_producer_write_propvalue(
 	*/
 	case PT_OBJECT:
 	case PT_BINARY:
-		return ftstream_producer_write_binary(pstream, static_cast<BINARY *>(ppropval->pvalue));
+		return ftstream_producer_write_binary(pstream,
+		       static_cast<BINARY *>(ppropval->pvalue), ppropval->proptag);
 	case PT_MV_SHORT:
 		count = ((SHORT_ARRAY*)ppropval->pvalue)->count;
 		if (!pstream->write_uint32(count))
@@ -584,7 +708,13 @@ static BOOL ftstream_producer_write_embeddedmessage(
 {
 	if (!pstream->write_uint32(STARTEMBED))
 		return FALSE;	
-	if (!pstream->write_messagecontent(b_delprop, pmessage))
+	BOOL b_source = !pstream->sources.empty();
+	if (b_source && !ftstream_producer_push_source(pstream, SOURCE_EMBEDDED, 0))
+		return FALSE;
+	auto ret = pstream->write_messagecontent(b_delprop, pmessage);
+	if (b_source)
+		pstream->sources.pop_back();
+	if (!ret)
 		return FALSE;	
 	if (!pstream->write_uint32(ENDEMBED))
 		return FALSE;	
@@ -624,7 +754,18 @@ static BOOL ftstream_producer_write_attachment(
 {
 	if (!pstream->write_uint32(NEWATTACH))
 		return FALSE;
-	if (!pstream->write_attachmentcontent(b_delprop, pattachment))
+	BOOL b_source = !pstream->sources.empty();
+	if (b_source) {
+		auto pnum = static_cast<uint32_t *>(common_util_get_propvals(
+		            &pattachment->proplist, PROP_TAG_ATTACHNUMBER));
+		if (!ftstream_producer_push_source(pstream, pnum != nullptr ?
+		    SOURCE_ATTACHMENT : SOURCE_NONE, pnum != nullptr ? *pnum : 0))
+			return FALSE;
+	}
+	auto ret = pstream->write_attachmentcontent(b_delprop, pattachment);
+	if (b_source)
+		pstream->sources.pop_back();
+	if (!ret)
 		return FALSE;	
 	if (!pstream->write_uint32(ENDATTACH))
 		return FALSE;
@@ -676,13 +817,24 @@ BOOL ftstream_producer::write_messagecontent(BOOL b_delprop,
 			pstream, b_delprop, &pmessage->children);
 }
 
-BOOL ftstream_producer::write_message(const MESSAGE_CONTENT *pmessage)
+/*
+ * With @message_id, large values of the message are fetched from its
+ * instance when they are read, instead of being buffered here.
+ */
+BOOL ftstream_producer::write_message(const MESSAGE_CONTENT *pmessage,
+    uint64_t message_id)
 {
 	auto pbool = static_cast<uint8_t *>(common_util_get_propvals(&pmessage->proplist, PR_ASSOCIATED));
 	uint32_t marker = pbool == nullptr || *pbool == 0 ? STARTMESSAGE : STARTFAIMSG;
 	if (!write_uint32(marker))
 		return FALSE;
-	if (!write_messagecontent(false, pmessage))
+	if (0 != message_id &&
+	    !ftstream_producer_push_source(this, SOURCE_MESSAGE, message_id))
+		return FALSE;
+	auto ret = write_messagecontent(false, pmessage);
+	if (0 != message_id)
+		sources.pop_back();
+	if (!ret)
 		return FALSE;	
 	if (!write_uint32(ENDMESSAGE))
 		return FALSE;
@@ -697,7 +849,7 @@ static BOOL ftstream_producer_write_messagechangeheader(
 
 BOOL ftstream_producer::write_messagechangefull(
 	const TPROPVAL_ARRAY *pchgheader,
-	MESSAGE_CONTENT *pmessage)
+	MESSAGE_CONTENT *pmessage, uint64_t message_id)
 {
 	auto pstream = this;
 	if (!write_uint32(INCRSYNCCHG))
@@ -708,10 +860,15 @@ BOOL ftstream_producer::write_messagechangefull(
 	}
 	if (!write_uint32(INCRSYNCMESSAGE))
 		return FALSE;
-	if (!write_proplist(&pmessage->proplist))
-		return FALSE;	
-	return ftstream_producer_write_messagechildren(
-				pstream, TRUE, &pmessage->children);
+	if (0 != message_id &&
+	    !ftstream_producer_push_source(pstream, SOURCE_MESSAGE, message_id))
+		return FALSE;
+	auto ret = write_proplist(&pmessage->proplist) &&
+	           ftstream_producer_write_messagechildren(pstream,
+	           TRUE, &pmessage->children) ? TRUE : false;
+	if (0 != message_id)
+		sources.pop_back();
+	return ret;
 }
 
 static BOOL ftstream_producer_write_groupinfo(
@@ -953,25 +1110,8 @@ BOOL ftstream_producer::write_hierarchysync(
 std::unique_ptr<FTSTREAM_PRODUCER>
 ftstream_producer_create(LOGON_OBJECT *plogon, uint8_t string_option) try
 {
-	int stream_id;
-	
-	stream_id = common_util_get_ftstream_id();
-	auto rpc_info = get_rpc_info();
-	auto path = rpc_info.maildir + "/tmp"s;
-	if (mkdir(path.c_str(), 0777) < 0 && errno != EEXIST) {
-		fprintf(stderr, "E-1422: mkdir %s: %s\n", path.c_str(), strerror(errno));
-		return nullptr;
-	}
-	path = rpc_info.maildir + "/tmp/faststream"s;
-	if (mkdir(path.c_str(), 0777) < 0 && errno != EEXIST) {
-		fprintf(stderr, "E-1341: mkdir %s: %s\n", path.c_str(), strerror(errno));
-		return nullptr;
-	}
 	auto pstream = std::make_unique<FTSTREAM_PRODUCER>();
-	pstream->path = path + "/"s + std::to_string(stream_id) + "." + get_host_ID();
-	pstream->fd = -1;
 	pstream->offset = 0;
-	pstream->buffer_offset = 0;
 	pstream->read_offset = 0;
 	pstream->plogon = plogon;
 	pstream->string_option = string_option;
@@ -983,21 +1123,138 @@ ftstream_producer_create(LOGON_OBJECT *plogon, uint8_t string_option) try
 	return nullptr;
 }
 
+static void ftstream_producer_unload_instances(FTSTREAM_PRODUCER *pstream)
+{
+	for (auto it = pstream->instances.rbegin();
+	     it != pstream->instances.rend(); ++it)
+		exmdb_client_unload_instance(pstream->plogon->get_dir(), *it);
+	pstream->instances.clear();
+}
+
 FTSTREAM_PRODUCER::~FTSTREAM_PRODUCER()
 {
 	auto pstream = this;
 	DOUBLE_LIST_NODE *pnode;
 	
-	if (-1 != pstream->fd) {
-		close(pstream->fd);
-		if (remove(pstream->path.c_str()) < 0 && errno != ENOENT)
-			fprintf(stderr, "W-1371: remove %s: %s\n", pstream->path.c_str(), strerror(errno));
-	}
+	ftstream_producer_unload_instances(pstream);
 	while ((pnode = double_list_pop_front(&pstream->bp_list)) != nullptr)
 		free(pnode->pdata);
 	double_list_free(&pstream->bp_list);
 }
 
+/*
+ * PR_BODY_W is fetched as UTF-8 and turned into the UTF-16LE that
+ * ftstream_producer_write_wstring would have written, terminator included.
+ */
+static BOOL ftstream_producer_read_body(FTSTREAM_PRODUCER *pstream,
+	FTSTREAM_SEGMENT &seg, char *pdst, uint16_t len) try
+{
+	BOOL b_found;
+	uint32_t total;
+	BINARY tmp_bin;
+	
+	while (seg.pending.size() < len && seg.src_offset < seg.src_length) {
+		uint32_t count = std::min(seg.src_length - seg.src_offset,
+		                 std::max(static_cast<uint32_t>(len), 4U));
+		if (!exmdb_client_read_instance_property_range(
+		    pstream->plogon->get_dir(), seg.instance_id, seg.proptag,
+		    seg.src_offset, count, &b_found, &total, &tmp_bin) ||
+		    FALSE == b_found || 0 == tmp_bin.cb) {
+			return FALSE;
+		}
+		/* a UTF-8 byte never becomes more than two UTF-16 bytes */
+		std::string out(2 * tmp_bin.cb, '\0');
+		auto pin = tmp_bin.pc;
+		auto pout = &out[0];
+		size_t in_len = tmp_bin.cb, out_len = out.size();
+		auto conv_id = iconv_open("UTF-16LE", "UTF-8");
+		if (conv_id == reinterpret_cast<iconv_t>(-1)) {
+			return FALSE;
+		}
+		auto ret = iconv(conv_id, &pin, &in_len, &pout, &out_len);
+		iconv_close(conv_id);
+		/* EINVAL: the last character continues in the next range */
+		if ((ret == static_cast<size_t>(-1) && errno != EINVAL) ||
+		    in_len == tmp_bin.cb) {
+			return FALSE;
+		}
+		seg.src_offset += tmp_bin.cb - in_len;
+		seg.pending.append(out.data(), out.size() - out_len);
+	}
+	uint32_t done = pstream->read_offset - seg.offset;
+	if (seg.src_offset >= seg.src_length &&
+	    done + seg.pending.size() < seg.length) {
+		seg.pending.append(seg.length - done - seg.pending.size(), '\0');
+	}
+	if (seg.pending.size() < len) {
+		return FALSE;
+	}
+	memcpy(pdst, seg.pending.data(), len);
+	seg.pending.erase(0, len);
+	return TRUE;
+} catch (const std::bad_alloc &) {
+	fprintf(stderr, "E-1533: ENOMEM\n");
+	return FALSE;
+}
+
+static BOOL ftstream_producer_read_segment(FTSTREAM_PRODUCER *pstream,
+	FTSTREAM_SEGMENT &seg, char *pdst, uint16_t len)
+{
+	BOOL b_found;
+	uint32_t total;
+	BINARY tmp_bin;
+	
+	if (PR_BODY_W == seg.proptag) {
+		return ftstream_producer_read_body(pstream, seg, pdst, len);
+	}
+	if (!exmdb_client_read_instance_property_range(
+	    pstream->plogon->get_dir(), seg.instance_id, seg.proptag,
+	    seg.src_offset, len, &b_found, &total, &tmp_bin) ||
+	    FALSE == b_found || tmp_bin.cb != len) {
+		return FALSE;
+	}
+	memcpy(pdst, tmp_bin.pv, len);
+	seg.src_offset += len;
+	return TRUE;
+}
+
+static BOOL ftstream_producer_read_data(FTSTREAM_PRODUCER *pstream,
+	void *pbuff, uint16_t len)
+{
+	uint32_t count;
+	auto pdst = static_cast<char *>(pbuff);
+	
+	while (len > 0) {
+		if (pstream->cur_segment < pstream->segments.size() &&
+		    pstream->segments[pstream->cur_segment].offset <= pstream->read_offset) {
+			auto &seg = pstream->segments[pstream->cur_segment];
+			count = std::min(static_cast<uint32_t>(len),
+			        seg.offset + seg.length - pstream->read_offset);
+			if (!ftstream_producer_read_segment(pstream, seg, pdst, count)) {
+				return FALSE;
+			}
+			if (pstream->read_offset + count == seg.offset + seg.length) {
+				pstream->cur_segment ++;
+			}
+		} else {
+			uint32_t end = pstream->cur_segment < pstream->segments.size() ?
+			               pstream->segments[pstream->cur_segment].offset :
+			               pstream->offset;
+			count = std::min(static_cast<uint32_t>(len), end - pstream->read_offset);
+			if (0 == count || pstream->buffer_offset + count >
+			    pstream->buffer.size()) {
+				return FALSE;
+			}
+			memcpy(pdst, pstream->buffer.data() + pstream->buffer_offset, count);
+			pstream->buffer_offset += count;
+		}
+		pstream->read_offset += count;
+		pdst += count;
+		len -= count;
+	}
+	return TRUE;
+}
+
 BOOL ftstream_producer::read_buffer(void *pbuff, uint16_t *plen, BOOL *pb_last)
 {
 	auto pstream = this;
@@ -1017,17 +1274,9 @@ BOOL ftstream_producer::read_buffer(void *pbuff, uint16_t *plen, BOOL *pb_last)
 			}
 		}
 		pstream->b_read = TRUE;
-		if (-1 != pstream->fd) {
-			if (0 != pstream->buffer_offset &&
-				pstream->buffer_offset != write(pstream->fd,
-				pstream->buffer, pstream->buffer_offset)) {
-				return FALSE;
-			}
-			lseek(pstream->fd, 0, SEEK_SET);
-		}
 		cur_offset = 0;
 	} else {
-		cur_offset = pstream->fd != -1 ? lseek(pstream->fd, 0, SEEK_CUR) : pstream->read_offset;
+		cur_offset = pstream->read_offset;
 	}
 	for (pnode=double_list_get_head(&pstream->bp_list); NULL!=pnode;
 		pnode=double_list_get_after(&pstream->bp_list, pnode)) {
@@ -1066,13 +1315,8 @@ BOOL ftstream_producer::read_buffer(void *pbuff, uint16_t *plen, BOOL *pb_last)
 			}
 			free(pnode->pdata);
 		}
-		if (-1 != pstream->fd) {
-			if (*plen != read(pstream->fd, pbuff, *plen)) {
-				return FALSE;
-			}
-		} else {
-			memcpy(pbuff, pstream->buffer + pstream->read_offset, *plen);
-			pstream->read_offset += *plen;
+		if (FALSE == ftstream_producer_read_data(pstream, pbuff, *plen)) {
+			return FALSE;
 		}
 		*pb_last = FALSE;
 		return TRUE;
@@ -1088,25 +1332,20 @@ BOOL ftstream_producer::read_buffer(void *pbuff, uint16_t *plen, BOOL *pb_last)
 	*plen = ppoint->offset - cur_offset;
 	while ((pnode = double_list_pop_front(&pstream->bp_list)) != nullptr)
 		free(pnode->pdata);
-	if (-1 != pstream->fd) {
-		if (*plen != read(pstream->fd, pbuff, *plen)) {
-			return FALSE;
-		}
-	} else {
-		memcpy(pbuff, pstream->buffer + pstream->read_offset, *plen);
-		pstream->read_offset += *plen;
+	if (FALSE == ftstream_producer_read_data(pstream, pbuff, *plen)) {
+		return FALSE;
 	}
 	*pb_last = TRUE;
-	if (-1 != pstream->fd) {
-		close(pstream->fd);
-		pstream->fd = -1;
-		if (remove(pstream->path.c_str()) < 0 && errno != ENOENT)
-			fprintf(stderr, "W-1340: remove: %s: %s\n",
-			        pstream->path.c_str(), strerror(errno));
-	}
+	ftstream_producer_unload_instances(pstream);
+	pstream->segments.clear();
+	pstream->cur_segment = 0;
+	/* a single huge message should not pin its memory for the next chunks */
+	pstream->buffer.clear();
+	if (pstream->buffer.capacity() > FTSTREAM_PRODUCER_BUFFER_LENGTH)
+		pstream->buffer.shrink_to_fit();
 	pstream->offset = 0;
-	pstream->buffer_offset = 0;
 	pstream->read_offset = 0;
+	pstream->buffer_offset = 0;
 	pstream->b_read = FALSE;
 	return TRUE;
 }
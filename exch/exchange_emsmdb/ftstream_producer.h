@@ -2,17 +2,40 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 #include <gromox/mapi_types.hpp>
 #include <gromox/double_list.hpp>
 #include "logon_object.h"
-#include <sys/types.h>
 #define FTSTREAM_PRODUCER_POINT_LENGTH			1024
-#define FTSTREAM_PRODUCER_BUFFER_LENGTH			4*1024*1024
+/* buffer capacity kept for the next chunk once a chunk has been read */
+#define FTSTREAM_PRODUCER_BUFFER_LENGTH			256*1024
+/* values at least this large are read from exmdb only when the chunk is read */
+#define FTSTREAM_PRODUCER_DEFER_LENGTH			64*1024
 #define STRING_OPTION_NONE						0x00
 #define STRING_OPTION_UNICODE					0x01
 #define STRING_OPTION_CPID						0x02
 #define STRING_OPTION_FORCE_UNICODE				0x08
 
+/* object whose values are being written, see ftstream_producer_source_instance */
+struct FTSTREAM_SOURCE {
+	uint8_t type;
+	uint64_t id; /* message id or attachment number */
+	uint32_t instance_id;
+};
+
+/*
+ * A large value that is not in the buffer; its bytes are fetched with
+ * READ_INSTANCE_PROPERTY_RANGE when the reader gets to them. PR_BODY_W
+ * comes as UTF-8 and is converted on the way (pending holds converted
+ * bytes that did not fit into the last read).
+ */
+struct FTSTREAM_SEGMENT {
+	uint32_t offset, length; /* in the stream */
+	uint32_t instance_id, proptag;
+	uint32_t src_offset, src_length; /* in the property value */
+	std::string pending;
+};
+
 struct FTSTREAM_PRODUCER {
 	~FTSTREAM_PRODUCER();
 	inline int total_length() const { return offset; }
@@ -21,21 +44,29 @@ struct FTSTREAM_PRODUCER {
 	BOOL write_proplist(const TPROPVAL_ARRAY *);
 	BOOL write_attachmentcontent(BOOL delprop, const ATTACHMENT_CONTENT *);
 	BOOL write_messagecontent(BOOL delprop, const MESSAGE_CONTENT *);
-	BOOL write_message(const MESSAGE_CONTENT *);
+	BOOL write_message(const MESSAGE_CONTENT *, uint64_t message_id = 0);
 	BOOL write_progresstotal(const PROGRESS_INFORMATION *);
 	BOOL write_progresspermessage(const PROGRESS_MESSAGE *);
-	BOOL write_messagechangefull(const TPROPVAL_ARRAY *chgheader, MESSAGE_CONTENT *);
+	BOOL write_messagechangefull(const TPROPVAL_ARRAY *chgheader, MESSAGE_CONTENT *, uint64_t message_id = 0);
 	BOOL write_messagechangepartial(const TPROPVAL_ARRAY *chgheader, const MSGCHG_PARTIAL *msg);
 	BOOL write_deletions(const TPROPVAL_ARRAY *);
 	BOOL write_readstatechanges(const TPROPVAL_ARRAY *);
 	BOOL write_state(const TPROPVAL_ARRAY *);
 	BOOL write_hierarchysync(const FOLDER_CHANGES *fldchgs, const TPROPVAL_ARRAY *del, const TPROPVAL_ARRAY *state);
 
-	int type = 0, fd = -1;
 	uint32_t offset = 0;
-	std::string path;
-	uint8_t buffer[FTSTREAM_PRODUCER_BUFFER_LENGTH]{};
-	uint32_t buffer_offset = 0, read_offset = 0;
+	/*
+	 * The stream is produced in chunks as the reader asks for data (see
+	 * fastdownctx/icsdownctx get_buffer); a chunk is only held here until
+	 * it has been read. When the message id was given to write_message,
+	 * large values are left to segments, so buffer only has the rest.
+	 */
+	std::string buffer;
+	std::vector<FTSTREAM_SEGMENT> segments;
+	std::vector<FTSTREAM_SOURCE> sources;
+	std::vector<uint32_t> instances; /* loaded for segments, unloaded per chunk */
+	uint32_t read_offset = 0, buffer_offset = 0;
+	size_t cur_segment = 0;
 	uint8_t string_option = 0;
 	LOGON_OBJECT *plogon = nullptr; /* plogon is a protected member */
 	DOUBLE_LIST bp_list{};
@@ -1,4 +1,5 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include "icsdownctx_object.h"
@@ -43,6 +44,8 @@ struct ics_group_node {
 }
 
 #define MAX_PARTIAL_ON_ROP		100	/* for limit of memory accumulation */
+#define ICS_PREFETCH_COUNT		32
+#define ICS_PREFETCH_SIZE		0x80000
 
 static BOOL icsdownctx_object_record_flow_node(
 	DOUBLE_LIST *pflow_list, int func_id, void *pparam)
@@ -1046,6 +1049,72 @@ static void icsdownctx_object_trim_report_recipients(
 	}
 }
 
+/*
+ * Reads the message about to be streamed. Instead of one exmdb round trip
+ * per message, the message changes queued next in flow_list are fetched
+ * in the same READ_MESSAGES call and kept for the following get_buffer
+ * calls. The contents live in the RPC's memory, so whatever is left over
+ * when the RPC ends gets dropped and read again later; to keep that small,
+ * the batch is sized to what the current get_buffer call can still put
+ * into the response.
+ */
+static BOOL icsdownctx_object_read_message(ICSDOWNCTX_OBJECT *pctx,
+	uint64_t message_id, MESSAGE_CONTENT **ppmsgctnt)
+{
+	EID_ARRAY ids;
+	MESSAGE_LIST msglst;
+	uint64_t id_buff[ICS_PREFETCH_COUNT];
+	
+	auto pinfo = emsmdb_interface_get_emsmdb_info();
+	if (pctx->prefetch_seq != pinfo->rpc_seq) {
+		pctx->prefetched.clear();
+		pctx->prefetch_seq = pinfo->rpc_seq;
+	}
+	auto it = pctx->prefetched.find(message_id);
+	if (it != pctx->prefetched.end()) {
+		*ppmsgctnt = it->second;
+		pctx->prefetched.erase(it);
+		return TRUE;
+	}
+	uint32_t used = pctx->pstream->total_length();
+	uint32_t size_limit = std::min(pctx->prefetch_space > used ?
+	                      pctx->prefetch_space - used : 0,
+	                      static_cast<uint32_t>(ICS_PREFETCH_SIZE));
+	ids.count = 0;
+	ids.pids = id_buff;
+	id_buff[ids.count++] = message_id;
+	for (auto pnode = double_list_get_head(&pctx->flow_list);
+	     0 != size_limit && NULL != pnode && ids.count < ICS_PREFETCH_COUNT;
+	     pnode = double_list_get_after(&pctx->flow_list, pnode)) {
+		auto pflow = static_cast<ICS_FLOW_NODE *>(pnode->pdata);
+		if (FUNC_ID_UPDATED_MESSAGE != pflow->func_id &&
+		    FUNC_ID_NEW_MESSAGE != pflow->func_id) {
+			break;
+		}
+		id_buff[ids.count++] = *static_cast<uint64_t *>(pflow->pparam);
+	}
+	const char *username = nullptr;
+	if (!pctx->pstream->plogon->check_private()) {
+		auto rpc_info = get_rpc_info();
+		username = rpc_info.username;
+	}
+	if (!exmdb_client_read_messages(pctx->pstream->plogon->get_dir(),
+	    username, pinfo->cpid, &ids, size_limit, &msglst) ||
+	    0 == msglst.count) {
+		return FALSE;
+	}
+	*ppmsgctnt = msglst.pplist[0];
+	try {
+		pctx->prefetched.clear();
+		for (size_t i = 1; i < msglst.count; ++i)
+			pctx->prefetched.emplace(id_buff[i], msglst.pplist[i]);
+	} catch (const std::bad_alloc &) {
+		/* only the read-ahead is lost */
+		pctx->prefetched.clear();
+	}
+	return TRUE;
+}
+
 static BOOL icsdownctx_object_write_message_change(ICSDOWNCTX_OBJECT *pctx,
 	uint64_t message_id, BOOL b_downloaded, int *ppartial_count)
 {
@@ -1067,17 +1136,8 @@ static BOOL icsdownctx_object_write_message_change(ICSDOWNCTX_OBJECT *pctx,
 	static constexpr uint8_t fake_true = 1;
 	static constexpr uint8_t fake_false = 0;
 	
-	auto pinfo = emsmdb_interface_get_emsmdb_info();
-	if (pctx->pstream->plogon->check_private()) {
-		if (!exmdb_client_read_message(pctx->pstream->plogon->get_dir(),
-		    nullptr, pinfo->cpid, message_id, &pmsgctnt))
-			return FALSE;
-	} else {
-		auto rpc_info = get_rpc_info();
-		if (!exmdb_client_read_message(pctx->pstream->plogon->get_dir(),
-		    rpc_info.username, pinfo->cpid, message_id, &pmsgctnt))
-			return FALSE;
-	}
+	if (FALSE == icsdownctx_object_read_message(pctx, message_id, &pmsgctnt))
+		return FALSE;
 	if (NULL == pmsgctnt) {
 		idset_remove(pctx->pstate->pgiven, message_id);
 		if (TRUE == b_downloaded) {
@@ -1310,7 +1370,8 @@ static BOOL icsdownctx_object_write_message_change(ICSDOWNCTX_OBJECT *pctx,
 		                     (*static_cast<uint32_t *>(pvalue) & MSGFLAG_NRN_PENDING) ?
 		                     deconst(&fake_true) : deconst(&fake_false);
 		common_util_set_propvals(&pmsgctnt->proplist, &tmp_propval);
-		if (!pctx->pstream->write_messagechangefull(&chgheader, pmsgctnt))
+		if (!pctx->pstream->write_messagechangefull(&chgheader,
+		    pmsgctnt, message_id))
 			return FALSE;
 	} else {
 		if (!pctx->pstream->write_messagechangepartial(&chgheader, &msg_partial))
@@ -1579,6 +1640,7 @@ static BOOL icsdownctx_object_get_buffer_internal(
 	}
 	partial_count = 0;
 	len1 = *plen - len;
+	pctx->prefetch_space = len1;
 	while ((pnode = double_list_pop_front(&pctx->flow_list)) != nullptr) {
 		pctx->progress_steps = pctx->next_progress_steps;
 		pflow = (ICS_FLOW_NODE*)pnode->pdata;
@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <memory>
+#include <unordered_map>
 #include <gromox/mem_file.hpp>
 #include "ics_state.h"
 #include <gromox/mapi_types.hpp>
@@ -38,6 +39,11 @@ struct ICSDOWNCTX_OBJECT final {
 	uint64_t total_steps = 0, progress_steps = 0, next_progress_steps = 0;
 	uint64_t ratio = 0;
 	PROPERTY_GROUPINFO fake_gpinfo{};
+	/* messages read ahead of the stream, valid during RPC prefetch_seq only */
+	uint32_t prefetch_seq = 0;
+	/* response bytes the current get_buffer call can still take */
+	uint32_t prefetch_space = 0;
+	std::unordered_map<uint64_t, MESSAGE_CONTENT *> prefetched;
 };
 
 extern std::unique_ptr<ICSDOWNCTX_OBJECT> icsdownctx_object_create(LOGON_OBJECT *, FOLDER_OBJECT *, uint8_t sync_type, uint8_t send_options, uint16_t sync_flags, const RESTRICTION *, uint32_t extra_flags, const PROPTAG_ARRAY *);
@@ -1,14 +1,18 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+#include <algorithm>
 #include <cerrno>
 #include <cstdint>
 #include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 #include <libHX/string.h>
 #include <gromox/defs.h>
 #include <gromox/paths.h>
 #include <gromox/guid.hpp>
 #include <gromox/util.hpp>
 #include <gromox/rop_util.hpp>
+#include <gromox/scope.hpp>
 #include <gromox/mail_func.hpp>
 #include "emsmdb_ndr.h"
 #include <gromox/proc_common.h>
@@ -25,8 +29,13 @@
 #include <cstring>
 #include <cstdio>
 #include "rop_dispatch.h"
+#include "rop_ids.h"
+#include "rop_ext.h"
+#include "property_cache.h"
+#include <gromox/lzxpress.hpp>
 
 using namespace std::string_literals;
+using namespace gromox;
 
 enum {
 	ecDoDisconnect = 1,
@@ -70,9 +79,120 @@ static bool exch_emsmdb_reload(std::shared_ptr<CONFIG_FILE> pconfig)
 	}
 	auto v = pconfig->get_value("rop_debug");
 	g_rop_debug = v != nullptr ? strtoul(v, nullptr, 0) : 0;
+	v = pconfig->get_value("rpc_compression_level");
+	g_rpc_compress_level = v != nullptr ? strtoul(v, nullptr, 0) : LZXPRESS_DEFAULT;
+	if (g_rpc_compress_level > LZXPRESS_BEST)
+		g_rpc_compress_level = LZXPRESS_BEST;
+	v = pconfig->get_value("property_cache");
+	g_prop_cache = v != nullptr ? parse_bool(v) : true;
+	v = pconfig->get_value("rop_slow_threshold");
+	g_rop_slow_threshold = v != nullptr ? strtoul(v, nullptr, 0) : 0;
 	return true;
 }
 
+static void console_rop_stats(char *result, int length)
+{
+	std::vector<std::pair<uint8_t, ROP_STATS>> rows;
+	for (unsigned int i = 0; i < 256; ++i) {
+		ROP_STATS st;
+		rop_processor_get_rop_stats(i, &st);
+		if (st.count > 0)
+			rows.emplace_back(i, st);
+	}
+	std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) {
+		return a.second.usec > b.second.usec;
+	});
+	int offset = snprintf(result, length, "250 ROP statistics, by total time "
+	             "(latency histogram bounds in ms:");
+	for (auto b : rop_latency_bounds)
+		offset += snprintf(result + offset, std::max(length - offset, 0), " %g", b / 1000.0);
+	offset += snprintf(result + offset, std::max(length - offset, 0),
+	          ")\r\n\t%-32s %9s %7s %11s %9s %9s %11s  %s",
+	          "ROP", "calls", "errors", "total ms", "avg ms",
+	          "max ms", "exmdb ms", "histogram");
+	for (const auto &[id, st] : rows) {
+		if (offset >= length)
+			break;
+		offset += snprintf(result + offset, length - offset,
+		          "\r\n\t%-32s %9llu %7llu %11.1f %9.2f %9.1f %11.1f  ",
+		          rop_idtoname(id), static_cast<unsigned long long>(st.count),
+		          static_cast<unsigned long long>(st.errors), st.usec / 1000.0,
+		          st.usec / 1000.0 / st.count, st.max_usec / 1000.0,
+		          st.exmdb_usec / 1000.0);
+		for (size_t i = 0; i < ROP_LATENCY_BUCKETS && offset < length; ++i)
+			offset += snprintf(result + offset, length - offset, "%s%llu",
+			          i == 0 ? "" : "/", static_cast<unsigned long long>(st.latency[i]));
+	}
+	result[length-1] = '\0';
+}
+
+static void console_sessions(char *result, int length)
+{
+	auto sessions = emsmdb_interface_get_sessions();
+	std::sort(sessions.begin(), sessions.end(), [](const auto &a, const auto &b) {
+		return a.stats.usec > b.stats.usec;
+	});
+	int offset = snprintf(result, length, "250 %zu sessions, by ROP time:\r\n"
+	             "\t%-40s %5s %-15s %9s %11s %11s %6s", sessions.size(),
+	             "user", "cxr", "client", "ROPs", "total ms", "exmdb ms", "slow");
+	for (const auto &e : sessions) {
+		if (offset >= length)
+			break;
+		char version[32];
+		snprintf(version, arsizeof(version), "%u.%u.%u.%u", e.client_version[0],
+		         e.client_version[1], e.client_version[2], e.client_version[3]);
+		offset += snprintf(result + offset, length - offset,
+		          "\r\n\t%-40s %5u %-15s %9llu %11.1f %11.1f %6llu",
+		          e.username, e.cxr, version,
+		          static_cast<unsigned long long>(e.stats.rops),
+		          e.stats.usec / 1000.0, e.stats.exmdb_usec / 1000.0,
+		          static_cast<unsigned long long>(e.stats.slow_rops));
+	}
+	result[length-1] = '\0';
+}
+
+/*
+ *	console talk for exchange_emsmdb plugin
+ *	@param
+ *		argc					arguments number
+ *		argv [in]				arguments array
+ *		result [out]			buffer for retriving result
+ *		length					result buffer length
+ */
+static void console_talk(int argc, char **argv, char *result, int length)
+{
+	char help_string[] = "250 exchange emsmdb help information:\r\n"
+						 "\t%s rop-stats [reset]\r\n"
+						 "\t    --print (or clear) per-ROP counters and latencies\r\n"
+						 "\t%s sessions\r\n"
+						 "\t    --print ROP totals of each session";
+
+	if (1 == argc) {
+		gx_strlcpy(result, "550 too few arguments", length);
+		return;
+	}
+	if (2 == argc && 0 == strcmp("--help", argv[1])) {
+		snprintf(result, length, help_string, argv[0], argv[0]);
+		result[length - 1] = '\0';
+		return;
+	}
+	if (2 == argc && 0 == strcmp("rop-stats", argv[1])) {
+		console_rop_stats(result, length);
+		return;
+	}
+	if (3 == argc && 0 == strcmp("rop-stats", argv[1]) &&
+	    0 == strcmp("reset", argv[2])) {
+		rop_processor_reset_rop_stats();
+		gx_strlcpy(result, "250 ROP statistics cleared", length);
+		return;
+	}
+	if (2 == argc && 0 == strcmp("sessions", argv[1])) {
+		console_sessions(result, length);
+		return;
+	}
+	snprintf(result, length, "550 invalid argument %s", argv[1]);
+}
+
 static BOOL proc_exchange_emsmdb(int reason, void **ppdata)
 {
 	int max_mail;
@@ -88,7 +208,7 @@ static BOOL proc_exchange_emsmdb(int reason, void **ppdata)
 	char size_buff[32];
 	char separator[16];
 	char org_name[256];
-	int average_handles;
+	unsigned int max_handles;
 	char temp_buff[256];
 	char file_name[256];
 	char submit_command[1024], *psearch;
@@ -121,12 +241,12 @@ static BOOL proc_exchange_emsmdb(int reason, void **ppdata)
 		gx_strlcpy(org_name, str_value == nullptr || *str_value == '\0' ?
 			"Gromox default" : str_value, GX_ARRAY_SIZE(org_name));
 		printf("[exchange_emsmdb]: x500 org name is \"%s\"\n", org_name);
-		str_value = pfile->get_value("AVERAGE_HANDLES");
-		average_handles = str_value != nullptr ? strtol(str_value, nullptr, 0) : 1000;
-		if (average_handles < 100)
-			average_handles = 100;
-		printf("[exchange_emsmdb]: average handles number "
-			"per context is %d\n", average_handles);
+		str_value = pfile->get_value("MAX_HANDLES_PER_LOGON");
+		max_handles = str_value != nullptr ? strtoul(str_value, nullptr, 0) : 500;
+		if (max_handles < 100)
+			max_handles = 100;
+		printf("[exchange_emsmdb]: maximum handles number "
+			"per logon is %u\n", max_handles);
 		str_value = pfile->get_value("AVERAGE_MEM");
 		if (NULL == str_value) {
 			average_blocks = 16;
@@ -202,6 +322,8 @@ static BOOL proc_exchange_emsmdb(int reason, void **ppdata)
 		    !regsvr(emsmdb_interface_connect_ex) ||
 		    !regsvr(emsmdb_interface_disconnect) ||
 		    !regsvr(emsmdb_interface_rpc_ext2) ||
+		    !regsvr(emsmdb_interface_get_rpcbuf) ||
+		    !regsvr(emsmdb_interface_put_rpcbuf) ||
 		    !regsvr(emsmdb_interface_touch_handle)) {
 			printf("[exchange_emsmdb]: service interface registration failure\n");
 			return false;
@@ -244,7 +366,7 @@ static BOOL proc_exchange_emsmdb(int reason, void **ppdata)
 		msgchg_grouping_init(get_data_path());
 		emsmdb_interface_init();
 		asyncemsmdb_interface_init(async_num);
-		rop_processor_init(average_handles, ping_interval);
+		rop_processor_init(max_handles, ping_interval);
 		if (bounce_producer_run(get_data_path()) != 0) {
 			printf("[exchange_emsmdb]: failed to run bounce producer\n");
 			return FALSE;
@@ -273,6 +395,10 @@ static BOOL proc_exchange_emsmdb(int reason, void **ppdata)
 			printf("[exchange_emsmdb]: failed to run rop processor\n");
 			return FALSE;
 		}
+		if (FALSE == register_talk(console_talk)) {
+			printf("[exchange_emsmdb]: failed to register console talk\n");
+			return FALSE;
+		}
 		printf("[exchange_emsmdb]: plugin is loaded into system\n");
 		return TRUE;
 	}
@@ -391,13 +517,25 @@ static int exchange_emsmdb_dispatch(int opnum, const GUID *pobject,
 		if (out == nullptr)
 			return DISPATCH_FAIL;
 		*ppout = out;
+		/*
+		 * Produce into a pooled buffer and put only what was used on
+		 * the NDR stack; the push buffer is sized after the latter.
+		 */
+		auto pbuff = emsmdb_interface_get_rpcbuf();
+		if (pbuff == nullptr)
+			return DISPATCH_FAIL;
+		auto cl_0 = make_scope_exit([&]() { emsmdb_interface_put_rpcbuf(pbuff); });
 		out->result = emsmdb_interface_rpc_ext2(&in->cxh, &in->flags,
-		              in->pin, in->cb_in, out->pout, &in->cb_out,
+		              in->pin, in->cb_in, pbuff, &in->cb_out,
 		              in->pauxin, in->cb_auxin, out->pauxout,
 		              &in->cb_auxout, &out->trans_time);
 		out->cxh = in->cxh;
 		out->flags = in->flags;
 		out->cb_out = in->cb_out;
+		out->pout = ndr_stack_anew<uint8_t>(NDR_STACK_OUT, out->cb_out + 1);
+		if (out->pout == nullptr)
+			return DISPATCH_FAIL;
+		memcpy(out->pout, pbuff, out->cb_out);
 		out->cb_auxout = in->cb_auxout;
 		return DISPATCH_SUCCESS;
 	}
@@ -225,6 +225,7 @@ BOOL MESSAGE_OBJECT::init_message(BOOL b_fai, uint32_t new_cpid)
 	TPROPVAL_ARRAY propvals;
 	
 	
+	pmessage->prop_cache.clear();
 	if (FALSE == pmessage->b_new) {
 		return FALSE;
 	}
@@ -426,6 +427,7 @@ gxerr_t MESSAGE_OBJECT::save()
 		FALSE == pmessage->b_touched) {
 		return GXERR_SUCCESS;
 	}
+	pmessage->prop_cache.clear();
 	auto rpc_info = get_rpc_info();
 	if (!exmdb_client_allocate_cn(pmessage->plogon->get_dir(), &pmessage->change_num))
 		return GXERR_CALL_FAILED;
@@ -732,6 +734,7 @@ BOOL MESSAGE_OBJECT::reload()
 	DOUBLE_LIST_NODE *pnode;
 	PROPTAG_ARRAY tmp_columns;
 	
+	pmessage->prop_cache.clear();
 	if (TRUE == pmessage->b_new) {
 		return TRUE;
 	}
@@ -785,6 +788,7 @@ BOOL MESSAGE_OBJECT::get_recipient_num(uint16_t *pnum)
 BOOL MESSAGE_OBJECT::empty_rcpts()
 {
 	auto pmessage = this;
+	pmessage->prop_cache.clear();
 	if (!exmdb_client_empty_message_instance_rcpts(pmessage->plogon->get_dir(),
 	    pmessage->instance_id))
 		return FALSE;	
@@ -799,6 +803,7 @@ BOOL MESSAGE_OBJECT::empty_rcpts()
 BOOL MESSAGE_OBJECT::set_rcpts(TARRAY_SET *pset)
 {
 	auto pmessage = this;
+	pmessage->prop_cache.clear();
 	if (!exmdb_client_update_message_instance_rcpts(pmessage->plogon->get_dir(),
 	    pmessage->instance_id, pset))
 		return FALSE;	
@@ -843,6 +848,7 @@ BOOL MESSAGE_OBJECT::get_attachments_num(uint16_t *pnum)
 BOOL MESSAGE_OBJECT::delete_attachment(uint32_t attachment_num)
 {
 	auto pmessage = this;
+	pmessage->prop_cache.clear();
 	if (!exmdb_client_delete_message_instance_attachment(
 	    pmessage->plogon->get_dir(), pmessage->instance_id, attachment_num))
 		return FALSE;
@@ -911,6 +917,7 @@ BOOL MESSAGE_OBJECT::commit_stream_object(STREAM_OBJECT *pstream)
 		if (pnode->pdata == pstream) {
 			double_list_remove(&pmessage->stream_list, pnode);
 			free(pnode);
+			pmessage->prop_cache.clear();
 			tmp_propval.proptag = pstream->get_proptag();
 			tmp_propval.pvalue = pstream->get_content();
 			if (!exmdb_client_set_instance_property(pmessage->plogon->get_dir(),
@@ -930,6 +937,7 @@ BOOL MESSAGE_OBJECT::flush_streams()
 	DOUBLE_LIST_NODE *pnode;
 	TAGGED_PROPVAL tmp_propval;
 	
+	pmessage->prop_cache.clear();
 	while ((pnode = double_list_pop_front(&pmessage->stream_list)) != nullptr) {
 		pstream = static_cast<STREAM_OBJECT *>(pnode->pdata);
 		tmp_propval.proptag = pstream->get_proptag();
@@ -951,6 +959,7 @@ BOOL MESSAGE_OBJECT::clear_unsent()
 	uint32_t *pmessage_flags;
 	TAGGED_PROPVAL tmp_propval;
 	
+	pmessage->prop_cache.clear();
 	if (0 == pmessage->message_id) {
 		return FALSE;
 	}
@@ -1179,6 +1188,8 @@ BOOL MESSAGE_OBJECT::get_properties(uint32_t size_limit,
 	TPROPVAL_ARRAY tmp_propvals;
 	static const uint32_t err_code = ecError;
 	static const uint32_t lcid_default = 0x0409;
+	static constexpr uint32_t computed_tags[] =
+		{PR_SOURCE_KEY, PR_MESSAGE_LOCALE_ID, PR_MESSAGE_CODEPAGE};
 	
 	ppropvals->ppropval = cu_alloc<TAGGED_PROPVAL>(pproptags->count);
 	if (NULL == ppropvals->ppropval) {
@@ -1212,21 +1223,28 @@ BOOL MESSAGE_OBJECT::get_properties(uint32_t size_limit,
 			ppropvals->count ++;
 			continue;
 		}	
+		if (pmessage->prop_cache.lookup(pproptags->pproptag[i],
+		    size_limit, ppropvals))
+			continue;
 		tmp_proptags.pproptag[tmp_proptags.count] = pproptags->pproptag[i];
 		tmp_proptags.count ++;
 	}
-	if (0 == tmp_proptags.count) {
-		return TRUE;
-	}
-	if (!exmdb_client_get_instance_properties(pmessage->plogon->get_dir(),
-	    size_limit, pmessage->instance_id, &tmp_proptags, &tmp_propvals))
-		return FALSE;	
-	
-	if (tmp_propvals.count > 0) {
-		memcpy(ppropvals->ppropval +
-			ppropvals->count, tmp_propvals.ppropval,
-			sizeof(TAGGED_PROPVAL)*tmp_propvals.count);
-		ppropvals->count += tmp_propvals.count;
+	/*
+	 * What exmdb lacks is filled in below; the cache does not take that
+	 * for "not found", and the fallbacks run for cached reads as well.
+	 */
+	if (tmp_proptags.count > 0) {
+		if (!exmdb_client_get_instance_properties(pmessage->plogon->get_dir(),
+		    size_limit, pmessage->instance_id, &tmp_proptags, &tmp_propvals))
+			return FALSE;
+		pmessage->prop_cache.store(&tmp_proptags, &tmp_propvals,
+			computed_tags, gromox::arsizeof(computed_tags));
+		if (tmp_propvals.count > 0) {
+			memcpy(ppropvals->ppropval +
+				ppropvals->count, tmp_propvals.ppropval,
+				sizeof(TAGGED_PROPVAL)*tmp_propvals.count);
+			ppropvals->count += tmp_propvals.count;
+		}
 	}
 	if (pmessage->pembedding == nullptr &&
 	    common_util_index_proptags(pproptags, PR_SOURCE_KEY) >= 0 &&
@@ -1290,6 +1308,7 @@ static BOOL message_object_set_properties_internal(MESSAGE_OBJECT *pmessage,
 	if (0 == (pmessage->open_flags & OPEN_MODE_FLAG_READWRITE)) {
 		return FALSE;
 	}
+	pmessage->prop_cache.clear();
 	pproblems->count = 0;
 	pproblems->pproblem = cu_alloc<PROPERTY_PROBLEM>(ppropvals->count);
 	if (NULL == pproblems->pproblem) {
@@ -1422,6 +1441,7 @@ BOOL MESSAGE_OBJECT::remove_properties(const PROPTAG_ARRAY *pproptags,
 	PROPTAG_ARRAY tmp_proptags;
 	uint16_t *poriginal_indices;
 	
+	pmessage->prop_cache.clear();
 	if (0 == (pmessage->open_flags & OPEN_MODE_FLAG_READWRITE)) {
 		return FALSE;
 	}
@@ -1507,6 +1527,7 @@ BOOL MESSAGE_OBJECT::copy_to(MESSAGE_OBJECT *pmessage_src,
 	PROPTAG_ARRAY *pcolumns;
 	MESSAGE_CONTENT msgctnt;
 	
+	pmessage->prop_cache.clear();
 	if (!exmdb_client_check_instance_cycle(pmessage->plogon->get_dir(),
 	    pmessage_src->instance_id, pmessage->instance_id, pb_cycle))
 		return FALSE;	
@@ -1563,6 +1584,7 @@ BOOL MESSAGE_OBJECT::copy_rcpts(MESSAGE_OBJECT *pmessage_src,
     BOOL b_force, BOOL *pb_result)
 {
 	auto pmessage = this;
+	pmessage->prop_cache.clear();
 	if (!exmdb_client_copy_instance_rcpts(pmessage->plogon->get_dir(),
 	    b_force, pmessage_src->instance_id, pmessage->instance_id, pb_result))
 		return FALSE;	
@@ -1576,6 +1598,7 @@ BOOL MESSAGE_OBJECT::copy_attachments(MESSAGE_OBJECT *pmessage_src,
     BOOL b_force, BOOL *pb_result)
 {
 	auto pmessage = this;
+	pmessage->prop_cache.clear();
 	if (!exmdb_client_copy_instance_attachments(pmessage->plogon->get_dir(),
 	    b_force, pmessage_src->instance_id, pmessage->instance_id, pb_result))
 		return FALSE;	
@@ -1600,6 +1623,7 @@ BOOL MESSAGE_OBJECT::set_readflag(uint8_t read_flag, BOOL *pb_changed)
 	static constexpr uint8_t fake_false = 0;
 	TAGGED_PROPVAL propval_buff[2];
 	
+	pmessage->prop_cache.clear();
 	auto rpc_info = get_rpc_info();
 	auto username = pmessage->plogon->check_private() ? nullptr : rpc_info.username;
 	b_notify = FALSE;
@@ -6,6 +6,7 @@
 #include <gromox/mapi_types.hpp>
 #include <gromox/double_list.hpp>
 #include "logon_object.h"
+#include "property_cache.h"
 #include "stream_object.h"
 
 /* MESSAGE_OBJECT and ATTACHMENT_OBJECT are friend classes,
@@ -60,6 +61,7 @@ struct MESSAGE_OBJECT {
 	PROPTAG_ARRAY *precipient_columns = nullptr;
 	PROPTAG_ARRAY *pchanged_proptags = nullptr, *premoved_proptags = nullptr;
 	DOUBLE_LIST stream_list{};
+	PROP_CACHE prop_cache;
 };
 
 extern std::unique_ptr<MESSAGE_OBJECT> message_object_create(LOGON_OBJECT *, BOOL b_new, uint32_t cpid, uint64_t message_id, void *parent, uint32_t tag_access, uint8_t open_flags, ICS_STATE *);
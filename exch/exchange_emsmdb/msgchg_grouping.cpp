@@ -1,356 +1,213 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+/*
+ * Property group definitions for partial message changes (OXCFXICS 2.2.1.2).
+ * The definition files are compiled at startup into per-group proptag
+ * vectors; msgchg_grouping_get_groupinfo only has to resolve the named
+ * properties of a store and copy the rest.
+ */
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <dirent.h>
+#include <map>
+#include <new>
 #include <string>
+#include <utility>
+#include <vector>
 #include <sys/types.h>
 #include <libHX/string.h>
 #include <gromox/defs.h>
 #include <gromox/mapidefs.h>
 #include "msgchg_grouping.h"
-#include <gromox/double_list.hpp>
 #include <gromox/fileio.h>
 #include <gromox/list_file.hpp>
 #include <gromox/proptag_array.hpp>
 #include <gromox/rop_util.hpp>
 #include <gromox/guid.hpp>
 #include <gromox/util.hpp>
-#include "common_util.h"
 
 using namespace std::string_literals;
 using namespace gromox;
 
 namespace {
 
-struct TAG_NODE {
-	DOUBLE_LIST_NODE node;
-	uint16_t propid;
+/* a named property of a group; its slot in the group is filled per store */
+struct named_tag {
+	uint32_t index, pos;
 	uint16_t type;
-	PROPERTY_NAME *ppropname;
-};
-
-struct msg_group_node {
-	DOUBLE_LIST_NODE node;
-	uint32_t index;
-	DOUBLE_LIST tag_list;
+	uint8_t kind;
+	GUID guid;
+	uint32_t lid;
+	std::string name;
 };
 
-struct INFO_NODE {
-	DOUBLE_LIST_NODE node;
-	uint32_t group_id;
-	DOUBLE_LIST group_list;
+struct group_info {
+	/* proptags by group index, with 0 in the slots of named properties */
+	std::vector<std::vector<uint32_t>> groups;
+	std::vector<named_tag> named;
 };
 
 }
 
 static std::string g_folder_path;
-static DOUBLE_LIST g_info_list;
+static std::map<uint32_t, group_info> g_group_infos;
 
 void msgchg_grouping_init(const char *sdlist)
 {
 	g_folder_path = sdlist;
-	double_list_init(&g_info_list);
-}
-
-static msg_group_node *msgchg_grouping_create_group_node(uint32_t index)
-{
-	auto pgp_node = me_alloc<msg_group_node>();
-	if (NULL == pgp_node) {
-		return NULL;
-	}
-	pgp_node->node.pdata = pgp_node;
-	pgp_node->index = index;
-	double_list_init(&pgp_node->tag_list);
-	return pgp_node;
-}
-
-static void msgchg_grouping_free_group_node(msg_group_node *pgp_node)
-{
-	TAG_NODE *ptag_node;
-	DOUBLE_LIST_NODE *pnode;
-	
-	while ((pnode = double_list_pop_front(&pgp_node->tag_list)) != nullptr) {
-		ptag_node = (TAG_NODE*)pnode->pdata;
-		if (0 == ptag_node->propid) {
-			switch (ptag_node->ppropname->kind) {
-			case MNID_STRING:
-				free(ptag_node->ppropname->pname);
-				break;
-			}
-			free(ptag_node->ppropname);
-		}
-		free(ptag_node);
-	}
-	double_list_free(&pgp_node->tag_list);
-	free(pgp_node);
-}
-
-static INFO_NODE* msgchg_grouping_create_info_node(uint32_t group_id)
-{
-	auto pinfo_node = me_alloc<INFO_NODE>();
-	if (NULL == pinfo_node) {
-		return NULL;
-	}
-	pinfo_node->node.pdata = pinfo_node;
-	pinfo_node->group_id = group_id;
-	double_list_init(&pinfo_node->group_list);
-	return pinfo_node;
-}
-
-static void msgchg_grouping_free_info_node(INFO_NODE *pinfo_node)
-{
-	DOUBLE_LIST_NODE *pnode;
-	
-	while ((pnode = double_list_pop_front(&pinfo_node->group_list)) != nullptr)
-		msgchg_grouping_free_group_node(static_cast<msg_group_node *>(pnode->pdata));
-	double_list_free(&pinfo_node->group_list);
-	free(pinfo_node);
-}
-
-static BOOL msgchg_grouping_append_group_list(INFO_NODE *pinfo_node, msg_group_node *pgp_node)
-{
-	DOUBLE_LIST_NODE *pnode;
-
-	for (pnode=double_list_get_head(&pinfo_node->group_list); NULL!=pnode;
-		pnode=double_list_get_after(&pinfo_node->group_list, pnode)) {
-		if (static_cast<msg_group_node *>(pnode->pdata)->index == pgp_node->index) {
-			return FALSE;
-		} else if (pgp_node->index < static_cast<msg_group_node *>(pnode->pdata)->index) {
-			double_list_insert_before(&pinfo_node->group_list,
-									pnode, &pgp_node->node);
-			return TRUE;
-		}
-	}
-	double_list_append_as_tail(&pinfo_node->group_list, &pgp_node->node);
-	return TRUE;
-}
-
-static BOOL msgchg_grouping_append_info_list(INFO_NODE *pinfo_node)
-{
-	DOUBLE_LIST_NODE *pnode;
-	
-	for (pnode=double_list_get_head(&g_info_list); NULL!=pnode;
-		pnode=double_list_get_after(&g_info_list, pnode)) {
-		if (((INFO_NODE*)pnode->pdata)->group_id == pinfo_node->group_id) {
-			return FALSE;
-		} else if (pinfo_node->group_id <
-			((INFO_NODE*)pnode->pdata)->group_id) {
-			double_list_insert_before(&g_info_list,
-							pnode, &pinfo_node->node);
-			return TRUE;
-		}
-	}
-	double_list_append_as_tail(&g_info_list, &pinfo_node->node);
-	return TRUE;
 }
 
-static BOOL msgchg_grouping_verify_group_list(INFO_NODE *pinfo_node)
-{
-	size_t i;
-	DOUBLE_LIST_NODE *pnode;
-	
-	for (i=0,pnode=double_list_get_head(&pinfo_node->group_list); NULL!=pnode;
-		pnode=double_list_get_after(&pinfo_node->group_list, pnode),i++) {
-		if (i != static_cast<msg_group_node *>(pnode->pdata)->index)
-			return FALSE;
-	}
-	return TRUE;
-}
-
-static INFO_NODE *msgchg_grouping_load_gpinfo(const char *dir, const char *file_name)
+static BOOL msgchg_grouping_load_gpinfo(const char *dir, const char *file_name)
 {
 	int index;
 	char *ptoken;
 	char *ptoken1;
 	uint32_t proptag;
-	TAG_NODE *ptag_node;
-	INFO_NODE *pinfo_node;
 	
 	uint32_t group_id = strtoul(file_name + 2, nullptr, 16);
 	if (0 == group_id || 0xFFFFFFFF == group_id) {
 		printf("[exchange_emsmdb]: file name"
 			" %s format error\n", file_name);
-		return NULL;
+		return FALSE;
 	}
 	std::string file_path;
 	try {
 		file_path = dir + "/"s + file_name;
 	} catch (const std::bad_alloc &) {
 		fprintf(stderr, "E-1493: ENOMEM\n");
-		return nullptr;
+		return FALSE;
 	}
 	auto pfile = list_file_initd(file_path.c_str(), nullptr, "%s:256");
 	if (NULL == pfile) {
 		printf("[exchange_emsmdb]: list_file_init %s: %s\n",
 		       file_path.c_str(), strerror(errno));
-		return NULL;
+		return FALSE;
 	}
-	pinfo_node = msgchg_grouping_create_info_node(group_id);
-	if (NULL == pinfo_node) {
-		printf("[exchange_emsmdb]: out of memory when "
-					"loading property group info\n");
-		return NULL;
+	if (g_group_infos.find(group_id) != g_group_infos.end()) {
+		printf("[exchange_emsmdb]: duplicated "
+			"group_id 0x%x\n", group_id);
+		return FALSE;
 	}
+	std::map<uint32_t, std::vector<uint32_t>> groups;
+	group_info info;
 	auto line_num = pfile->get_size();
 	auto pline = static_cast<char *>(pfile->get_list());
 	index = -1;
-	msg_group_node *pgp_node = nullptr;
-	for (decltype(line_num) i = 0; i < line_num; ++i) {
-		if (0 == strncasecmp(pline, "index:", 6)) {
-			index = atoi(pline + 6);
-			if (index < 0) {
-				printf("[exchange_emsmdb]: index %d "
-					"error in %s\n", index, file_path.c_str());
-				return NULL;
-			}
-			pgp_node = msgchg_grouping_create_group_node(index);
-			if (NULL == pgp_node) {
-				printf("[exchange_emsmdb]: out of memory when "
-					"loading property group info\n");
-				return NULL;
-			}
-			if (FALSE == msgchg_grouping_append_group_list(
-				pinfo_node, pgp_node)) {
-				msgchg_grouping_free_group_node(pgp_node);
-				printf("[exchange_emsmdb]: index %d "
-							"duplicated\n", index);
-				return NULL;
-			}
-		} else if (0 == strncasecmp(pline, "0x", 2)) {
-			if (-1 == index) {
-				printf("[exchange_emsmdb]: file %s must "
-					"begin with \"index:\"\n", file_path.c_str());
-				return NULL;
-			}
-			proptag = strtol(pline + 2, NULL, 16);
-			if (PROP_ID(proptag) == 0 || PROP_ID(proptag) >= 0x8000) {
-				printf("[exchange_emsmdb]: fail to parse line"
-					"\"%s\" in %s\n", pline, file_path.c_str());
-				return NULL;
-			}
-			ptag_node = me_alloc<TAG_NODE>();
-			if (NULL == ptag_node) {
-				printf("[exchange_emsmdb]: out of memory when "
-					"loading property group info\n");
-				return NULL;
-			}
-			ptag_node->node.pdata = ptag_node;
-			ptag_node->propid = PROP_ID(proptag);
-			ptag_node->type = PROP_TYPE(proptag);
-			ptag_node->ppropname = NULL;
-			double_list_append_as_tail(
-				&pgp_node->tag_list, &ptag_node->node);
-		} else if (0 == strncasecmp(pline, "GUID=", 5)) {
-			if (-1 == index) {
-				printf("[exchange_emsmdb]: file %s must "
-					"begin with \"index:\"\n", file_path.c_str());
-				return NULL;
-			}
-			ptoken = strchr(pline + 5, ',');
-			if (NULL == ptoken) {
-				printf("[exchange_emsmdb]: line "
-					"\"%s\" format error\n", pline);
-				return NULL;
-			}
-			*ptoken = '\0';
-			ptoken ++;
-			ptoken1 = strchr(ptoken, ',');
-			if (NULL == ptoken1) {
-				printf("[exchange_emsmdb]: format"
-					" error in \"%s\"\n", ptoken);
-				return NULL;
-			}
-			*ptoken1 = '\0';
-			ptoken1 ++;
-			if (0 != strncasecmp(ptoken1, "TYPE=0x", 7)) {
-				printf("[exchange_emsmdb]: format"
-					" error in \"%s\"\n", ptoken1);
-				return NULL;
-			}
-			ptag_node = me_alloc<TAG_NODE>();
-			if (NULL == ptag_node) {
-				printf("[exchange_emsmdb]: out of memory "
-					"when loading property group info\n");
-				return NULL;
-			}
-			ptag_node->node.pdata = ptag_node;
-			ptag_node->propid = 0;
-			ptag_node->type = strtol(ptoken1 + 7, NULL, 16);
-			if (0 == ptag_node->type) {
-				printf("[exchange_emsmdb]: format"
-					"error in \"%s\"\n", ptoken1);
-				return NULL;
-			}
-			ptag_node->ppropname = me_alloc<PROPERTY_NAME>();
-			if (NULL == ptag_node->ppropname) {
-				free(ptag_node);
-				printf("[exchange_emsmdb]: out of memory when "
-					"loading property group info\n");
-				return NULL;
-			}
-			if (FALSE == guid_from_string(
-				&ptag_node->ppropname->guid, pline + 5)) {
-				free(ptag_node->ppropname);
-				free(ptag_node);
-				printf("[exchange_emsmdb]: guid string"
-					" \"%s\" format error\n", pline + 5);
-				return NULL;
-			}
-			if (0 == strncasecmp(ptoken, "LID=", 4)) {
-				ptag_node->ppropname->kind = MNID_ID;
-				ptag_node->ppropname->lid = atoi(ptoken + 4);
-				if (ptag_node->ppropname->lid == 0) {
-					free(ptag_node->ppropname);
-					free(ptag_node);
-					printf("[exchange_emsmdb]: lid \"%s\"/%u error "
-						"with guid \"%s\"\n", ptoken + 4,
-						ptag_node->ppropname->lid, pline + 5);
-					return NULL;
+	std::vector<uint32_t> *pgroup = nullptr;
+	try {
+		for (decltype(line_num) i = 0; i < line_num; ++i, pline += 256) {
+			if (0 == strncasecmp(pline, "index:", 6)) {
+				index = atoi(pline + 6);
+				if (index < 0) {
+					printf("[exchange_emsmdb]: index %d "
+						"error in %s\n", index, file_path.c_str());
+					return FALSE;
 				}
-				ptag_node->ppropname->pname = NULL;
-				double_list_append_as_tail(
-					&pgp_node->tag_list, &ptag_node->node);
-			} else if (0 == strncasecmp(ptoken, "NAME=", 5)) {
-				ptag_node->ppropname->kind = MNID_STRING;
-				HX_strrtrim(ptoken + 5);
-				HX_strltrim(ptoken + 5);
-				if ('\0' == ptoken[5]) {
-					free(ptag_node->ppropname);
-					free(ptag_node);
-					printf("[exchange_emsmdb]: name empty "
-						"with guid \"%s\"\n", pline + 5);
-					return NULL;
+				auto ret = groups.emplace(index, std::vector<uint32_t>{});
+				if (!ret.second) {
+					printf("[exchange_emsmdb]: index %d "
+								"duplicated\n", index);
+					return FALSE;
 				}
-				ptag_node->ppropname->pname = strdup(ptoken + 5);
-				if (NULL == ptag_node->ppropname->pname) {
-					free(ptag_node->ppropname);
-					free(ptag_node);
-					printf("[exchange_emsmdb]: out of memory "
-						"when loading property group info\n");
-					return NULL;
+				pgroup = &ret.first->second;
+			} else if (0 == strncasecmp(pline, "0x", 2)) {
+				if (-1 == index) {
+					printf("[exchange_emsmdb]: file %s must "
+						"begin with \"index:\"\n", file_path.c_str());
+					return FALSE;
 				}
-				ptag_node->ppropname->lid = 0;
-				double_list_append_as_tail(
-					&pgp_node->tag_list, &ptag_node->node);
-			} else {
-				free(ptag_node->ppropname);
-				free(ptag_node);
-				printf("[exchange_emsmdb]: type %s unknown\n", ptoken);
-				return NULL;
+				proptag = strtol(pline + 2, NULL, 16);
+				if (PROP_ID(proptag) == 0 || PROP_ID(proptag) >= 0x8000) {
+					printf("[exchange_emsmdb]: fail to parse line"
+						"\"%s\" in %s\n", pline, file_path.c_str());
+					return FALSE;
+				}
+				pgroup->push_back(proptag);
+			} else if (0 == strncasecmp(pline, "GUID=", 5)) {
+				if (-1 == index) {
+					printf("[exchange_emsmdb]: file %s must "
+						"begin with \"index:\"\n", file_path.c_str());
+					return FALSE;
+				}
+				ptoken = strchr(pline + 5, ',');
+				if (NULL == ptoken) {
+					printf("[exchange_emsmdb]: line "
+						"\"%s\" format error\n", pline);
+					return FALSE;
+				}
+				*ptoken = '\0';
+				ptoken ++;
+				ptoken1 = strchr(ptoken, ',');
+				if (NULL == ptoken1) {
+					printf("[exchange_emsmdb]: format"
+						" error in \"%s\"\n", ptoken);
+					return FALSE;
+				}
+				*ptoken1 = '\0';
+				ptoken1 ++;
+				if (0 != strncasecmp(ptoken1, "TYPE=0x", 7)) {
+					printf("[exchange_emsmdb]: format"
+						" error in \"%s\"\n", ptoken1);
+					return FALSE;
+				}
+				named_tag tag;
+				tag.index = index;
+				tag.pos = pgroup->size();
+				tag.type = strtol(ptoken1 + 7, NULL, 16);
+				if (0 == tag.type) {
+					printf("[exchange_emsmdb]: format"
+						"error in \"%s\"\n", ptoken1);
+					return FALSE;
+				}
+				if (FALSE == guid_from_string(&tag.guid, pline + 5)) {
+					printf("[exchange_emsmdb]: guid string"
+						" \"%s\" format error\n", pline + 5);
+					return FALSE;
+				}
+				if (0 == strncasecmp(ptoken, "LID=", 4)) {
+					tag.kind = MNID_ID;
+					tag.lid = atoi(ptoken + 4);
+					if (tag.lid == 0) {
+						printf("[exchange_emsmdb]: lid \"%s\"/%u error "
+							"with guid \"%s\"\n", ptoken + 4,
+							tag.lid, pline + 5);
+						return FALSE;
+					}
+				} else if (0 == strncasecmp(ptoken, "NAME=", 5)) {
+					tag.kind = MNID_STRING;
+					HX_strrtrim(ptoken + 5);
+					HX_strltrim(ptoken + 5);
+					if ('\0' == ptoken[5]) {
+						printf("[exchange_emsmdb]: name empty "
+							"with guid \"%s\"\n", pline + 5);
+						return FALSE;
+					}
+					tag.lid = 0;
+					tag.name = ptoken + 5;
+				} else {
+					printf("[exchange_emsmdb]: type %s unknown\n", ptoken);
+					return FALSE;
+				}
+				pgroup->push_back(0);
+				info.named.push_back(std::move(tag));
 			}
 		}
-		pline += 256;
+		uint32_t expected = 0;
+		for (auto &&[idx, tags] : groups) {
+			if (idx != expected++) {
+				printf("[exchange_emsmdb]: indexes shoud "
+					"begin with 0 and be continuous\n");
+				return FALSE;
+			}
+			info.groups.push_back(std::move(tags));
+		}
+		g_group_infos.emplace(group_id, std::move(info));
+	} catch (const std::bad_alloc &) {
+		printf("[exchange_emsmdb]: out of memory when "
+			"loading property group info\n");
+		return FALSE;
 	}
-	if (!msgchg_grouping_verify_group_list(pinfo_node))
-		printf("[exchange_emsmdb]: indexes shoud "
-			"begin with 0 and be continuous\n");
-	else if (msgchg_grouping_append_info_list(pinfo_node))
-		return pinfo_node;
-	else
-		printf("[exchange_emsmdb]: duplicated "
-			"group_id 0x%x\n", pinfo_node->group_id);
-	return NULL;
+	return TRUE;
 }
 
 int msgchg_grouping_run()
@@ -366,14 +223,14 @@ int msgchg_grouping_run()
 		if (0 != strncasecmp(direntp->d_name, "0x", 2)) {
 			continue;	
 		}
-		if (msgchg_grouping_load_gpinfo(dinfo.m_path.c_str(), direntp->d_name) == nullptr) {
+		if (!msgchg_grouping_load_gpinfo(dinfo.m_path.c_str(), direntp->d_name)) {
 			printf("[exchange_emsmdb]: Failed to load property group "
 				"info definition file %s/%s: %s\n",
 				dinfo.m_path.c_str(), direntp->d_name, strerror(errno));
 			return -2;
 		}
 	}
-	if (0 == double_list_get_nodes_num(&g_info_list)) {
+	if (g_group_infos.empty()) {
 		printf("[exchange_emsmdb]: no \"property"
 			" group info\" found within directory \"%s\"\n",
 			dinfo.m_path.c_str());
@@ -384,10 +241,7 @@ int msgchg_grouping_run()
 
 uint32_t msgchg_grouping_get_last_group_id()
 {
-	DOUBLE_LIST_NODE *pnode;
-	
-	pnode = double_list_get_tail(&g_info_list);
-	return ((INFO_NODE*)pnode->pdata)->group_id;
+	return g_group_infos.rbegin()->first;
 }
 
 PROPERTY_GROUPINFO *msgchg_grouping_get_groupinfo(
@@ -395,47 +249,42 @@ PROPERTY_GROUPINFO *msgchg_grouping_get_groupinfo(
     void *stororlogin, uint32_t group_id)
 {
 	uint16_t propid;
-	uint32_t proptag;
-	TAG_NODE *ptag_node;
-	msg_group_node *pgp_node;
-	INFO_NODE *pinfo_node;
-	DOUBLE_LIST_NODE *pnode;
-	DOUBLE_LIST_NODE *pnode1;
 	PROPTAG_ARRAY *pproptags;
 	PROPERTY_GROUPINFO *pinfo;
 	
-	for (pnode=double_list_get_head(&g_info_list); NULL!=pnode;
-		pnode=double_list_get_after(&g_info_list, pnode)) {
-		pinfo_node = (INFO_NODE*)pnode->pdata;
-		if (group_id == pinfo_node->group_id) {
-			break;
-		}
+	auto it = g_group_infos.find(group_id);
+	if (it == g_group_infos.end()) {
+		return NULL;
 	}
-	if (NULL == pnode) {
+	auto &info = it->second;
+	std::vector<std::vector<uint32_t>> groups;
+	try {
+		groups = info.groups;
+	} catch (const std::bad_alloc &) {
 		return NULL;
 	}
+	for (const auto &tag : info.named) {
+		PROPERTY_NAME propname;
+		propname.kind = tag.kind;
+		propname.guid = tag.guid;
+		propname.lid = tag.lid;
+		propname.pname = tag.kind == MNID_STRING ? deconst(tag.name.c_str()) : nullptr;
+		if (!get_named_propid(stororlogin, TRUE, &propname, &propid) ||
+		    propid == 0)
+			return NULL;
+		groups[tag.index][tag.pos] = PROP_TAG(tag.type, propid);
+	}
 	pinfo = property_groupinfo_init(group_id);
 	if (NULL == pinfo) {
 		return NULL;
 	}
-	for (pnode=double_list_get_head(&pinfo_node->group_list); NULL!=pnode;
-		pnode=double_list_get_after(&pinfo_node->group_list, pnode)) {
-		pgp_node = static_cast<msg_group_node *>(pnode->pdata);
+	for (const auto &group : groups) {
 		pproptags = proptag_array_init();
-		for (pnode1=double_list_get_head(&pgp_node->tag_list); NULL!=pnode1;
-			pnode1=double_list_get_after(&pgp_node->tag_list, pnode1)) {
-			ptag_node = (TAG_NODE*)pnode1->pdata;
-			if (0 != ptag_node->propid) {
-				proptag = PROP_TAG(ptag_node->type, ptag_node->propid);
-			} else {
-				if (!get_named_propid(stororlogin, TRUE,
-				    ptag_node->ppropname, &propid) || propid == 0) {
-					property_groupinfo_free(pinfo);
-					proptag_array_free(pproptags);
-					return NULL;
-				}
-				proptag = PROP_TAG(ptag_node->type, propid);
-			}
+		if (NULL == pproptags) {
+			property_groupinfo_free(pinfo);
+			return NULL;
+		}
+		for (auto proptag : group) {
 			if (!proptag_array_append(pproptags, proptag)) {
 				property_groupinfo_free(pinfo);
 				proptag_array_free(pproptags);
@@ -454,13 +303,9 @@ PROPERTY_GROUPINFO *msgchg_grouping_get_groupinfo(
 
 void msgchg_grouping_stop()
 {
-	DOUBLE_LIST_NODE *pnode;
-	
-	while ((pnode = double_list_pop_front(&g_info_list)) != nullptr)
-		msgchg_grouping_free_info_node(static_cast<INFO_NODE *>(pnode->pdata));
+	g_group_infos.clear();
 }
 
 void msgchg_grouping_free()
 {
-	double_list_free(&g_info_list);
 }
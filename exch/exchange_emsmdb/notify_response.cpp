@@ -1,4 +1,5 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+#include <algorithm>
 #include <cstdint>
 #include "notify_response.h"
 #include <gromox/rop_util.hpp>
@@ -735,16 +736,67 @@ BOOL notify_response_retrieve(NOTIFY_RESPONSE *pnotify,
 	return FALSE;
 }
 
-void notify_response_content_table_row_event_to_change(
-	NOTIFY_RESPONSE *pnotify)
+/* turns a row event of any table type into that table's TABLE_CHANGED */
+void notify_response_row_event_to_change(NOTIFY_RESPONSE *pnotify)
 {
 	uint16_t *ptable_event;
 	
+	auto flags = pnotify->notification_data.notification_flags &
+	             (NOTIFICATION_FLAG_MOST_SEARCH | NOTIFICATION_FLAG_MOST_MESSAGE);
 	ptable_event = pnotify->notification_data.ptable_event;
 	memset(&pnotify->notification_data, 0, sizeof(NOTIFICATION_DATA));
 	pnotify->notification_data.notification_flags =
-					NOTIFICATION_FLAG_TABLE_MODIFIED |
-					NOTIFICATION_FLAG_MOST_MESSAGE;
+					NOTIFICATION_FLAG_TABLE_MODIFIED | flags;
 	pnotify->notification_data.ptable_event = ptable_event;
 	*ptable_event = TABLE_EVENT_TABLE_CHANGED;
 }
+
+/*
+ * Folds the object-modified notification @psrc into @pdst for the same
+ * object: the changed property lists are united (an empty list stands
+ * for "unspecified" and absorbs the other one) and counts are taken from
+ * the newer event.
+ */
+BOOL notify_response_merge_modified(NOTIFY_RESPONSE *pdst,
+	const NOTIFY_RESPONSE *psrc)
+{
+	auto pmemory = notify_to_ndm(pdst);
+	auto &dst = pdst->notification_data;
+	auto &src = psrc->notification_data;
+	
+	if (NULL == dst.pproptags || NULL == src.pproptags) {
+		return FALSE;
+	}
+	if (NULL != src.ptotal_count) {
+		dst.notification_flags |= NOTIFICATION_FLAG_MOST_TOTAL;
+		dst.ptotal_count = &pmemory->total_count;
+		pmemory->total_count = *src.ptotal_count;
+	}
+	if (NULL != src.punread_count) {
+		dst.notification_flags |= NOTIFICATION_FLAG_MOST_UNREAD;
+		dst.punread_count = &pmemory->unread_count;
+		pmemory->unread_count = *src.punread_count;
+	}
+	if (0 == dst.pproptags->count) {
+		return TRUE;
+	}
+	if (0 == src.pproptags->count) {
+		free(dst.pproptags->pproptag);
+		dst.pproptags->pproptag = NULL;
+		dst.pproptags->count = 0;
+		return TRUE;
+	}
+	auto ptags = static_cast<uint32_t *>(realloc(dst.pproptags->pproptag,
+	             sizeof(uint32_t) * (dst.pproptags->count + src.pproptags->count)));
+	if (NULL == ptags) {
+		return FALSE;
+	}
+	dst.pproptags->pproptag = ptags;
+	for (size_t i = 0; i < src.pproptags->count; ++i) {
+		auto tag = src.pproptags->pproptag[i];
+		if (std::find(ptags, ptags + dst.pproptags->count, tag) ==
+		    ptags + dst.pproptags->count)
+			ptags[dst.pproptags->count++] = tag;
+	}
+	return TRUE;
+}
@@ -105,7 +105,9 @@ uint32_t rop_getpropertiesspecific(uint16_t size_limit,
 	PROPTAG_ARRAY *ptmp_proptags;
 	
 	/* we ignore the size_limit as
-		mentioned in MS-OXCPRPT 3.2.5.1 */
+		mentioned in MS-OXCPRPT 3.2.5.1; values above 0x8000
+		are replaced by ecMAPIOOM below anyway, so have the
+		store skip reading such attachment data at all */
 	pobject = rop_processor_get_object(plogmap,
 				logon_id, hin, &object_type);
 	if (NULL == pobject) {
@@ -139,14 +141,14 @@ uint32_t rop_getpropertiesspecific(uint16_t size_limit,
 	}
 	case OBJECT_TYPE_MESSAGE: {
 		auto msg = static_cast<MESSAGE_OBJECT *>(pobject);
-		if (!msg->get_properties(0, ptmp_proptags, &propvals))
+		if (!msg->get_properties(0x8000, ptmp_proptags, &propvals))
 			return ecError;
 		cpid = msg->get_cpid();
 		break;
 	}
 	case OBJECT_TYPE_ATTACHMENT: {
 		auto atx = static_cast<ATTACHMENT_OBJECT *>(pobject);
-		if (!atx->get_properties(0, ptmp_proptags, &propvals))
+		if (!atx->get_properties(0x8000, ptmp_proptags, &propvals))
 			return ecError;
 		cpid = atx->get_cpid();
 		break;
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+/*
+ * Per-object property cache for MESSAGE_OBJECT and FOLDER_OBJECT. Clients
+ * tend to read the same handful of properties of an open object over and
+ * over (Outlook does so for every redraw of a message); this answers the
+ * repeats without another exmdb round trip.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <gromox/mapidefs.h>
+#include "common_util.h"
+#include "property_cache.h"
+
+bool g_prop_cache = true;
+
+static size_t propcache_fixed_size(uint16_t type)
+{
+	switch (type) {
+	case PT_BOOLEAN:
+		return sizeof(uint8_t);
+	case PT_SHORT:
+		return sizeof(uint16_t);
+	case PT_LONG:
+	case PT_FLOAT:
+		return sizeof(uint32_t);
+	case PT_DOUBLE:
+	case PT_APPTIME:
+	case PT_CURRENCY:
+	case PT_I8:
+	case PT_SYSTIME:
+		return sizeof(uint64_t);
+	case PT_CLSID:
+		return sizeof(GUID);
+	default:
+		return 0;
+	}
+}
+
+static bool propcache_check_type(uint16_t type)
+{
+	return propcache_fixed_size(type) != 0 || type == PT_STRING8 ||
+	       type == PT_UNICODE || type == PT_BINARY;
+}
+
+BOOL PROP_CACHE::lookup(uint32_t proptag, uint32_t size_limit,
+    TPROPVAL_ARRAY *ppropvals) const
+{
+	if (!g_prop_cache) {
+		return FALSE;
+	}
+	auto it = entries.find(proptag);
+	if (it == entries.end()) {
+		return FALSE;
+	}
+	if (!it->second.b_found) {
+		return TRUE;
+	}
+	auto &data = it->second.data;
+	auto type = PROP_TYPE(proptag);
+	void *pvalue;
+	if (propcache_fixed_size(type) != 0) {
+		pvalue = common_util_alloc(data.size());
+		if (NULL == pvalue) {
+			return FALSE;
+		}
+		memcpy(pvalue, data.data(), data.size());
+	} else if (size_limit != 0 && data.size() > size_limit) {
+		return FALSE;
+	} else if (PT_BINARY == type) {
+		auto pbin = cu_alloc<BINARY>();
+		if (NULL == pbin) {
+			return FALSE;
+		}
+		pbin->cb = data.size();
+		pbin->pv = nullptr;
+		if (pbin->cb > 0) {
+			pbin->pv = common_util_alloc(pbin->cb);
+			if (pbin->pv == nullptr)
+				return FALSE;
+			memcpy(pbin->pv, data.data(), pbin->cb);
+		}
+		pvalue = pbin;
+	} else {
+		pvalue = common_util_alloc(data.size() + 1);
+		if (NULL == pvalue) {
+			return FALSE;
+		}
+		memcpy(pvalue, data.c_str(), data.size() + 1);
+	}
+	auto &pv = ppropvals->ppropval[ppropvals->count++];
+	pv.proptag = proptag;
+	pv.pvalue = pvalue;
+	return TRUE;
+}
+
+/*
+ * Remembers the outcome of an exmdb query for @pproptags: the values in
+ * @ppropvals, and as missing, every requested tag that is not in there,
+ * except for those in @pcomputed.
+ */
+void PROP_CACHE::store(const PROPTAG_ARRAY *pproptags,
+    const TPROPVAL_ARRAY *ppropvals, const uint32_t *pcomputed,
+    size_t ncomputed)
+{
+	if (!g_prop_cache) {
+		return;
+	}
+	for (size_t i = 0; i < pproptags->count; ++i) {
+		auto proptag = pproptags->pproptag[i];
+		auto type = PROP_TYPE(proptag);
+		if (!propcache_check_type(type) ||
+		    mem_used >= PROPCACHE_MAX_SIZE ||
+		    entries.find(proptag) != entries.end()) {
+			continue;
+		}
+		PROPCACHE_ENTRY entry;
+		entry.b_found = false;
+		size_t j;
+		for (j = 0; j < ppropvals->count; ++j) {
+			auto tag = ppropvals->ppropval[j].proptag;
+			if (tag == proptag || tag == CHANGE_PROP_TYPE(proptag, PT_ERROR)) {
+				break;
+			}
+		}
+		if (j == ppropvals->count &&
+		    std::find(pcomputed, pcomputed + ncomputed, proptag) !=
+		    pcomputed + ncomputed) {
+			continue;
+		} else if (j < ppropvals->count) {
+			auto &pv = ppropvals->ppropval[j];
+			if (pv.proptag != proptag || NULL == pv.pvalue) {
+				/* errors are not remembered */
+				continue;
+			}
+			entry.b_found = true;
+			auto size = propcache_fixed_size(type);
+			try {
+				if (size != 0) {
+					entry.data.assign(static_cast<const char *>(pv.pvalue), size);
+				} else if (PT_BINARY == type) {
+					auto pbin = static_cast<const BINARY *>(pv.pvalue);
+					if (pbin->cb > 0)
+						entry.data.assign(pbin->pc, pbin->cb);
+				} else {
+					entry.data = static_cast<const char *>(pv.pvalue);
+				}
+			} catch (const std::bad_alloc &) {
+				return;
+			}
+			if (mem_used + entry.data.size() > PROPCACHE_MAX_SIZE) {
+				continue;
+			}
+		}
+		mem_used += sizeof(PROPCACHE_ENTRY) + entry.data.size();
+		try {
+			entries.emplace(proptag, std::move(entry));
+		} catch (const std::bad_alloc &) {
+			return;
+		}
+	}
+}
+
+void PROP_CACHE::clear()
+{
+	entries.clear();
+	mem_used = 0;
+}
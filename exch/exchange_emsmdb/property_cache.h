@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <gromox/mapi_types.hpp>
+
+/* upper bound for the values of one object, in bytes */
+#define PROPCACHE_MAX_SIZE			0x10000
+
+struct PROPCACHE_ENTRY {
+	bool b_found;
+	std::string data;
+};
+
+/*
+ * Property values of one open message or folder, as last read from
+ * exmdb. Fixed-size, string and binary values are kept, as well as the
+ * fact that a property does not exist; other types always go to exmdb.
+ * Tags for which the owner computes a value when exmdb has none are never
+ * remembered as missing, so that the owner's fallback always gets to run.
+ * The owner clears the cache whenever the object may have changed.
+ */
+struct PROP_CACHE {
+	BOOL lookup(uint32_t proptag, uint32_t size_limit, TPROPVAL_ARRAY *ppropvals) const;
+	void store(const PROPTAG_ARRAY *pproptags, const TPROPVAL_ARRAY *ppropvals,
+	    const uint32_t *pcomputed = nullptr, size_t ncomputed = 0);
+	void clear();
+
+	std::unordered_map<uint32_t, PROPCACHE_ENTRY> entries;
+	size_t mem_used = 0;
+};
+
+extern bool g_prop_cache;
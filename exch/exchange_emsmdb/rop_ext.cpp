@@ -9,6 +9,8 @@
 #include <gromox/ext_buffer.hpp>
 #include <gromox/lzxpress.hpp>
 #include "rop_ext.h"
+
+unsigned int g_rpc_compress_level = LZXPRESS_DEFAULT;
 #define TRY(expr) do { int v = (expr); if (v != EXT_ERR_SUCCESS) return v; } while (false)
 
 static int rop_ext_push_logon_time(EXT_PUSH *pext, const LOGON_TIME *r)
@@ -3084,10 +3086,13 @@ int rop_ext_make_rpc_ext(const void *pbuff_in, uint32_t in_len,
 	rpc_header_ext.size_actual = subext.m_offset;
 	rpc_header_ext.size = rpc_header_ext.size_actual;
 	if (rpc_header_ext.flags & RHE_FLAG_COMPRESSED) {
-		if (rpc_header_ext.size_actual < MINIMUM_COMPRESS_SIZE) {
+		if (rpc_header_ext.size_actual < MINIMUM_COMPRESS_SIZE ||
+		    0 == g_rpc_compress_level) {
 			rpc_header_ext.flags &= ~RHE_FLAG_COMPRESSED;
 		} else {
-			uint32_t compressed_len = lzxpress_compress(ext_buff, subext.m_offset, tmp_buff);
+			uint32_t compressed_len = lzxpress_compress(ext_buff,
+			         subext.m_offset, tmp_buff, subext.m_offset,
+			         g_rpc_compress_level);
 			if (compressed_len == 0 || compressed_len >= subext.m_offset) {
 				/* if we can not get benefit from the
 					compression, unmask the compress bit */
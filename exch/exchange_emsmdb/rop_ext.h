@@ -3,6 +3,9 @@
 #include <gromox/ext_buffer.hpp>
 #include "processor_types.h"
 
+/* LZXPRESS_* effort for response compression, 0 to not compress */
+extern unsigned int g_rpc_compress_level;
+
 int rop_ext_pull_rop_buffer(EXT_PULL *pext, ROP_BUFFER *r);
 extern int rop_ext_make_rpc_ext(const void *pbuff_in, uint32_t in_len, const ROP_BUFFER *prop_buff, void *pbuff_out, uint32_t *pout_len);
 void rop_ext_set_rhe_flag_last(uint8_t *pdata, uint32_t last_offset);
@@ -1,9 +1,16 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <cstring>
 #include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include <gromox/defs.h>
 #include "subscription_object.h"
 #include "fastdownctx_object.h"
@@ -20,14 +27,12 @@
 #include "folder_object.h"
 #include "table_object.h"
 #include "rop_dispatch.h"
+#include "rop_ids.h"
 #include "exmdb_client.h"
 #include "common_util.h"
 #include <gromox/proc_common.h>
-#include <gromox/simple_tree.hpp>
 #include <gromox/lib_buffer.hpp>
 #include "aux_types.h"
-#include <gromox/str_hash.hpp>
-#include <gromox/int_hash.hpp>
 #include "rop_ext.h"
 #include <gromox/util.hpp>
 #include <pthread.h>
@@ -39,37 +44,60 @@
 
 #define MAX_ROP_PAYLOADS				96
 
-#define HGROWING_SIZE					250
+/*
+ * Object handles are (generation << HANDLE_SLOT_BITS) | slot index, so a
+ * lookup is an index into the logon's slot array plus a generation check,
+ * and a handle which has been released and whose slot was reused since no
+ * longer resolves.
+ */
+#define HANDLE_SLOT_BITS				20
+#define HANDLE_SLOT_MASK				((1U << HANDLE_SLOT_BITS) - 1)
+#define HANDLE_GEN_MASK					(0x7FFFFFFFU >> HANDLE_SLOT_BITS)
+#define SLOT_NONE						UINT32_MAX
 
-
-/* maximum handle number per session */
-#define MAX_HANDLE_NUM					500
+/* must be a power of two */
+#define LOGON_SHARDS					64
 
 namespace {
 
+struct OBJECT_SLOT {
+	uint32_t gen; /* bumped when the slot is freed */
+	int type; /* OBJECT_TYPE_NONE: slot is free */
+	void *pobject;
+	/* links of the handle tree; next_sibling also chains free slots */
+	uint32_t parent, first_child, next_sibling, prev_sibling;
+};
+
 struct LOGON_ITEM {
-	INT_HASH_TABLE *phash;
-	SIMPLE_TREE tree;
+	std::vector<OBJECT_SLOT> slots;
+	uint32_t free_head = SLOT_NONE, count = 0, root = SLOT_NONE;
 };
 
-struct OBJECT_NODE {
-	SIMPLE_TREE_NODE node;
-	uint32_t handle;
-	int type;
-	void *pobject;
+/* stores with at least one logon, and how many; pinged by the scan thread */
+struct LOGON_SHARD {
+	std::mutex lock;
+	std::unordered_map<std::string, uint32_t> refs;
+};
+
+struct ROP_COUNTERS {
+	std::atomic<uint64_t> count, errors, usec, max_usec, exmdb_usec;
+	std::atomic<uint64_t> latency[ROP_LATENCY_BUCKETS];
 };
 
 }
 
 static int g_scan_interval;
 static pthread_t g_scan_id;
-static int g_average_handles;
+static unsigned int g_max_handles;
 static std::atomic<bool> g_notify_stop{true};
-static std::mutex g_hash_lock;
-static STR_HASH_TABLE *g_logon_hash;
+static LOGON_SHARD g_logon_shards[LOGON_SHARDS];
+static ROP_COUNTERS g_rop_counters[256];
+/* totals of the rop_processor_proc call last made on this thread */
+static thread_local EMSMDB_SESSION_STATS g_rpc_stats;
+unsigned int g_rop_slow_threshold; /* in milliseconds, 0: no slow-ROP log */
+const uint32_t rop_latency_bounds[] =
+	{100, 300, 1000, 3000, 10000, 30000, 100000, 300000, 1000000};
 static LIB_BUFFER *g_logmap_allocator;
-static LIB_BUFFER *g_handle_allocator;
-static LIB_BUFFER *g_logitem_allocator;
 
 
 void* rop_processor_create_logmap()
@@ -83,17 +111,6 @@ void* rop_processor_create_logmap()
 	return plogmap;
 }
 
-static void rop_processor_enum_objnode(SIMPLE_TREE_NODE *pnode,
-	void *pparam)
-{
-	LOGON_ITEM *plogitem;
-	OBJECT_NODE *pobjnode;
-	
-	plogitem = (LOGON_ITEM*)pparam;
-	pobjnode = (OBJECT_NODE*)pnode->pdata;
-	int_hash_remove(plogitem->phash, pobjnode->handle);
-}
-
 static void rop_processor_free_object(void *pobject, int type)
 {
 	switch (type) {
@@ -133,67 +150,107 @@ static void rop_processor_free_object(void *pobject, int type)
 	}
 }
 
-static void rop_processor_free_objnode(SIMPLE_TREE_NODE *pnode)
+static OBJECT_SLOT *rop_processor_lookup(LOGON_ITEM *plogitem, uint32_t obj_handle)
 {
-	OBJECT_NODE *pobjnode;
+	uint32_t idx = obj_handle & HANDLE_SLOT_MASK;
 	
-	pobjnode = (OBJECT_NODE*)pnode->pdata;
-	rop_processor_free_object(pobjnode->pobject, pobjnode->type);
-	pobjnode->type = 0;
-	pobjnode->pobject = NULL;
-	lib_buffer_put(g_handle_allocator, pobjnode);
+	if (obj_handle >= 0x7FFFFFFF || idx >= plogitem->slots.size()) {
+		return nullptr;
+	}
+	auto pslot = &plogitem->slots[idx];
+	if (OBJECT_TYPE_NONE == pslot->type ||
+	    pslot->gen != obj_handle >> HANDLE_SLOT_BITS) {
+		return nullptr;
+	}
+	return pslot;
 }
 
-static void rop_processor_release_objnode(
-	LOGON_ITEM *plogitem, OBJECT_NODE *pobjnode)
+/* frees the object and puts the slot on the free list; links are left alone */
+static void rop_processor_free_slot(LOGON_ITEM *plogitem, uint32_t idx)
 {
-	BOOL b_root;
-	void *pobject;
-	uint32_t *pref;
-	SIMPLE_TREE_NODE *proot;
+	auto pslot = &plogitem->slots[idx];
+	rop_processor_free_object(pslot->pobject, pslot->type);
+	pslot->type = OBJECT_TYPE_NONE;
+	pslot->pobject = nullptr;
+	pslot->gen = (pslot->gen + 1) & HANDLE_GEN_MASK;
+	pslot->next_sibling = plogitem->free_head;
+	plogitem->free_head = idx;
+	plogitem->count --;
+}
+
+static void rop_processor_release_slot(LOGON_ITEM *plogitem, uint32_t idx)
+{
+	auto &slots = plogitem->slots;
+	auto pslot = &slots[idx];
 	
-	/* root is the logon object, free logon object
-		will cause the logon item to be released
-	*/
-	if (simple_tree_get_root(&plogitem->tree) == &pobjnode->node) {
-		proot = simple_tree_get_root(&plogitem->tree);
-		pobject = ((OBJECT_NODE*)proot->pdata)->pobject;
-		std::lock_guard hl_hold(g_hash_lock);
-		pref = static_cast<uint32_t *>(str_hash_query(g_logon_hash,
-		       static_cast<LOGON_OBJECT *>(pobject)->get_dir()));
-		if (pref != nullptr) {
-			(*pref) --;
-			if (0 == *pref) {
-				str_hash_remove(g_logon_hash, static_cast<LOGON_OBJECT *>(pobject)->get_dir());
-			}
+	/* unhook the subtree */
+	if (SLOT_NONE != pslot->prev_sibling) {
+		slots[pslot->prev_sibling].next_sibling = pslot->next_sibling;
+	} else if (SLOT_NONE != pslot->parent) {
+		slots[pslot->parent].first_child = pslot->next_sibling;
+	}
+	if (SLOT_NONE != pslot->next_sibling) {
+		slots[pslot->next_sibling].prev_sibling = pslot->prev_sibling;
+	}
+	/*
+	 * Post-order walk: descend to a leaf, free it, and go back up to its
+	 * parent, whose next child is now its first.
+	 */
+	auto cur = idx;
+	while (true) {
+		if (SLOT_NONE != slots[cur].first_child) {
+			cur = slots[cur].first_child;
+			continue;
 		}
-		b_root = TRUE;
-	} else {
-		b_root = FALSE;
-	}
-	simple_tree_enum_from_node(&pobjnode->node,
-		rop_processor_enum_objnode, plogitem);
-	simple_tree_destroy_node(&plogitem->tree,
-		&pobjnode->node, rop_processor_free_objnode);
-	if (TRUE == b_root) {
-		simple_tree_free(&plogitem->tree);
-		int_hash_free(plogitem->phash);
-		plogitem->phash = NULL;
-		lib_buffer_put(g_logitem_allocator, plogitem);
+		if (cur == idx) {
+			rop_processor_free_slot(plogitem, cur);
+			break;
+		}
+		auto parent = slots[cur].parent;
+		slots[parent].first_child = slots[cur].next_sibling;
+		rop_processor_free_slot(plogitem, cur);
+		cur = parent;
+	}
+}
+
+static LOGON_SHARD &rop_processor_shard(const char *dir)
+{
+	return g_logon_shards[std::hash<std::string_view>{}(dir) & (LOGON_SHARDS - 1)];
+}
+
+static void rop_processor_ref_store(const char *dir)
+{
+	auto &shard = rop_processor_shard(dir);
+	std::lock_guard sh_hold(shard.lock);
+	try {
+		++shard.refs[dir];
+	} catch (const std::bad_alloc &) {
+		/* the store just misses out on pings */
 	}
 }
 
+static void rop_processor_unref_store(const char *dir)
+{
+	auto &shard = rop_processor_shard(dir);
+	std::lock_guard sh_hold(shard.lock);
+	auto it = shard.refs.find(dir);
+	if (it != shard.refs.end() && --it->second == 0)
+		shard.refs.erase(it);
+}
+
 static void rop_processor_release_logon_item(LOGON_ITEM *plogitem)
 {
-	SIMPLE_TREE_NODE *proot;
-	
-	proot = simple_tree_get_root(&plogitem->tree);
-	if (NULL == proot) {
+	if (SLOT_NONE == plogitem->root) {
 		debug_info("[exchange_emsmdb]: fatal error in"
 				" rop_processor_release_logon_item\n");
-	} else {
-		rop_processor_release_objnode(plogitem, static_cast<OBJECT_NODE *>(proot->pdata));
+		delete plogitem;
+		return;
 	}
+	/* root is the logon object, freeing it releases the logon item */
+	auto plogon = static_cast<LOGON_OBJECT *>(plogitem->slots[plogitem->root].pobject);
+	rop_processor_unref_store(plogon->get_dir());
+	rop_processor_release_slot(plogitem, plogitem->root);
+	delete plogitem;
 }
 
 void rop_processor_release_logmap(void *plogmap)
@@ -213,8 +270,6 @@ int rop_processor_create_logon_item(void *plogmap,
 	uint8_t logon_id, LOGON_OBJECT *plogon)
 {
 	int handle;
-	uint32_t *pref;
-	uint32_t tmp_ref;
 	LOGON_ITEM *plogitem;
 	
 	plogitem = ((LOGON_ITEM**)plogmap)[logon_id];
@@ -223,181 +278,145 @@ int rop_processor_create_logon_item(void *plogmap,
 		rop_processor_release_logon_item(plogitem);
 		((LOGON_ITEM**)plogmap)[logon_id] = NULL;
 	}
-	plogitem = static_cast<LOGON_ITEM *>(lib_buffer_get(g_logitem_allocator));
+	plogitem = new(std::nothrow) LOGON_ITEM;
 	if (NULL == plogitem) {
 		return -1;
 	}
-	plogitem->phash = int_hash_init(HGROWING_SIZE, sizeof(OBJECT_NODE *));
-	if (NULL == plogitem->phash) {
-		lib_buffer_put(g_logitem_allocator, plogitem);
-		return -2;
-	}
-	simple_tree_init(&plogitem->tree);
 	((LOGON_ITEM**)plogmap)[logon_id] = plogitem;
 	handle = rop_processor_add_object_handle(plogmap,
 				logon_id, -1, OBJECT_TYPE_LOGON, plogon);
 	if (handle < 0) {
-		lib_buffer_put(g_logitem_allocator, plogitem);
+		((LOGON_ITEM**)plogmap)[logon_id] = NULL;
+		delete plogitem;
 		return -3;
 	}
-	std::lock_guard hl_hold(g_hash_lock);
-	pref = static_cast<uint32_t *>(str_hash_query(g_logon_hash, plogon->get_dir()));
-	if (NULL == pref) {
-		tmp_ref = 1;
-		str_hash_add(g_logon_hash, plogon->get_dir(), &tmp_ref);
-	} else {
-		(*pref) ++;
-	}
+	rop_processor_ref_store(plogon->get_dir());
 	return handle;
 }
 
 int rop_processor_add_object_handle(void *plogmap, uint8_t logon_id,
 	int parent_handle, int type, void *pobject)
 {
-	int tmp_handle;
-	INT_HASH_ITER *iter;
+	uint32_t idx;
+	uint32_t parent;
 	LOGON_ITEM *plogitem;
-	OBJECT_NODE *pobjnode;
-	OBJECT_NODE *ptmphanle;
-	OBJECT_NODE **ppparent;
 	EMSMDB_INFO *pemsmdb_info;
 	
 	plogitem = ((LOGON_ITEM**)plogmap)[logon_id];
 	if (NULL == plogitem) {
 		return -1;
 	}
-	if (simple_tree_get_nodes_num(&plogitem->tree) > MAX_HANDLE_NUM) {
+	if (plogitem->count >= g_max_handles) {
 		return -3;
 	}
 	if (parent_handle < 0) {
-		if (NULL != simple_tree_get_root(&plogitem->tree)) {
+		if (SLOT_NONE != plogitem->root) {
 			return -4;
 		}
-		ppparent = NULL;
+		parent = SLOT_NONE;
 	} else if (parent_handle >= 0 && parent_handle < 0x7FFFFFFF) {
-		ppparent = static_cast<OBJECT_NODE **>(int_hash_query(plogitem->phash, parent_handle));
-		if (NULL == ppparent) {
+		if (NULL == rop_processor_lookup(plogitem, parent_handle)) {
 			return -5;
 		}
+		parent = parent_handle & HANDLE_SLOT_MASK;
 	} else {
 		return -6;
 	}
-	pobjnode = static_cast<OBJECT_NODE *>(lib_buffer_get(g_handle_allocator));
-	if (NULL == pobjnode) {
-		return -7;
-	}
-	if (FALSE == emsmdb_interface_alloc_hanlde_number(
-		&pobjnode->handle)) {
-		return -8;
-	}
-	pobjnode->node.pdata = pobjnode;
-	pobjnode->type = type;
-	pobjnode->pobject = pobject;
-	if (1 != int_hash_add(plogitem->phash, pobjnode->handle, &pobjnode)) {
-		INT_HASH_TABLE *phash = int_hash_init(plogitem->phash->capacity +
-		                        HGROWING_SIZE, sizeof(OBJECT_NODE *));
-		if (NULL == phash) {
-			lib_buffer_put(g_handle_allocator, pobjnode);
-			return -8;
-		}
-		iter = int_hash_iter_init(plogitem->phash);
-		for (int_hash_iter_begin(iter); !int_hash_iter_done(iter);
-			int_hash_iter_forward(iter)) {
-			ptmphanle = static_cast<OBJECT_NODE *>(int_hash_iter_get_value(iter, &tmp_handle));
-			int_hash_add(phash, tmp_handle, ptmphanle);
+	auto &slots = plogitem->slots;
+	if (SLOT_NONE != plogitem->free_head) {
+		idx = plogitem->free_head;
+		plogitem->free_head = slots[idx].next_sibling;
+	} else {
+		idx = slots.size();
+		try {
+			slots.push_back(OBJECT_SLOT{});
+		} catch (const std::bad_alloc &) {
+			return -7;
 		}
-		int_hash_iter_free(iter);
-		int_hash_free(plogitem->phash);
-		plogitem->phash = phash;
-		int_hash_add(plogitem->phash, pobjnode->handle, &pobjnode);
 	}
-	if (NULL == ppparent) {
-		simple_tree_set_root(&plogitem->tree, &pobjnode->node);
+	auto pslot = &slots[idx];
+	pslot->type = type;
+	pslot->pobject = pobject;
+	pslot->parent = parent;
+	pslot->first_child = SLOT_NONE;
+	pslot->prev_sibling = SLOT_NONE;
+	if (SLOT_NONE == parent) {
+		pslot->next_sibling = SLOT_NONE;
+		plogitem->root = idx;
 	} else {
-		simple_tree_add_child(&plogitem->tree, &(*ppparent)->node,
-			&pobjnode->node, SIMPLE_TREE_ADD_LAST);
+		/* newest first; the order of siblings carries no meaning */
+		pslot->next_sibling = slots[parent].first_child;
+		if (SLOT_NONE != pslot->next_sibling)
+			slots[pslot->next_sibling].prev_sibling = idx;
+		slots[parent].first_child = idx;
 	}
+	plogitem->count ++;
 	if (OBJECT_TYPE_ICSUPCTX == type) {
 		pemsmdb_info = emsmdb_interface_get_emsmdb_info();
 		pemsmdb_info->upctx_ref ++;
 	}
-	return pobjnode->handle;
+	return (pslot->gen << HANDLE_SLOT_BITS) | idx;
 }
 
 void* rop_processor_get_object(void *plogmap,
 	uint8_t logon_id, uint32_t obj_handle, int *ptype)
 {
 	LOGON_ITEM *plogitem;
-	OBJECT_NODE **ppobjnode;
 	
-	if (obj_handle >= 0x7FFFFFFF) {
-		return NULL;
-	}
 	plogitem = ((LOGON_ITEM**)plogmap)[logon_id];
 	if (NULL == plogitem) {
 		return NULL;
 	}
-	ppobjnode = static_cast<OBJECT_NODE **>(int_hash_query(plogitem->phash, obj_handle));
-	if (NULL == ppobjnode) {
+	auto pslot = rop_processor_lookup(plogitem, obj_handle);
+	if (NULL == pslot) {
 		return NULL;
 	}
-	*ptype = (*ppobjnode)->type;
-	return (*ppobjnode)->pobject;
+	*ptype = pslot->type;
+	return pslot->pobject;
 }
 
 void rop_processor_release_object_handle(void *plogmap,
 	uint8_t logon_id, uint32_t obj_handle)
 {
 	LOGON_ITEM *plogitem;
-	OBJECT_NODE **ppobjnode;
 	EMSMDB_INFO *pemsmdb_info;
 	
-	if (obj_handle >= 0x7FFFFFFF) {
-		return;
-	}
 	plogitem = ((LOGON_ITEM**)plogmap)[logon_id];
 	if (NULL == plogitem) {
 		return;
 	}
-	ppobjnode = static_cast<OBJECT_NODE **>(int_hash_query(plogitem->phash, obj_handle));
-	if (NULL == ppobjnode) {
+	auto pslot = rop_processor_lookup(plogitem, obj_handle);
+	if (NULL == pslot) {
 		return;
 	}
-	if (OBJECT_TYPE_ICSUPCTX == (*ppobjnode)->type) {
+	if (OBJECT_TYPE_ICSUPCTX == pslot->type) {
 		pemsmdb_info = emsmdb_interface_get_emsmdb_info();
 		pemsmdb_info->upctx_ref --;
 	}
-	rop_processor_release_objnode(plogitem, *ppobjnode);
-	if (NULL == plogitem->phash) {
+	if ((obj_handle & HANDLE_SLOT_MASK) == plogitem->root) {
+		rop_processor_release_logon_item(plogitem);
 		((LOGON_ITEM**)plogmap)[logon_id] = NULL;
+		return;
 	}
+	rop_processor_release_slot(plogitem, obj_handle & HANDLE_SLOT_MASK);
 }
 
 LOGON_OBJECT* rop_processor_get_logon_object(void *plogmap, uint8_t logon_id)
 {
 	LOGON_ITEM *plogitem;
-	SIMPLE_TREE_NODE *proot;
 	
 	plogitem = ((LOGON_ITEM**)plogmap)[logon_id];
-	if (NULL == plogitem) {
-		return nullptr;
-	}
-	proot = simple_tree_get_root(&plogitem->tree);
-	if (NULL == proot) {
+	if (NULL == plogitem || SLOT_NONE == plogitem->root) {
 		return nullptr;
 	}
-	return static_cast<LOGON_OBJECT *>(static_cast<OBJECT_NODE *>(proot->pdata)->pobject);
+	return static_cast<LOGON_OBJECT *>(plogitem->slots[plogitem->root].pobject);
 }
 
 static void *emsrop_scanwork(void *param)
 {
 	int count;
-	char tmp_dir[256];
-	STR_HASH_ITER *iter;
-	DOUBLE_LIST temp_list;
-	DOUBLE_LIST_NODE *pnode;
+	std::vector<std::string> dirs;
 	
-	double_list_init(&temp_list);
 	count = 0;
 	while (!g_notify_stop) {
 		sleep(1);
@@ -408,37 +427,27 @@ static void *emsrop_scanwork(void *param)
 		} else {
 			count = 0;
 		}
-		std::unique_lock hl_hold(g_hash_lock);
-		iter = str_hash_iter_init(g_logon_hash);
-		for (str_hash_iter_begin(iter); FALSE == str_hash_iter_done(iter);
-			str_hash_iter_forward(iter)) {
-			str_hash_iter_get_value(iter, tmp_dir);
-			pnode = me_alloc<DOUBLE_LIST_NODE>();
-			if (NULL == pnode) {
-				continue;
-			}
-			pnode->pdata = strdup(tmp_dir);
-			if (NULL == pnode->pdata) {
-				free(pnode);
-				continue;
+		/* one shard at a time, pinging outside of its lock */
+		for (auto &shard : g_logon_shards) {
+			std::unique_lock sh_hold(shard.lock);
+			try {
+				dirs.reserve(shard.refs.size());
+				for (const auto &e : shard.refs)
+					dirs.push_back(e.first);
+			} catch (const std::bad_alloc &) {
 			}
-			double_list_append_as_tail(&temp_list, pnode);
-		}
-		str_hash_iter_free(iter);
-		hl_hold.unlock();
-		while ((pnode = double_list_pop_front(&temp_list)) != nullptr) {
-			exmdb_client_ping_store(static_cast<char *>(pnode->pdata));
-			free(pnode->pdata);
-			free(pnode);
+			sh_hold.unlock();
+			for (const auto &dir : dirs)
+				exmdb_client_ping_store(dir.c_str());
+			dirs.clear();
 		}
 	}
-	double_list_free(&temp_list);
 	return nullptr;
 }
 
-void rop_processor_init(int average_handles, int scan_interval)
+void rop_processor_init(unsigned int max_handles, int scan_interval)
 {
-	g_average_handles = average_handles;
+	g_max_handles = max_handles < HANDLE_SLOT_MASK ? max_handles : HANDLE_SLOT_MASK;
 	g_scan_interval = scan_interval;
 }
 
@@ -453,31 +462,13 @@ int rop_processor_run()
 		printf("[exchange_emsmdb]: Failed to init logon map allocator\n");
 		return -1;
 	}
-	g_logitem_allocator = lib_buffer_init(sizeof(LOGON_ITEM),
-									256*context_num, TRUE);
-	if (NULL == g_logitem_allocator) {
-		printf("[exchange_emsmdb]: Failed to init object map allocator\n");
-		return -2;
-	}
-	g_handle_allocator = lib_buffer_init(sizeof(OBJECT_NODE),
-							g_average_handles*context_num, TRUE);
-	if (NULL == g_handle_allocator) {
-		printf("[exchange_emsmdb]: Failed to init object handle allocator\n");
-		return -3;
-	}
-	g_logon_hash = str_hash_init(get_context_num()*256,
-								sizeof(uint32_t), NULL);
-	if (NULL == g_logon_hash) {
-		printf("[exchange_emsmdb]: Failed to init logon hash\n");
-		return -4;
-	}
 	g_notify_stop = false;
 	auto ret = pthread_create(&g_scan_id, nullptr, emsrop_scanwork, nullptr);
 	if (ret != 0) {
 		g_notify_stop = true;
 		printf("[exchange_emsmdb]: failed to create scanning thread "
-		       "for logon hash table: %s\n", strerror(ret));
-		return -5;
+		       "for logon registry: %s\n", strerror(ret));
+		return -2;
 	}
 	pthread_setname_np(g_scan_id, "rop_scan");
 	return 0;
@@ -494,19 +485,126 @@ void rop_processor_stop()
 		lib_buffer_free(g_logmap_allocator);
 		g_logmap_allocator = NULL;
 	}
-	if (NULL != g_logitem_allocator) {
-		lib_buffer_free(g_logitem_allocator);
-		g_logitem_allocator = NULL;
-	}
-	if (NULL != g_handle_allocator) {
-		lib_buffer_free(g_handle_allocator);
-		g_handle_allocator = NULL;
+	for (auto &shard : g_logon_shards)
+		shard.refs.clear();
+}
+
+static const char *rop_processor_handle_type(void *plogmap,
+	uint8_t logon_id, uint32_t handle)
+{
+	static const char *const type_names[] = {
+		"none", "logon", "folder", "message", "attachment", "table",
+		"stream", "fastdownctx", "fastupctx", "icsdownctx", "icsupctx",
+		"subscription",
+	};
+	int type = OBJECT_TYPE_NONE;
+	if (rop_processor_get_object(plogmap, logon_id, handle, &type) == nullptr ||
+	    type < 0 || static_cast<size_t>(type) >= GX_ARRAY_SIZE(type_names))
+		return "-";
+	return type_names[type];
+}
+
+static void rop_processor_log_slow(const ROP_REQUEST *req,
+	const ROP_RESPONSE *rsp, uint32_t result, uint64_t usec,
+	const uint32_t *phandles, uint8_t hnum)
+{
+	auto pinfo = emsmdb_interface_get_emsmdb_info();
+	auto pcalls = exmdb_client_get_call_stats();
+	EXMDB_CALL_STAT calls[EXMDB_CALL_KINDS];
+	char breakdown[256];
+	size_t offset = 0;
+	uint64_t other = pcalls->usec;
+	
+	std::copy(std::begin(pcalls->calls), std::end(pcalls->calls), calls);
+	std::sort(std::begin(calls), std::end(calls),
+		[](const EXMDB_CALL_STAT &a, const EXMDB_CALL_STAT &b) { return a.usec > b.usec; });
+	breakdown[0] = '\0';
+	for (const auto &e : calls) {
+		if (e.name == nullptr || offset >= sizeof(breakdown))
+			continue;
+		other -= e.usec;
+		offset += snprintf(breakdown + offset, sizeof(breakdown) - offset,
+		          "%s %s %ux %llu ms", offset == 0 ? "" : ",", e.name,
+		          e.count, static_cast<unsigned long long>(e.usec / 1000));
+	}
+	if (other >= 1000 && offset < sizeof(breakdown))
+		snprintf(breakdown + offset, sizeof(breakdown) - offset,
+		         ", other %llu ms", static_cast<unsigned long long>(other / 1000));
+	/* the output handle is only valid for a dispatched ROP */
+	auto out_hindex = rsp != nullptr && rsp->hindex < hnum ?
+	                  rsp->hindex : req->hindex;
+	auto rpc_info = get_rpc_info();
+	log_info(LV_WARN, "user=%s host=%s  slow ROP %s: %llu ms, result %xh, "
+		"handles %s/%s, exmdb %llu ms in %u calls%s%s",
+		rpc_info.username, rpc_info.client_ip, rop_idtoname(req->rop_id),
+		static_cast<unsigned long long>(usec / 1000),
+		rsp == nullptr ? result : rsp->result,
+		rop_processor_handle_type(pinfo->plogmap, req->logon_id, phandles[req->hindex]),
+		rop_processor_handle_type(pinfo->plogmap, req->logon_id, phandles[out_hindex]),
+		static_cast<unsigned long long>(pcalls->usec / 1000), pcalls->count,
+		offset > 0 ? ":" : "", breakdown);
+}
+
+/*
+ * @rsp is the response of rop_dispatch, or NULL when dispatching failed
+ * (in which case no response, or only a partially filled one, exists).
+ */
+static void rop_processor_account(const ROP_REQUEST *req,
+	const ROP_RESPONSE *rsp, uint32_t result, uint64_t usec,
+	const uint32_t *phandles, uint8_t hnum)
+{
+	auto &c = g_rop_counters[req->rop_id];
+	auto exmdb_usec = exmdb_client_get_call_stats()->usec;
+	size_t bucket = std::lower_bound(std::begin(rop_latency_bounds),
+	                std::end(rop_latency_bounds), usec) - std::begin(rop_latency_bounds);
+	
+	c.count.fetch_add(1, std::memory_order_relaxed);
+	if (rsp == nullptr || rsp->result != ecSuccess)
+		c.errors.fetch_add(1, std::memory_order_relaxed);
+	c.usec.fetch_add(usec, std::memory_order_relaxed);
+	c.exmdb_usec.fetch_add(exmdb_usec, std::memory_order_relaxed);
+	c.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+	auto max = c.max_usec.load(std::memory_order_relaxed);
+	while (usec > max && !c.max_usec.compare_exchange_weak(max, usec,
+	       std::memory_order_relaxed))
+		/* retry */;
+	g_rpc_stats.rops ++;
+	g_rpc_stats.usec += usec;
+	g_rpc_stats.exmdb_usec += exmdb_usec;
+	if (0 == g_rop_slow_threshold ||
+	    usec < static_cast<uint64_t>(g_rop_slow_threshold) * 1000) {
+		return;
 	}
-	if (NULL != g_logon_hash) {
-		str_hash_free(g_logon_hash);
+	g_rpc_stats.slow_rops ++;
+	rop_processor_log_slow(req, rsp, result, usec, phandles, hnum);
+}
+
+void rop_processor_get_rop_stats(uint8_t rop_id, ROP_STATS *pstats)
+{
+	auto &c = g_rop_counters[rop_id];
+	pstats->count = c.count.load(std::memory_order_relaxed);
+	pstats->errors = c.errors.load(std::memory_order_relaxed);
+	pstats->usec = c.usec.load(std::memory_order_relaxed);
+	pstats->max_usec = c.max_usec.load(std::memory_order_relaxed);
+	pstats->exmdb_usec = c.exmdb_usec.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < ROP_LATENCY_BUCKETS; ++i)
+		pstats->latency[i] = c.latency[i].load(std::memory_order_relaxed);
+}
+
+void rop_processor_reset_rop_stats()
+{
+	for (auto &c : g_rop_counters) {
+		c.count = c.errors = c.usec = c.max_usec = c.exmdb_usec = 0;
+		for (auto &l : c.latency)
+			l = 0;
 	}
 }
 
+void rop_processor_get_rpc_stats(EMSMDB_SESSION_STATS *pstats)
+{
+	*pstats = g_rpc_stats;
+}
+
 static int rop_processor_execute_and_push(uint8_t *pbuff,
 	uint32_t *pbuff_len, ROP_BUFFER *prop_buff,
 	BOOL b_notify, DOUBLE_LIST *presponse_list)
@@ -552,16 +650,18 @@ static int rop_processor_execute_and_push(uint8_t *pbuff,
 		}
 		emsmdb_interface_set_rop_left(tmp_len - ext_push.m_offset);
 		auto req = static_cast<ROP_REQUEST *>(pnode->pdata);
+		exmdb_client_reset_call_stats();
+		auto start = std::chrono::steady_clock::now();
 		result = rop_dispatch(req, reinterpret_cast<ROP_RESPONSE **>(&pnode1->pdata),
 				prop_buff->phandles, prop_buff->hnum);
+		if (req->hindex < prop_buff->hnum)
+			rop_processor_account(req, result == ecSuccess ?
+				static_cast<ROP_RESPONSE *>(pnode1->pdata) : nullptr,
+				result, std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count(),
+				prop_buff->phandles, prop_buff->hnum);
 		switch (result) {
 		case ecSuccess:
-			/* disable compression when RopReadStream
-				RopFastTransferSourceGetBuffer success.
-				in many cases, lzxpress will make buffer inflate! */
-			if (req->rop_id == ropReadStream ||
-			    req->rop_id == ropFastTransferSourceGetBuffer)
-				prop_buff->rhe_flags &= ~RHE_FLAG_COMPRESSED;
 			break;
 		case ecBufferTooSmall: {
 			auto rsp = static_cast<ROP_RESPONSE *>(pnode1->pdata);
@@ -714,6 +814,7 @@ uint32_t rop_processor_proc(uint32_t flags, const uint8_t *pin,
 	DOUBLE_LIST_NODE *pnode1;
 	DOUBLE_LIST response_list;
 	
+	g_rpc_stats = {};
 	ext_pull.init(pin, cb_in, common_util_alloc, EXT_FLAG_UTF16);
 	switch(rop_ext_pull_rop_buffer(&ext_pull, &rop_buff)) {
 	case EXT_ERR_SUCCESS:
@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <ctime>
+#include "emsmdb_interface.h"
 #include "logon_object.h"
 #include <gromox/mapi_types.hpp>
 #define OBJECT_TYPE_NONE					0
@@ -16,9 +17,21 @@
 #define OBJECT_TYPE_ICSUPCTX				10
 #define OBJECT_TYPE_SUBSCRIPTION			11
 
+#define ROP_LATENCY_BUCKETS				10
+
+/* lifetime counters of one ROP id */
+struct ROP_STATS {
+	uint64_t count, errors, usec, max_usec, exmdb_usec;
+	uint64_t latency[ROP_LATENCY_BUCKETS];
+};
+
+/* upper bounds of all but the last latency bucket, in microseconds */
+extern const uint32_t rop_latency_bounds[ROP_LATENCY_BUCKETS-1];
+extern unsigned int g_rop_slow_threshold;
+
 extern void *rop_processor_create_logmap();
 void rop_processor_release_logmap(void *plogmap);
-void rop_processor_init(int average_handles, int scan_interval);
+void rop_processor_init(unsigned int max_handles, int scan_interval);
 extern int rop_processor_run();
 extern void rop_processor_stop();
 uint32_t rop_processor_proc(uint32_t flags, const uint8_t *pin,
@@ -32,3 +45,6 @@ void* rop_processor_get_object(void *plogmap,
 void rop_processor_release_object_handle(void *plogmap,
 	uint8_t logon_id, uint32_t obj_handle);
 LOGON_OBJECT* rop_processor_get_logon_object(void *plogmap, uint8_t logon_id);
+extern void rop_processor_get_rop_stats(uint8_t rop_id, ROP_STATS *);
+extern void rop_processor_reset_rop_stats();
+extern void rop_processor_get_rpc_stats(EMSMDB_SESSION_STATS *);
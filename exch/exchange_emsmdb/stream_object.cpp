@@ -13,9 +13,133 @@
 #include "folder_object.h"
 #include "message_object.h"
 #include "attachment_object.h"
+#include "exmdb_client.h"
 #include <cstdlib>
 #include <cstring>
 #define STREAM_INIT_BUFFER_LENGTH						4096
+#define STREAM_RANGE_THRESHOLD							(256 * 1024)
+#define STREAM_READAHEAD_SIZE							(1024 * 1024)
+
+/*
+ * Read-only binary streams of messages and attachments whose value is
+ * larger than STREAM_RANGE_THRESHOLD are read from the store in blocks of
+ * STREAM_READAHEAD_SIZE as the client asks for them, instead of copying
+ * the whole value into the stream object when it is opened.
+ */
+static BOOL stream_object_rangeable(const STREAM_OBJECT *pstream)
+{
+	DOUBLE_LIST *pstream_list;
+	
+	if (OPENSTREAM_FLAG_READONLY != pstream->open_flags) {
+		return FALSE;
+	}
+	switch (PROP_TYPE(pstream->proptag)) {
+	case PT_BINARY:
+	case PT_OBJECT:
+		break;
+	default:
+		return FALSE;
+	}
+	if (OBJECT_TYPE_MESSAGE == pstream->object_type)
+		pstream_list = &static_cast<MESSAGE_OBJECT *>(pstream->pparent)->stream_list;
+	else if (OBJECT_TYPE_ATTACHMENT == pstream->object_type)
+		pstream_list = &static_cast<ATTACHMENT_OBJECT *>(pstream->pparent)->stream_list;
+	else
+		return FALSE;
+	/* writes of other open streams are not in the store yet */
+	return double_list_get_nodes_num(pstream_list) == 0 ? TRUE : false;
+}
+
+static BOOL stream_object_fetch(const STREAM_OBJECT *pstream,
+	uint32_t offset, uint32_t length, uint32_t *ptotal, BINARY *pbin)
+{
+	BOOL b_found;
+	const char *dir;
+	uint32_t instance_id;
+	
+	if (OBJECT_TYPE_MESSAGE == pstream->object_type) {
+		auto pmessage = static_cast<MESSAGE_OBJECT *>(pstream->pparent);
+		dir = pmessage->plogon->get_dir();
+		instance_id = pmessage->instance_id;
+	} else {
+		auto pattachment = static_cast<ATTACHMENT_OBJECT *>(pstream->pparent);
+		dir = pattachment->pparent->plogon->get_dir();
+		instance_id = pattachment->instance_id;
+	}
+	if (!exmdb_client_read_instance_property_range(dir, instance_id,
+	    pstream->proptag, offset, length, &b_found, ptotal, pbin) ||
+	    FALSE == b_found || pbin->cb > length) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Read one block starting at @offset into the read-ahead buffer. */
+static BOOL stream_object_fill_range(STREAM_OBJECT *pstream,
+	uint32_t offset, uint32_t *ptotal)
+{
+	BINARY tmp_bin;
+	uint32_t total;
+	
+	if (!stream_object_fetch(pstream, offset,
+	    STREAM_READAHEAD_SIZE, &total, &tmp_bin)) {
+		return FALSE;
+	}
+	try {
+		pstream->ra_buf.assign(tmp_bin.pb, tmp_bin.pb + tmp_bin.cb);
+	} catch (const std::bad_alloc &) {
+		return FALSE;
+	}
+	pstream->ra_offset = offset;
+	if (NULL != ptotal) {
+		*ptotal = total;
+	}
+	return TRUE;
+}
+
+/* The value was too large for the regular open; switch to ranged reads. */
+static BOOL stream_object_probe_range(STREAM_OBJECT *pstream)
+{
+	uint32_t total;
+	
+	if (!stream_object_fill_range(pstream, 0, &total)) {
+		return FALSE;
+	}
+	pstream->b_ranged = TRUE;
+	pstream->content_bin.cb = total;
+	return TRUE;
+}
+
+static uint32_t stream_object_read_range(STREAM_OBJECT *pstream,
+	void *pbuff, uint32_t offset, uint32_t length)
+{
+	BINARY tmp_bin;
+	uint32_t total;
+	uint32_t done = 0;
+	auto pdst = static_cast<uint8_t *>(pbuff);
+	
+	while (done < length) {
+		uint32_t pos = offset + done;
+		if (pos >= pstream->ra_offset &&
+		    pos - pstream->ra_offset < pstream->ra_buf.size()) {
+			auto avail = pstream->ra_buf.size() - (pos - pstream->ra_offset);
+			uint32_t count = std::min(static_cast<size_t>(length - done), avail);
+			memcpy(pdst + done, &pstream->ra_buf[pos - pstream->ra_offset], count);
+			done += count;
+		} else if (length - done >= STREAM_READAHEAD_SIZE) {
+			/* large reads (e.g. get_content) go around the buffer */
+			if (!stream_object_fetch(pstream, pos, length - done,
+			    &total, &tmp_bin) || 0 == tmp_bin.cb)
+				break;
+			memcpy(pdst + done, tmp_bin.pv, tmp_bin.cb);
+			done += tmp_bin.cb;
+		} else if (!stream_object_fill_range(pstream, pos, nullptr) ||
+		    pstream->ra_buf.empty()) {
+			break;
+		}
+	}
+	return done;
+}
 
 std::unique_ptr<STREAM_OBJECT> stream_object_create(void *pparent, int object_type,
 	uint32_t open_flags, uint32_t proptag, uint32_t max_length)
@@ -40,13 +164,16 @@ std::unique_ptr<STREAM_OBJECT> stream_object_create(void *pparent, int object_ty
 	pstream->seek_ptr = 0;
 	pstream->max_length = max_length;
 	pstream->b_touched = FALSE;
+	/* values above the threshold come back as ecMAPIOOM */
+	uint32_t size_limit = stream_object_rangeable(pstream.get()) ?
+	                      STREAM_RANGE_THRESHOLD : 0;
 	switch (object_type) {
 	case OBJECT_TYPE_MESSAGE:
 		proptags.count = 2;
 		proptags.pproptag = proptag_buff;
-		proptag_buff[0] = proptag;
-		proptag_buff[1] = PR_MESSAGE_SIZE;
-		if (!static_cast<MESSAGE_OBJECT *>(pparent)->get_properties(0, &proptags, &propvals))
+		proptag_buff[0] = PR_MESSAGE_SIZE;
+		proptag_buff[1] = proptag;
+		if (!static_cast<MESSAGE_OBJECT *>(pparent)->get_properties(size_limit, &proptags, &propvals))
 			return NULL;
 		psize = static_cast<uint32_t *>(common_util_get_propvals(&propvals, PR_MESSAGE_SIZE));
 		if (NULL != psize && *psize >= common_util_get_param(
@@ -57,9 +184,9 @@ std::unique_ptr<STREAM_OBJECT> stream_object_create(void *pparent, int object_ty
 	case OBJECT_TYPE_ATTACHMENT:
 		proptags.count = 2;
 		proptags.pproptag = proptag_buff;
-		proptag_buff[0] = proptag;
-		proptag_buff[1] = PROP_TAG_ATTACHSIZE;
-		if (!static_cast<ATTACHMENT_OBJECT *>(pparent)->get_properties(0, &proptags, &propvals))
+		proptag_buff[0] = PROP_TAG_ATTACHSIZE;
+		proptag_buff[1] = proptag;
+		if (!static_cast<ATTACHMENT_OBJECT *>(pparent)->get_properties(size_limit, &proptags, &propvals))
 			return NULL;
 		psize = static_cast<uint32_t *>(common_util_get_propvals(
 		        &propvals, PROP_TAG_ATTACHSIZE));
@@ -77,6 +204,15 @@ std::unique_ptr<STREAM_OBJECT> stream_object_create(void *pparent, int object_ty
 	default:
 		return NULL;
 	}
+	if (0 != size_limit && NULL == common_util_get_propvals(&propvals, proptag)) {
+		auto perr = static_cast<uint32_t *>(common_util_get_propvals(
+		            &propvals, CHANGE_PROP_TYPE(proptag, PT_ERROR)));
+		if (NULL != perr && ecMAPIOOM == *perr) {
+			if (!stream_object_probe_range(pstream.get()))
+				return NULL;
+			return pstream;
+		}
+	}
 	auto pvalue = common_util_get_propvals(&propvals, proptag);
 	if (NULL == pvalue) {
 		if (0 == (open_flags & OPENSTREAM_FLAG_CREATE)) {
@@ -143,6 +279,12 @@ uint32_t STREAM_OBJECT::read(void *pbuff, uint32_t buf_len)
 		return 0;
 	}
 	auto length = std::min(buf_len, pstream->content_bin.cb - pstream->seek_ptr);
+	if (TRUE == pstream->b_ranged) {
+		length = stream_object_read_range(pstream,
+		         pbuff, pstream->seek_ptr, length);
+		pstream->seek_ptr += length;
+		return length;
+	}
 	memcpy(pbuff, pstream->content_bin.pb + pstream->seek_ptr, length);
 	pstream->seek_ptr += length;
 	return length;
@@ -185,8 +327,22 @@ void *STREAM_OBJECT::get_content()
 	uint32_t length;
 	
 	switch (PROP_TYPE(pstream->proptag)) {
-	case PT_BINARY:
-		return &pstream->content_bin;
+	case PT_BINARY: {
+		if (FALSE == pstream->b_ranged) {
+			return &pstream->content_bin;
+		}
+		auto pbin = cu_alloc<BINARY>();
+		if (NULL == pbin) {
+			return NULL;
+		}
+		pbin->cb = pstream->content_bin.cb;
+		pbin->pv = common_util_alloc(pbin->cb);
+		if (pbin->pv == nullptr || stream_object_read_range(pstream,
+		    pbin->pv, 0, pbin->cb) != pbin->cb) {
+			return NULL;
+		}
+		return pbin;
+	}
 	case PT_STRING8:
 		return pstream->content_bin.pb;
 	case PT_UNICODE:
@@ -280,6 +436,17 @@ BOOL STREAM_OBJECT::copy(STREAM_OBJECT *pstream_src, uint32_t *plength)
 		if (!pstream_dst->set_length(pstream_dst->seek_ptr + *plength))
 			return FALSE;	
 	}
+	if (TRUE == pstream_dst->b_ranged) {
+		return FALSE;
+	}
+	if (TRUE == pstream_src->b_ranged) {
+		if (pstream_src->read(pstream_dst->content_bin.pb +
+		    pstream_dst->seek_ptr, *plength) != *plength) {
+			return FALSE;
+		}
+		pstream_dst->seek_ptr += *plength;
+		return TRUE;
+	}
 	memcpy(pstream_dst->content_bin.pb +
 		pstream_dst->seek_ptr,
 		pstream_src->content_bin.pb +
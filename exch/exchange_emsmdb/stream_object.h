@@ -1,13 +1,14 @@
 #pragma once
 #include <cstdint>
 #include <memory>
+#include <vector>
 #include <gromox/mapi_types.hpp>
 
 #define MAX_LENGTH_FOR_FOLDER						64*1024
 
 struct STREAM_OBJECT {
 	~STREAM_OBJECT();
-	BOOL check() const { return content_bin.pb != nullptr ? TRUE : false; }
+	BOOL check() const { return content_bin.pb != nullptr || b_ranged ? TRUE : false; }
 	uint32_t get_max_length() const { return max_length; }
 	uint32_t read(void *buf, uint32_t len);
 	uint16_t write(void *buf, uint16_t len);
@@ -29,6 +30,11 @@ struct STREAM_OBJECT {
 	BINARY content_bin{};
 	BOOL b_touched = false;
 	uint32_t max_length = 0;
+	/* content stays in the store; content_bin.cb is its length */
+	BOOL b_ranged = false;
+	/* the block of a ranged stream read last, starting at ra_offset */
+	std::vector<uint8_t> ra_buf;
+	uint32_t ra_offset = 0;
 };
 
 extern std::unique_ptr<STREAM_OBJECT> stream_object_create(void *parent, int object_type, uint32_t open_flags, uint32_t proptag, uint32_t max_length);
@@ -1,12 +1,16 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 // SPDX-FileCopyrightText: 2020–2021 grommunio GmbH
 // This file is part of Gromox.
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <climits>
 #include <cstdint>
+#include <mutex>
 #include <new>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <libHX/string.h>
 #include <gromox/defs.h>
 #include <gromox/mapidefs.h>
@@ -18,11 +22,13 @@
 #include <gromox/scope.hpp>
 #include <gromox/ext_buffer.hpp>
 #include "common_util.h"
+#include "db_engine.h"
 #include "exmdb_server.h"
 #include <gromox/alloc_context.hpp>
 #include <gromox/database.h>
 #include <gromox/fileio.h>
 #include <gromox/svc_common.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <pthread.h>
@@ -31,11 +37,17 @@
 #include <fcntl.h>
 #include <cstdio>
 #include <iconv.h>
+#ifdef __linux__
+#	include <linux/fs.h>
+#endif
 #define UI(x) static_cast<unsigned int>(x)
 #define LLD(x) static_cast<long long>(x)
 #define LLU(x) static_cast<unsigned long long>(x)
 #define S2A(x) reinterpret_cast<const char *>(x)
 
+/* number of cids reserved in CONFIG_ID_LAST_CID at a time */
+#define CID_RESERVE_SIZE									128
+
 #define SERVICE_ID_LANG_TO_CHARSET							1
 #define SERVICE_ID_CPID_TO_CHARSET							2
 #define SERVICE_ID_GET_USER_DISPLAYNAME						3
@@ -537,10 +549,444 @@ BOOL common_util_check_allocated_eid(sqlite3 *psqlite,
 	return TRUE;
 }
 
+/*
+ * A rolled back transaction may have added named properties or changed
+ * counts and the folder tree; look at the database again. The cid range
+ * is kept: cids that were handed out in that transaction must not be
+ * given out again (their content files may still be reclaimed), and
+ * common_util_allocate_cid is told to check whether the rollback undid
+ * its reservation.
+ */
+static void common_util_db_cache_rollback(void *pcache)
+{
+	auto c = static_cast<DB_CACHE *>(pcache);
+	c->b_names = false;
+	c->name_to_id.clear();
+	c->id_to_name.clear();
+	c->b_store_counts = false;
+	c->folder_counts.clear();
+	c->b_tree = false;
+	c->tree.clear();
+	c->b_cid_stale = true;
+}
+
+/*
+ * The cache of the DB_ITEM that @psqlite belongs to, or @ptmp if the
+ * calling thread did not get the store through db_engine_get_db. @ptmp is
+ * an empty cache of the caller's, so that everything is read from SQL.
+ */
+static DB_CACHE *common_util_db_cache(sqlite3 *psqlite, DB_CACHE *ptmp)
+{
+	auto pcache = db_engine_get_cache(psqlite);
+	return pcache != nullptr ? pcache : ptmp;
+}
+
+/*
+ * SQL function msg_count(parent_fid, is_associated, flag, delta). flag is
+ * read_state in private stores and is_deleted in public stores.
+ */
+static void common_util_msg_count(sqlite3_context *pctx,
+	int argc, sqlite3_value **argv)
+{
+	auto c = static_cast<DB_CACHE *>(sqlite3_user_data(pctx));
+	int delta = sqlite3_value_int(argv[3]);
+	
+	if (sqlite3_value_type(argv[1]) == SQLITE_NULL)
+		return;
+	if (c->stmt_changes < 0)
+		c->stmt_changes = sqlite3_total_changes(sqlite3_context_db_handle(pctx));
+	bool b_assoc = sqlite3_value_int64(argv[1]) != 0;
+	bool b_flag = sqlite3_value_type(argv[2]) == SQLITE_NULL ||
+	              sqlite3_value_int64(argv[2]) != 0;
+	if (c->b_store_counts)
+		(b_assoc ? c->store_assoc : c->store_normal) += delta;
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+		return;
+	auto it = c->folder_counts.find(sqlite3_value_int64(argv[0]));
+	if (it == c->folder_counts.end() || it->second.b_search)
+		return;
+	auto &f = it->second;
+	if (!c->b_private && b_flag)
+		return;
+	try {
+		c->stmt_fids.push_back(it->first);
+	} catch (const std::bad_alloc &) {
+		/* could not be discarded later; read it again instead */
+		c->folder_counts.erase(it);
+		return;
+	}
+	if (b_assoc) {
+		f.assoc += delta;
+		return;
+	}
+	f.normal += delta;
+	if (c->b_private && !b_flag)
+		f.unread += delta;
+}
+
+/* SQL function folder_changed(deleted_folder_id) */
+static void common_util_folder_changed(sqlite3_context *pctx,
+	int argc, sqlite3_value **argv)
+{
+	auto c = static_cast<DB_CACHE *>(sqlite3_user_data(pctx));
+	
+	c->b_tree = false;
+	c->tree.clear();
+	if (sqlite3_value_type(argv[0]) != SQLITE_NULL)
+		c->folder_counts.erase(sqlite3_value_int64(argv[0]));
+}
+
+/*
+ * Trace callback, run when a top-level statement has finished. If the
+ * counter functions ran during it but the statement did not add to the
+ * change count, it failed and SQLite undid its rows, while the counters
+ * kept the deltas: the store totals and the folders touched are read
+ * from SQL again. (A rollback of the whole transaction is handled by
+ * common_util_db_cache_rollback.)
+ */
+static int common_util_stmt_done(unsigned int type, void *pcache,
+	void *pstmt, void *)
+{
+	auto c = static_cast<DB_CACHE *>(pcache);
+	
+	if (c->stmt_changes < 0)
+		return 0;
+	auto psqlite = sqlite3_db_handle(static_cast<sqlite3_stmt *>(pstmt));
+	if (sqlite3_total_changes(psqlite) == c->stmt_changes) {
+		c->b_store_counts = false;
+		for (auto fid : c->stmt_fids)
+			c->folder_counts.erase(fid);
+	}
+	c->stmt_fids.clear();
+	c->stmt_changes = -1;
+	return 0;
+}
+
+/*
+ * Called once after a mailbox database has been opened. Besides creating
+ * the cache, this installs temporary (per-connection) triggers which keep
+ * the message counters and the folder tree current, whichever code path
+ * modifies messages or folders.
+ */
+void common_util_init_db_cache(sqlite3 *psqlite, DB_CACHE *pcache,
+	BOOL b_private)
+{
+	char sql_string[1536];
+	const char *flag = b_private ? "read_state" : "is_deleted";
+	
+	sqlite3_rollback_hook(psqlite, common_util_db_cache_rollback, pcache);
+	pcache->b_private = b_private;
+	if (SQLITE_OK != sqlite3_create_function(psqlite, "msg_count", 4,
+	    SQLITE_UTF8, pcache, common_util_msg_count, nullptr, nullptr) ||
+	    SQLITE_OK != sqlite3_create_function(psqlite, "folder_changed", 1,
+	    SQLITE_UTF8, pcache, common_util_folder_changed, nullptr, nullptr)) {
+		fprintf(stderr, "W-1523: cannot register counter functions: %s\n",
+		        sqlite3_errmsg(psqlite));
+		return;
+	}
+	snprintf(sql_string, arsizeof(sql_string),
+		"CREATE TEMP TRIGGER messages_count_ins AFTER INSERT ON messages"
+		" BEGIN SELECT msg_count(new.parent_fid, new.is_associated, new.%s, 1); END;"
+		"CREATE TEMP TRIGGER messages_count_del AFTER DELETE ON messages"
+		" BEGIN SELECT msg_count(old.parent_fid, old.is_associated, old.%s, -1); END;"
+		"CREATE TEMP TRIGGER messages_count_upd AFTER UPDATE OF"
+		" parent_fid, is_associated, %s ON messages BEGIN"
+		" SELECT msg_count(old.parent_fid, old.is_associated, old.%s, -1);"
+		" SELECT msg_count(new.parent_fid, new.is_associated, new.%s, 1); END;"
+		"CREATE TEMP TRIGGER folders_tree_ins AFTER INSERT ON folders"
+		" BEGIN SELECT folder_changed(NULL); END;"
+		"CREATE TEMP TRIGGER folders_tree_del AFTER DELETE ON folders"
+		" BEGIN SELECT folder_changed(old.folder_id); END;"
+		"CREATE TEMP TRIGGER folders_tree_upd AFTER UPDATE OF parent_id%s"
+		" ON folders BEGIN SELECT folder_changed(NULL); END",
+		flag, flag, flag, flag, flag, b_private ? "" : ", is_deleted");
+	if (SQLITE_OK != sqlite3_exec(psqlite, sql_string, nullptr, nullptr, nullptr)) {
+		fprintf(stderr, "W-1524: cannot install counter triggers: %s\n",
+		        sqlite3_errmsg(psqlite));
+		return;
+	}
+	sqlite3_trace_v2(psqlite, SQLITE_TRACE_PROFILE, common_util_stmt_done, pcache);
+	pcache->b_counting = true;
+}
+
+static BOOL common_util_count_folder(sqlite3 *psqlite, const DB_CACHE *c,
+	uint64_t folder_id, FOLDER_COUNTS *pcounts)
+{
+	char sql_string[256];
+	
+	*pcounts = {};
+	if (c->b_private && PRIVATE_FID_ROOT != folder_id) {
+		snprintf(sql_string, arsizeof(sql_string), "SELECT is_search "
+		          "FROM folders WHERE folder_id=%llu", LLU(folder_id));
+		auto pstmt = gx_sql_prep(psqlite, sql_string);
+		if (pstmt == nullptr || sqlite3_step(pstmt) != SQLITE_ROW)
+			return FALSE;
+		pcounts->b_search = sqlite3_column_int64(pstmt, 0) != 0;
+		if (pcounts->b_search)
+			return TRUE;
+	}
+	if (c->b_private)
+		snprintf(sql_string, arsizeof(sql_string), "SELECT "
+			"sum(is_associated=0), sum(is_associated=1), "
+			"sum(is_associated=0 AND read_state=0) FROM messages"
+			" WHERE parent_fid=%llu", LLU(folder_id));
+	else
+		snprintf(sql_string, arsizeof(sql_string), "SELECT "
+			"sum(is_associated=0), sum(is_associated=1), 0 FROM"
+			" messages WHERE parent_fid=%llu AND is_deleted=0",
+			LLU(folder_id));
+	auto pstmt = gx_sql_prep(psqlite, sql_string);
+	if (pstmt == nullptr || sqlite3_step(pstmt) != SQLITE_ROW)
+		return FALSE;
+	pcounts->normal = sqlite3_column_int64(pstmt, 0);
+	pcounts->assoc = sqlite3_column_int64(pstmt, 1);
+	pcounts->unread = sqlite3_column_int64(pstmt, 2);
+	return TRUE;
+}
+
+static BOOL common_util_count_store(sqlite3 *psqlite,
+	uint32_t *pnormal, uint32_t *passoc)
+{
+	auto pstmt = gx_sql_prep(psqlite, "SELECT sum(is_associated=0),"
+	             " sum(is_associated=1) FROM messages");
+	if (pstmt == nullptr || sqlite3_step(pstmt) != SQLITE_ROW)
+		return FALSE;
+	*pnormal = sqlite3_column_int64(pstmt, 0);
+	*passoc = sqlite3_column_int64(pstmt, 1);
+	return TRUE;
+}
+
+/* NULL: not available, count in SQL instead */
+static const FOLDER_COUNTS *common_util_get_folder_counts(
+	sqlite3 *psqlite, uint64_t folder_id)
+{
+	FOLDER_COUNTS counts;
+	DB_CACHE tmp_cache;
+	auto c = common_util_db_cache(psqlite, &tmp_cache);
+	
+	if (!c->b_counting)
+		return nullptr;
+	auto it = c->folder_counts.find(folder_id);
+	if (it != c->folder_counts.end())
+		return it->second.b_search ? nullptr : &it->second;
+	if (FALSE == common_util_count_folder(psqlite, c, folder_id, &counts))
+		return nullptr;
+	try {
+		it = c->folder_counts.emplace(folder_id, counts).first;
+	} catch (const std::bad_alloc &) {
+		return nullptr;
+	}
+	return it->second.b_search ? nullptr : &it->second;
+}
+
+static uint32_t common_util_descendants(
+	std::unordered_map<uint64_t, FOLDER_NODE> &tree, FOLDER_NODE &node)
+{
+	node.descendants = 0;
+	for (auto fid : node.children) {
+		auto it = tree.find(fid);
+		if (it != tree.end())
+			node.descendants += common_util_descendants(tree, it->second) + 1;
+	}
+	return node.descendants;
+}
+
+/* NULL: not available, walk the folders table instead */
+static const std::unordered_map<uint64_t, FOLDER_NODE> *
+common_util_get_folder_tree(sqlite3 *psqlite)
+{
+	DB_CACHE tmp_cache;
+	auto c = common_util_db_cache(psqlite, &tmp_cache);
+	
+	if (!c->b_counting)
+		return nullptr;
+	if (c->b_tree)
+		return &c->tree;
+	auto pstmt = gx_sql_prep(psqlite, c->b_private ?
+	             "SELECT folder_id, parent_id, 0 FROM folders" :
+	             "SELECT folder_id, parent_id, is_deleted FROM folders");
+	if (pstmt == nullptr)
+		return nullptr;
+	c->tree.clear();
+	try {
+		while (SQLITE_ROW == sqlite3_step(pstmt)) {
+			auto &node = c->tree[sqlite3_column_int64(pstmt, 0)];
+			node.parent_id = sqlite3_column_int64(pstmt, 1);
+			node.b_deleted = sqlite3_column_int64(pstmt, 2) != 0;
+		}
+		for (auto &e : c->tree) {
+			auto it = c->tree.find(e.second.parent_id);
+			if (it != c->tree.end() && it->first != e.first)
+				it->second.children.push_back(e.first);
+		}
+	} catch (const std::bad_alloc &) {
+		c->tree.clear();
+		return nullptr;
+	}
+	for (auto &e : c->tree) {
+		/* same order as a parent_id lookup in SQL yields */
+		std::sort(e.second.children.begin(), e.second.children.end());
+		auto it = c->tree.find(e.second.parent_id);
+		if (it == c->tree.end() || it->first == e.first)
+			common_util_descendants(c->tree, e.second);
+	}
+	c->b_tree = true;
+	return &c->tree;
+}
+
+/*
+ * Direct subfolders of @folder_id, in folder_id order, from the cached
+ * folder tree. @deleted selects soft-deleted (1) or live (0) folders of
+ * public stores; -1 takes both. Returns FALSE if the tree is unavailable,
+ * in which case the caller has to ask SQL.
+ */
+BOOL common_util_get_subfolders(sqlite3 *psqlite, uint64_t folder_id,
+	int deleted, std::vector<uint64_t> &fids)
+{
+	auto ptree = common_util_get_folder_tree(psqlite);
+	if (NULL == ptree) {
+		return FALSE;
+	}
+	fids.clear();
+	auto it = ptree->find(folder_id);
+	if (it == ptree->end()) {
+		return TRUE;
+	}
+	try {
+		for (auto fid : it->second.children) {
+			auto it1 = ptree->find(fid);
+			if (it1 == ptree->end() || (deleted >= 0 &&
+			    it1->second.b_deleted != (deleted != 0)))
+				continue;
+			fids.push_back(fid);
+		}
+	} catch (const std::bad_alloc &) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Recount every cached folder and the store totals in SQL and compare.
+ * Mismatches are logged and corrected; returns their number, or -1.
+ */
+int common_util_verify_db_cache(sqlite3 *psqlite)
+{
+	int mismatches = 0;
+	FOLDER_COUNTS counts;
+	uint32_t normal, assoc;
+	DB_CACHE tmp_cache;
+	auto c = common_util_db_cache(psqlite, &tmp_cache);
+	
+	if (!c->b_counting)
+		return -1;
+	if (c->b_store_counts) {
+		if (FALSE == common_util_count_store(psqlite, &normal, &assoc))
+			return -1;
+		if (normal != c->store_normal || assoc != c->store_assoc) {
+			fprintf(stderr, "W-1525: store counters were %u/%u,"
+			        " actual %u/%u\n", c->store_normal,
+			        c->store_assoc, normal, assoc);
+			c->store_normal = normal;
+			c->store_assoc = assoc;
+			mismatches ++;
+		}
+	}
+	for (auto it = c->folder_counts.begin(); it != c->folder_counts.end(); ) {
+		if (FALSE == common_util_count_folder(psqlite, c, it->first, &counts)) {
+			/* the folder is gone */
+			it = c->folder_counts.erase(it);
+			continue;
+		}
+		auto &f = it->second;
+		if (counts.b_search != f.b_search || counts.normal != f.normal ||
+		    counts.assoc != f.assoc || counts.unread != f.unread) {
+			fprintf(stderr, "W-1526: counters of folder %llu were"
+			        " %u/%u/%u, actual %u/%u/%u\n", LLU(it->first),
+			        f.normal, f.assoc, f.unread, counts.normal,
+			        counts.assoc, counts.unread);
+			f = counts;
+			mismatches ++;
+		}
+		++it;
+	}
+	c->b_tree = false;
+	c->tree.clear();
+	return mismatches;
+}
+
+/*
+ * Called before the connection is closed: return the unused rest of the
+ * reserved cid range, unless something else moved the high-water mark.
+ * A high-water mark below the last cid handed out (its reservation was
+ * rolled back) is raised.
+ */
+void common_util_drop_db_cache(sqlite3 *psqlite, DB_CACHE *pcache)
+{
+	char sql_string[192];
+	auto next = pcache->cid_next, end = pcache->cid_end;
+	
+	sqlite3_rollback_hook(psqlite, nullptr, nullptr);
+	sqlite3_trace_v2(psqlite, 0, nullptr, nullptr);
+	*pcache = DB_CACHE{};
+	if (next <= 1)
+		return;
+	snprintf(sql_string, arsizeof(sql_string), "UPDATE configurations SET "
+		"config_value=%llu WHERE config_id=%u AND (config_value=%llu"
+		" OR config_value<%llu)", LLU(next - 1), CONFIG_ID_LAST_CID,
+		LLU(end), LLU(next - 1));
+	sqlite3_exec(psqlite, sql_string, nullptr, nullptr, nullptr);
+}
+
+/*
+ * cids are reserved CID_RESERVE_SIZE at a time per database connection
+ * (i.e. per DB_ITEM). CONFIG_ID_LAST_CID holds the high-water mark of all
+ * reservations, so after a crash the unused rest of a range is skipped,
+ * never handed out twice.
+ *
+ * The reservation is written in the caller's transaction. A rollback
+ * can undo it while the range stays in use, so the rollback hook (and a
+ * cid-allocating caller whose later step failed) marks the persisted
+ * mark as possibly stale; only then, or when the range is used up, is it
+ * read again and, if it went below the range, written anew. The in-memory
+ * range itself only ever moves up.
+ *
+ * Without a DB_ITEM cache (the store was not obtained through
+ * db_engine_get_db), a single cid is taken off the high-water mark.
+ */
 BOOL common_util_allocate_cid(sqlite3 *psqlite, uint64_t *pcid)
 {
 	char sql_string[128];
+	auto pcache = db_engine_get_cache(psqlite);
 	
+	if (pcache == nullptr) {
+		snprintf(sql_string, arsizeof(sql_string), "UPDATE configurations"
+			" SET config_value=config_value+1 WHERE config_id=%u",
+			CONFIG_ID_LAST_CID);
+		if (sqlite3_exec(psqlite, sql_string, nullptr, nullptr,
+		    nullptr) != SQLITE_OK)
+			return FALSE;
+		if (sqlite3_changes(psqlite) == 0) {
+			snprintf(sql_string, arsizeof(sql_string), "INSERT INTO "
+				"configurations VALUES (%u, 1)", CONFIG_ID_LAST_CID);
+			if (sqlite3_exec(psqlite, sql_string, nullptr, nullptr,
+			    nullptr) != SQLITE_OK)
+				return FALSE;
+			*pcid = 1;
+			return TRUE;
+		}
+		snprintf(sql_string, arsizeof(sql_string), "SELECT config_value FROM "
+			"configurations WHERE config_id=%u", CONFIG_ID_LAST_CID);
+		auto pstmt = gx_sql_prep(psqlite, sql_string);
+		if (pstmt == nullptr || sqlite3_step(pstmt) != SQLITE_ROW)
+			return FALSE;
+		*pcid = sqlite3_column_int64(pstmt, 0);
+		return TRUE;
+	}
+	if (pcache->cid_next <= pcache->cid_end && !pcache->b_cid_stale) {
+		*pcid = pcache->cid_next ++;
+		return TRUE;
+	}
 	snprintf(sql_string, arsizeof(sql_string), "SELECT config_value FROM "
 		"configurations WHERE config_id=%u", CONFIG_ID_LAST_CID);
 	auto pstmt = gx_sql_prep(psqlite, sql_string);
@@ -549,20 +995,42 @@ BOOL common_util_allocate_cid(sqlite3 *psqlite, uint64_t *pcid)
 	uint64_t last_cid = sqlite3_step(pstmt) == SQLITE_ROW ?
 	                    sqlite3_column_int64(pstmt, 0) : 0;
 	pstmt.finalize();
-	last_cid ++;
-	snprintf(sql_string, arsizeof(sql_string), "REPLACE INTO configurations"
-					" VALUES (%u, ?)", CONFIG_ID_LAST_CID);
-	pstmt = gx_sql_prep(psqlite, sql_string);
-	if (pstmt == nullptr)
-		return FALSE;
-	sqlite3_bind_int64(pstmt, 1, last_cid);
-	if (sqlite3_step(pstmt) != SQLITE_DONE) {
-		return FALSE;
+	uint64_t new_end = 0;
+	if (pcache->cid_next > pcache->cid_end)
+		new_end = std::max(last_cid, pcache->cid_next - 1) + CID_RESERVE_SIZE;
+	else if (last_cid < pcache->cid_end)
+		new_end = pcache->cid_end;
+	if (new_end != 0) {
+		snprintf(sql_string, arsizeof(sql_string), "REPLACE INTO "
+			"configurations VALUES (%u, ?)", CONFIG_ID_LAST_CID);
+		pstmt = gx_sql_prep(psqlite, sql_string);
+		if (pstmt == nullptr)
+			return FALSE;
+		sqlite3_bind_int64(pstmt, 1, new_end);
+		if (sqlite3_step(pstmt) != SQLITE_DONE) {
+			return FALSE;
+		}
+		if (pcache->cid_next > pcache->cid_end) {
+			pcache->cid_next = new_end - CID_RESERVE_SIZE + 1;
+			pcache->cid_end = new_end;
+		}
 	}
-	*pcid = last_cid;
+	pcache->b_cid_stale = false;
+	*pcid = pcache->cid_next ++;
 	return TRUE;
 }
 
+/*
+ * A cid-allocating caller failed after its allocation; the statement that
+ * failed may have taken the reservation with it.
+ */
+static void common_util_cid_stale(sqlite3 *psqlite)
+{
+	auto pcache = db_engine_get_cache(psqlite);
+	if (pcache != nullptr)
+		pcache->b_cid_stale = true;
+}
+
 BOOL common_util_begin_message_optimize(sqlite3 *psqlite)
 {
 	char sql_string[256];
@@ -787,6 +1255,11 @@ static uint32_t common_util_calculate_childcount(
 	uint32_t count;
 	char sql_string[80];
 	
+	auto ptree = common_util_get_folder_tree(psqlite);
+	if (NULL != ptree) {
+		auto it = ptree->find(folder_id);
+		return it != ptree->end() ? it->second.descendants : 0;
+	}
 	count = 0;
 	snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM "
 	          "folders WHERE parent_id=%llu", LLU(folder_id));
@@ -806,6 +1279,19 @@ static BOOL common_util_check_subfolders(
 {
 	char sql_string[80];
 	
+	auto ptree = common_util_get_folder_tree(psqlite);
+	if (NULL != ptree) {
+		auto it = ptree->find(folder_id);
+		if (it == ptree->end()) {
+			return FALSE;
+		}
+		for (auto fid : it->second.children) {
+			auto it1 = ptree->find(fid);
+			if (it1 != ptree->end() && !it1->second.b_deleted)
+				return TRUE;
+		}
+		return FALSE;
+	}
 	if (TRUE == exmdb_server_check_private()) {
 		snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM "
 		          "folders WHERE parent_id=%llu", LLU(folder_id));
@@ -906,7 +1392,14 @@ static uint32_t common_util_get_store_message_count(
 	sqlite3 *psqlite, BOOL b_associated)
 {
 	char sql_string[64];
+	DB_CACHE tmp_cache;
+	auto c = common_util_db_cache(psqlite, &tmp_cache);
 	
+	if (c->b_counting && !c->b_store_counts &&
+	    common_util_count_store(psqlite, &c->store_normal, &c->store_assoc))
+		c->b_store_counts = true;
+	if (c->b_store_counts)
+		return b_associated ? c->store_assoc : c->store_normal;
 	if (FALSE == b_associated) {
 		snprintf(sql_string, arsizeof(sql_string), "SELECT count(*)"
 				" FROM messages WHERE is_associated=0");
@@ -937,6 +1430,10 @@ static uint32_t common_util_get_folder_count(sqlite3 *psqlite,
 	uint32_t folder_type;
 	char sql_string[256];
 	
+	auto pcounts = common_util_get_folder_counts(psqlite, folder_id);
+	if (NULL != pcounts) {
+		return b_associated ? pcounts->assoc : pcounts->normal;
+	}
 	if (common_util_get_folder_type(psqlite, folder_id, &folder_type) &&
 	    folder_type == FOLDER_SEARCH) {
 		snprintf(sql_string, GX_ARRAY_SIZE(sql_string), "SELECT count(*)"
@@ -971,6 +1468,10 @@ uint32_t common_util_get_folder_unread_count(
 	const char *username;
 	
 	if (TRUE == exmdb_server_check_private()) {
+		auto pcounts = common_util_get_folder_counts(psqlite, folder_id);
+		if (NULL != pcounts) {
+			return pcounts->unread;
+		}
 		if (common_util_get_folder_type(psqlite, folder_id, &folder_type) &&
 		    folder_type == FOLDER_SEARCH) {
 			snprintf(sql_string, arsizeof(sql_string), "SELECT count(*)"
@@ -1184,14 +1685,22 @@ BOOL common_util_get_folder_by_name(
 	sqlite3 *psqlite, uint64_t parent_id,
 	const char *str_name, uint64_t *pfolder_id)
 {
-	uint64_t tmp_val;
 	char sql_string[128];
+	std::vector<uint64_t> fids;
 	
-	snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id "
-	          "FROM folders WHERE parent_id=%llu", LLU(parent_id));
-	auto pstmt = gx_sql_prep(psqlite, sql_string);
-	if (pstmt == nullptr)
-		return FALSE;
+	if (FALSE == common_util_get_subfolders(psqlite, parent_id, -1, fids)) {
+		snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id "
+		          "FROM folders WHERE parent_id=%llu", LLU(parent_id));
+		auto pstmt = gx_sql_prep(psqlite, sql_string);
+		if (pstmt == nullptr)
+			return FALSE;
+		try {
+			while (SQLITE_ROW == sqlite3_step(pstmt))
+				fids.push_back(sqlite3_column_int64(pstmt, 0));
+		} catch (const std::bad_alloc &) {
+			return FALSE;
+		}
+	}
 	snprintf(sql_string, arsizeof(sql_string), "SELECT propval "
 		"FROM folder_properties WHERE folder_id=?"
 	        " AND proptag=%u", PR_DISPLAY_NAME);
@@ -1200,8 +1709,7 @@ BOOL common_util_get_folder_by_name(
 		return FALSE;
 	}
 	*pfolder_id = 0;
-	while (SQLITE_ROW == sqlite3_step(pstmt)) {
-		tmp_val = sqlite3_column_int64(pstmt, 0);
+	for (auto tmp_val : fids) {
 		sqlite3_bind_int64(pstmt1, 1, tmp_val);
 		if (SQLITE_ROW == sqlite3_step(pstmt1)) {
 			if (strcasecmp(str_name, S2A(sqlite3_column_text(pstmt1, 0))) == 0) {
@@ -2802,6 +3310,7 @@ static BOOL common_util_set_message_body(
 	close(fd);
 	if (FALSE == common_util_update_message_cid(
 		psqlite, message_id, proptag, cid)) {
+		common_util_cid_stale(psqlite);
 		if (remove(path) < 0 && errno != ENOENT)
 			fprintf(stderr, "W-1384: remove %s: %s\n", path, strerror(errno));
 	}
@@ -2868,6 +3377,7 @@ static BOOL common_util_set_message_header(
 	close(fd);
 	if (FALSE == common_util_update_message_cid(
 		psqlite, message_id, proptag, cid)) {
+		common_util_cid_stale(psqlite);
 		if (remove(path) < 0 && errno != ENOENT)
 			fprintf(stderr, "W-1368: remove %s: %s\n", path, strerror(errno));
 	}
@@ -2908,6 +3418,7 @@ static BOOL common_util_set_message_cid_value(sqlite3 *psqlite,
 	close(fd);
 	if (FALSE == common_util_update_message_cid(
 		psqlite, message_id, ppropval->proptag, cid)) {
+		common_util_cid_stale(psqlite);
 		if (remove(path) < 0 && errno != ENOENT)
 			fprintf(stderr, "W-1390: remove %s: %s\n", path, strerror(errno));
 		return FALSE;
@@ -2962,6 +3473,7 @@ static BOOL common_util_set_attachment_cid_value(sqlite3 *psqlite,
 	close(fd);
 	if (FALSE == common_util_update_attachment_cid(
 		psqlite, attachment_id, ppropval->proptag, cid)) {
+		common_util_cid_stale(psqlite);
 		if (remove(path) < 0 && errno != ENOENT)
 			fprintf(stderr, "W-1364: remove %s: %s\n", path, strerror(errno));
 		return FALSE;	
@@ -5183,41 +5695,150 @@ BOOL common_util_copy_message(sqlite3 *psqlite, int account_id,
 	return TRUE;
 }
 
+/* named_properties.name_string has COLLATE NOCASE, which folds ASCII only */
+static std::string common_util_fold_name(const char *name)
+{
+	std::string s = name;
+	for (auto &c : s)
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+	return s;
+}
+
+/*
+ * The named_properties table is read once per connection and then served
+ * from memory; common_util_get_named_propids keeps the maps up to date.
+ */
+static BOOL common_util_load_names(sqlite3 *psqlite, DB_CACHE *pcache)
+{
+	if (pcache->b_names) {
+		return TRUE;
+	}
+	auto pstmt = gx_sql_prep(psqlite, "SELECT propid, name_string"
+	             " FROM named_properties ORDER BY propid");
+	if (pstmt == nullptr)
+		return FALSE;
+	pcache->name_to_id.clear();
+	pcache->id_to_name.clear();
+	while (SQLITE_ROW == sqlite3_step(pstmt)) {
+		uint16_t propid = sqlite3_column_int64(pstmt, 0);
+		auto name = S2A(sqlite3_column_text(pstmt, 1));
+		if (NULL == name) {
+			continue;
+		}
+		pcache->id_to_name.emplace(propid, name);
+		/* first match wins, like the former SELECT did */
+		pcache->name_to_id.emplace(common_util_fold_name(name), propid);
+	}
+	pcache->b_names = true;
+	return TRUE;
+}
+
+BOOL common_util_get_all_named_propids(sqlite3 *psqlite,
+	PROPID_ARRAY *ppropids)
+{
+	DB_CACHE tmp_cache;
+	auto pcache = common_util_db_cache(psqlite, &tmp_cache);
+	try {
+		if (FALSE == common_util_load_names(psqlite, pcache)) {
+			return FALSE;
+		}
+	} catch (const std::bad_alloc &) {
+		fprintf(stderr, "E-1522: ENOMEM\n");
+		return FALSE;
+	}
+	ppropids->count = 0;
+	if (pcache->id_to_name.size() == 0) {
+		ppropids->ppropid = nullptr;
+		return TRUE;
+	}
+	ppropids->ppropid = cu_alloc<uint16_t>(pcache->id_to_name.size());
+	if (NULL == ppropids->ppropid) {
+		return FALSE;
+	}
+	for (const auto &e : pcache->id_to_name)
+		ppropids->ppropid[ppropids->count++] = e.first;
+	std::sort(ppropids->ppropid, ppropids->ppropid + ppropids->count);
+	return TRUE;
+}
+
+/*
+ * Load what clients ask for first after logon. This is split in steps, so
+ * that the caller can give way to real requests in between:
+ * - the named property map and the folder tree; @fids receives the
+ *   subfolders of @top_fid
+ * - the counters of one such folder
+ * - the sort and display columns of the newest messages in @view_fid, the
+ *   latter only so that their pages are in the page cache
+ */
+BOOL common_util_prewarm_names(sqlite3 *psqlite, uint64_t top_fid,
+	std::vector<uint64_t> &fids)
+{
+	DB_CACHE tmp_cache;
+	auto pcache = common_util_db_cache(psqlite, &tmp_cache);
+	
+	try {
+		common_util_load_names(psqlite, pcache);
+	} catch (const std::bad_alloc &) {
+		fprintf(stderr, "E-1522: ENOMEM\n");
+		return FALSE;
+	}
+	return common_util_get_subfolders(psqlite, top_fid, 0, fids);
+}
+
+void common_util_prewarm_counts(sqlite3 *psqlite, uint64_t folder_id)
+{
+	common_util_get_folder_counts(psqlite, folder_id);
+}
+
+void common_util_prewarm_view(sqlite3 *psqlite, uint64_t view_fid)
+{
+	static constexpr unsigned int view_rows = 200;
+	char sql_string[512];
+	
+	snprintf(sql_string, arsizeof(sql_string), "SELECT propval FROM "
+		"message_properties WHERE proptag IN (%u, %u, %u) AND message_id"
+		" IN (SELECT message_id FROM messages WHERE parent_fid=%llu AND "
+		"is_associated=0 ORDER BY message_id DESC LIMIT %u)", PR_SUBJECT,
+		PROP_TAG_MESSAGEDELIVERYTIME, PROP_TAG_SENTREPRESENTINGNAME,
+		LLU(view_fid), view_rows);
+	auto pstmt = gx_sql_prep(psqlite, sql_string);
+	if (pstmt == nullptr)
+		return;
+	while (SQLITE_ROW == sqlite3_step(pstmt))
+		/* nothing */;
+}
+
 BOOL common_util_get_named_propids(sqlite3 *psqlite,
 	BOOL b_create, const PROPNAME_ARRAY *ppropnames,
 	PROPID_ARRAY *ppropids)
 {
-	char sql_string[128];
 	char guid_string[64];
+	DB_CACHE tmp_cache;
+	auto pcache = common_util_db_cache(psqlite, &tmp_cache);
 	
 	ppropids->ppropid = cu_alloc<uint16_t>(ppropnames->count);
 	if (NULL == ppropids->ppropid) {
 		return FALSE;
 	}
 	ppropids->count = ppropnames->count;
-	if (TRUE == b_create) {
-		snprintf(sql_string, arsizeof(sql_string), "SELECT"
-			" count(*) FROM named_properties");
-		auto pstmt = gx_sql_prep(psqlite, sql_string);
-		if (pstmt == nullptr || sqlite3_step(pstmt) != SQLITE_ROW)
+	try {
+		if (FALSE == common_util_load_names(psqlite, pcache)) {
 			return FALSE;
-		/* if there're too many property names in table, stop creating */
-		if (sqlite3_column_int64(pstmt, 0) + ppropnames->count >
-			MAXIMUM_PROPNAME_NUMBER) {
-			b_create = FALSE;
 		}
-	}
-	snprintf(sql_string, arsizeof(sql_string), "SELECT propid FROM "
-				"named_properties WHERE name_string=?");
-	auto pstmt = gx_sql_prep(psqlite, sql_string);
-	decltype(pstmt) pstmt1;
-	if (pstmt == nullptr)
+	} catch (const std::bad_alloc &) {
+		fprintf(stderr, "E-1522: ENOMEM\n");
 		return FALSE;
+	}
+	/* if there're too many property names in table, stop creating */
+	if (TRUE == b_create && pcache->id_to_name.size() +
+	    ppropnames->count > MAXIMUM_PROPNAME_NUMBER)
+		b_create = FALSE;
+	xstmt pstmt;
 	if (TRUE == b_create) {
-		snprintf(sql_string, arsizeof(sql_string), "INSERT INTO "
-			"named_properties (name_string) VALUES (?)");
-		pstmt1 = gx_sql_prep(psqlite, sql_string);
-		if (pstmt1 == nullptr) {
+		pstmt = gx_sql_prep(psqlite, "INSERT INTO "
+		        "named_properties (name_string) VALUES (?)");
+		if (pstmt == nullptr) {
 			return FALSE;
 		}
 	}
@@ -5241,25 +5862,29 @@ BOOL common_util_get_named_propids(sqlite3 *psqlite,
 			ppropids->ppropid[i] = 0;
 			continue;
 		}
-		sqlite3_bind_text(pstmt, 1, name_string.c_str(), -1, SQLITE_STATIC);
-		if (SQLITE_ROW == sqlite3_step(pstmt)) {
-			ppropids->ppropid[i] = sqlite3_column_int64(pstmt, 0);
-			sqlite3_reset(pstmt);
+		auto folded = common_util_fold_name(name_string.c_str());
+		auto it = pcache->name_to_id.find(folded);
+		if (it != pcache->name_to_id.end()) {
+			ppropids->ppropid[i] = it->second;
 			continue;
 		}
-		sqlite3_reset(pstmt);
-		if (TRUE == b_create) {
-			sqlite3_bind_text(pstmt1, 1, name_string.c_str(), -1, SQLITE_STATIC);
-			if (SQLITE_DONE != sqlite3_step(pstmt1)) {
-				return FALSE;
-			}
-			ppropids->ppropid[i] = sqlite3_last_insert_rowid(psqlite);
-			sqlite3_reset(pstmt1);
-		} else {
+		if (FALSE == b_create) {
 			ppropids->ppropid[i] = 0;
+			continue;
+		}
+		sqlite3_bind_text(pstmt, 1, name_string.c_str(), -1, SQLITE_STATIC);
+		if (SQLITE_DONE != sqlite3_step(pstmt)) {
+			return FALSE;
 		}
+		sqlite3_reset(pstmt);
+		uint16_t propid = sqlite3_last_insert_rowid(psqlite);
+		ppropids->ppropid[i] = propid;
+		pcache->id_to_name.emplace(propid, std::move(name_string));
+		pcache->name_to_id.emplace(std::move(folded), propid);
 	} catch (const std::bad_alloc &) {
 		fprintf(stderr, "E-1503: ENOMEM\n");
+		/* the row may be in, but the maps are incomplete */
+		pcache->b_names = false;
 		return false;
 	}
 	return TRUE;
@@ -5270,27 +5895,29 @@ BOOL common_util_get_named_propnames(sqlite3 *psqlite,
 {
 	int i;
 	char *ptoken;
-	char sql_string[128];
 	char temp_name[1024];
+	DB_CACHE tmp_cache;
+	auto pcache = common_util_db_cache(psqlite, &tmp_cache);
 	
 	ppropnames->ppropname = cu_alloc<PROPERTY_NAME>(ppropids->count);
 	if (NULL == ppropnames->ppropname) {
 		return FALSE;
 	}
 	ppropnames->count = ppropids->count;
-	snprintf(sql_string, arsizeof(sql_string), "SELECT name_string "
-				"FROM named_properties WHERE propid=?");
-	auto pstmt = gx_sql_prep(psqlite, sql_string);
-	if (pstmt == nullptr)
+	try {
+		if (FALSE == common_util_load_names(psqlite, pcache)) {
+			return FALSE;
+		}
+	} catch (const std::bad_alloc &) {
+		fprintf(stderr, "E-1522: ENOMEM\n");
 		return FALSE;
+	}
 	for (i=0; i<ppropids->count; i++) {
-		sqlite3_bind_int64(pstmt, 1, ppropids->ppropid[i]);
-		if (SQLITE_ROW != sqlite3_step(pstmt)) {
-			sqlite3_reset(pstmt);
+		auto it = pcache->id_to_name.find(ppropids->ppropid[i]);
+		if (it == pcache->id_to_name.end()) {
 			goto NOT_FOUND_PROPNAME;
 		}
-		gx_strlcpy(temp_name, S2A(sqlite3_column_text(pstmt, 0)), sizeof(temp_name));
-		sqlite3_reset(pstmt);
+		gx_strlcpy(temp_name, it->second.c_str(), sizeof(temp_name));
 		if (0 != strncasecmp(temp_name, "GUID=", 5)) {
 			goto NOT_FOUND_PROPNAME;
 		}
@@ -5562,85 +6189,121 @@ BINARY* common_util_pcl_append(const BINARY *pbin_pcl,
 	return pbin;
 }
 
+/*
+ * Where the filesystem supports it (btrfs, XFS), the copy is a reflink
+ * sharing the data blocks copy-on-write. Otherwise the content is
+ * streamed over in chunks rather than being read into memory whole.
+ */
 BOOL common_util_copy_file(const char *src_file, const char *dst_file)
 {
-	struct stat node_stat;
+	ssize_t len;
+	char buff[65536];
+	
 	wrapfd fd = open(src_file, O_RDONLY);
-	if (fd.get() < 0 || fstat(fd.get(), &node_stat) != 0)
+	if (fd.get() < 0)
 		return false;
-	auto pbuff = me_alloc<char>(node_stat.st_size);
-	if (NULL == pbuff) {
-		return FALSE;
+	wrapfd fd1 = open(dst_file, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+	if (fd1.get() < 0)
+		return false;
+#ifdef FICLONE
+	if (ioctl(fd1.get(), FICLONE, fd.get()) == 0)
+		return TRUE;
+#endif
+	while ((len = read(fd.get(), buff, sizeof(buff))) > 0) {
+		if (write(fd1.get(), buff, len) != len) {
+			unlink(dst_file);
+			return FALSE;
+		}
 	}
-	if (read(fd.get(), pbuff, node_stat.st_size) != node_stat.st_size) {
-		free(pbuff);
+	if (len < 0) {
+		unlink(dst_file);
 		return FALSE;
 	}
-	fd = open(dst_file, O_CREAT|O_TRUNC|O_WRONLY, 0666);
-	if (fd.get() < 0) {
-		free(pbuff);
+	return TRUE;
+}
+
+/*
+ * cid and eml files are never rewritten once referenced, so a second
+ * reference to one can be a hardlink; st_nlink then acts as refcount.
+ * Across filesystems this falls back to common_util_copy_file.
+ */
+BOOL common_util_link_file(const char *src_file, const char *dst_file)
+{
+	if (link(src_file, dst_file) == 0) {
+		return TRUE;
+	}
+	if (errno != EXDEV && errno != EPERM && errno != EMLINK) {
 		return FALSE;
 	}
-	write(fd.get(), pbuff, node_stat.st_size);
-	free(pbuff);
-	return TRUE;
+	return common_util_copy_file(src_file, dst_file);
 }
 
 
-BOOL common_util_bind_sqlite_statement(sqlite3_stmt *pstmt,
-	int bind_index, uint16_t proptype, void *pvalue)
+BOOL common_util_propval_to_sql(uint16_t proptype, void *pvalue,
+	SQL_VALUE *pv)
 {
 	EXT_PUSH ext_push;
-	char temp_buff[256];
 	
-	if (NULL == pvalue) {
-		return FALSE;
-	}
 	switch (proptype) {
 	case PT_STRING8:
 	case PT_UNICODE:
-		sqlite3_bind_text(pstmt, bind_index, static_cast<char *>(pvalue), -1, SQLITE_STATIC);
+		pv->type = SQLITE_TEXT;
+		pv->pv = pvalue;
+		pv->cb = strlen(static_cast<char *>(pvalue));
 		break;
 	case PT_FLOAT:
-		sqlite3_bind_double(pstmt, bind_index, *(float*)pvalue);
+		pv->type = SQLITE_FLOAT;
+		pv->d = *(float*)pvalue;
 		break;
 	case PT_DOUBLE:
 	case PT_APPTIME:
-		sqlite3_bind_double(pstmt, bind_index, *(double*)pvalue);
+		pv->type = SQLITE_FLOAT;
+		pv->d = *(double*)pvalue;
 		break;
 	case PT_CURRENCY:
 	case PT_I8:
 	case PT_SYSTIME:
-		sqlite3_bind_int64(pstmt, bind_index, *(uint64_t*)pvalue);
+		pv->type = SQLITE_INTEGER;
+		pv->i = *(uint64_t*)pvalue;
 		break;
 	case PT_SHORT:
-		sqlite3_bind_int64(pstmt, bind_index, *(uint16_t*)pvalue);
+		pv->type = SQLITE_INTEGER;
+		pv->i = *(uint16_t*)pvalue;
 		break;
 	case PT_LONG:
-		sqlite3_bind_int64(pstmt, bind_index, *(uint32_t*)pvalue);
+		pv->type = SQLITE_INTEGER;
+		pv->i = *(uint32_t*)pvalue;
 		break;
 	case PT_BOOLEAN:
-		sqlite3_bind_int64(pstmt, bind_index, *(uint8_t*)pvalue);
+		pv->type = SQLITE_INTEGER;
+		pv->i = *(uint8_t*)pvalue;
 		break;
 	case PT_CLSID:
-		if (!ext_push.init(temp_buff, 16, 0) ||
+		if (!ext_push.init(pv->buff, 16, 0) ||
 		    ext_push.p_guid(static_cast<GUID *>(pvalue)) != EXT_ERR_SUCCESS)
 			return FALSE;
-		sqlite3_bind_blob(pstmt, bind_index, ext_push.m_udata, ext_push.m_offset, SQLITE_STATIC);
+		pv->type = SQLITE_BLOB;
+		pv->pv = pv->buff;
+		pv->cb = ext_push.m_offset;
 		break;
 	case PT_SVREID:
-		if (!ext_push.init(temp_buff, 256, 0) ||
+		if (!ext_push.init(pv->buff, sizeof(pv->buff), 0) ||
 		    ext_push.p_svreid(static_cast<SVREID *>(pvalue)) != EXT_ERR_SUCCESS)
 			return FALSE;
-		sqlite3_bind_blob(pstmt, bind_index, ext_push.m_udata, ext_push.m_offset, SQLITE_STATIC);
+		pv->type = SQLITE_BLOB;
+		pv->pv = pv->buff;
+		pv->cb = ext_push.m_offset;
 		break;
 	case PT_OBJECT:
 	case PT_BINARY: {
 		auto bv = static_cast<BINARY *>(pvalue);
-		if (bv->cb == 0)
-			sqlite3_bind_null(pstmt, bind_index);
-		else
-			sqlite3_bind_blob(pstmt, bind_index, bv->pv, bv->cb, SQLITE_STATIC);
+		if (bv->cb == 0) {
+			pv->type = SQLITE_NULL;
+			break;
+		}
+		pv->type = SQLITE_BLOB;
+		pv->pv = bv->pv;
+		pv->cb = bv->cb;
 		break;
 	}
 	default:
@@ -5649,6 +6312,37 @@ BOOL common_util_bind_sqlite_statement(sqlite3_stmt *pstmt,
 	return TRUE;
 }
 
+BOOL common_util_bind_sqlite_statement(sqlite3_stmt *pstmt,
+	int bind_index, uint16_t proptype, void *pvalue)
+{
+	SQL_VALUE v;
+	
+	if (NULL == pvalue ||
+	    !common_util_propval_to_sql(proptype, pvalue, &v)) {
+		return FALSE;
+	}
+	switch (v.type) {
+	case SQLITE_TEXT:
+		sqlite3_bind_text(pstmt, bind_index, static_cast<const char *>(v.pv), v.cb, SQLITE_STATIC);
+		break;
+	case SQLITE_FLOAT:
+		sqlite3_bind_double(pstmt, bind_index, v.d);
+		break;
+	case SQLITE_INTEGER:
+		sqlite3_bind_int64(pstmt, bind_index, v.i);
+		break;
+	case SQLITE_BLOB:
+		/* v.buff is gone once we return */
+		sqlite3_bind_blob(pstmt, bind_index, v.pv, v.cb,
+			v.pv == v.buff ? SQLITE_TRANSIENT : SQLITE_STATIC);
+		break;
+	default:
+		sqlite3_bind_null(pstmt, bind_index);
+		break;
+	}
+	return TRUE;
+}
+
 void* common_util_column_sqlite_statement(sqlite3_stmt *pstmt,
 	int column_index, uint16_t proptype)
 {
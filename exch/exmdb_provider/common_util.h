@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <string>
+#include <vector>
 #include <gromox/defs.h>
 #include <gromox/mail.hpp>
 #include <gromox/common_types.hpp>
@@ -24,6 +25,8 @@
 #define ID_TAG_ATTACHDATABINARY										0x000B0014
 #define ID_TAG_ATTACHDATAOBJECT										0x000F0014
 
+struct DB_CACHE;
+
 enum {
 	STORE_PROPERTIES_TABLE,
 	FOLDER_PROPERTIES_TABLE,
@@ -37,6 +40,16 @@ enum {
 	COMMON_UTIL_MAX_EXT_RULE_NUMBER
 };
 
+/* a propval the way it is kept in an SQLite column */
+struct SQL_VALUE {
+	int type; /* SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, SQLITE_BLOB or SQLITE_NULL */
+	int64_t i;
+	double d;
+	const void *pv; /* SQLITE_TEXT (NUL-terminated), SQLITE_BLOB */
+	size_t cb;
+	uint8_t buff[256]; /* pv storage of serialized CLSID and SVREID */
+};
+
 extern BOOL (*common_util_lang_to_charset)(
 	const char *lang, char *charset);
 extern const char* (*common_util_cpid_to_charset)(uint32_t cpid);
@@ -97,6 +110,13 @@ BOOL common_util_allocate_folder_art(sqlite3 *psqlite, uint32_t *part);
 BOOL common_util_check_allocated_eid(sqlite3 *psqlite,
 	uint64_t eid_val, BOOL *pb_result);
 BOOL common_util_allocate_cid(sqlite3 *psqlite, uint64_t *pcid);
+extern void common_util_init_db_cache(sqlite3 *, DB_CACHE *, BOOL b_private);
+extern void common_util_drop_db_cache(sqlite3 *, DB_CACHE *);
+extern int common_util_verify_db_cache(sqlite3 *);
+extern BOOL common_util_get_subfolders(sqlite3 *, uint64_t folder_id, int deleted, std::vector<uint64_t> &);
+extern BOOL common_util_prewarm_names(sqlite3 *, uint64_t top_fid, std::vector<uint64_t> &fids);
+extern void common_util_prewarm_counts(sqlite3 *, uint64_t folder_id);
+extern void common_util_prewarm_view(sqlite3 *, uint64_t view_fid);
 BOOL common_util_get_proptags(int table_type, uint64_t id,
 	sqlite3 *psqlite, PROPTAG_ARRAY *pproptags);
 BOOL common_util_get_mapping_guid(sqlite3 *psqlite,
@@ -175,6 +195,7 @@ BOOL common_util_check_message_owner(sqlite3 *psqlite,
 BOOL common_util_copy_message(sqlite3 *psqlite, int account_id,
 	uint64_t message_id, uint64_t folder_id, uint64_t *pdst_mid,
 	BOOL *pb_result, uint32_t *pmessage_size);
+extern BOOL common_util_get_all_named_propids(sqlite3 *, PROPID_ARRAY *);
 BOOL common_util_get_named_propids(sqlite3 *psqlite,
 	BOOL b_create, const PROPNAME_ARRAY *ppropnames,
 	PROPID_ARRAY *ppropids);
@@ -195,6 +216,8 @@ BOOL common_util_binary_to_xid(const BINARY *pbin, XID *pxid);
 BINARY* common_util_pcl_append(const BINARY *pbin_pcl,
 	const BINARY *pchange_key);
 BOOL common_util_copy_file(const char *src_file, const char *dst_file);
+extern BOOL common_util_link_file(const char *src_file, const char *dst_file);
+extern BOOL common_util_propval_to_sql(uint16_t proptype, void *pvalue, SQL_VALUE *);
 BOOL common_util_bind_sqlite_statement(sqlite3_stmt *pstmt,
 	int bind_index, uint16_t proptype, void *pvalue);
 void* common_util_column_sqlite_statement(sqlite3_stmt *pstmt,
@@ -1,12 +1,18 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <csignal>
+#include <cerrno>
+#include <climits>
 #include <cstdint>
 #include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include <gromox/database.h>
 #include <gromox/exmdb_rpc.hpp>
@@ -24,11 +30,13 @@
 #include <gromox/sortorder_set.hpp>
 #include <gromox/proptag_array.hpp>
 #include "notification_agent.h"
+#include "page_cache.h"
 #include <ctime>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <pthread.h>
 #define LLD(x) static_cast<long long>(x)
 #define LLU(x) static_cast<unsigned long long>(x)
@@ -39,6 +47,24 @@
 
 #define MAX_DYNAMIC_NODES				100
 
+/* a mailbox is maintained at most once in this interval */
+#define DB_MAINTENANCE_INTERVAL			43200
+
+/* upper bound on rows sampled per index by PRAGMA optimize */
+#define DB_ANALYSIS_LIMIT				1000
+
+/* pages copied per online backup step, and pause between steps (usec) */
+#define DB_BACKUP_STEP_PAGES			256
+#define DB_BACKUP_STEP_DELAY			10000
+
+/* table states are written back at the latest this long after a change */
+#define STATE_FLUSH_DELAY				60
+/* failed writes of table states, with doubling delays, before they are dropped */
+#define STATE_FLUSH_RETRIES				5
+
+/* page cache every scratch database may have even when over the limit */
+#define SCRATCH_MIN_CACHE				(256 * 1024)
+
 using namespace gromox;
 
 namespace {
@@ -89,6 +115,12 @@ struct ROWDEL_NODE {
 	BOOL b_read;
 };
 
+/* what a scratch database is charged for, and to which mailbox */
+struct SCRATCH_NODE {
+	std::string dir;
+	uint64_t grant = 0, used = 0;
+};
+
 }
 
 static BOOL g_wal;
@@ -105,9 +137,134 @@ static std::condition_variable g_waken_cond;
 static std::unordered_map<std::string, DB_ITEM> g_hash_table;
 static DOUBLE_LIST g_populating_list;
 static DOUBLE_LIST g_populating_list1;
+/* stores to be opened and warmed up by the populating threads */
+static std::deque<std::pair<std::string, BOOL>> g_prewarm_list;
+/* maintenance window in minutes after local midnight; start == end: off */
+static std::atomic<int> g_maint_start{0}, g_maint_end{0};
+static std::atomic<int> g_maint_idle{900};
+static std::atomic<unsigned int> g_maint_pages{1000};
+/*
+ * Ceiling for the page caches of all scratch databases (table, ICS and
+ * idset state) together; 0: unbounded, all in :memory:.
+ */
+static std::atomic<uint64_t> g_table_mem_limit{0};
+static std::atomic<uint64_t> g_table_spills{0};
+/* scratch databases by connection, see db_engine_open_scratch */
+static std::mutex g_scratch_lock;
+static std::unordered_map<sqlite3 *, SCRATCH_NODE> g_scratch_dbs;
+static uint64_t g_scratch_granted, g_scratch_used, g_scratch_peak;
+/* cid files unlinked per second by the scan thread; 0 disables reclamation */
+static std::atomic<unsigned int> g_reclaim_rate{0};
+/* mailbox directories with a backup in progress (see db_engine_hold_reclaim) */
+static std::mutex g_reclaim_hold_lock;
+static std::unordered_multiset<std::string> g_reclaim_holds;
+static std::atomic<uint64_t> g_reclaimed{0}, g_reclaim_pending{0};
+/* DB_ITEMs the current thread has locked through db_engine_get_db */
+static thread_local DB_ITEM *g_held_dbs[8];
+static thread_local unsigned int g_held_num;
 
 static void db_engine_notify_content_table_modify_row(db_item_ptr &, uint64_t folder_id, uint64_t message_id);
 
+/* SQL function cid_release(cid, b_attachment), called from the triggers */
+static void db_engine_cid_release(sqlite3_context *pctx,
+	int argc, sqlite3_value **argv)
+{
+	auto pdb = static_cast<DB_ITEM *>(sqlite3_user_data(pctx));
+	if (0 == g_reclaim_rate ||
+	    sqlite3_value_type(argv[0]) != SQLITE_INTEGER)
+		return;
+	try {
+		pdb->cid_pending.emplace_back(sqlite3_value_int64(argv[0]),
+			sqlite3_value_int(argv[1]) != 0);
+		g_reclaim_pending ++;
+	} catch (const std::bad_alloc &) {
+		/* the file is merely left behind */
+	}
+}
+
+/*
+ * Temporary (per-connection) triggers put the cid of every cid-backed
+ * property row that is deleted, or replaced by REPLACE INTO, on the
+ * pending list of the DB_ITEM. This includes rows removed through
+ * ON DELETE CASCADE. Whether the cid is still referenced elsewhere is
+ * only decided later, by db_engine_collect_cids.
+ */
+static void db_engine_install_reclaim(DB_ITEM *pdb)
+{
+	char tags[128], sql_string[1024];
+	static constexpr struct {
+		const char *table, *key;
+		bool b_attachment;
+	} cid_tables[] = {
+		{"message_properties", "message_id", false},
+		{"attachment_properties", "attachment_id", true},
+	};
+
+	if (SQLITE_OK != sqlite3_create_function(pdb->psqlite, "cid_release",
+	    2, SQLITE_UTF8, pdb, db_engine_cid_release, nullptr, nullptr)) {
+		fprintf(stderr, "W-1519: cannot register cid_release: %s\n",
+		        sqlite3_errmsg(pdb->psqlite));
+		return;
+	}
+	for (const auto &t : cid_tables) {
+		if (!t.b_attachment)
+			snprintf(tags, arsizeof(tags), "%u,%u,%u,%u,%u,%u",
+			         PR_BODY, PR_BODY_A, PROP_TAG_HTML,
+			         PROP_TAG_RTFCOMPRESSED, PROP_TAG_TRANSPORTMESSAGEHEADERS,
+			         PROP_TAG_TRANSPORTMESSAGEHEADERS_STRING8);
+		else
+			snprintf(tags, arsizeof(tags), "%u,%u",
+			         PR_ATTACH_DATA_BIN, PR_ATTACH_DATA_OBJ);
+		snprintf(sql_string, arsizeof(sql_string),
+			"CREATE TEMP TRIGGER %s_cid_del AFTER DELETE ON %s"
+			" WHEN old.proptag IN (%s) BEGIN"
+			" SELECT cid_release(old.propval, %d); END;"
+			"CREATE TEMP TRIGGER %s_cid_upd AFTER UPDATE OF propval ON %s"
+			" WHEN old.proptag IN (%s) AND old.propval<>new.propval BEGIN"
+			" SELECT cid_release(old.propval, %d); END;"
+			"CREATE TEMP TRIGGER %s_cid_rep BEFORE INSERT ON %s"
+			" WHEN new.proptag IN (%s) BEGIN"
+			" SELECT cid_release(propval, %d) FROM %s"
+			" WHERE %s=new.%s AND proptag=new.proptag; END",
+			t.table, t.table, tags, t.b_attachment,
+			t.table, t.table, tags, t.b_attachment,
+			t.table, t.table, tags, t.b_attachment, t.table,
+			t.key, t.key);
+		if (SQLITE_OK != sqlite3_exec(pdb->psqlite, sql_string,
+		    nullptr, nullptr, nullptr))
+			fprintf(stderr, "W-1520: cannot install cid triggers on %s: %s\n",
+			        t.table, sqlite3_errmsg(pdb->psqlite));
+	}
+	/*
+	 * Stores created before the index was part of the schema get it
+	 * from db_engine_reclaim_pass; until then, db_engine_collect_cids
+	 * scans attachment_properties.
+	 */
+	auto pstmt = gx_sql_prep(pdb->psqlite, "SELECT 1 FROM sqlite_master"
+	             " WHERE type='index' AND name='attachment_cid_index'");
+	pdb->b_cid_index = pstmt != nullptr && sqlite3_step(pstmt) == SQLITE_ROW;
+}
+
+/*
+ * Build the index db_engine_collect_cids looks attachment cids up by.
+ * Called with the DB_ITEM lock held, on an idle store. The WHERE clause
+ * must stay identical to the one of that query.
+ */
+static void db_engine_build_cid_index(DB_ITEM *pdb)
+{
+	char sql_string[192];
+
+	snprintf(sql_string, arsizeof(sql_string), "CREATE INDEX IF NOT EXISTS"
+		" attachment_cid_index ON attachment_properties(propval)"
+		" WHERE proptag IN (%u,%u)", PR_ATTACH_DATA_BIN, PR_ATTACH_DATA_OBJ);
+	if (SQLITE_OK != sqlite3_exec(pdb->psqlite, sql_string,
+	    nullptr, nullptr, nullptr))
+		/* not tried again; the lookups merely stay slow */
+		fprintf(stderr, "W-1537: cannot create attachment_cid_index: %s\n",
+		        sqlite3_errmsg(pdb->psqlite));
+	pdb->b_cid_index = true;
+}
+
 static void db_engine_load_dynamic_list(DB_ITEM *pdb)
 {
 	EXT_PULL ext_pull;
@@ -217,6 +374,8 @@ db_item_ptr db_engine_get_db(const char *path)
 		hhold.unlock();
 		return NULL;
 	}
+	if (g_held_num < arsizeof(g_held_dbs))
+		g_held_dbs[g_held_num++] = pdb;
 	if (TRUE == b_new) {
 		double_list_init(&pdb->dynamic_list);
 		double_list_init(&pdb->tables.table_list);
@@ -251,6 +410,9 @@ db_item_ptr db_engine_get_db(const char *path)
 				snprintf(sql_string, sizeof(sql_string), "PRAGMA mmap_size=%llu", LLU(g_mmap_size));
 				sqlite3_exec(pdb->psqlite, sql_string, NULL, NULL, NULL);
 			}
+			db_engine_install_reclaim(pdb);
+			common_util_init_db_cache(pdb->psqlite, &pdb->cache,
+				exmdb_server_check_private());
 			if (TRUE == exmdb_server_check_private()) {
 				db_engine_load_dynamic_list(pdb);
 			}
@@ -259,20 +421,58 @@ db_item_ptr db_engine_get_db(const char *path)
 	return db_item_ptr(pdb);
 }
 
+/*
+ * The DB_CACHE of @psqlite, for common_util functions that only get the
+ * connection. Only stores which the calling thread holds through
+ * db_engine_get_db are considered, so no further locking is needed.
+ */
+DB_CACHE *db_engine_get_cache(sqlite3 *psqlite)
+{
+	for (unsigned int i = g_held_num; i-- > 0; )
+		if (g_held_dbs[i]->psqlite == psqlite)
+			return &g_held_dbs[i]->cache;
+	return nullptr;
+}
+
 void db_engine_put_db(DB_ITEM *pdb)
 {
+	for (unsigned int i = g_held_num; i-- > 0; ) {
+		if (g_held_dbs[i] != pdb)
+			continue;
+		std::copy(g_held_dbs + i + 1, g_held_dbs + g_held_num, g_held_dbs + i);
+		--g_held_num;
+		break;
+	}
 	time(&pdb->last_time);
 	pdb->lock.unlock();
 	std::lock_guard hhold(g_hash_lock);
 	pdb->reference --;
 }
 
+static void db_engine_drop_states(DB_ITEM *);
+
 BOOL db_engine_unload_db(const char *path)
 {
 	int i;
 	char htag[256];
 	
 	swap_string(htag, path);
+	std::unique_lock hhold(g_hash_lock);
+	auto it = g_hash_table.find(htag);
+	if (it != g_hash_table.end() && 0 != it->second.states.dirty_time) {
+		/* write the table states now, the scan thread only evicts clean stores */
+		auto pdb = &it->second;
+		pdb->reference ++;
+		hhold.unlock();
+		if (pdb->lock.try_lock_for(std::chrono::seconds(10))) {
+			if (!db_engine_flush_states(pdb) && 0 != pdb->states.dirty_time)
+				db_engine_drop_states(pdb);
+			pdb->lock.unlock();
+		}
+		hhold.lock();
+		pdb->reference --;
+	}
+	hhold.unlock();
 	for (i=0; i<20; i++) {
 		std::unique_lock hhold(g_hash_lock);
 		auto it = g_hash_table.find(htag);
@@ -295,6 +495,57 @@ BOOL db_engine_unload_db(const char *path)
 	return FALSE;
 }
 
+/*
+ * Copy the mailbox database into @pdst using the SQLite online backup API.
+ * The DB_ITEM lock is only held for one step at a time, so that regular
+ * operations can interleave with the copy; writes made through the same
+ * connection in between are carried into the backup by SQLite itself.
+ * @pprogress is told the pages copied so far and the page count after
+ * every step; the copy is abandoned when it returns false.
+ */
+BOOL db_engine_backup_db(const char *dir, sqlite3 *pdst,
+    bool (*pprogress)(int copied, int total))
+{
+	auto pdb = db_engine_get_db(dir);
+	if (pdb == nullptr || pdb->psqlite == nullptr)
+		return FALSE;
+	auto pbackup = sqlite3_backup_init(pdst, "main", pdb->psqlite, "main");
+	if (NULL == pbackup) {
+		printf("[exmdb_provider]: E-1511: sqlite3_backup_init %s: %s\n",
+		       dir, sqlite3_errmsg(pdst));
+		return FALSE;
+	}
+	/*
+	 * The reference obtained by get_db is kept across steps, so the item
+	 * cannot be evicted (and its connection closed) while pbackup still
+	 * refers to it; only the lock is given up in between.
+	 */
+	auto praw = pdb.release();
+	int ret;
+	while (true) {
+		ret = sqlite3_backup_step(pbackup, DB_BACKUP_STEP_PAGES);
+		if (ret != SQLITE_OK && ret != SQLITE_BUSY && ret != SQLITE_LOCKED)
+			break;
+		praw->lock.unlock();
+		usleep(DB_BACKUP_STEP_DELAY);
+		praw->lock.lock();
+		int total = sqlite3_backup_pagecount(pbackup);
+		if (g_notify_stop || (pprogress != nullptr &&
+		    !pprogress(total - sqlite3_backup_remaining(pbackup), total))) {
+			ret = SQLITE_ABORT;
+			break;
+		}
+	}
+	sqlite3_backup_finish(pbackup);
+	db_engine_put_db(praw);
+	if (ret != SQLITE_DONE) {
+		printf("[exmdb_provider]: E-1512: backup of %s failed: %s\n",
+		       dir, sqlite3_errstr(ret));
+		return FALSE;
+	}
+	return TRUE;
+}
+
 DB_ITEM::~DB_ITEM()
 {
 	auto pdb = this;
@@ -303,6 +554,7 @@ DB_ITEM::~DB_ITEM()
 	DOUBLE_LIST_NODE *pnode;
 	INSTANCE_NODE *pinstance;
 	
+	/* table states were written by db_engine_state_pass beforehand */
 	while ((pnode = double_list_pop_front(&pdb->instance_list)) != nullptr) {
 		pinstance = (INSTANCE_NODE*)pnode->pdata;
 		if (NULL != pinstance->username) {
@@ -341,20 +593,822 @@ DB_ITEM::~DB_ITEM()
 	}
 	double_list_free(&pdb->tables.table_list);
 	if (NULL != pdb->tables.psqlite) {
-		sqlite3_close(pdb->tables.psqlite);
+		db_engine_close_scratch(pdb->tables.psqlite);
 		pdb->tables.psqlite = NULL;
 	}
+	g_reclaim_pending -= pdb->cid_pending.size();
 	pdb->last_time = 0;
 	if (NULL != pdb->psqlite) {
+		common_util_drop_db_cache(pdb->psqlite, &pdb->cache);
 		sqlite3_close(pdb->psqlite);
 		pdb->psqlite = NULL;
 	}
 }
 
+void db_engine_set_maintenance(int start, int end,
+	int idle_time, unsigned int max_pages)
+{
+	g_maint_start = start;
+	g_maint_end = end;
+	g_maint_idle = idle_time;
+	g_maint_pages = max_pages;
+}
+
+void db_engine_set_table_memory(uint64_t limit)
+{
+	g_table_mem_limit = limit;
+}
+
+/* caller holds g_scratch_lock */
+static void db_engine_set_scratch_grant(sqlite3 *psqlite,
+	SCRATCH_NODE &node, uint64_t grant)
+{
+	char sql_string[64];
+
+	g_scratch_granted += grant - node.grant;
+	node.grant = grant;
+	/*
+	 * negative cache_size is in units of KiB; with sqlite_page_cache_size,
+	 * page_cache.cpp enforces it within the shared budget
+	 */
+	snprintf(sql_string, arsizeof(sql_string), "PRAGMA cache_size=-%llu",
+	         LLU(grant / 1024));
+	sqlite3_exec(psqlite, sql_string, nullptr, nullptr, nullptr);
+}
+
+/*
+ * Half of what the other scratch databases have not been granted of the
+ * limit, but at least SCRATCH_MIN_CACHE. Caller holds g_scratch_lock.
+ */
+static uint64_t db_engine_scratch_share(uint64_t limit, uint64_t others)
+{
+	return std::max(others >= limit ? 0 : (limit - others) / 2,
+	       static_cast<uint64_t>(SCRATCH_MIN_CACHE));
+}
+
+/*
+ * Opens a private database for table, ICS or idset state of the mailbox
+ * in @dir. Without a limit, this is a plain :memory: database. With a
+ * limit, it is an anonymous temporary database whose page cache is capped
+ * at its share of the limit that all scratch databases draw from; anything
+ * beyond spills to a temporary file instead of growing the heap.
+ */
+BOOL db_engine_open_scratch(const char *dir, sqlite3 **ppsqlite)
+{
+	uint64_t limit = g_table_mem_limit;
+	if (SQLITE_OK != sqlite3_open_v2(limit == 0 ? ":memory:" : "",
+	    ppsqlite, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr)) {
+		sqlite3_close(*ppsqlite);
+		*ppsqlite = nullptr;
+		return FALSE;
+	}
+	try {
+		std::lock_guard hold(g_scratch_lock);
+		auto &node = g_scratch_dbs[*ppsqlite];
+		node.dir = dir;
+		if (limit != 0)
+			db_engine_set_scratch_grant(*ppsqlite, node,
+				db_engine_scratch_share(limit, g_scratch_granted));
+	} catch (const std::bad_alloc &) {
+		sqlite3_close(*ppsqlite);
+		*ppsqlite = nullptr;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void db_engine_close_scratch(sqlite3 *psqlite)
+{
+	int cur = 0, hiwtr = 0;
+	if (SQLITE_OK == sqlite3_db_status(psqlite,
+	    SQLITE_DBSTATUS_CACHE_SPILL, &cur, &hiwtr, 0))
+		g_table_spills += cur;
+	/* short-lived ones are only accounted here, for the peak */
+	db_engine_account_scratch(psqlite);
+	std::unique_lock hold(g_scratch_lock);
+	auto it = g_scratch_dbs.find(psqlite);
+	if (it != g_scratch_dbs.end()) {
+		g_scratch_granted -= it->second.grant;
+		g_scratch_used -= it->second.used;
+		g_scratch_dbs.erase(it);
+	}
+	hold.unlock();
+	sqlite3_close(psqlite);
+}
+
+/*
+ * Charge the current page cache of @psqlite to its mailbox and to the
+ * total, and renew its share of the limit: a database that has grown
+ * while others were opened is made to spill down to its share. The caller
+ * must have the connection to itself (e.g. hold the DB_ITEM lock for
+ * tables.psqlite).
+ */
+void db_engine_account_scratch(sqlite3 *psqlite)
+{
+	int cur = 0, hiwtr = 0;
+	uint64_t limit = g_table_mem_limit;
+
+	if (NULL == psqlite || SQLITE_OK != sqlite3_db_status(psqlite,
+	    SQLITE_DBSTATUS_CACHE_USED, &cur, &hiwtr, 0))
+		return;
+	std::lock_guard hold(g_scratch_lock);
+	auto it = g_scratch_dbs.find(psqlite);
+	if (it == g_scratch_dbs.end())
+		return;
+	auto &node = it->second;
+	g_scratch_used += cur - node.used;
+	node.used = cur;
+	g_scratch_peak = std::max(g_scratch_peak, g_scratch_used);
+	if (limit != 0)
+		db_engine_set_scratch_grant(psqlite, node, db_engine_scratch_share(
+			limit, g_scratch_granted - node.grant));
+}
+
+void db_engine_get_table_memory(TABLE_MEMORY_STATS *pstats)
+{
+	std::lock_guard hold(g_scratch_lock);
+	pstats->limit = g_table_mem_limit;
+	pstats->used = g_scratch_used;
+	pstats->granted = g_scratch_granted;
+	pstats->peak = g_scratch_peak;
+	pstats->spills = g_table_spills;
+	pstats->scratch_dbs = g_scratch_dbs.size();
+}
+
+/* scratch memory by mailbox, largest first */
+std::vector<SCRATCH_USAGE> db_engine_get_scratch_usage()
+{
+	std::vector<SCRATCH_USAGE> usage;
+	std::unordered_map<std::string, size_t> index;
+	std::lock_guard hold(g_scratch_lock);
+	for (const auto &e : g_scratch_dbs) {
+		auto ins = index.emplace(e.second.dir, usage.size());
+		if (ins.second)
+			usage.push_back(SCRATCH_USAGE{e.second.dir});
+		auto &u = usage[ins.first->second];
+		u.used += e.second.used;
+		u.granted += e.second.grant;
+		u.scratch_dbs ++;
+	}
+	std::sort(usage.begin(), usage.end(),
+		[](const SCRATCH_USAGE &a, const SCRATCH_USAGE &b) { return a.used > b.used; });
+	return usage;
+}
+
+static const char *const state_columns = "state_id, folder_id, "
+	"table_flags, sorts, message_id, inst_num, header_id, header_stat";
+
+/* caller holds the DB_ITEM lock */
+BOOL db_engine_load_states(DB_ITEM *pdb, const char *dir)
+{
+	char sql_string[256];
+	struct stat node_stat;
+	auto &ts = pdb->states;
+	
+	if (ts.b_loaded) {
+		return TRUE;
+	}
+	try {
+		ts.path = std::string(dir) + "/tmp/state.sqlite3";
+	} catch (const std::bad_alloc &) {
+		return FALSE;
+	}
+	if (0 != stat(ts.path.c_str(), &node_stat)) {
+		ts.b_loaded = true;
+		return TRUE;
+	}
+	sqlite3 *psqlite = nullptr;
+	auto ret = sqlite3_open_v2(ts.path.c_str(), &psqlite, SQLITE_OPEN_READWRITE, nullptr);
+	if (ret != SQLITE_OK) {
+		fprintf(stderr, "E-1437: sqlite3_open %s: %s\n", ts.path.c_str(), sqlite3_errstr(ret));
+		sqlite3_close(psqlite);
+		return FALSE;
+	}
+	auto cl_0 = make_scope_exit([&]() { sqlite3_close(psqlite); });
+	snprintf(sql_string, arsizeof(sql_string), "SELECT %s, "
+	         "headers FROM state_info", state_columns);
+	auto pstmt = gx_sql_prep(psqlite, sql_string);
+	if (pstmt == nullptr) {
+		/* written before header rows moved into state_info */
+		snprintf(sql_string, arsizeof(sql_string), "SELECT %s, "
+		         "NULL FROM state_info", state_columns);
+		pstmt = gx_sql_prep(psqlite, sql_string);
+		if (pstmt == nullptr)
+			return FALSE;
+	}
+	try {
+		while (SQLITE_ROW == sqlite3_step(pstmt)) {
+			uint32_t state_id = sqlite3_column_int64(pstmt, 0);
+			auto &st = ts.states[state_id];
+			st.folder_id = sqlite3_column_int64(pstmt, 1);
+			st.table_flags = sqlite3_column_int64(pstmt, 2);
+			if (SQLITE_NULL != sqlite3_column_type(pstmt, 3))
+				st.sorts.assign(static_cast<const char *>(sqlite3_column_blob(pstmt, 3)),
+					sqlite3_column_bytes(pstmt, 3));
+			st.message_id = sqlite3_column_int64(pstmt, 4);
+			st.inst_num = sqlite3_column_int64(pstmt, 5);
+			st.header_id = sqlite3_column_int64(pstmt, 6);
+			st.header_stat = sqlite3_column_int64(pstmt, 7);
+			if (SQLITE_NULL != sqlite3_column_type(pstmt, 8))
+				st.headers.assign(static_cast<const char *>(sqlite3_column_blob(pstmt, 8)),
+					sqlite3_column_bytes(pstmt, 8));
+			if (state_id > ts.last_id)
+				ts.last_id = state_id;
+		}
+	} catch (const std::bad_alloc &) {
+		ts.states.clear();
+		ts.last_id = 0;
+		return FALSE;
+	}
+	ts.b_loaded = true;
+	return TRUE;
+}
+
+/* forget the unsaved changes of table states; caller holds the DB_ITEM lock */
+static void db_engine_drop_states(DB_ITEM *pdb)
+{
+	auto &ts = pdb->states;
+	fprintf(stderr, "W-1534: discarding unsaved table states of %s\n",
+	        ts.path.c_str());
+	for (auto &e : ts.states)
+		e.second.b_dirty = false;
+	ts.dirty_time = 0;
+	ts.next_flush = 0;
+	ts.flush_failures = 0;
+}
+
+static BOOL db_engine_write_states(DB_ITEM *pdb)
+{
+	char sql_string[256];
+	sqlite3 *psqlite = nullptr;
+	auto &ts = pdb->states;
+	
+	auto ret = sqlite3_open_v2(ts.path.c_str(), &psqlite,
+	           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+	if (ret != SQLITE_OK) {
+		fprintf(stderr, "E-1435: sqlite3_open %s: %s\n", ts.path.c_str(), sqlite3_errstr(ret));
+		sqlite3_close(psqlite);
+		return FALSE;
+	}
+	auto cl_0 = make_scope_exit([&]() { sqlite3_close(psqlite); });
+	sqlite3_exec(psqlite, "PRAGMA journal_mode=OFF", NULL, NULL, NULL);
+	sqlite3_exec(psqlite, "PRAGMA synchronous=OFF", NULL, NULL, NULL);
+	if (SQLITE_OK != sqlite3_exec(psqlite, "CREATE TABLE IF NOT EXISTS "
+	    "state_info (state_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	    "folder_id INTEGER NOT NULL, table_flags INTEGER NOT NULL, "
+	    "sorts BLOB, message_id INTEGER DEFAULT NULL, "
+	    "inst_num INTEGER DEFAULT NULL, header_id INTEGER DEFAULT NULL, "
+	    "header_stat INTEGER DEFAULT NULL, headers BLOB DEFAULT NULL);"
+	    "CREATE UNIQUE INDEX IF NOT EXISTS state_index "
+	    "ON state_info (folder_id, table_flags, sorts)", nullptr, nullptr, nullptr)) {
+		fprintf(stderr, "W-1527: cannot save table states to %s: %s\n",
+		        ts.path.c_str(), sqlite3_errmsg(psqlite));
+		return FALSE;
+	}
+	/* fails harmlessly if the column is there already */
+	sqlite3_exec(psqlite, "ALTER TABLE state_info ADD COLUMN "
+		"headers BLOB DEFAULT NULL", nullptr, nullptr, nullptr);
+	snprintf(sql_string, arsizeof(sql_string), "REPLACE INTO state_info "
+	         "(%s, headers) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", state_columns);
+	auto pstmt = gx_sql_prep(psqlite, sql_string);
+	if (pstmt == nullptr)
+		return FALSE;
+	sqlite3_exec(psqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	for (auto &e : ts.states) {
+		auto &st = e.second;
+		if (!st.b_dirty)
+			continue;
+		sqlite3_bind_int64(pstmt, 1, e.first);
+		sqlite3_bind_int64(pstmt, 2, st.folder_id);
+		sqlite3_bind_int64(pstmt, 3, st.table_flags);
+		if (st.sorts.empty())
+			sqlite3_bind_null(pstmt, 4);
+		else
+			sqlite3_bind_blob(pstmt, 4, st.sorts.data(), st.sorts.size(), SQLITE_STATIC);
+		if (0 == st.message_id) {
+			sqlite3_bind_null(pstmt, 5);
+			sqlite3_bind_null(pstmt, 6);
+		} else {
+			sqlite3_bind_int64(pstmt, 5, st.message_id);
+			sqlite3_bind_int64(pstmt, 6, st.inst_num);
+		}
+		sqlite3_bind_int64(pstmt, 7, st.header_id);
+		sqlite3_bind_int64(pstmt, 8, st.header_stat);
+		if (st.headers.empty())
+			sqlite3_bind_null(pstmt, 9);
+		else
+			sqlite3_bind_blob(pstmt, 9, st.headers.data(), st.headers.size(), SQLITE_STATIC);
+		if (SQLITE_DONE != sqlite3_step(pstmt)) {
+			fprintf(stderr, "W-1535: cannot save table state %u to %s: %s\n",
+			        e.first, ts.path.c_str(), sqlite3_errmsg(psqlite));
+			sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
+			return FALSE;
+		}
+		sqlite3_reset(pstmt);
+		/* per-state tables of the former layout */
+		snprintf(sql_string, arsizeof(sql_string), "DROP TABLE IF EXISTS s%u", e.first);
+		sqlite3_exec(psqlite, sql_string, nullptr, nullptr, nullptr);
+	}
+	pstmt.finalize();
+	if (SQLITE_OK != sqlite3_exec(psqlite, "COMMIT TRANSACTION",
+	    nullptr, nullptr, nullptr)) {
+		fprintf(stderr, "W-1536: cannot save table states to %s: %s\n",
+		        ts.path.c_str(), sqlite3_errmsg(psqlite));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Write back the dirty table states. After a failure, the next attempt is
+ * not made before ts.next_flush, with the delay doubling each time; after
+ * STATE_FLUSH_RETRIES, the changes are dropped so that the store is not
+ * kept loaded for them. Caller holds the DB_ITEM lock.
+ */
+BOOL db_engine_flush_states(DB_ITEM *pdb)
+{
+	auto &ts = pdb->states;
+	
+	if (0 == ts.dirty_time) {
+		return TRUE;
+	}
+	if (!db_engine_write_states(pdb)) {
+		if (++ts.flush_failures >= STATE_FLUSH_RETRIES) {
+			db_engine_drop_states(pdb);
+			return FALSE;
+		}
+		ts.next_flush = time(nullptr) +
+			(STATE_FLUSH_DELAY << (ts.flush_failures - 1));
+		return FALSE;
+	}
+	for (auto &e : ts.states)
+		e.second.b_dirty = false;
+	ts.dirty_time = 0;
+	ts.next_flush = 0;
+	ts.flush_failures = 0;
+	return TRUE;
+}
+
+/*
+ * Write back table states that have been dirty for a while, outside of
+ * g_hash_lock. With @b_all (at shutdown), write all of them and wait for
+ * busy stores.
+ */
+static void db_engine_state_pass(time_t now_time, bool b_all = false)
+{
+	std::vector<DB_ITEM *> cand;
+	
+	std::unique_lock hhold(g_hash_lock);
+	for (auto &e : g_hash_table) {
+		auto pdb = &e.second;
+		auto dirty_time = pdb->states.dirty_time.load();
+		if (0 == dirty_time || (!b_all && (now_time -
+		    dirty_time < STATE_FLUSH_DELAY ||
+		    now_time < pdb->states.next_flush)))
+			continue;
+		try {
+			cand.push_back(pdb);
+		} catch (const std::bad_alloc &) {
+			break;
+		}
+		pdb->reference ++;
+	}
+	hhold.unlock();
+	for (auto pdb : cand) {
+		/* a busy store gets its turn on the next pass */
+		if (b_all) {
+			std::lock_guard lhold(pdb->lock);
+			db_engine_flush_states(pdb);
+		} else if (pdb->lock.try_lock()) {
+			db_engine_flush_states(pdb);
+			pdb->lock.unlock();
+		}
+		hhold.lock();
+		pdb->reference --;
+		hhold.unlock();
+	}
+}
+
+void db_engine_set_reclaim_rate(unsigned int cids_per_sec)
+{
+	g_reclaim_rate = cids_per_sec;
+}
+
+/*
+ * Backups link the cids referenced by their finished database snapshot,
+ * so no cid of the mailbox in @dir may disappear between the snapshot and
+ * the linking. Other mailboxes are not affected.
+ */
+void db_engine_hold_reclaim(const char *dir, bool b_hold)
+{
+	std::lock_guard hold(g_reclaim_hold_lock);
+	if (b_hold) {
+		g_reclaim_holds.emplace(dir);
+		return;
+	}
+	auto it = g_reclaim_holds.find(dir);
+	if (it != g_reclaim_holds.end())
+		g_reclaim_holds.erase(it);
+}
+
+static bool db_engine_reclaim_held(const std::string &dir)
+{
+	std::lock_guard hold(g_reclaim_hold_lock);
+	return g_reclaim_holds.count(dir) > 0;
+}
+
+void db_engine_get_reclaim_stats(uint64_t *preclaimed, uint64_t *ppending)
+{
+	*preclaimed = g_reclaimed;
+	*ppending = g_reclaim_pending;
+}
+
+static void db_engine_proplist_cids(const TPROPVAL_ARRAY *pproplist,
+	std::unordered_set<uint64_t> &cids)
+{
+	for (size_t i = 0; i < pproplist->count; ++i) {
+		switch (pproplist->ppropval[i].proptag) {
+		case ID_TAG_BODY:
+		case ID_TAG_BODY_STRING8:
+		case ID_TAG_HTML:
+		case ID_TAG_RTFCOMPRESSED:
+		case ID_TAG_TRANSPORTMESSAGEHEADERS:
+		case ID_TAG_TRANSPORTMESSAGEHEADERS_STRING8:
+		case ID_TAG_ATTACHDATABINARY:
+		case ID_TAG_ATTACHDATAOBJECT:
+			cids.insert(*static_cast<uint64_t *>(pproplist->ppropval[i].pvalue));
+			break;
+		}
+	}
+}
+
+static void db_engine_message_cids(const MESSAGE_CONTENT *pmsgctnt,
+	std::unordered_set<uint64_t> &cids)
+{
+	db_engine_proplist_cids(&pmsgctnt->proplist, cids);
+	auto pattachments = pmsgctnt->children.pattachments;
+	if (NULL == pattachments) {
+		return;
+	}
+	for (size_t i = 0; i < pattachments->count; ++i) {
+		db_engine_proplist_cids(&pattachments->pplist[i]->proplist, cids);
+		if (NULL != pattachments->pplist[i]->pembedded)
+			db_engine_message_cids(pattachments->pplist[i]->pembedded, cids);
+	}
+}
+
+/* cids that the open instances of @pdb still carry */
+static void db_engine_instance_cids(DB_ITEM *pdb,
+	std::unordered_set<uint64_t> &cids)
+{
+	for (auto pnode = double_list_get_head(&pdb->instance_list);
+	     NULL != pnode; pnode = double_list_get_after(
+	     &pdb->instance_list, pnode)) {
+		auto pinstance = static_cast<INSTANCE_NODE *>(pnode->pdata);
+		if (NULL == pinstance->pcontent)
+			continue;
+		if (INSTANCE_TYPE_MESSAGE == pinstance->type) {
+			db_engine_message_cids(static_cast<MESSAGE_CONTENT *>(
+				pinstance->pcontent), cids);
+			continue;
+		}
+		auto pattachment = static_cast<ATTACHMENT_CONTENT *>(pinstance->pcontent);
+		db_engine_proplist_cids(&pattachment->proplist, cids);
+		if (NULL != pattachment->pembedded)
+			db_engine_message_cids(pattachment->pembedded, cids);
+	}
+}
+
+/*
+ * Called with the DB_ITEM lock held. Takes up to @max_cids entries off the
+ * pending list and appends those which neither a property row nor an open
+ * instance references anymore to @doomed. Entries still carried by an
+ * instance go back on the pending list, to be looked at again once the
+ * instance is gone.
+ */
+static unsigned int db_engine_collect_cids(DB_ITEM *pdb, const std::string &dir,
+	unsigned int max_cids, std::vector<uint64_t> &doomed)
+{
+	char sql_string[256];
+	auto &pending = pdb->cid_pending;
+	std::unordered_set<uint64_t> inst_cids;
+
+	db_engine_instance_cids(pdb, inst_cids);
+	size_t count = std::min(static_cast<size_t>(max_cids), pending.size());
+	std::vector<std::pair<uint64_t, bool>> batch(pending.end() - count, pending.end());
+	std::sort(batch.begin(), batch.end());
+	batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+	snprintf(sql_string, arsizeof(sql_string), "SELECT 1 FROM "
+		"message_properties WHERE proptag IN (%u,%u,%u,%u,%u,%u)"
+		" AND propval=? LIMIT 1", PR_BODY, PR_BODY_A, PROP_TAG_HTML,
+		PROP_TAG_RTFCOMPRESSED, PROP_TAG_TRANSPORTMESSAGEHEADERS,
+		PROP_TAG_TRANSPORTMESSAGEHEADERS_STRING8);
+	auto pstmt = gx_sql_prep(pdb->psqlite, sql_string);
+	if (pstmt == nullptr) {
+		return 0;
+	}
+	/* uses attachment_cid_index once db_engine_build_cid_index made it */
+	snprintf(sql_string, arsizeof(sql_string), "SELECT 1 FROM "
+		"attachment_properties WHERE proptag IN (%u,%u)"
+		" AND propval=? LIMIT 1", PR_ATTACH_DATA_BIN, PR_ATTACH_DATA_OBJ);
+	auto pstmt1 = gx_sql_prep(pdb->psqlite, sql_string);
+	if (pstmt1 == nullptr) {
+		return 0;
+	}
+	size_t first = doomed.size();
+	std::vector<std::pair<uint64_t, bool>> kept;
+	for (const auto &e : batch) {
+		if (inst_cids.count(e.first) > 0) {
+			kept.push_back(e);
+			continue;
+		}
+		auto &stmt = e.second ? pstmt1 : pstmt;
+		sqlite3_bind_int64(stmt, 1, e.first);
+		int ret = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (SQLITE_DONE == ret) {
+			doomed.push_back(e.first);
+		} else if (SQLITE_ROW != ret) {
+			doomed.resize(first);
+			return 0;
+		}
+	}
+	if (db_engine_reclaim_held(dir)) {
+		/* a backup started; try again once it is over */
+		doomed.resize(first);
+		return 0;
+	}
+	pending.resize(pending.size() - count);
+	g_reclaim_pending -= count;
+	/* in front, so that the next pass takes the newer entries first */
+	pending.insert(pending.begin(), kept.begin(), kept.end());
+	g_reclaim_pending += kept.size();
+	return count;
+}
+
+/*
+ * Unlink cid files whose last referencing property row has gone away.
+ * Deletions themselves only fill the pending lists (through the triggers
+ * of db_engine_install_reclaim); the file system work is done here, for
+ * at most @budget pending entries per pass. Mailboxes that are in use are
+ * skipped. The DB_ITEM lock is held until the files are gone, so that
+ * nothing can reference a cid between the check and the unlink. A store
+ * still lacking attachment_cid_index gets it instead, once it is idle.
+ */
+static void db_engine_reclaim_pass(unsigned int budget)
+{
+	char dir[256], path[256];
+	std::vector<std::pair<std::string, DB_ITEM *>> cand;
+	std::vector<uint64_t> doomed;
+
+	if (0 == budget) {
+		return;
+	}
+	std::unique_lock hhold(g_hash_lock);
+	for (auto &e : g_hash_table) {
+		auto pdb = &e.second;
+		/* with reference at 0, nobody holds pdb->lock */
+		if (0 != pdb->reference || NULL == pdb->psqlite ||
+		    pdb->cid_pending.empty() || db_engine_reclaim_held(e.first))
+			continue;
+		try {
+			cand.emplace_back(e.first, pdb);
+		} catch (const std::bad_alloc &) {
+			break;
+		}
+		pdb->reference ++;
+	}
+	hhold.unlock();
+	for (const auto &e : cand) {
+		auto pdb = e.second;
+		if (budget > 0 && !pdb->b_cid_index && pdb->lock.try_lock()) {
+			/* reads all of attachment_properties: the rest of the pass */
+			db_engine_build_cid_index(pdb);
+			budget = 0;
+			pdb->lock.unlock();
+		} else if (budget > 0 && pdb->lock.try_lock()) {
+			unsigned int used = 0;
+			doomed.clear();
+			try {
+				used = db_engine_collect_cids(pdb, e.first, budget, doomed);
+			} catch (const std::bad_alloc &) {
+				doomed.clear();
+			}
+			budget = used >= budget ? 0 : budget - used;
+			swap_string(dir, e.first.c_str());
+			for (auto cid : doomed) {
+				snprintf(path, arsizeof(path), "%s/cid/%llu", dir, LLU(cid));
+				if (remove(path) < 0 && errno != ENOENT)
+					fprintf(stderr, "W-1521: remove %s: %s\n", path, strerror(errno));
+				else
+					g_reclaimed ++;
+			}
+			pdb->lock.unlock();
+		}
+		hhold.lock();
+		pdb->reference --;
+		hhold.unlock();
+	}
+}
+
+static bool db_engine_in_maintenance_window(time_t now_time)
+{
+	int start = g_maint_start, end = g_maint_end;
+	struct tm tmp_tm;
+
+	if (start == end) {
+		return false;
+	}
+	localtime_r(&now_time, &tmp_tm);
+	int now = tmp_tm.tm_hour * 60 + tmp_tm.tm_min;
+	if (start < end) {
+		return now >= start && now < end;
+	}
+	return now >= start || now < end;
+}
+
+static uint64_t db_engine_query_int(sqlite3 *psqlite, const char *sql)
+{
+	auto pstmt = gx_sql_prep(psqlite, sql);
+	if (pstmt == nullptr || sqlite3_step(pstmt) != SQLITE_ROW)
+		return 0;
+	return sqlite3_column_int64(pstmt, 0);
+}
+
+/* number of frames in the WAL of @psqlite, from the size of the -wal file */
+static uint64_t db_engine_wal_pages(sqlite3 *psqlite, uint64_t page_size)
+{
+	struct stat node_stat;
+	auto db_path = sqlite3_db_filename(psqlite, "main");
+	if (db_path == nullptr || *db_path == '\0' || page_size == 0)
+		return 0;
+	if (stat((std::string(db_path) + "-wal").c_str(), &node_stat) != 0 ||
+	    node_stat.st_size <= 32)
+		return 0;
+	/* 32-byte file header, 24-byte header per frame */
+	return (node_stat.st_size - 32) / (page_size + 24);
+}
+
+/*
+ * Perform one bounded step of housekeeping on an idle mailbox. Returns the
+ * number of pages that were (approximately) touched and sets *pb_done once
+ * there is nothing left to do. A WAL checkpoint cannot be split; it is
+ * only started when it fits into @max_pages or, when it is bigger than
+ * that, at the start of a pass (@b_fresh). Conversion to
+ * auto_vacuum=INCREMENTAL is only done for stores that fit into a pass.
+ */
+static unsigned int db_engine_maintain_db(DB_ITEM *pdb,
+	unsigned int max_pages, bool b_fresh, bool *pb_done)
+{
+	char sql_string[64];
+	unsigned int pages = 0;
+
+	*pb_done = false;
+	auto page_size = db_engine_query_int(pdb->psqlite, "PRAGMA page_size");
+	if (TRUE == g_wal) {
+		auto wal_pages = db_engine_wal_pages(pdb->psqlite, page_size);
+		if (wal_pages > max_pages && !b_fresh)
+			return 0;
+		int log_pages = 0, ckpt_pages = 0;
+		sqlite3_wal_checkpoint_v2(pdb->psqlite, nullptr,
+			SQLITE_CHECKPOINT_TRUNCATE, &log_pages, &ckpt_pages);
+		pages += std::max(static_cast<uint64_t>(std::max(ckpt_pages, 0)), wal_pages);
+		if (pages >= max_pages)
+			return pages;
+	}
+	if (!pdb->b_maint_optimized) {
+		/* only for this run; the connection keeps serving requests */
+		snprintf(sql_string, arsizeof(sql_string),
+			"PRAGMA analysis_limit=%u", DB_ANALYSIS_LIMIT);
+		sqlite3_exec(pdb->psqlite, sql_string, nullptr, nullptr, nullptr);
+		sqlite3_exec(pdb->psqlite, "PRAGMA optimize", nullptr, nullptr, nullptr);
+		sqlite3_exec(pdb->psqlite, "PRAGMA analysis_limit=0", nullptr, nullptr, nullptr);
+		pages += DB_ANALYSIS_LIMIT / 10;
+		pdb->b_maint_optimized = true;
+		if (pages >= max_pages)
+			return pages;
+	}
+	if (db_engine_query_int(pdb->psqlite, "PRAGMA auto_vacuum") != 2) {
+		/*
+		 * Stores made before auto_vacuum=INCREMENTAL became the default
+		 * need one full VACUUM to switch. It rewrites the whole file, so
+		 * it is charged with page_count.
+		 */
+		auto page_count = db_engine_query_int(pdb->psqlite, "PRAGMA page_count");
+		if (page_count <= g_maint_pages) {
+			if (page_count > max_pages - pages)
+				/* fits into a later pass */
+				return pages;
+			sqlite3_exec(pdb->psqlite, "PRAGMA auto_vacuum=INCREMENTAL",
+				nullptr, nullptr, nullptr);
+			sqlite3_exec(pdb->psqlite, "VACUUM", nullptr, nullptr, nullptr);
+			pages += page_count;
+		}
+		/* bigger stores stay as they are; see db_maintenance_pages */
+		*pb_done = true;
+		return pages;
+	}
+	auto free_pages = db_engine_query_int(pdb->psqlite, "PRAGMA freelist_count");
+	if (pages >= max_pages) {
+		return pages;
+	}
+	auto vac_pages = std::min(free_pages, static_cast<uint64_t>(max_pages - pages));
+	if (vac_pages > 0) {
+		snprintf(sql_string, arsizeof(sql_string),
+			"PRAGMA incremental_vacuum(%llu)", LLU(vac_pages));
+		sqlite3_exec(pdb->psqlite, sql_string, nullptr, nullptr, nullptr);
+		pages += vac_pages;
+	}
+	if (vac_pages == free_pages)
+		*pb_done = true;
+	return pages;
+}
+
+/*
+ * During the configured idle window, run PRAGMA optimize, incremental
+ * vacuum and WAL checkpoints on mailboxes that nobody has used for a
+ * while. At most g_maint_pages are processed per scan pass, and mailboxes
+ * whose lock is held are skipped rather than waited for.
+ */
+static void db_engine_maintenance_pass(time_t now_time)
+{
+	std::vector<DB_ITEM *> cand;
+
+	if (!db_engine_in_maintenance_window(now_time)) {
+		return;
+	}
+	std::unique_lock hhold(g_hash_lock);
+	for (auto &e : g_hash_table) {
+		auto pdb = &e.second;
+		if (0 != pdb->reference || NULL == pdb->psqlite ||
+		    now_time - pdb->last_time < g_maint_idle ||
+		    now_time - pdb->maint_time < DB_MAINTENANCE_INTERVAL)
+			continue;
+		try {
+			cand.push_back(pdb);
+		} catch (const std::bad_alloc &) {
+			break;
+		}
+		/* keep the scan loop from evicting it meanwhile */
+		pdb->reference ++;
+	}
+	hhold.unlock();
+	/*
+	 * Pages beyond the budget of a pass (an oversized checkpoint or
+	 * vacuum) are owed by the following passes. Only this thread
+	 * touches g_maint_debt.
+	 */
+	static uint64_t g_maint_debt;
+	unsigned int full = g_maint_pages;
+	unsigned int budget = g_maint_debt >= full ? 0 : full - g_maint_debt;
+	g_maint_debt -= full - budget;
+	for (auto pdb : cand) {
+		if (!g_notify_stop && budget > 0 && pdb->lock.try_lock()) {
+			bool b_done = false;
+			auto used = db_engine_maintain_db(pdb, budget, budget == full, &b_done);
+			if (used > budget)
+				g_maint_debt += used - budget;
+			budget = used >= budget ? 0 : budget - used;
+			if (b_done) {
+				pdb->b_maint_optimized = false;
+				pdb->maint_time = now_time;
+			}
+			pdb->lock.unlock();
+		}
+		hhold.lock();
+		pdb->reference --;
+		hhold.unlock();
+	}
+}
+
+/*
+ * Write the table states of idle stores the scan thread found dirty, and
+ * evict those that are clean then, including the ones whose states were
+ * dropped after too many failed writes.
+ */
+static void db_engine_evict_dirty(const std::vector<std::pair<std::string, DB_ITEM *>> &dirty)
+{
+	for (const auto &e : dirty) {
+		auto pdb = e.second;
+		if (pdb->lock.try_lock()) {
+			if (time(nullptr) >= pdb->states.next_flush)
+				db_engine_flush_states(pdb);
+			pdb->lock.unlock();
+		}
+		std::lock_guard hhold(g_hash_lock);
+		pdb->reference --;
+		if (0 == pdb->reference && 0 == pdb->states.dirty_time &&
+		    0 == double_list_get_nodes_num(&pdb->tables.table_list) &&
+		    time(nullptr) - pdb->last_time > g_cache_interval)
+			g_hash_table.erase(e.first);
+	}
+}
+
 static void *mdpeng_scanwork(void *param)
 {
 	int count;
 	time_t now_time;
+	std::vector<std::pair<std::string, DB_ITEM *>> dirty;
 
 	count = 0;
 	while (!g_notify_stop) {
@@ -364,7 +1418,7 @@ static void *mdpeng_scanwork(void *param)
 			continue;
 		}
 		count = 0;
-		std::lock_guard hhold(g_hash_lock);
+		std::unique_lock hhold(g_hash_lock);
 		time(&now_time);
 		for (auto it = g_hash_table.begin(); it != g_hash_table.end(); ) {
 			auto pdb = &it->second;
@@ -382,9 +1436,34 @@ static void *mdpeng_scanwork(void *param)
 				++it;
 				continue;
 			}
+			if (g_reclaim_rate > 0 && !pdb->cid_pending.empty()) {
+				/* let db_engine_reclaim_pass drain it first */
+				++it;
+				continue;
+			}
+			if (pdb->states.dirty_time != 0) {
+				/* written by db_engine_evict_dirty, outside g_hash_lock */
+				try {
+					dirty.emplace_back(it->first, pdb);
+					pdb->reference ++;
+				} catch (const std::bad_alloc &) {
+				}
+				++it;
+				continue;
+			}
 			it = g_hash_table.erase(it);
 		}
+		hhold.unlock();
+		db_engine_evict_dirty(dirty);
+		dirty.clear();
+		db_engine_state_pass(now_time);
+		db_engine_maintenance_pass(now_time);
+		/* one pass every 10 seconds */
+		db_engine_reclaim_pass(g_reclaim_rate * 10);
 	}
+	if (g_reclaim_rate > 0)
+		db_engine_reclaim_pass(UINT_MAX);
+	db_engine_state_pass(time(nullptr), true);
 	std::lock_guard hhold(g_hash_lock);
 	g_hash_table.clear();
 	return nullptr;
@@ -474,10 +1553,17 @@ static BOOL db_engine_load_folder_descendant(const char *dir,
 	BOOL b_recursive, uint64_t folder_id, EID_ARRAY *pfolder_ids)
 {
 	char sql_string[128];
+	std::vector<uint64_t> fids;
 	
 	auto pdb = db_engine_get_db(dir);
 	if (pdb == nullptr || pdb->psqlite == nullptr)
 		return FALSE;
+	if (TRUE == common_util_get_subfolders(pdb->psqlite, folder_id, -1, fids)) {
+		for (auto fid : fids)
+			if (!eid_array_append(pfolder_ids, fid))
+				return FALSE;
+		return TRUE;
+	}
 	snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM "
 	          "folders WHERE parent_id=%llu", LLU(folder_id));
 	auto pstmt = gx_sql_prep(pdb->psqlite, sql_string);
@@ -635,6 +1721,35 @@ static void db_engine_notify_search_completion(db_item_ptr &pdb, uint64_t folder
 	}
 }
 
+/*
+ * The prewarm is run in steps, and it stops as soon as anybody else wants
+ * the store (reference counts the waiters too): a logon must wait for one
+ * step at most, and its own requests load what it needs anyway.
+ */
+static void db_engine_prewarm(const char *dir, BOOL b_private)
+{
+	std::vector<uint64_t> fids;
+	
+	exmdb_server_build_environment(FALSE, b_private, dir);
+	auto pdb = db_engine_get_db(dir);
+	if (pdb == nullptr || pdb->psqlite == nullptr ||
+	    !common_util_prewarm_names(pdb->psqlite, TRUE == b_private ?
+	    PRIVATE_FID_IPMSUBTREE : PUBLIC_FID_IPMSUBTREE, fids)) {
+		pdb.reset();
+		exmdb_server_free_environment();
+		return;
+	}
+	for (auto fid : fids) {
+		if (g_notify_stop || pdb->reference > 1)
+			break;
+		common_util_prewarm_counts(pdb->psqlite, fid);
+	}
+	if (TRUE == b_private && !g_notify_stop && pdb->reference <= 1)
+		common_util_prewarm_view(pdb->psqlite, PRIVATE_FID_INBOX);
+	pdb.reset();
+	exmdb_server_free_environment();
+}
+
 static void *mdpeng_thrwork(void *param)
 {
 	int table_num;
@@ -652,9 +1767,16 @@ static void *mdpeng_thrwork(void *param)
 		if (g_notify_stop)
 			break;
 		std::unique_lock lhold(g_list_lock);
+		/* searches are waited for by a client, prewarms are not */
 		pnode = double_list_pop_front(&g_populating_list);
 		if (NULL != pnode) {
 			double_list_append_as_tail(&g_populating_list1, pnode);
+		} else if (g_prewarm_list.size() > 0) {
+			auto item = std::move(g_prewarm_list.front());
+			g_prewarm_list.pop_front();
+			lhold.unlock();
+			db_engine_prewarm(item.first.c_str(), item.second);
+			goto NEXT_SEARCH;
 		}
 		lhold.unlock();
 		if (NULL == pnode) {
@@ -770,6 +1892,10 @@ int db_engine_run()
 		printf("[exmdb_provider]: warning! fail to close"
 			" memory statistic for sqlite engine\n");
 	}
+	if (page_cache_run() != 0) {
+		printf("[exmdb_provider]: warning! falling back to"
+			" per-database page caches\n");
+	}
 	if (SQLITE_OK != sqlite3_initialize()) {
 		printf("[exmdb_provider]: Failed to initialize sqlite engine\n");
 		return -2;
@@ -813,6 +1939,7 @@ void db_engine_stop()
 		}
 	}
 	g_thread_ids.clear();
+	g_prewarm_list.clear();
 	g_hash_table.clear();
 	while ((pnode = double_list_pop_front(&g_populating_list)) != nullptr) {
 		psearch = (POPULATING_NODE*)pnode->pdata;
@@ -870,6 +1997,29 @@ BOOL db_engine_enqueue_populating_criteria(
 	return TRUE;
 }
 
+/*
+ * Have the store opened and its caches loaded in the background, ahead of
+ * the requests that usually follow a logon. A store that is already queued
+ * is not queued again; the request is dropped when the queue is full.
+ */
+BOOL db_engine_enqueue_prewarm(const char *dir, BOOL b_private)
+{
+	static constexpr size_t max_queued = 4096;
+	std::unique_lock lhold(g_list_lock);
+	if (g_prewarm_list.size() >= max_queued ||
+	    std::any_of(g_prewarm_list.cbegin(), g_prewarm_list.cend(),
+	    [&](const auto &e) { return e.first == dir; }))
+		return TRUE;
+	try {
+		g_prewarm_list.emplace_back(dir, b_private);
+	} catch (const std::bad_alloc &) {
+		return FALSE;
+	}
+	lhold.unlock();
+	g_waken_cond.notify_one();
+	return TRUE;
+}
+
 BOOL db_engine_check_populating(const char *dir, uint64_t folder_id)
 {
 	DOUBLE_LIST_NODE *pnode;
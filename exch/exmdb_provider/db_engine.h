@@ -1,8 +1,14 @@
 #pragma once
 #include <atomic>
 #include <cstdint>
+#include <ctime>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <gromox/element_data.hpp>
 #include <gromox/double_list.hpp>
 #include <gromox/mapi_types.hpp>
@@ -91,20 +97,112 @@ struct MEMORY_TABLES {
 	sqlite3 *psqlite = nullptr;
 };
 
+struct TABLE_MEMORY_STATS {
+	uint64_t limit, used, granted, peak, spills;
+	size_t scratch_dbs;
+};
+
+struct SCRATCH_USAGE {
+	std::string dir;
+	uint64_t used = 0, granted = 0;
+	unsigned int scratch_dbs = 0;
+};
+
+/* a saved position and collapse state, see exmdb_server_store_table_state */
+struct TABLE_STATE {
+	uint64_t folder_id = 0;
+	uint32_t table_flags = 0;
+	std::string sorts; /* serialized SORTORDER_SET; empty if not categorized */
+	uint64_t message_id = 0, header_id = 0;
+	uint32_t inst_num = 0;
+	uint8_t header_stat = 0;
+	std::string headers; /* collapse state of header rows */
+	bool b_dirty = false;
+};
+
+/* tmp/state.sqlite3 of a store, read on first use and written back lazily */
+struct TABLE_STATES {
+	bool b_loaded = false;
+	std::string path;
+	uint32_t last_id = 0;
+	/* oldest change not yet written; 0: none. Read without the DB_ITEM lock. */
+	std::atomic<time_t> dirty_time{0};
+	/* after a failed write, no retry before next_flush (see db_engine_flush_states) */
+	std::atomic<time_t> next_flush{0};
+	unsigned int flush_failures = 0;
+	std::map<uint32_t, TABLE_STATE> states;
+};
+
+struct FOLDER_COUNTS {
+	bool b_search = false;
+	uint32_t normal = 0, assoc = 0, unread = 0;
+};
+
+struct FOLDER_NODE {
+	uint64_t parent_id = 0;
+	bool b_deleted = false;
+	uint32_t descendants = 0; /* as counted by PR_FOLDER_CHILD_COUNT */
+	std::vector<uint64_t> children;
+};
+
+/*
+ * State kept alongside the mailbox database connection of a DB_ITEM,
+ * only used under the DB_ITEM lock; see common_util.cpp.
+ */
+struct DB_CACHE {
+	/* cids [cid_next, cid_end] are reserved but not yet handed out */
+	uint64_t cid_next = 1, cid_end = 0;
+	/* a rollback may have undone the persisted reservation */
+	bool b_cid_stale = true;
+	/* named_properties, keyed by the ASCII-lowercased name_string */
+	bool b_names = false;
+	std::unordered_map<std::string, uint16_t> name_to_id;
+	std::unordered_map<uint16_t, std::string> id_to_name;
+	/*
+	 * Message counters, kept current by the temporary triggers of
+	 * common_util_init_db_cache. Folders are loaded on first use; search
+	 * folders (b_search) are always counted in SQL.
+	 */
+	bool b_private = false, b_counting = false;
+	bool b_store_counts = false;
+	uint32_t store_normal = 0, store_assoc = 0;
+	std::unordered_map<uint64_t, FOLDER_COUNTS> folder_counts;
+	/*
+	 * Folders whose counters the running statement changed, and the
+	 * connection's total change count before it (-1: none changed).
+	 */
+	std::vector<uint64_t> stmt_fids;
+	int stmt_changes = -1;
+	/* folder hierarchy, rebuilt on first use after any folder change */
+	bool b_tree = false;
+	std::unordered_map<uint64_t, FOLDER_NODE> tree;
+};
 struct DB_ITEM {
 	~DB_ITEM();
 	/* client reference count, item can be flushed into file system only count is 0 */
 	std::atomic<int> reference{0};
 	time_t last_time = 0;
+	time_t maint_time = 0; /* last completed background maintenance */
+	bool b_maint_optimized = false;
 	std::timed_mutex lock;
 	sqlite3 *psqlite = nullptr;
 	DOUBLE_LIST dynamic_list{};	/* dynamic search list */
 	DOUBLE_LIST nsub_list{};
 	DOUBLE_LIST instance_list{};
 	MEMORY_TABLES tables{};
+	TABLE_STATES states;
+	DB_CACHE cache;
+	/* cids whose last reference may have gone; see db_engine_reclaim_pass */
+	std::vector<std::pair<uint64_t, bool>> cid_pending; /* cid, b_attachment */
+	bool b_cid_index = false; /* attachment_cid_index exists */
 };
 
 extern void db_engine_init(size_t table_size, int cache_interval, BOOL async, BOOL wal, uint64_t mmap_size, int threads_num);
+extern void db_engine_set_maintenance(int start, int end, int idle_time, unsigned int max_pages);
+extern void db_engine_set_table_memory(uint64_t limit);
+extern void db_engine_set_reclaim_rate(unsigned int cids_per_sec);
+extern void db_engine_hold_reclaim(const char *dir, bool);
+extern void db_engine_get_reclaim_stats(uint64_t *reclaimed, uint64_t *pending);
 extern int db_engine_run();
 extern void db_engine_stop();
 extern void db_engine_free();
@@ -118,12 +216,22 @@ class db_item_deleter {
 using db_item_ptr = std::unique_ptr<DB_ITEM, db_item_deleter>;
 
 extern db_item_ptr db_engine_get_db(const char *dir);
+extern DB_CACHE *db_engine_get_cache(sqlite3 *);
 BOOL db_engine_unload_db(const char *path);
+extern BOOL db_engine_backup_db(const char *dir, sqlite3 *pdst, bool (*)(int, int));
+extern BOOL db_engine_open_scratch(const char *dir, sqlite3 **);
+extern void db_engine_close_scratch(sqlite3 *);
+extern void db_engine_account_scratch(sqlite3 *);
+extern void db_engine_get_table_memory(TABLE_MEMORY_STATS *);
+extern std::vector<SCRATCH_USAGE> db_engine_get_scratch_usage();
+extern BOOL db_engine_load_states(DB_ITEM *, const char *dir);
+extern BOOL db_engine_flush_states(DB_ITEM *);
 BOOL db_engine_enqueue_populating_criteria(
 	const char *dir, uint32_t cpid, uint64_t folder_id,
 	BOOL b_recursive, const RESTRICTION *prestriction,
 	const LONGLONG_ARRAY *pfolder_ids);
 BOOL db_engine_check_populating(const char *dir, uint64_t folder_id);
+extern BOOL db_engine_enqueue_prewarm(const char *dir, BOOL b_private);
 extern void db_engine_update_dynamic(db_item_ptr &, uint64_t folder_id, uint32_t search_flags, const RESTRICTION *prestriction, const LONGLONG_ARRAY *pfolder_ids);
 extern void db_engine_delete_dynamic(db_item_ptr &, uint64_t folder_id);
 extern void db_engine_proc_dynamic_event(db_item_ptr &, uint32_t cpid, int event_type, uint64_t id1, uint64_t id2, uint64_t id3);
@@ -662,6 +662,12 @@ static BOOL exmdb_parser_dispatch2(const EXMDB_REQUEST *prequest,
 		       q.username, q.cpid, q.message_id,
 			&presponse->payload.read_message.pmsgctnt);
 	}
+	case exmdb_callid::READ_MESSAGES: {
+		const auto &q = prequest->payload.read_messages;
+		return exmdb_server_read_messages(prequest->dir,
+		       q.username, q.cpid, q.pmessage_ids, q.size_limit,
+			&presponse->payload.read_messages.msglst);
+	}
 	case exmdb_callid::GET_CONTENT_SYNC: {
 		auto &q = prequest->payload.get_content_sync;
 		auto &r = presponse->payload.get_content_sync;
@@ -735,6 +741,20 @@ static BOOL exmdb_parser_dispatch2(const EXMDB_REQUEST *prequest,
 				&presponse->payload.get_public_folder_unread_count.count);
 	case exmdb_callid::UNLOAD_STORE:
 		return exmdb_server_unload_store(prequest->dir);
+	case exmdb_callid::BACKUP_STORE:
+		return exmdb_server_backup_store(prequest->dir,
+			prequest->payload.backup_store.dest_dir);
+	case exmdb_callid::READ_INSTANCE_PROPERTY_RANGE:
+		return exmdb_server_read_instance_property_range(prequest->dir,
+			prequest->payload.read_instance_property_range.instance_id,
+			prequest->payload.read_instance_property_range.proptag,
+			prequest->payload.read_instance_property_range.offset,
+			prequest->payload.read_instance_property_range.length,
+			&presponse->payload.read_instance_property_range.b_found,
+			&presponse->payload.read_instance_property_range.total,
+			&presponse->payload.read_instance_property_range.data);
+	case exmdb_callid::PREWARM_STORE:
+		return exmdb_server_prewarm_store(prequest->dir);
 	default:
 		return FALSE;
 	}
@@ -47,6 +47,7 @@ int exmdb_server_run()
 
 void exmdb_server_stop()
 {
+	exmdb_server_backup_stop();
 	if (NULL != g_ctx_allocator) {
 		lib_buffer_free(g_ctx_allocator);
 		g_ctx_allocator = NULL;
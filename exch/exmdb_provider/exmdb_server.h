@@ -216,6 +216,7 @@ BOOL exmdb_server_get_instance_all_proptags(
 BOOL exmdb_server_get_instance_properties(
 	const char *dir, uint32_t size_limit, uint32_t instance_id,
 	const PROPTAG_ARRAY *pproptags, TPROPVAL_ARRAY *ppropvals);
+extern BOOL exmdb_server_read_instance_property_range(const char *dir, uint32_t instance_id, uint32_t proptag, uint32_t offset, uint32_t length, BOOL *pb_found, uint32_t *ptotal, BINARY *pdata);
 BOOL exmdb_server_set_instance_properties(const char *dir,
 	uint32_t instance_id, const TPROPVAL_ARRAY *pproperties,
 	PROBLEM_ARRAY *pproblems);
@@ -313,6 +314,7 @@ BOOL exmdb_server_delivery_message(const char *dir,
 extern BOOL exmdb_server_write_message(const char *dir, const char *account, uint32_t cpid, uint64_t folder_id, const MESSAGE_CONTENT *, gxerr_t *);
 BOOL exmdb_server_read_message(const char *dir, const char *username,
 	uint32_t cpid, uint64_t message_id, MESSAGE_CONTENT **ppmsgctnt);
+extern BOOL exmdb_server_read_messages(const char *dir, const char *username, uint32_t cpid, const EID_ARRAY *pmessage_ids, uint32_t size_limit, MESSAGE_LIST *);
 BOOL exmdb_server_get_content_sync(const char *dir,
 	uint64_t folder_id, const char *username, const IDSET *pgiven,
 	const IDSET *pseen, const IDSET *pseen_fai, const IDSET *pread,
@@ -341,5 +343,11 @@ BOOL exmdb_server_get_public_folder_unread_count(const char *dir,
 	const char *username, uint64_t folder_id, uint32_t *pcount);
 void exmdb_server_register_proc(void *pproc);
 BOOL exmdb_server_unload_store(const char *dir);
+BOOL exmdb_server_backup_store(const char *dir, const char *dest_dir);
+extern void exmdb_server_set_backup_root(const char *);
+extern void exmdb_server_backup_status(char *result, int length);
+extern void exmdb_server_backup_stop();
+extern BOOL exmdb_server_verify_counters(const char *dir, int *pmismatches);
+extern BOOL exmdb_server_prewarm_store(const char *dir);
 extern void *instance_read_cid_content(uint64_t cid, uint32_t *plen);
 extern int instance_get_message_body(MESSAGE_CONTENT *, unsigned int tag, unsigned int cpid, TPROPVAL_ARRAY *);
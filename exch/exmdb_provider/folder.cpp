@@ -546,30 +546,13 @@ BOOL exmdb_server_create_folder_by_properties(const char *dir,
 		if (!b_result)
 			return TRUE;
 	}
-	snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM "
-	          "folders WHERE parent_id=%llu", LLU(parent_id));
-	pstmt = gx_sql_prep(pdb->psqlite, sql_string);
-	if (pstmt == nullptr) {
-		return FALSE;
-	}
-	snprintf(sql_string, arsizeof(sql_string), "SELECT propval "
-		"FROM folder_properties WHERE folder_id=?"
-	        " AND proptag=%u", PR_DISPLAY_NAME);
-	auto pstmt1 = gx_sql_prep(pdb->psqlite, sql_string);
-	if (pstmt1 == nullptr) {
+	if (FALSE == common_util_get_folder_by_name(pdb->psqlite,
+	    parent_id, pname, &tmp_val)) {
 		return FALSE;
 	}
-	while (SQLITE_ROW == sqlite3_step(pstmt)) {
-		tmp_val = sqlite3_column_int64(pstmt, 0);
-		sqlite3_bind_int64(pstmt1, 1, tmp_val);
-		if (SQLITE_ROW == sqlite3_step(pstmt1)) {
-			if (strcasecmp(pname, reinterpret_cast<const char *>(sqlite3_column_text(pstmt1, 0))) == 0)
-				return TRUE;
-		}
-		sqlite3_reset(pstmt1);
+	if (0 != tmp_val) {
+		return TRUE;
 	}
-	pstmt1.finalize();
-	pstmt.finalize();
 	if (type == FOLDER_GENERIC) {
 		snprintf(sql_string, arsizeof(sql_string), "SELECT "
 			"max(range_end) FROM allocated_eids");
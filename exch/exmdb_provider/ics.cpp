@@ -60,7 +60,7 @@ IDSET_CACHE::~IDSET_CACHE()
 {
 	pstmt.finalize();
 	if (psqlite != nullptr)
-		sqlite3_close(psqlite);
+		db_engine_close_scratch(psqlite);
 	double_list_free(&range_list);
 }
 
@@ -74,8 +74,7 @@ static BOOL ics_init_idset_cache(const IDSET *pset, IDSET_CACHE *pcache)
 	RANGE_NODE *prange_node1;
 	DOUBLE_LIST *prange_list;
 	
-	if (SQLITE_OK != sqlite3_open_v2(":memory:", &pcache->psqlite,
-		SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL)) {
+	if (!db_engine_open_scratch(exmdb_server_get_dir(), &pcache->psqlite)) {
 		return FALSE;
 	}
 	snprintf(sql_string, arsizeof(sql_string), "CREATE TABLE id_vals"
@@ -130,6 +129,7 @@ static BOOL ics_init_idset_cache(const IDSET *pset, IDSET_CACHE *pcache)
 			}
 		}
 	}
+	db_engine_account_scratch(pcache->psqlite);
 	return TRUE;
 }
 
@@ -216,11 +216,10 @@ BOOL exmdb_server_get_content_sync(const char *dir,
 	*pnormal_count = 0;
 	*pnormal_total = 0;
 	auto b_private = exmdb_server_check_private();
-	if (SQLITE_OK != sqlite3_open_v2(":memory:", &psqlite,
-		SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL)) {
+	if (!db_engine_open_scratch(exmdb_server_get_dir(), &psqlite)) {
 		return FALSE;
 	}
-	auto cl_0 = make_scope_exit([&]() { sqlite3_close(psqlite); });
+	auto cl_0 = make_scope_exit([&]() { db_engine_close_scratch(psqlite); });
 	snprintf(sql_string, arsizeof(sql_string), "CREATE TABLE existence"
 			" (message_id INTEGER PRIMARY KEY)");
 	if (SQLITE_OK != sqlite3_exec(psqlite,
@@ -828,12 +827,11 @@ BOOL exmdb_server_get_hierarchy_sync(const char *dir,
 	PROPTAG_ARRAY proptags;
 	uint32_t tmp_proptags[0x8000];
 	
-	if (SQLITE_OK != sqlite3_open_v2(":memory:", &psqlite,
-		SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL)) {
+	if (!db_engine_open_scratch(exmdb_server_get_dir(), &psqlite)) {
 		return FALSE;
 	}
 	{
-	auto cl_0 = make_scope_exit([&]() { sqlite3_close(psqlite); });
+	auto cl_0 = make_scope_exit([&]() { db_engine_close_scratch(psqlite); });
 	snprintf(sql_string, arsizeof(sql_string), "CREATE TABLE existence "
 				"(folder_id INTEGER PRIMARY KEY)");
 	if (SQLITE_OK != sqlite3_exec(psqlite,
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 // SPDX-FileCopyrightText: 2020–2021 grommunio GmbH
 // This file is part of Gromox.
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <gromox/database.h>
@@ -2045,9 +2046,33 @@ static BOOL instance_get_message_subject(
 	return TRUE;
 }
 
+/*
+ * Attachment data, HTML and compressed RTF stay in their cid files until a
+ * client actually asks for them. With a nonzero size_limit, data above the
+ * limit is not read at all; the caller gets ecMAPIOOM and is expected to
+ * open a stream instead.
+ */
+static BOOL instance_check_cid_size(uint64_t cid, uint32_t size_limit)
+{
+	char path[256];
+	struct stat node_stat;
+	
+	if (0 == size_limit) {
+		return TRUE;
+	}
+	snprintf(path, sizeof(path), "%s/cid/%llu",
+		exmdb_server_get_dir(), LLU(cid));
+	if (0 != stat(path, &node_stat)) {
+		/* let instance_read_cid_content report the problem */
+		return TRUE;
+	}
+	return static_cast<uint64_t>(node_stat.st_size) <= size_limit ? TRUE : false;
+}
+
 static BOOL instance_get_attachment_properties(uint32_t cpid,
 	const uint64_t *pmessage_id, ATTACHMENT_CONTENT *pattachment,
-	const PROPTAG_ARRAY *pproptags, TPROPVAL_ARRAY *ppropvals)
+	uint32_t size_limit, const PROPTAG_ARRAY *pproptags,
+	TPROPVAL_ARRAY *ppropvals)
 {
 	int i;
 	BINARY *pbin;
@@ -2055,6 +2080,7 @@ static BOOL instance_get_attachment_properties(uint32_t cpid,
 	uint32_t length;
 	uint32_t proptag;
 	uint16_t proptype;
+	static const uint32_t err_code = ecMAPIOOM;
 	
 	ppropvals->count = 0;
 	ppropvals->ppropval = cu_alloc<TAGGED_PROPVAL>(pproptags->count);
@@ -2168,6 +2194,21 @@ static BOOL instance_get_attachment_properties(uint32_t cpid,
 			pbin = static_cast<BINARY *>(tpropval_array_get_propval(
 			       &pattachment->proplist, PR_ATTACH_DATA_BIN));
 			if (NULL == pbin) {
+				pvalue = tpropval_array_get_propval(
+							&pattachment->proplist,
+							ID_TAG_ATTACHDATABINARY);
+				if (NULL == pvalue) {
+					pvalue = tpropval_array_get_propval(
+					         &pattachment->proplist,
+					         ID_TAG_ATTACHDATAOBJECT);
+				}
+				if (NULL != pvalue && !instance_check_cid_size(
+				    *static_cast<uint64_t *>(pvalue), size_limit)) {
+					vc.proptag = CHANGE_PROP_TYPE(pproptags->pproptag[i], PT_ERROR);
+					vc.pvalue = deconst(&err_code);
+					ppropvals->count ++;
+					continue;
+				}
 				pvalue = tpropval_array_get_propval(
 							&pattachment->proplist,
 							ID_TAG_ATTACHDATABINARY);
@@ -2228,6 +2269,13 @@ static BOOL instance_get_attachment_properties(uint32_t cpid,
 			else
 				pvalue = tpropval_array_get_propval(
 					&pattachment->proplist, ID_TAG_ATTACHDATAOBJECT);
+			if (NULL != pvalue && !instance_check_cid_size(
+			    *static_cast<uint64_t *>(pvalue), size_limit)) {
+				vc.proptag = CHANGE_PROP_TYPE(pproptags->pproptag[i], PT_ERROR);
+				vc.pvalue = deconst(&err_code);
+				ppropvals->count ++;
+				continue;
+			}
 			if (NULL != pvalue) {
 				pvalue = instance_read_cid_content(
 						*(uint64_t*)pvalue, &length);
@@ -2261,6 +2309,7 @@ BOOL exmdb_server_get_instance_properties(
 	uint32_t length;
 	uint32_t proptag;
 	MESSAGE_CONTENT *pmsgctnt;
+	static const uint32_t oom_code = ecMAPIOOM;
 	
 	auto pdb = db_engine_get_db(dir);
 	if (pdb == nullptr || pdb->psqlite == nullptr)
@@ -2279,7 +2328,7 @@ BOOL exmdb_server_get_instance_properties(
 		if (FALSE == instance_get_attachment_properties(
 		    pinstance->cpid, static_cast<uint64_t *>(pvalue),
 		    static_cast<ATTACHMENT_CONTENT *>(pinstance->pcontent),
-			pproptags, ppropvals)) {
+		    size_limit, pproptags, ppropvals)) {
 			return FALSE;
 		}
 		return TRUE;
@@ -2371,6 +2420,18 @@ BOOL exmdb_server_get_instance_properties(
 		case PR_HTML:
 		case CHANGE_PROP_TYPE(PR_HTML, PT_UNSPECIFIED):
 		case PR_RTF_COMPRESSED: {
+			pvalue = pproptags->pproptag[i] == PR_HTML ?
+			         tpropval_array_get_propval(&pmsgctnt->proplist, ID_TAG_HTML) :
+			         pproptags->pproptag[i] == PR_RTF_COMPRESSED ?
+			         tpropval_array_get_propval(&pmsgctnt->proplist, ID_TAG_RTFCOMPRESSED) :
+			         nullptr;
+			if (NULL != pvalue && !instance_check_cid_size(
+			    *static_cast<uint64_t *>(pvalue), size_limit)) {
+				vc.proptag = CHANGE_PROP_TYPE(pproptags->pproptag[i], PT_ERROR);
+				vc.pvalue = deconst(&oom_code);
+				ppropvals->count ++;
+				continue;
+			}
 			auto ret = instance_get_message_body(pmsgctnt, pproptags->pproptag[i], pinstance->cpid, ppropvals);
 			if (ret < 0) {
 				return false;
@@ -2560,6 +2621,106 @@ BOOL exmdb_server_get_instance_properties(
 	return TRUE;
 }
 
+/*
+ * Reads a byte range of a binary stream property (attachment data, HTML,
+ * compressed RTF) of an instance. If the value is still backed by its cid
+ * file, only the requested range is read from disk. PR_BODY_W is served as
+ * its UTF-8 text, without terminator. *pb_found is false if the property
+ * cannot be served this way, e.g. because it needs a body conversion; the
+ * caller should then fall back to get_instance_properties.
+ */
+BOOL exmdb_server_read_instance_property_range(const char *dir,
+	uint32_t instance_id, uint32_t proptag, uint32_t offset,
+	uint32_t length, BOOL *pb_found, uint32_t *ptotal, BINARY *pdata)
+{
+	uint32_t id_tag;
+	char path[256];
+	BINARY tmp_bin;
+	uint32_t skip = 0;
+	struct stat node_stat;
+	TPROPVAL_ARRAY *pproplist;
+	
+	*pb_found = FALSE;
+	*ptotal = 0;
+	pdata->cb = 0;
+	pdata->pv = nullptr;
+	auto pdb = db_engine_get_db(dir);
+	if (pdb == nullptr || pdb->psqlite == nullptr)
+		return FALSE;
+	auto pinstance = instance_get_instance(pdb, instance_id);
+	if (NULL == pinstance) {
+		return FALSE;
+	}
+	if (INSTANCE_TYPE_ATTACHMENT == pinstance->type) {
+		pproplist = &static_cast<ATTACHMENT_CONTENT *>(pinstance->pcontent)->proplist;
+		switch (proptag) {
+		case PR_ATTACH_DATA_BIN: id_tag = ID_TAG_ATTACHDATABINARY; break;
+		case PR_ATTACH_DATA_OBJ: id_tag = ID_TAG_ATTACHDATAOBJECT; break;
+		default: return TRUE;
+		}
+	} else {
+		pproplist = &static_cast<MESSAGE_CONTENT *>(pinstance->pcontent)->proplist;
+		switch (proptag) {
+		case PR_BODY_W: id_tag = ID_TAG_BODY; break;
+		case PR_HTML: id_tag = ID_TAG_HTML; break;
+		case PR_RTF_COMPRESSED: id_tag = ID_TAG_RTFCOMPRESSED; break;
+		default: return TRUE;
+		}
+	}
+	auto pvalue = tpropval_array_get_propval(pproplist, proptag);
+	auto pbin = static_cast<BINARY *>(pvalue);
+	if (NULL != pvalue && PR_BODY_W == proptag) {
+		tmp_bin.cb = strlen(static_cast<char *>(pvalue));
+		tmp_bin.pv = pvalue;
+		pbin = &tmp_bin;
+	}
+	if (NULL != pbin) {
+		/* value was set on the instance and lives in memory */
+		*pb_found = TRUE;
+		*ptotal = pbin->cb;
+		if (offset >= pbin->cb || 0 == length) {
+			return TRUE;
+		}
+		pdata->cb = std::min(length, pbin->cb - offset);
+		pdata->pv = common_util_alloc(pdata->cb);
+		if (NULL == pdata->pv) {
+			return FALSE;
+		}
+		memcpy(pdata->pv, pbin->pb + offset, pdata->cb);
+		return TRUE;
+	}
+	auto pcid = static_cast<uint64_t *>(tpropval_array_get_propval(pproplist, id_tag));
+	if (NULL == pcid) {
+		return TRUE;
+	}
+	snprintf(path, arsizeof(path), "%s/cid/%llu", exmdb_server_get_dir(), LLU(*pcid));
+	wrapfd fd = open(path, O_RDONLY);
+	if (fd.get() < 0 || fstat(fd.get(), &node_stat) != 0 ||
+	    static_cast<uint64_t>(node_stat.st_size) > UINT32_MAX) {
+		return FALSE;
+	}
+	*pb_found = TRUE;
+	*ptotal = node_stat.st_size;
+	if (ID_TAG_BODY == id_tag) {
+		/* UTF-8 length marker ahead, NUL at the end */
+		skip = sizeof(uint32_t);
+		*ptotal = *ptotal > skip ? *ptotal - skip - 1 : 0;
+	}
+	if (offset >= *ptotal || 0 == length) {
+		return TRUE;
+	}
+	pdata->cb = std::min(length, *ptotal - offset);
+	pdata->pv = common_util_alloc(pdata->cb);
+	if (NULL == pdata->pv) {
+		return FALSE;
+	}
+	if (pread(fd.get(), pdata->pv, pdata->cb, skip + offset) !=
+	    static_cast<ssize_t>(pdata->cb)) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
 BOOL exmdb_server_set_instance_properties(const char *dir,
 	uint32_t instance_id, const TPROPVAL_ARRAY *pproperties,
 	PROBLEM_ARRAY *pproblems)
@@ -3427,7 +3588,7 @@ BOOL exmdb_server_query_message_instance_attachment_table(
 			}
 			if (FALSE == instance_get_attachment_properties(
 			    pinstance->cpid, static_cast<uint64_t *>(pvalue),
-			    pattachments->pplist[i],
+			    pattachments->pplist[i], 0,
 				pproptags, pset->pparray[pset->count])) {
 				return FALSE;
 			}
@@ -3450,7 +3611,7 @@ BOOL exmdb_server_query_message_instance_attachment_table(
 			}
 			if (FALSE == instance_get_attachment_properties(
 			    pinstance->cpid, static_cast<uint64_t *>(pvalue),
-			    pattachments->pplist[i],
+			    pattachments->pplist[i], 0,
 				pproptags, pset->pparray[pset->count])) {
 				return FALSE;
 			}
@@ -14,6 +14,7 @@
 #include "common_util.h"
 #include <gromox/config_file.hpp>
 #include "db_engine.h"
+#include "page_cache.h"
 #include <gromox/util.hpp>
 #include <cstring>
 #include <cstdlib>
@@ -27,7 +28,12 @@ DECLARE_API();
 static std::shared_ptr<CONFIG_FILE> g_config_during_init;
 
 static constexpr cfg_directive cfg_default_values[] = {
+	{"backup_root", ""},
 	{"cache_interval", "2h", CFG_TIME, "1s"},
+	{"cid_reclaim_rate", "100", CFG_SIZE},
+	{"db_maintenance_idle", "15min", CFG_TIME, "1min"},
+	{"db_maintenance_pages", "1000", CFG_SIZE, "1"},
+	{"db_maintenance_window", ""},
 	{"exrpc_debug", "0"},
 	{"listen_ip", "::1"},
 	{"listen_port", "5000"},
@@ -41,8 +47,10 @@ static constexpr cfg_directive cfg_default_values[] = {
 	{"rpc_proxy_connection_num", "10", CFG_SIZE, "0"},
 	{"separator_for_bounce", ";"},
 	{"sqlite_mmap_size", "0", CFG_SIZE},
+	{"sqlite_page_cache_size", "0", CFG_SIZE},
 	{"sqlite_synchronous", "false", CFG_BOOL},
 	{"sqlite_wal_mode", "false", CFG_BOOL},
+	{"table_memory_limit", "0", CFG_SIZE},
 	{"table_size", "5000", CFG_SIZE, "100"},
 	{"x500_org_name", "Gromox default"},
 	{},
@@ -61,6 +69,14 @@ static void console_talk(int argc, char **argv, char *result, int length)
 	char help_string[] = "250 exmdb provider help information:\r\n"
 						 "\t%s unload <maildir>\r\n"
 						 "\t    --unload the store\r\n"
+						 "\t%s backup <maildir> <destdir>\r\n"
+						 "\t    --copy the store to destdir (below backup_root) in the background\r\n"
+						 "\t%s backup status\r\n"
+						 "\t    --print the progress or outcome of the last backup\r\n"
+						 "\t%s scratch\r\n"
+						 "\t    --print the scratch database memory by mailbox\r\n"
+						 "\t%s verify <maildir>\r\n"
+						 "\t    --check the cached message counters of a loaded store\r\n"
 						 "\t%s info\r\n"
 						 "\t    --print the module information";
 
@@ -69,19 +85,69 @@ static void console_talk(int argc, char **argv, char *result, int length)
 		return;
 	}
 	if (2 == argc && 0 == strcmp("--help", argv[1])) {
-		snprintf(result, length, help_string, argv[0], argv[0]);
+		snprintf(result, length, help_string, argv[0], argv[0], argv[0],
+		         argv[0], argv[0], argv[0]);
 		result[length - 1] = '\0';
 		return;
 	}
 	if (2 == argc && 0 == strcmp("info", argv[1])) {
+		PAGE_CACHE_STATS pcs;
+		TABLE_MEMORY_STATS tms;
+		uint64_t reclaimed, reclaim_pending;
+		char used_buff[32], budget_buff[32], peak_buff[32];
+		char tbl_used_buff[32], tbl_limit_buff[32], tbl_peak_buff[32];
+
+		page_cache_get_stats(&pcs);
+		bytetoa(pcs.used, used_buff);
+		bytetoa(pcs.budget, budget_buff);
+		bytetoa(pcs.peak, peak_buff);
+		db_engine_get_table_memory(&tms);
+		bytetoa(tms.used, tbl_used_buff);
+		bytetoa(tms.peak, tbl_peak_buff);
+		if (0 == tms.limit)
+			gx_strlcpy(tbl_limit_buff, "unlimited", arsizeof(tbl_limit_buff));
+		else
+			bytetoa(tms.limit, tbl_limit_buff);
+		db_engine_get_reclaim_stats(&reclaimed, &reclaim_pending);
+		auto lookups = pcs.hits + pcs.misses;
 		snprintf(result, length,
 			"250 exmdb provider information:\r\n"
 			"\talive proxy connections    %d\r\n"
 			"\tlost proxy connections     %d\r\n"
-			"\talive router connections   %d",
+			"\talive router connections   %d\r\n"
+			"\tpage cache used            %s of %s (peak %s)\r\n"
+			"\tpage cache hit rate        %.1f%% (%llu/%llu)\r\n"
+			"\tpage cache evictions       %llu\r\n"
+			"\tscratch memory             %s (peak %s, limit %s)\r\n"
+			"\tscratch databases          %zu (%llu pages spilled)\r\n"
+			"\tcid files reclaimed        %llu (%llu pending)",
 			exmdb_client_get_param(ALIVE_PROXY_CONNECTIONS),
 			exmdb_client_get_param(LOST_PROXY_CONNECTIONS),
-			exmdb_parser_get_param(ALIVE_ROUTER_CONNECTIONS));
+			exmdb_parser_get_param(ALIVE_ROUTER_CONNECTIONS),
+			used_buff, budget_buff, peak_buff,
+			lookups == 0 ? 0.0 : 100.0 * pcs.hits / lookups,
+			static_cast<unsigned long long>(pcs.hits),
+			static_cast<unsigned long long>(lookups),
+			static_cast<unsigned long long>(pcs.evictions),
+			tbl_used_buff, tbl_peak_buff, tbl_limit_buff, tms.scratch_dbs,
+			static_cast<unsigned long long>(tms.spills),
+			static_cast<unsigned long long>(reclaimed),
+			static_cast<unsigned long long>(reclaim_pending));
+		return;
+	}
+	if (2 == argc && 0 == strcmp("scratch", argv[1])) {
+		char used_buff[32], granted_buff[32];
+		int offset = snprintf(result, length,
+		             "250 scratch memory by mailbox:");
+		for (const auto &u : db_engine_get_scratch_usage()) {
+			if (offset >= length - 1)
+				break;
+			bytetoa(u.used, used_buff);
+			bytetoa(u.granted, granted_buff);
+			offset += snprintf(result + offset, length - offset,
+			          "\r\n\t%s %s (share %s, %u databases)", u.dir.c_str(),
+			          used_buff, granted_buff, u.scratch_dbs);
+		}
 		return;
 	}
 	if (3 == argc && 0 == strcmp("unload", argv[1])) {
@@ -92,6 +158,29 @@ static void console_talk(int argc, char **argv, char *result, int length)
 		}
 		return;
 	}
+	if (3 == argc && 0 == strcmp("verify", argv[1])) {
+		int mismatches = 0;
+		if (TRUE == exmdb_server_verify_counters(argv[2], &mismatches)) {
+			snprintf(result, length, "250 counters verified, "
+			         "%d mismatches corrected", mismatches);
+		} else {
+			gx_strlcpy(result, "550 failed to verify counters", length);
+		}
+		return;
+	}
+	if (3 == argc && 0 == strcmp("backup", argv[1]) &&
+	    0 == strcmp("status", argv[2])) {
+		exmdb_server_backup_status(result, length);
+		return;
+	}
+	if (4 == argc && 0 == strcmp("backup", argv[1])) {
+		if (TRUE == exmdb_server_backup_store(argv[2], argv[3])) {
+			gx_strlcpy(result, "250 backup store started", length);
+		} else {
+			gx_strlcpy(result, "550 failed to start backup of store", length);
+		}
+		return;
+	}
 	snprintf(result, length, "550 invalid argument %s", argv[1]);
     return;
 }
@@ -110,6 +199,22 @@ static bool exmdb_provider_reload(std::shared_ptr<CONFIG_FILE> pconfig)
 	}
 	try {
 		g_exrpc_debug = pconfig->get_ll("exrpc_debug");
+		exmdb_server_set_backup_root(pconfig->get_value("backup_root"));
+		db_engine_set_table_memory(pconfig->get_ll("table_memory_limit"));
+		db_engine_set_reclaim_rate(pconfig->get_ll("cid_reclaim_rate"));
+		unsigned int h1, m1, h2, m2;
+		auto window = pconfig->get_value("db_maintenance_window");
+		if (*window == '\0') {
+			db_engine_set_maintenance(0, 0, 0, 0);
+		} else if (sscanf(window, "%u:%u-%u:%u", &h1, &m1, &h2, &m2) != 4 ||
+		    h1 > 23 || h2 > 23 || m1 > 59 || m2 > 59) {
+			printf("[exmdb_provider]: invalid db_maintenance_window \"%s\"\n", window);
+			db_engine_set_maintenance(0, 0, 0, 0);
+		} else {
+			db_engine_set_maintenance(h1 * 60 + m1, h2 * 60 + m2,
+				pconfig->get_ll("db_maintenance_idle"),
+				pconfig->get_ll("db_maintenance_pages"));
+		}
 	} catch (const cfg_error &) {
 		return false;
 	}
@@ -203,6 +308,14 @@ static BOOL svc_exmdb_provider(int reason, void **ppdata) try
 			printf("[exmdb_provider]: sqlite mmap_size is %s\n", temp_buff);
 		}
 		
+		uint64_t page_cache_size = pconfig->get_ll("sqlite_page_cache_size");
+		if (0 == page_cache_size) {
+			printf("[exmdb_provider]: sqlite global page cache is disabled\n");
+		} else {
+			bytetoa(page_cache_size, temp_buff);
+			printf("[exmdb_provider]: sqlite global page cache size is %s\n", temp_buff);
+		}
+		
 		int populating_num = pconfig->get_ll("populating_threads_num");
 		printf("[exmdb_provider]: populating threads"
 				" number is %d\n", populating_num);
@@ -211,6 +324,7 @@ static BOOL svc_exmdb_provider(int reason, void **ppdata) try
 		
 		common_util_init(org_name, max_msg_count, max_rule, max_ext_rule);
 		bounce_producer_init(separator);
+		page_cache_init(page_cache_size);
 		db_engine_init(table_size, cache_interval,
 			b_async ? TRUE : false, b_wal ? TRUE : false, mmap_size, populating_num);
 		exmdb_server_init();
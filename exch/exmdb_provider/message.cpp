@@ -4049,7 +4049,7 @@ static bool op_delegate(const char *from_address, const char *account,
 				  std::to_string(common_util_sequence_ID()) + "." +
 				  get_host_ID();
 		auto eml_path = maildir + "/eml/"s + mid_string;
-		if (!common_util_copy_file(tmp_path1, eml_path.c_str()))
+		if (!common_util_link_file(tmp_path1, eml_path.c_str()))
 			continue;
 		char tmp_buff[MAX_DIGLEN];
 		strcpy(tmp_buff, pdigest);
@@ -4484,7 +4484,7 @@ static bool opx_delegate(const char *from_address, const char *account,
 				  std::to_string(common_util_sequence_ID()) + "." +
 				  get_host_ID();
 		auto eml_path = maildir + "/eml/"s + mid_string;
-		if (!common_util_copy_file(tmp_path1, eml_path.c_str()))
+		if (!common_util_link_file(tmp_path1, eml_path.c_str()))
 			continue;
 		char tmp_buff[MAX_DIGLEN];
 		strcpy(tmp_buff, pdigest);
@@ -5096,6 +5096,61 @@ BOOL exmdb_server_read_message(const char *dir, const char *username,
 	return TRUE;
 }
 
+/*
+ * Reads messages in the given order until the PR_MESSAGE_SIZE of those
+ * read adds up to size_limit; the first one is always read. The result
+ * can hence be shorter than pmessage_ids.
+ */
+BOOL exmdb_server_read_messages(const char *dir, const char *username,
+	uint32_t cpid, const EID_ARRAY *pmessage_ids, uint32_t size_limit,
+	MESSAGE_LIST *pmsglst)
+{
+	uint64_t total_size = 0;
+	
+	auto pdb = db_engine_get_db(dir);
+	if (pdb == nullptr || pdb->psqlite == nullptr)
+		return FALSE;
+	if (FALSE == exmdb_server_check_private()) {
+		exmdb_server_set_public_username(username);
+	}
+	pmsglst->count = 0;
+	pmsglst->pplist = NULL;
+	if (0 == pmessage_ids->count) {
+		return TRUE;
+	}
+	pmsglst->pplist = cu_alloc<MESSAGE_CONTENT *>(pmessage_ids->count);
+	if (NULL == pmsglst->pplist) {
+		return FALSE;
+	}
+	sqlite3_exec(pdb->psqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	if (FALSE == common_util_begin_message_optimize(pdb->psqlite)) {
+		sqlite3_exec(pdb->psqlite, "ROLLBACK", NULL, NULL, NULL);
+		return FALSE;
+	}
+	for (size_t i = 0; i < pmessage_ids->count && (0 == i ||
+	     total_size < size_limit); ++i) {
+		auto &pmsgctnt = pmsglst->pplist[i];
+		if (FALSE == message_read_message(pdb->psqlite, cpid,
+		    rop_util_get_gc_value(pmessage_ids->pids[i]), &pmsgctnt)) {
+			common_util_end_message_optimize();
+			sqlite3_exec(pdb->psqlite, "ROLLBACK", NULL, NULL, NULL);
+			return FALSE;
+		}
+		pmsglst->count ++;
+		if (NULL == pmsgctnt) {
+			continue;
+		}
+		auto psize = static_cast<uint32_t *>(common_util_get_propvals(
+		             &pmsgctnt->proplist, PR_MESSAGE_SIZE));
+		if (NULL != psize) {
+			total_size += *psize;
+		}
+	}
+	common_util_end_message_optimize();
+	sqlite3_exec(pdb->psqlite, "COMMIT TRANSACTION", NULL, NULL, NULL);
+	return TRUE;
+}
+
 BOOL exmdb_server_rule_new_message(const char *dir,
 	const char *username, const char *account, uint32_t cpid,
 	uint64_t folder_id, uint64_t message_id)
@@ -137,13 +137,17 @@ static constexpr const char *exmdb_rpc_names[] = {
 	nullptr,
 	nullptr,
 	E(UNLOAD_STORE),
+	E(BACKUP_STORE),
+	E(READ_INSTANCE_PROPERTY_RANGE),
+	E(PREWARM_STORE),
+	E(READ_MESSAGES),
 };
 #undef E
 #undef EXP
 
 const char *exmdb_rpc_idtoname(unsigned int i)
 {
-	static_assert(GX_ARRAY_SIZE(exmdb_rpc_names) == exmdb_callid::UNLOAD_STORE + 1);
+	static_assert(GX_ARRAY_SIZE(exmdb_rpc_names) == exmdb_callid::READ_MESSAGES + 1);
 	const char *s = i < GX_ARRAY_SIZE(exmdb_rpc_names) ? exmdb_rpc_names[i] : nullptr;
 	return s != nullptr ? s : "";
 }
@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+/*
+ * Process-wide SQLite page cache. All connections opened by exmdb_provider
+ * (one per mailbox DB_ITEM) draw their pages from a single memory budget,
+ * and unpinned pages of all mailboxes sit on one LRU list, so that a busy
+ * mailbox can take pages away from idle ones. A purgeable cache is also
+ * held to its own PRAGMA cache_size, which is how the scratch databases
+ * are kept to their share of table_memory_limit (db_engine_open_scratch).
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <sqlite3.h>
+#include "page_cache.h"
+
+namespace {
+
+struct PC_CACHE;
+
+struct PC_PAGE {
+	sqlite3_pcache_page base;
+	PC_CACHE *pcache;
+	unsigned int key;
+	bool b_pinned;
+	PC_PAGE *lru_prev, *lru_next;
+	/* same order, this cache's pages only */
+	PC_PAGE *cache_prev, *cache_next;
+};
+
+struct PC_CACHE {
+	size_t page_size, buf_size;
+	bool b_purgeable;
+	unsigned int max_pages; /* from xCachesize; 0: only the budget */
+	std::unordered_map<unsigned int, PC_PAGE *> pages;
+	PC_PAGE *lru_head, *lru_tail;
+};
+
+}
+
+static uint64_t g_budget;
+static uint64_t g_used, g_peak, g_unevictable;
+static uint64_t g_hits, g_misses, g_evictions;
+static size_t g_cache_count;
+static std::mutex g_pc_lock;
+/* most recently unpinned page at the head, eviction from the tail */
+static PC_PAGE *g_lru_head, *g_lru_tail;
+
+static void pc_lru_unlink(PC_PAGE *ppage)
+{
+	auto pcache = ppage->pcache;
+	if (NULL != ppage->cache_prev) {
+		ppage->cache_prev->cache_next = ppage->cache_next;
+	} else {
+		pcache->lru_head = ppage->cache_next;
+	}
+	if (NULL != ppage->cache_next) {
+		ppage->cache_next->cache_prev = ppage->cache_prev;
+	} else {
+		pcache->lru_tail = ppage->cache_prev;
+	}
+	ppage->cache_prev = ppage->cache_next = nullptr;
+	if (NULL != ppage->lru_prev) {
+		ppage->lru_prev->lru_next = ppage->lru_next;
+	} else {
+		g_lru_head = ppage->lru_next;
+	}
+	if (NULL != ppage->lru_next) {
+		ppage->lru_next->lru_prev = ppage->lru_prev;
+	} else {
+		g_lru_tail = ppage->lru_prev;
+	}
+	ppage->lru_prev = ppage->lru_next = nullptr;
+}
+
+static void pc_lru_push(PC_PAGE *ppage)
+{
+	auto pcache = ppage->pcache;
+	ppage->cache_prev = nullptr;
+	ppage->cache_next = pcache->lru_head;
+	if (NULL != pcache->lru_head) {
+		pcache->lru_head->cache_prev = ppage;
+	} else {
+		pcache->lru_tail = ppage;
+	}
+	pcache->lru_head = ppage;
+	ppage->lru_prev = nullptr;
+	ppage->lru_next = g_lru_head;
+	if (NULL != g_lru_head) {
+		g_lru_head->lru_prev = ppage;
+	} else {
+		g_lru_tail = ppage;
+	}
+	g_lru_head = ppage;
+}
+
+/* caller holds g_pc_lock and has removed the page from its cache map */
+static void pc_page_free(PC_PAGE *ppage)
+{
+	auto pcache = ppage->pcache;
+	if (pcache->b_purgeable) {
+		if (!ppage->b_pinned)
+			pc_lru_unlink(ppage);
+		g_used -= pcache->page_size;
+	} else {
+		g_unevictable -= pcache->page_size;
+	}
+	free(ppage);
+}
+
+static bool pc_evict_one()
+{
+	auto ppage = g_lru_tail;
+	if (NULL == ppage) {
+		return false;
+	}
+	ppage->pcache->pages.erase(ppage->key);
+	pc_page_free(ppage);
+	g_evictions ++;
+	return true;
+}
+
+/* evict unpinned pages of @pcache until fewer than @limit are left */
+static void pc_enforce_max(PC_CACHE *pcache, size_t limit)
+{
+	while (pcache->pages.size() >= limit && NULL != pcache->lru_tail) {
+		auto ppage = pcache->lru_tail;
+		pcache->pages.erase(ppage->key);
+		pc_page_free(ppage);
+		g_evictions ++;
+	}
+}
+
+static int pc_init(void *)
+{
+	return SQLITE_OK;
+}
+
+static void pc_shutdown(void *)
+{
+}
+
+static sqlite3_pcache *pc_create(int szpage, int szextra, int purgeable)
+{
+	auto pcache = new(std::nothrow) PC_CACHE;
+	if (NULL == pcache) {
+		return nullptr;
+	}
+	pcache->page_size = szpage + szextra;
+	pcache->buf_size = szpage;
+	pcache->b_purgeable = purgeable;
+	pcache->max_pages = 0;
+	pcache->lru_head = pcache->lru_tail = nullptr;
+	std::lock_guard lhold(g_pc_lock);
+	g_cache_count ++;
+	return reinterpret_cast<sqlite3_pcache *>(pcache);
+}
+
+/*
+ * SQLite passes its cache_size here, already in pages. For purgeable
+ * caches, it is a limit within the global budget; the budget still wins
+ * if it runs out first.
+ */
+static void pc_cachesize(sqlite3_pcache *p, int nmax)
+{
+	auto pcache = reinterpret_cast<PC_CACHE *>(p);
+	if (!pcache->b_purgeable) {
+		return;
+	}
+	std::lock_guard lhold(g_pc_lock);
+	pcache->max_pages = nmax > 0 ? nmax : 0;
+	if (pcache->max_pages > 0)
+		pc_enforce_max(pcache, pcache->max_pages + 1);
+}
+
+static int pc_pagecount(sqlite3_pcache *p)
+{
+	auto pcache = reinterpret_cast<PC_CACHE *>(p);
+	std::lock_guard lhold(g_pc_lock);
+	return pcache->pages.size();
+}
+
+static sqlite3_pcache_page *pc_fetch(sqlite3_pcache *p,
+	unsigned int key, int create_flag)
+{
+	auto pcache = reinterpret_cast<PC_CACHE *>(p);
+	std::lock_guard lhold(g_pc_lock);
+	auto it = pcache->pages.find(key);
+	if (it != pcache->pages.end()) {
+		auto ppage = it->second;
+		if (pcache->b_purgeable && !ppage->b_pinned)
+			pc_lru_unlink(ppage);
+		ppage->b_pinned = true;
+		g_hits ++;
+		return &ppage->base;
+	}
+	/* createFlag 2 is only ever a retry after a failed 1 */
+	if (create_flag < 2)
+		g_misses ++;
+	if (0 == create_flag) {
+		return nullptr;
+	}
+	if (pcache->b_purgeable) {
+		if (pcache->max_pages > 0)
+			pc_enforce_max(pcache, pcache->max_pages);
+		while (g_used + pcache->page_size > g_budget && pc_evict_one())
+			/* nothing */;
+		/*
+		 * Everything left is pinned. Have SQLite spill its dirty pages
+		 * first; on the second attempt, overcommit rather than fail.
+		 */
+		if (1 == create_flag && (g_used + pcache->page_size > g_budget ||
+		    (pcache->max_pages > 0 && pcache->pages.size() >= pcache->max_pages))) {
+			return nullptr;
+		}
+	}
+	auto ppage = static_cast<PC_PAGE *>(malloc(sizeof(PC_PAGE) + pcache->page_size));
+	if (NULL == ppage) {
+		return nullptr;
+	}
+	try {
+		pcache->pages.emplace(key, ppage);
+	} catch (const std::bad_alloc &) {
+		free(ppage);
+		return nullptr;
+	}
+	memset(ppage + 1, 0, pcache->page_size);
+	ppage->pcache = pcache;
+	ppage->key = key;
+	ppage->b_pinned = true;
+	ppage->lru_prev = ppage->lru_next = nullptr;
+	ppage->cache_prev = ppage->cache_next = nullptr;
+	ppage->base.pBuf = ppage + 1;
+	ppage->base.pExtra = reinterpret_cast<char *>(ppage + 1) + pcache->buf_size;
+	if (pcache->b_purgeable) {
+		g_used += pcache->page_size;
+		if (g_used > g_peak)
+			g_peak = g_used;
+	} else {
+		g_unevictable += pcache->page_size;
+	}
+	return &ppage->base;
+}
+
+static void pc_unpin(sqlite3_pcache *p, sqlite3_pcache_page *pbase, int discard)
+{
+	auto pcache = reinterpret_cast<PC_CACHE *>(p);
+	auto ppage = reinterpret_cast<PC_PAGE *>(pbase);
+	std::lock_guard lhold(g_pc_lock);
+	if (discard) {
+		pcache->pages.erase(ppage->key);
+		pc_page_free(ppage);
+		return;
+	}
+	if (!pcache->b_purgeable) {
+		ppage->b_pinned = false;
+		return;
+	}
+	ppage->b_pinned = false;
+	pc_lru_push(ppage);
+	if (pcache->max_pages > 0)
+		pc_enforce_max(pcache, pcache->max_pages + 1);
+	while (g_used > g_budget && pc_evict_one())
+		/* nothing */;
+}
+
+static void pc_rekey(sqlite3_pcache *p, sqlite3_pcache_page *pbase,
+	unsigned int old_key, unsigned int new_key)
+{
+	auto pcache = reinterpret_cast<PC_CACHE *>(p);
+	auto ppage = reinterpret_cast<PC_PAGE *>(pbase);
+	std::lock_guard lhold(g_pc_lock);
+	auto it = pcache->pages.find(new_key);
+	if (it != pcache->pages.end()) {
+		auto pold = it->second;
+		pcache->pages.erase(it);
+		pc_page_free(pold);
+	}
+	pcache->pages.erase(old_key);
+	ppage->key = new_key;
+	pcache->pages.emplace(new_key, ppage);
+}
+
+static void pc_truncate(sqlite3_pcache *p, unsigned int limit)
+{
+	auto pcache = reinterpret_cast<PC_CACHE *>(p);
+	std::lock_guard lhold(g_pc_lock);
+	for (auto it = pcache->pages.begin(); it != pcache->pages.end(); ) {
+		if (it->first < limit) {
+			++it;
+			continue;
+		}
+		auto ppage = it->second;
+		it = pcache->pages.erase(it);
+		pc_page_free(ppage);
+	}
+}
+
+static void pc_destroy(sqlite3_pcache *p)
+{
+	auto pcache = reinterpret_cast<PC_CACHE *>(p);
+	std::unique_lock lhold(g_pc_lock);
+	for (const auto &e : pcache->pages)
+		pc_page_free(e.second);
+	pcache->pages.clear();
+	g_cache_count --;
+	lhold.unlock();
+	delete pcache;
+}
+
+static void pc_shrink(sqlite3_pcache *p)
+{
+	auto pcache = reinterpret_cast<PC_CACHE *>(p);
+	std::lock_guard lhold(g_pc_lock);
+	for (auto it = pcache->pages.begin(); it != pcache->pages.end(); ) {
+		auto ppage = it->second;
+		if (ppage->b_pinned) {
+			++it;
+			continue;
+		}
+		it = pcache->pages.erase(it);
+		pc_page_free(ppage);
+	}
+}
+
+void page_cache_init(uint64_t max_size)
+{
+	g_budget = max_size;
+}
+
+/* must be called before sqlite3_initialize */
+int page_cache_run()
+{
+	static constexpr sqlite3_pcache_methods2 pc_methods = {
+		1, nullptr, pc_init, pc_shutdown, pc_create, pc_cachesize,
+		pc_pagecount, pc_fetch, pc_unpin, pc_rekey, pc_truncate,
+		pc_destroy, pc_shrink,
+	};
+	if (0 == g_budget) {
+		return 0;
+	}
+	if (SQLITE_OK != sqlite3_config(SQLITE_CONFIG_PCACHE2, &pc_methods)) {
+		printf("[exmdb_provider]: failed to install global page cache\n");
+		return -1;
+	}
+	return 0;
+}
+
+void page_cache_get_stats(PAGE_CACHE_STATS *pstats)
+{
+	std::lock_guard lhold(g_pc_lock);
+	pstats->budget = g_budget;
+	pstats->used = g_used;
+	pstats->peak = g_peak;
+	pstats->unevictable = g_unevictable;
+	pstats->hits = g_hits;
+	pstats->misses = g_misses;
+	pstats->evictions = g_evictions;
+	pstats->caches = g_cache_count;
+}
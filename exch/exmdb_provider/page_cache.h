@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+
+struct PAGE_CACHE_STATS {
+	uint64_t budget, used, peak, unevictable;
+	uint64_t hits, misses, evictions;
+	size_t caches;
+};
+
+extern void page_cache_init(uint64_t max_size);
+extern int page_cache_run();
+extern void page_cache_get_stats(PAGE_CACHE_STATS *);
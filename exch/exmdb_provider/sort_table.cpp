@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+/*
+ * Sorting and categorizing of content table rows in memory. This replaces
+ * the scratch SQLite table ("stbl") plus per-column indexes that table.cpp
+ * used to build just to run its GROUP BY and ORDER BY queries over it.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include "db_engine.h"
+#include "sort_table.h"
+
+namespace {
+struct SORT_WALK {
+	SORT_TABLE *pstbl;
+	sqlite3_stmt *pstmt;
+	size_t ccategories, cexpanded;
+	int extremum; /* column whose max/min orders the last category, or -1 */
+	std::vector<size_t> keys; /* columns ordering the message rows */
+	uint32_t *pheader_id;
+};
+}
+
+using row_iter = std::vector<uint32_t>::iterator;
+
+void SORT_TABLE::add_column(int type, int role, bool b_desc)
+{
+	SORT_COLUMN col;
+	col.type = type;
+	col.role = role;
+	col.b_desc = b_desc;
+	columns.push_back(std::move(col));
+}
+
+void SORT_TABLE::add_row(uint64_t row_id, bool b_read)
+{
+	row_ids.push_back(row_id);
+	read_states.push_back(b_read);
+}
+
+void SORT_TABLE::push_null(size_t col)
+{
+	auto &c = columns[col];
+	c.nulls.push_back(1);
+	switch (c.type) {
+	case SORT_COL_INTEGER:
+		c.ints.push_back(0);
+		break;
+	case SORT_COL_REAL:
+		c.reals.push_back(0);
+		break;
+	default:
+		c.strs.emplace_back();
+		break;
+	}
+}
+
+void SORT_TABLE::push_int(size_t col, int64_t v)
+{
+	auto &c = columns[col];
+	c.nulls.push_back(0);
+	c.ints.push_back(v);
+}
+
+void SORT_TABLE::push_real(size_t col, double v)
+{
+	auto &c = columns[col];
+	c.nulls.push_back(0);
+	c.reals.push_back(v);
+}
+
+void SORT_TABLE::push_text(size_t col, const char *s)
+{
+	auto &c = columns[col];
+	c.nulls.push_back(0);
+	c.strs.emplace_back(s);
+}
+
+void SORT_TABLE::push_blob(size_t col, const void *pv, size_t cb)
+{
+	auto &c = columns[col];
+	c.nulls.push_back(0);
+	c.strs.emplace_back(static_cast<const char *>(pv), cb);
+}
+
+/* COLLATE NOCASE: only ASCII is folded, then the shorter one first */
+static int sort_table_nocase(const std::string &a, const std::string &b)
+{
+	size_t len = std::min(a.size(), b.size());
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char x = a[i], y = b[i];
+		if (x >= 'A' && x <= 'Z')
+			x += 'a' - 'A';
+		if (y >= 'A' && y <= 'Z')
+			y += 'a' - 'A';
+		if (x != y)
+			return x < y ? -1 : 1;
+	}
+	return a.size() < b.size() ? -1 : a.size() > b.size();
+}
+
+static int sort_table_compare(const SORT_COLUMN &c, uint32_t a, uint32_t b)
+{
+	if (c.nulls[a] || c.nulls[b]) {
+		/* NULL sorts before everything else */
+		return c.nulls[b] - c.nulls[a];
+	}
+	switch (c.type) {
+	case SORT_COL_INTEGER:
+		return c.ints[a] < c.ints[b] ? -1 : c.ints[a] > c.ints[b];
+	case SORT_COL_REAL:
+		return c.reals[a] < c.reals[b] ? -1 : c.reals[a] > c.reals[b];
+	case SORT_COL_TEXT:
+		return sort_table_nocase(c.strs[a], c.strs[b]);
+	default:
+		/* memcmp, then the shorter one first */
+		return c.strs[a].compare(c.strs[b]);
+	}
+}
+
+static void sort_table_bind(sqlite3_stmt *pstmt, int bind_index,
+	const SORT_COLUMN &c, uint32_t row)
+{
+	if (c.nulls[row]) {
+		sqlite3_bind_null(pstmt, bind_index);
+		return;
+	}
+	switch (c.type) {
+	case SORT_COL_INTEGER:
+		sqlite3_bind_int64(pstmt, bind_index, c.ints[row]);
+		break;
+	case SORT_COL_REAL:
+		sqlite3_bind_double(pstmt, bind_index, c.reals[row]);
+		break;
+	case SORT_COL_TEXT:
+		sqlite3_bind_text(pstmt, bind_index, c.strs[row].c_str(),
+			c.strs[row].size(), SQLITE_STATIC);
+		break;
+	default:
+		sqlite3_bind_blob(pstmt, bind_index, c.strs[row].data(),
+			c.strs[row].size(), SQLITE_STATIC);
+		break;
+	}
+}
+
+/*
+ * Write the rows of [first, last) at @depth below the header row
+ * @parent_id (0: top level).
+ */
+static BOOL sort_table_write_level(const SORT_WALK &w, row_iter first,
+	row_iter last, size_t depth, int64_t parent_id)
+{
+	auto &stbl = *w.pstbl;
+	auto pstmt = w.pstmt;
+	int64_t prev_id = -parent_id;
+
+	if (depth == w.ccategories) {
+		std::stable_sort(first, last, [&](uint32_t a, uint32_t b) {
+			for (auto col : w.keys) {
+				auto &c = stbl.columns[col];
+				auto r = sort_table_compare(c, a, b);
+				if (r != 0)
+					return c.b_desc ? r > 0 : r < 0;
+			}
+			return false;
+		});
+		for (auto it = first; it != last; ++it) {
+			sqlite3_bind_int64(pstmt, 1, stbl.row_ids[*it]);
+			sqlite3_bind_int64(pstmt, 2, CONTENT_ROW_MESSAGE);
+			sqlite3_bind_null(pstmt, 3);
+			sqlite3_bind_int64(pstmt, 4, parent_id);
+			sqlite3_bind_int64(pstmt, 5, depth);
+			sqlite3_bind_null(pstmt, 6);
+			sqlite3_bind_null(pstmt, 7);
+			if (w.ccategories > 0) {
+				/* read(1) or unread(0) in extremum for message row */
+				sqlite3_bind_int64(pstmt, 9, stbl.read_states[*it]);
+				sqlite3_bind_null(pstmt, 11);
+			} else {
+				sqlite3_bind_null(pstmt, 9);
+				sqlite3_bind_int64(pstmt, 11, prev_id + 1);
+			}
+			sqlite3_bind_null(pstmt, 8);
+			sqlite3_bind_int64(pstmt, 10, prev_id);
+			if (SQLITE_DONE != sqlite3_step(pstmt))
+				return FALSE;
+			prev_id = sqlite3_last_insert_rowid(sqlite3_db_handle(pstmt));
+			sqlite3_reset(pstmt);
+		}
+		return TRUE;
+	}
+	/* GROUP BY the category column, one header row per group */
+	auto &cat = stbl.columns[depth];
+	std::stable_sort(first, last, [&](uint32_t a, uint32_t b) {
+		return sort_table_compare(cat, a, b) < 0;
+	});
+	bool b_extremum = depth + 1 == w.ccategories && w.extremum >= 0;
+	/* each group, and the row holding its extremum (-1: none) */
+	std::vector<std::pair<std::pair<row_iter, row_iter>, int64_t>> order;
+	for (auto it = first; it != last; ) {
+		auto end = std::next(it);
+		while (end != last && sort_table_compare(cat, *it, *end) == 0)
+			++end;
+		/* max() and min() skip NULLs */
+		int64_t ext = -1;
+		if (b_extremum) {
+			auto &c = stbl.columns[w.extremum];
+			bool b_max = c.role == SORT_ROLE_MAXIMUM;
+			for (auto r = it; r != end; ++r) {
+				if (c.nulls[*r])
+					continue;
+				if (ext < 0) {
+					ext = *r;
+					continue;
+				}
+				auto cmp = sort_table_compare(c, *r, ext);
+				if (b_max ? cmp > 0 : cmp < 0)
+					ext = *r;
+			}
+		}
+		order.emplace_back(std::make_pair(it, end), ext);
+		it = end;
+	}
+	if (b_extremum) {
+		auto &c = stbl.columns[w.extremum];
+		std::stable_sort(order.begin(), order.end(), [&](const auto &x, const auto &y) {
+			int r;
+			if (x.second < 0 || y.second < 0)
+				r = (y.second < 0) - (x.second < 0);
+			else
+				r = sort_table_compare(c, x.second, y.second);
+			return cat.b_desc ? r > 0 : r < 0;
+		});
+	} else if (cat.b_desc) {
+		std::reverse(order.begin(), order.end());
+	}
+	for (const auto &o : order) {
+		auto &g = o.first;
+		(*w.pheader_id) ++;
+		uint64_t header_id = *w.pheader_id | 0x100000000000000ULL;
+		sqlite3_bind_int64(pstmt, 1, header_id);
+		sqlite3_bind_int64(pstmt, 2, CONTENT_ROW_HEADER);
+		sqlite3_bind_int64(pstmt, 3, depth < w.cexpanded);
+		sqlite3_bind_int64(pstmt, 4, parent_id);
+		sqlite3_bind_int64(pstmt, 5, depth);
+		/* total and unread messages */
+		sqlite3_bind_int64(pstmt, 6, g.second - g.first);
+		sqlite3_bind_int64(pstmt, 7, std::count_if(g.first, g.second,
+			[&](uint32_t r) { return stbl.read_states[r] == 0; }));
+		sort_table_bind(pstmt, 8, cat, *g.first);
+		if (o.second >= 0)
+			sort_table_bind(pstmt, 9, stbl.columns[w.extremum], o.second);
+		else
+			sqlite3_bind_null(pstmt, 9);
+		sqlite3_bind_int64(pstmt, 10, prev_id);
+		sqlite3_bind_null(pstmt, 11);
+		if (SQLITE_DONE != sqlite3_step(pstmt))
+			return FALSE;
+		prev_id = sqlite3_last_insert_rowid(sqlite3_db_handle(pstmt));
+		sqlite3_reset(pstmt);
+		if (FALSE == sort_table_write_level(w, g.first,
+		    g.second, depth + 1, prev_id))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Fill t@table_id of @psqlite, whose first @ccategories columns are the
+ * categories and whose first @cexpanded levels are expanded. Uncategorized
+ * rows get their idx right away; for categorized ones, the caller has to
+ * index the visible rows.
+ */
+BOOL SORT_TABLE::write(sqlite3 *psqlite, uint32_t table_id,
+	size_t ccategories, size_t cexpanded, uint32_t *pheader_id)
+{
+	char sql_string[256];
+	sqlite3_stmt *pstmt = nullptr;
+
+	snprintf(sql_string, sizeof(sql_string), "INSERT INTO t%u "
+	         "(inst_id, row_type, row_stat, parent_id, depth, count, "
+	         "unread, inst_num, value, extremum, prev_id, idx) VALUES "
+	         "(?, ?, ?, ?, ?, ?, ?, 0, ?, ?, ?, ?)", table_id);
+	if (sqlite3_prepare_v2(psqlite, sql_string, -1, &pstmt,
+	    nullptr) != SQLITE_OK)
+		return FALSE;
+	SORT_WALK w;
+	w.pstbl = this;
+	w.pstmt = pstmt;
+	w.ccategories = ccategories;
+	w.cexpanded = cexpanded;
+	w.extremum = -1;
+	w.pheader_id = pheader_id;
+	try {
+		std::vector<uint32_t> rows(row_ids.size());
+		for (size_t i = ccategories; i < columns.size(); ++i) {
+			if (columns[i].role == SORT_ROLE_KEY)
+				w.keys.push_back(i);
+			else if (i == ccategories && ccategories > 0)
+				w.extremum = i;
+		}
+		for (size_t i = 0; i < rows.size(); ++i)
+			rows[i] = i;
+		auto ret = sort_table_write_level(w, rows.begin(), rows.end(), 0, 0);
+		sqlite3_finalize(pstmt);
+		return ret;
+	} catch (const std::bad_alloc &) {
+		sqlite3_finalize(pstmt);
+		return FALSE;
+	}
+}
+
+size_t SORT_TABLE::mem_used() const
+{
+	size_t n = row_ids.capacity() * sizeof(uint64_t) +
+	           read_states.capacity();
+	for (const auto &c : columns) {
+		n += c.nulls.capacity() + c.ints.capacity() * sizeof(int64_t) +
+		     c.reals.capacity() * sizeof(double) +
+		     c.strs.capacity() * sizeof(std::string);
+		for (const auto &s : c.strs)
+			if (s.capacity() > sizeof(std::string))
+				n += s.capacity();
+	}
+	return n;
+}
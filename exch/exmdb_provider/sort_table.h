@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+#include <gromox/common_types.hpp>
+
+enum {
+	SORT_COL_INTEGER,
+	SORT_COL_REAL,
+	SORT_COL_TEXT,	/* compared like COLLATE NOCASE */
+	SORT_COL_BLOB,
+};
+
+enum {
+	SORT_ROLE_CATEGORY,
+	SORT_ROLE_KEY,
+	SORT_ROLE_MAXIMUM,	/* TABLE_SORT_MAXIMUM_CATEGORY */
+	SORT_ROLE_MINIMUM,	/* TABLE_SORT_MINIMUM_CATEGORY */
+};
+
+struct SORT_COLUMN {
+	int type;
+	int role;
+	bool b_desc;
+	std::vector<uint8_t> nulls;
+	std::vector<int64_t> ints;
+	std::vector<double> reals;
+	std::vector<std::string> strs;
+};
+
+/*
+ * In-memory, column-wise row set of a content table being loaded. Columns
+ * are added in the order of the SORTORDER_SET, categories first; rows are
+ * added with add_row followed by one push_* per column, in column order.
+ * write() then fills the table's t<id> with the same rows that
+ * table_load_content produces from a scratch SQLite table: the category
+ * header rows, and the message rows in ORDER BY order with ties kept in
+ * insertion order.
+ */
+struct SORT_TABLE {
+	void add_column(int type, int role, bool b_desc);
+	void add_row(uint64_t row_id, bool b_read = true);
+	void push_null(size_t col);
+	void push_int(size_t col, int64_t v);
+	void push_real(size_t col, double v);
+	void push_text(size_t col, const char *s);
+	void push_blob(size_t col, const void *pv, size_t cb);
+	BOOL write(sqlite3 *psqlite, uint32_t table_id, size_t ccategories,
+		size_t cexpanded, uint32_t *pheader_id);
+	size_t size() const { return row_ids.size(); }
+	size_t mem_used() const;
+
+	std::vector<uint64_t> row_ids;
+	std::vector<uint8_t> read_states;
+	std::vector<SORT_COLUMN> columns;
+};
@@ -1,7 +1,16 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 // SPDX-FileCopyrightText: 2020–2021 grommunio GmbH
 // This file is part of Gromox.
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <dirent.h>
+#include <libHX/string.h>
 #include <gromox/database.h>
+#include <gromox/fileio.h>
 #include <gromox/mapidefs.h>
 #include "exmdb_server.h"
 #include "common_util.h"
@@ -11,10 +20,15 @@
 #include <gromox/guid.hpp>
 #include <gromox/scope.hpp>
 #include <gromox/util.hpp>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
 #include <ctime>
+#include <unistd.h>
+#include <sys/stat.h>
+#define LLU(x) static_cast<unsigned long long>(x)
 #define MAXIMUM_ALLOCATION_NUMBER				1000000
 
 #define ALLOCATION_INTERVAL						24*60*60
@@ -37,44 +51,19 @@ BOOL exmdb_server_ping_store(const char *dir)
 	return TRUE;
 }
 
+/* returns at once; the store is loaded by a db_engine thread */
+BOOL exmdb_server_prewarm_store(const char *dir)
+{
+	return db_engine_enqueue_prewarm(dir, exmdb_server_check_private());
+}
+
 BOOL exmdb_server_get_all_named_propids(
 	const char *dir, PROPID_ARRAY *ppropids)
 {
-	int total_count;
-	char sql_string[256];
-	
 	auto pdb = db_engine_get_db(dir);
 	if (pdb == nullptr || pdb->psqlite == nullptr)
 		return FALSE;
-	snprintf(sql_string, arsizeof(sql_string), "SELECT "
-			"count(*) FROM named_properties");
-	auto pstmt = gx_sql_prep(pdb->psqlite, sql_string);
-	if (pstmt == nullptr || sqlite3_step(pstmt) != SQLITE_ROW)
-		return FALSE;
-	total_count = sqlite3_column_int64(pstmt, 0);
-	pstmt.finalize();
-	if (0 == total_count) {
-		ppropids->count = 0;
-		ppropids->ppropid = NULL;
-		return TRUE;
-	}
-	ppropids->ppropid = cu_alloc<uint16_t>(total_count);
-	if (NULL == ppropids->ppropid) {
-		return FALSE;
-	}
-	snprintf(sql_string, arsizeof(sql_string), "SELECT"
-		" propid FROM named_properties");
-	pstmt = gx_sql_prep(pdb->psqlite, sql_string);
-	if (pstmt == nullptr) {
-		return FALSE;
-	}
-	ppropids->count = 0;
-	while (SQLITE_ROW == sqlite3_step(pstmt)) {
-		ppropids->ppropid[ppropids->count] =
-				sqlite3_column_int64(pstmt, 0);
-		ppropids->count ++;
-	}
-	return TRUE;
+	return common_util_get_all_named_propids(pdb->psqlite, ppropids);
 }
 
 BOOL exmdb_server_get_named_propids(const char *dir,
@@ -84,6 +73,11 @@ BOOL exmdb_server_get_named_propids(const char *dir,
 	auto pdb = db_engine_get_db(dir);
 	if (pdb == nullptr || pdb->psqlite == nullptr)
 		return FALSE;
+	if (FALSE == b_create) {
+		/* served from memory, see common_util_load_names */
+		return common_util_get_named_propids(pdb->psqlite,
+		       FALSE, ppropnames, ppropids);
+	}
 	sqlite3_exec(pdb->psqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
 	if (FALSE == common_util_get_named_propids(
 		pdb->psqlite, b_create, ppropnames, ppropids)) {
@@ -559,7 +553,336 @@ BOOL exmdb_server_check_contact_address(const char *dir,
 	       PRIVATE_FID_CONTACTS, paddress, pb_found);
 }
 
+/* compare the in-memory folder/store counters against the database */
+BOOL exmdb_server_verify_counters(const char *dir, int *pmismatches)
+{
+	auto pdb = db_engine_get_db(dir);
+	if (pdb == nullptr || pdb->psqlite == nullptr)
+		return FALSE;
+	*pmismatches = common_util_verify_db_cache(pdb->psqlite);
+	return *pmismatches >= 0 ? TRUE : false;
+}
+
 BOOL exmdb_server_unload_store(const char *dir)
 {
 	return db_engine_unload_db(dir);
 }
+
+namespace {
+enum class backup_result { ok, partial, failed, aborted };
+}
+
+/*
+ * State of the one store backup that may run at a time. The worker thread
+ * owns g_backup_dir/g_backup_dest while g_backup_running is set; the
+ * counters are only read for the progress report.
+ */
+static std::mutex g_backup_lock;
+static std::thread g_backup_thread;
+static std::string g_backup_root, g_backup_dir, g_backup_dest;
+static bool g_backup_running;
+static std::atomic<bool> g_backup_abort{false};
+static std::atomic<int> g_backup_pages, g_backup_page_total;
+static std::atomic<uint64_t> g_backup_cids, g_backup_cid_total, g_backup_missing;
+static backup_result g_backup_result = backup_result::ok;
+
+void exmdb_server_set_backup_root(const char *root)
+{
+	std::lock_guard hold(g_backup_lock);
+	g_backup_root = root;
+	while (g_backup_root.size() > 1 && g_backup_root.back() == '/')
+		g_backup_root.pop_back();
+}
+
+/*
+ * Backups may only be written below backup_root. @dest_dir is taken
+ * relative to it, or may name a directory inside it absolutely; ".."
+ * components are refused. Symlinks are checked once the directory exists,
+ * see exmdb_server_backup_work.
+ */
+static bool exmdb_server_backup_path(const char *dest_dir, std::string &out)
+{
+	std::lock_guard hold(g_backup_lock);
+	auto &root = g_backup_root;
+	if (root.empty()) {
+		fprintf(stderr, "E-1530: backup refused: backup_root is not set\n");
+		return false;
+	}
+	for (auto p = dest_dir; *p != '\0'; ) {
+		auto q = strchr(p, '/');
+		size_t len = q == nullptr ? strlen(p) : q - p;
+		if (len == 2 && strncmp(p, "..", 2) == 0) {
+			fprintf(stderr, "E-1538: backup refused: \"%s\" contains \"..\"\n", dest_dir);
+			return false;
+		}
+		p += q == nullptr ? len : len + 1;
+	}
+	if (*dest_dir != '/') {
+		out = root + "/" + dest_dir;
+	} else if (strncmp(dest_dir, root.c_str(), root.size()) == 0 &&
+	    dest_dir[root.size()] == '/') {
+		out = dest_dir;
+	} else {
+		fprintf(stderr, "E-1539: backup refused: %s is outside of %s\n",
+		        dest_dir, root.c_str());
+		return false;
+	}
+	while (out.size() > root.size() + 1 && out.back() == '/')
+		out.pop_back();
+	if (out.size() <= root.size() + 1) {
+		fprintf(stderr, "E-1540: backup refused: no directory below %s given\n",
+		        root.c_str());
+		return false;
+	}
+	return true;
+}
+
+static bool exmdb_server_backup_inside_root(const std::string &path)
+{
+	std::string root;
+	{
+		std::lock_guard hold(g_backup_lock);
+		root = g_backup_root;
+	}
+	char rroot[PATH_MAX], rpath[PATH_MAX];
+	if (realpath(root.c_str(), rroot) == nullptr ||
+	    realpath(path.c_str(), rpath) == nullptr)
+		return false;
+	auto len = strlen(rroot);
+	return strncmp(rpath, rroot, len) == 0 &&
+	       (rpath[len] == '/' || (len == 1 && rpath[1] != '\0'));
+}
+
+static bool exmdb_server_backup_progress(int copied, int total)
+{
+	g_backup_pages = copied;
+	g_backup_page_total = total;
+	return !g_backup_abort;
+}
+
+/*
+ * Put cid file @cid of @dir into @dest_dir, preferably as a hardlink. A
+ * file of that name left by an earlier backup is kept only if it already
+ * is the same file; anything else there is replaced.
+ */
+static int exmdb_server_backup_cid(const char *dir,
+    const char *dest_dir, uint64_t cid)
+{
+	char src_path[256], dst_path[256];
+	struct stat src_st, dst_st;
+
+	snprintf(src_path, arsizeof(src_path), "%s/cid/%llu", dir, LLU(cid));
+	snprintf(dst_path, arsizeof(dst_path), "%s/cid/%llu", dest_dir, LLU(cid));
+	if (link(src_path, dst_path) == 0)
+		return 0;
+	if (errno == EEXIST) {
+		if (stat(src_path, &src_st) == 0 && stat(dst_path, &dst_st) == 0 &&
+		    src_st.st_dev == dst_st.st_dev && src_st.st_ino == dst_st.st_ino)
+			return 0;
+		if (remove(dst_path) < 0) {
+			fprintf(stderr, "E-1517: backup of %s: remove %s: %s\n",
+			        dir, dst_path, strerror(errno));
+			return -EIO;
+		}
+		if (link(src_path, dst_path) == 0)
+			return 0;
+	}
+	if (errno == ENOENT) {
+		fprintf(stderr, "W-1516: backup of %s: cid %llu"
+		        " is referenced but missing\n", dir, LLU(cid));
+		return -ENOENT;
+	}
+	if (FALSE == common_util_copy_file(src_path, dst_path)) {
+		fprintf(stderr, "E-1517: backup of %s: cannot copy %s\n",
+		        dir, src_path);
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Remove cid files of earlier backups that the new snapshot does not use. */
+static void exmdb_server_backup_prune(const char *dest_dir,
+    const std::unordered_set<uint64_t> &cids)
+{
+	char path[256];
+
+	snprintf(path, arsizeof(path), "%s/cid", dest_dir);
+	std::unique_ptr<DIR, file_deleter> dirp(opendir(path));
+	if (dirp == nullptr)
+		return;
+	struct dirent *de;
+	while ((de = readdir(dirp.get())) != nullptr) {
+		char *end = nullptr;
+		auto cid = strtoull(de->d_name, &end, 10);
+		if (end == de->d_name || *end != '\0' || cids.count(cid) > 0)
+			continue;
+		snprintf(path, arsizeof(path), "%s/cid/%s", dest_dir, de->d_name);
+		if (remove(path) < 0 && errno != ENOENT)
+			fprintf(stderr, "W-1514: remove %s: %s\n", path, strerror(errno));
+	}
+}
+
+/*
+ * Write a consistent copy of the store to @dest_dir while it stays online.
+ * cid files are never rewritten once they are referenced, and the cids of
+ * @dir are not reclaimed while its backup runs, so linking (or copying)
+ * the cids referenced by the finished database snapshot yields a matching
+ * set. The database only appears under its final name once all its cids
+ * are in place; if some are missing, it is left as exchange.sqlite3.partial.
+ */
+static backup_result exmdb_server_backup_work(const char *dir,
+    const char *dest_dir)
+{
+	sqlite3 *pdst = nullptr;
+	char tmp_path[256], tmp_path1[256];
+	
+	for (auto sub : {"", "/exmdb", "/cid"}) {
+		snprintf(tmp_path, arsizeof(tmp_path), "%s%s", dest_dir, sub);
+		if (mkdir(tmp_path, 0777) < 0 && errno != EEXIST) {
+			fprintf(stderr, "E-1513: mkdir %s: %s\n", tmp_path, strerror(errno));
+			return backup_result::failed;
+		}
+		if (*sub == '\0' && !exmdb_server_backup_inside_root(dest_dir)) {
+			fprintf(stderr, "E-1541: backup refused: %s resolves to"
+			        " outside of backup_root\n", dest_dir);
+			return backup_result::failed;
+		}
+	}
+	snprintf(tmp_path, arsizeof(tmp_path), "%s/exmdb/exchange.sqlite3.new", dest_dir);
+	if (remove(tmp_path) < 0 && errno != ENOENT)
+		fprintf(stderr, "W-1514: remove %s: %s\n", tmp_path, strerror(errno));
+	if (sqlite3_open_v2(tmp_path, &pdst, SQLITE_OPEN_READWRITE |
+	    SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+		fprintf(stderr, "E-1515: sqlite3_open %s: %s\n", tmp_path,
+		        sqlite3_errmsg(pdst));
+		sqlite3_close(pdst);
+		return backup_result::failed;
+	}
+	auto cl_0 = make_scope_exit([&]() {
+		if (pdst != nullptr)
+			sqlite3_close(pdst);
+	});
+	db_engine_hold_reclaim(dir, true);
+	auto cl_1 = make_scope_exit([&]() { db_engine_hold_reclaim(dir, false); });
+	if (FALSE == db_engine_backup_db(dir, pdst, exmdb_server_backup_progress)) {
+		return g_backup_abort ? backup_result::aborted : backup_result::failed;
+	}
+	char sql_string[384];
+	snprintf(sql_string, arsizeof(sql_string), "SELECT propval FROM "
+		"message_properties WHERE proptag IN (%u,%u,%u,%u,%u,%u) UNION "
+		"SELECT propval FROM attachment_properties WHERE proptag IN (%u,%u)",
+		PR_BODY, PR_BODY_A, PROP_TAG_HTML, PROP_TAG_RTFCOMPRESSED,
+		PROP_TAG_TRANSPORTMESSAGEHEADERS,
+		PROP_TAG_TRANSPORTMESSAGEHEADERS_STRING8,
+		PR_ATTACH_DATA_BIN, PR_ATTACH_DATA_OBJ);
+	auto pstmt = gx_sql_prep(pdst, sql_string);
+	if (pstmt == nullptr) {
+		return backup_result::failed;
+	}
+	std::unordered_set<uint64_t> cids;
+	while (SQLITE_ROW == sqlite3_step(pstmt))
+		cids.insert(sqlite3_column_int64(pstmt, 0));
+	pstmt.finalize();
+	sqlite3_close(pdst);
+	pdst = nullptr;
+	g_backup_cid_total = cids.size();
+	for (auto cid : cids) {
+		if (g_backup_abort)
+			return backup_result::aborted;
+		auto ret = exmdb_server_backup_cid(dir, dest_dir, cid);
+		if (ret == -ENOENT)
+			g_backup_missing ++;
+		else if (ret != 0)
+			return backup_result::failed;
+		g_backup_cids ++;
+	}
+	exmdb_server_backup_prune(dest_dir, cids);
+	bool b_partial = g_backup_missing > 0;
+	snprintf(tmp_path1, arsizeof(tmp_path1), "%s/exmdb/exchange.sqlite3%s",
+	         dest_dir, b_partial ? ".partial" : "");
+	if (rename(tmp_path, tmp_path1) < 0) {
+		fprintf(stderr, "E-1518: rename %s: %s\n", tmp_path, strerror(errno));
+		return backup_result::failed;
+	}
+	if (b_partial) {
+		fprintf(stderr, "E-1531: backup of %s is incomplete: %llu"
+		        " referenced cids are missing; left as %s\n", dir,
+		        LLU(g_backup_missing.load()), tmp_path1);
+		return backup_result::partial;
+	}
+	return backup_result::ok;
+}
+
+/*
+ * Start a backup of @dir into @dest_dir (below backup_root) in the
+ * background; its progress and outcome are shown by "backup status" on the
+ * console. Fails if the destination is refused or a backup is running.
+ */
+BOOL exmdb_server_backup_store(const char *dir, const char *dest_dir)
+{
+	std::string dest;
+	if (!exmdb_server_backup_path(dest_dir, dest))
+		return FALSE;
+	std::lock_guard hold(g_backup_lock);
+	if (g_backup_running) {
+		fprintf(stderr, "E-1542: backup refused: a backup"
+		        " of %s is in progress\n", g_backup_dir.c_str());
+		return FALSE;
+	}
+	if (g_backup_thread.joinable())
+		g_backup_thread.join();
+	try {
+		g_backup_dir = dir;
+		g_backup_dest = std::move(dest);
+		g_backup_abort = false;
+		g_backup_pages = g_backup_page_total = 0;
+		g_backup_cids = g_backup_cid_total = g_backup_missing = 0;
+		g_backup_running = true;
+		g_backup_thread = std::thread([]() {
+			auto result = exmdb_server_backup_work(g_backup_dir.c_str(),
+			              g_backup_dest.c_str());
+			std::lock_guard hold(g_backup_lock);
+			g_backup_result = result;
+			g_backup_running = false;
+		});
+	} catch (const std::system_error &e) {
+		g_backup_running = false;
+		fprintf(stderr, "E-1543: backup: cannot start thread: %s\n", e.what());
+		return FALSE;
+	} catch (const std::bad_alloc &) {
+		g_backup_running = false;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void exmdb_server_backup_status(char *result, int length)
+{
+	static constexpr const char *outcome[] =
+		{"complete", "PARTIAL (referenced cids missing)", "FAILED", "aborted"};
+	std::lock_guard hold(g_backup_lock);
+	if (g_backup_dir.empty()) {
+		gx_strlcpy(result, "250 no backup has been started", length);
+		return;
+	}
+	if (g_backup_running)
+		snprintf(result, length, "250 backup of %s to %s running:"
+		         " %d/%d pages, %llu/%llu cids (%llu missing)",
+		         g_backup_dir.c_str(), g_backup_dest.c_str(),
+		         g_backup_pages.load(), g_backup_page_total.load(),
+		         LLU(g_backup_cids.load()), LLU(g_backup_cid_total.load()),
+		         LLU(g_backup_missing.load()));
+	else
+		snprintf(result, length, "250 backup of %s to %s %s:"
+		         " %llu cids (%llu missing)", g_backup_dir.c_str(),
+		         g_backup_dest.c_str(),
+		         outcome[static_cast<int>(g_backup_result)],
+		         LLU(g_backup_cid_total.load()), LLU(g_backup_missing.load()));
+}
+
+void exmdb_server_backup_stop()
+{
+	g_backup_abort = true;
+	if (g_backup_thread.joinable())
+		g_backup_thread.join();
+}
@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+#include <algorithm>
 #include <cerrno>
 #include <cstdint>
+#include <vector>
 #include <gromox/database.h>
 #include <gromox/fileio.h>
 #include <gromox/mapidefs.h>
@@ -12,6 +14,7 @@
 #include "common_util.h"
 #include <gromox/ext_buffer.hpp>
 #include "db_engine.h"
+#include "sort_table.h"
 #include <gromox/int_hash.hpp>
 #include <gromox/rop_util.hpp>
 #include <gromox/propval.hpp>
@@ -74,59 +77,68 @@ static BOOL table_sum_table_count(db_item_ptr &pdb,
 	return TRUE;
 }
 
+/*
+ * Direct subfolders of @folder_id, from the cached folder tree or else from
+ * SQL. @deleted: 1 for soft-deleted, 0 for live folders, -1 for both.
+ */
+static BOOL table_get_subfolders(sqlite3 *psqlite, uint64_t folder_id,
+	int deleted, std::vector<uint64_t> &fids)
+{
+	char sql_string[128];
+	
+	if (TRUE == common_util_get_subfolders(psqlite, folder_id, deleted, fids)) {
+		return TRUE;
+	}
+	fids.clear();
+	if (deleted < 0) {
+		snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM "
+		          "folders WHERE parent_id=%llu", LLU(folder_id));
+	} else if (!exmdb_server_check_private()) {
+		snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM"
+		         " folders WHERE parent_id=%llu AND is_deleted=%u",
+		         LLU(folder_id), !!deleted);
+	} else if (deleted > 0) {
+		/* private stores do not soft-delete folders */
+		return TRUE;
+	} else {
+		snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM "
+		          "folders WHERE parent_id=%llu", LLU(folder_id));
+	}
+	auto pstmt = gx_sql_prep(psqlite, sql_string);
+	if (pstmt == nullptr)
+		return FALSE;
+	try {
+		while (SQLITE_ROW == sqlite3_step(pstmt))
+			fids.push_back(sqlite3_column_int64(pstmt, 0));
+	} catch (const std::bad_alloc &) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static uint32_t table_sum_hierarchy(sqlite3 *psqlite,
 	uint64_t folder_id, const char *username, BOOL b_depth)
 {
 	uint32_t count;
 	uint32_t permission;
-	char sql_string[128];
+	std::vector<uint64_t> fids;
 	
-	if (FALSE == b_depth) {
-		if (NULL == username) {
-			snprintf(sql_string, arsizeof(sql_string), "SELECT count(*) FROM"
-			          " folders WHERE parent_id=%llu", LLU(folder_id));
-			auto pstmt = gx_sql_prep(psqlite, sql_string);
-			if (pstmt == nullptr || sqlite3_step(pstmt) != SQLITE_ROW)
-				return 0;
-			count = sqlite3_column_int64(pstmt, 0);
-		} else {
-			count = 0;
-			snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM "
-			          "folders WHERE parent_id=%llu", LLU(folder_id));
-			auto pstmt = gx_sql_prep(psqlite, sql_string);
-			if (pstmt == nullptr)
-				return 0;
-			while (SQLITE_ROW == sqlite3_step(pstmt)) {
-				if (FALSE == common_util_check_folder_permission(
-					psqlite, sqlite3_column_int64(pstmt, 0),
-					username, &permission)) {
-					continue;
-				}
-				if (!(permission & (frightsReadAny | frightsVisible | frightsOwner)))
-					continue;
-				count ++;
+	if (FALSE == table_get_subfolders(psqlite, folder_id, -1, fids)) {
+		return 0;
+	}
+	count = 0;
+	for (auto fid : fids) {
+		if (NULL != username) {
+			if (FALSE == common_util_check_folder_permission(
+				psqlite, fid, username, &permission)) {
+				continue;
 			}
+			if (!(permission & (frightsReadAny | frightsVisible | frightsOwner)))
+				continue;
 		}
-	} else {
-		count = 0;
-		snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id FROM "
-		          "folders WHERE parent_id=%llu", LLU(folder_id));
-		auto pstmt = gx_sql_prep(psqlite, sql_string);
-		if (pstmt == nullptr)
-			return 0;
-		while (SQLITE_ROW == sqlite3_step(pstmt)) {
-			if (NULL != username) {
-				if (FALSE == common_util_check_folder_permission(
-					psqlite, sqlite3_column_int64(pstmt, 0),
-					username, &permission)) {
-					continue;
-				}
-				if (!(permission & (frightsReadAny | frightsVisible | frightsOwner)))
-					continue;
-			}
-			count += table_sum_hierarchy(psqlite,
-				sqlite3_column_int64(pstmt, 0), username, TRUE);
-			count ++;
+		count ++;
+		if (TRUE == b_depth) {
+			count += table_sum_hierarchy(psqlite, fid, username, TRUE);
 		}
 	}
 	return count;
@@ -137,26 +149,14 @@ static BOOL table_load_hierarchy(sqlite3 *psqlite,
 	const RESTRICTION *prestriction, sqlite3_stmt *pstmt, int depth,
 	uint32_t *prow_count)
 {
-	uint64_t folder_id1;
 	uint32_t permission;
-	char sql_string[256];
+	std::vector<uint64_t> fids;
 	
-	if (!exmdb_server_check_private()) {
-		snprintf(sql_string, GX_ARRAY_SIZE(sql_string), "SELECT folder_id FROM"
-		         " folders WHERE parent_id=%llu AND is_deleted=%u",
-		         LLU(folder_id), !!(table_flags & TABLE_FLAG_SOFTDELETES));
-	} else if (table_flags & TABLE_FLAG_SOFTDELETES) {
-		snprintf(sql_string, arsizeof(sql_string), "SELECT"
-		        " folder_id FROM folders WHERE 0");
-	} else {
-		snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id "
-		        "FROM folders WHERE parent_id=%llu", LLU(folder_id));
-	}
-	auto pstmt1 = gx_sql_prep(psqlite, sql_string);
-	if (pstmt1 == nullptr)
+	if (FALSE == table_get_subfolders(psqlite, folder_id,
+	    !!(table_flags & TABLE_FLAG_SOFTDELETES), fids)) {
 		return FALSE;
-	while (SQLITE_ROW == sqlite3_step(pstmt1)) {
-		folder_id1 = sqlite3_column_int64(pstmt1, 0);
+	}
+	for (auto folder_id1 : fids) {
 		if (NULL != username) {
 			if (FALSE == common_util_check_folder_permission(
 				psqlite, folder_id1, username, &permission)) {
@@ -219,8 +219,7 @@ BOOL exmdb_server_load_hierarchy_table(const char *dir,
 	}
 	fid_val = rop_util_get_gc_value(folder_id);
 	if (NULL == pdb->tables.psqlite) {
-		if (SQLITE_OK != sqlite3_open_v2(":memory:", &pdb->tables.psqlite,
-			SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL)) {
+		if (!db_engine_open_scratch(dir, &pdb->tables.psqlite)) {
 			return FALSE;
 		}
 	}
@@ -308,6 +307,7 @@ BOOL exmdb_server_load_hierarchy_table(const char *dir,
 	pstmt.finalize();
 	sqlite3_exec(pdb->tables.psqlite, "COMMIT TRANSACTION", NULL, NULL, NULL);
 	double_list_append_as_tail(&pdb->tables.table_list, &ptnode->node);
+	db_engine_account_scratch(pdb->tables.psqlite);
 	*ptable_id = ptnode->table_id;
 	return TRUE;
 }
@@ -627,6 +627,80 @@ static BOOL table_load_content(db_item_ptr &pdb, sqlite3 *psqlite,
 	return TRUE;
 }
 
+static BOOL table_memsort_add_column(SORT_TABLE &stbl,
+	const SORT_ORDER &sort, BOOL b_category)
+{
+	int role = SORT_ROLE_KEY;
+	bool b_desc = sort.table_sort != TABLE_SORT_ASCEND;
+	
+	if (TRUE == b_category)
+		role = SORT_ROLE_CATEGORY;
+	else if (TABLE_SORT_MAXIMUM_CATEGORY == sort.table_sort)
+		role = SORT_ROLE_MAXIMUM;
+	else if (TABLE_SORT_MINIMUM_CATEGORY == sort.table_sort)
+		role = SORT_ROLE_MINIMUM;
+	switch (sort.type) {
+	case PT_STRING8:
+	case PT_UNICODE:
+		stbl.add_column(SORT_COL_TEXT, role, b_desc);
+		return TRUE;
+	case PT_FLOAT:
+	case PT_DOUBLE:
+	case PT_APPTIME:
+		stbl.add_column(SORT_COL_REAL, role, b_desc);
+		return TRUE;
+	case PT_CURRENCY:
+	case PT_I8:
+	case PT_SYSTIME:
+	case PT_SHORT:
+	case PT_LONG:
+	case PT_BOOLEAN:
+		stbl.add_column(SORT_COL_INTEGER, role, b_desc);
+		return TRUE;
+	case PT_CLSID:
+	case PT_SVREID:
+	case PT_OBJECT:
+	case PT_BINARY:
+		stbl.add_column(SORT_COL_BLOB, role, b_desc);
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/* same representation as common_util_bind_sqlite_statement gives */
+static BOOL table_memsort_push(SORT_TABLE &stbl, size_t col,
+	uint16_t proptype, void *pvalue)
+{
+	SQL_VALUE v;
+	
+	if (NULL == pvalue) {
+		stbl.push_null(col);
+		return TRUE;
+	}
+	if (FALSE == common_util_propval_to_sql(proptype, pvalue, &v)) {
+		return FALSE;
+	}
+	switch (v.type) {
+	case SQLITE_TEXT:
+		stbl.push_text(col, static_cast<const char *>(v.pv));
+		break;
+	case SQLITE_FLOAT:
+		stbl.push_real(col, v.d);
+		break;
+	case SQLITE_INTEGER:
+		stbl.push_int(col, v.i);
+		break;
+	case SQLITE_BLOB:
+		stbl.push_blob(col, v.pv, v.cb);
+		break;
+	default:
+		stbl.push_null(col);
+		break;
+	}
+	return TRUE;
+}
+
 /* under public mode username always available for read state */
 static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 	uint64_t fid_val, const char *username, uint8_t table_flags,
@@ -655,6 +729,8 @@ static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 	DOUBLE_LIST value_list;
 	uint32_t tmp_proptags[16];
 	RESTRICTION_PROPERTY *pres = nullptr;
+	BOOL b_memsort = FALSE;
+	SORT_TABLE mstbl;
 	
 	b_conversation = FALSE;
 	if ((table_flags & TABLE_FLAG_CONVERSATIONMEMBERS) &&
@@ -686,8 +762,7 @@ static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 		}
 	}
 	if (pdb->tables.psqlite == nullptr &&
-	    sqlite3_open_v2(":memory:", &pdb->tables.psqlite,
-	    SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK)
+	    !db_engine_open_scratch(exmdb_server_get_dir(), &pdb->tables.psqlite))
 		return FALSE;
 	if (0 == *ptable_id) {
 		pdb->tables.last_id ++;
@@ -758,7 +833,7 @@ static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 		pstmt1.finalize();
 		if (psqlite != nullptr) {
 			sqlite3_exec(psqlite, "ROLLBACK", nullptr, nullptr, nullptr);
-			sqlite3_close(psqlite);
+			db_engine_close_scratch(psqlite);
 		}
 		if (ptnode->psorts != nullptr)
 			sortorder_set_free(ptnode->psorts);
@@ -799,8 +874,38 @@ static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 		if (NULL == ptnode->psorts) {
 			return false;
 		}
-		if (SQLITE_OK != sqlite3_open_v2(":memory:", &psqlite,
-			SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL)) {
+		/*
+		 * Without multi-value instances, the rows are sorted and
+		 * grouped in memory instead of via stbl.
+		 */
+		b_memsort = std::none_of(psorts->psort, psorts->psort + psorts->count,
+		            [](const SORT_ORDER &o) { return (o.type & MVI_FLAG) == MVI_FLAG; }) ?
+		            TRUE : FALSE;
+	}
+	if (TRUE == b_memsort) {
+		try {
+			for (size_t i = 0; i < psorts->count; ++i) {
+				if (TABLE_SORT_MAXIMUM_CATEGORY ==
+				    psorts->psort[i].table_sort ||
+				    TABLE_SORT_MINIMUM_CATEGORY ==
+				    psorts->psort[i].table_sort)
+					ptnode->extremum_tag = PROP_TAG(psorts->psort[i].type,
+					                       psorts->psort[i].propid);
+				if (!table_memsort_add_column(mstbl, psorts->psort[i],
+				    i < psorts->ccategories ? TRUE : FALSE))
+					return false;
+			}
+		} catch (const std::bad_alloc &) {
+			return false;
+		}
+		snprintf(sql_string, arsizeof(sql_string), "CREATE UNIQUE INDEX"
+			" t%u_4 ON t%u (inst_id)", table_id, table_id);
+		if (SQLITE_OK != sqlite3_exec(pdb->tables.psqlite,
+			sql_string, NULL, NULL, NULL)) {
+			return false;
+		}
+	} else if (NULL != psorts) {
+		if (!db_engine_open_scratch(exmdb_server_get_dir(), &psqlite)) {
 			return false;
 		}
 		sqlite3_exec(psqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
@@ -1022,6 +1127,31 @@ static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 		    !common_util_evaluate_message_restriction(pdb->psqlite, cpid, mid_val, prestriction)) {
 			continue;
 		}
+		if (TRUE == b_memsort) {
+			BOOL b_read = TRUE;
+			if (psorts->ccategories > 0) {
+				if (!common_util_get_property(MESSAGE_PROPERTIES_TABLE,
+				    mid_val, 0, pdb->psqlite, PR_READ, &pvalue))
+					return false;
+				b_read = pvalue == nullptr || *static_cast<uint8_t *>(pvalue) == 0 ?
+				         FALSE : TRUE;
+			}
+			try {
+				mstbl.add_row(mid_val, b_read);
+				for (size_t i = 0; i < psorts->count; ++i) {
+					tmp_proptag = PROP_TAG(psorts->psort[i].type,
+					              psorts->psort[i].propid);
+					if (!common_util_get_property(MESSAGE_PROPERTIES_TABLE,
+					    mid_val, cpid, pdb->psqlite, tmp_proptag, &pvalue) ||
+					    !table_memsort_push(mstbl, i,
+					    PROP_TYPE(tmp_proptag), pvalue))
+						return false;
+				}
+			} catch (const std::bad_alloc &) {
+				return false;
+			}
+			continue;
+		}
 		sqlite3_bind_int64(pstmt1, 1, mid_val);
 		if (NULL != psorts) {
 			for (size_t i = 0; i < tag_count; ++i) {
@@ -1187,13 +1317,18 @@ static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 		}
 		sqlite3_reset(pstmt1);
 	}
-	if (NULL != psorts) {
+	if (TRUE == b_memsort) {
+		if (FALSE == mstbl.write(pdb->tables.psqlite, table_id,
+		    psorts->ccategories, psorts->cexpanded, &ptnode->header_id)) {
+			return false;
+		}
+	} else if (NULL != psorts) {
 		sqlite3_exec(psqlite, "COMMIT TRANSACTION", NULL, NULL, NULL);
 		sqlite3_exec(psqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
 	}
 	pstmt.finalize();
 	pstmt1.finalize();
-	if (NULL != psorts) {
+	if (NULL != psorts && FALSE == b_memsort) {
 		snprintf(sql_string, arsizeof(sql_string), "INSERT INTO t%u "
 			    "(inst_id, row_type, row_stat, parent_id, depth, "
 			    "count, inst_num, value, extremum, prev_id) VALUES"
@@ -1216,48 +1351,9 @@ static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 		pstmt.finalize();
 		pstmt1.finalize();
 		sqlite3_exec(psqlite, "COMMIT TRANSACTION", NULL, NULL, NULL);
-		sqlite3_close(psqlite);
+		db_engine_close_scratch(psqlite);
 		psqlite = NULL;
-		/* index the content table */
-		if (psorts->ccategories > 0) {
-			snprintf(sql_string, arsizeof(sql_string), "SELECT row_id,"
-			        " row_type, row_stat, depth, prev_id FROM"
-			        " t%u ORDER BY row_id", table_id);
-			pstmt = gx_sql_prep(pdb->tables.psqlite, sql_string);
-			if (pstmt == nullptr)
-				return false;
-			snprintf(sql_string, arsizeof(sql_string), "UPDATE t%u SET "
-			        "idx=? WHERE row_id=?", table_id);
-			pstmt1 = gx_sql_prep(pdb->tables.psqlite, sql_string);
-			if (pstmt1 == nullptr)
-				return false;
-			size_t i = 1;
-			prev_id = 0;
-			while (SQLITE_ROW == sqlite3_step(pstmt)) {
-				if (0 != prev_id &&
-					depth < sqlite3_column_int64(pstmt, 3) &&
-				    gx_sql_col_uint64(pstmt, 4) != prev_id)
-					continue;
-				row_id = sqlite3_column_int64(pstmt, 0);
-				if (CONTENT_ROW_HEADER == sqlite3_column_int64(pstmt, 1)) {
-					if (0 == sqlite3_column_int64(pstmt, 2)) {
-						prev_id = row_id;
-						depth = sqlite3_column_int64(pstmt, 3);
-					} else {
-						prev_id = 0;
-					}
-				}
-				sqlite3_bind_int64(pstmt1, 1, i);
-				sqlite3_bind_int64(pstmt1, 2, row_id);
-				if (SQLITE_DONE != sqlite3_step(pstmt1)) {
-					return false;
-				}
-				sqlite3_reset(pstmt1);
-				i ++;
-			}
-			pstmt.finalize();
-			pstmt1.finalize();
-		} else {
+		if (0 == psorts->ccategories) {
 			snprintf(sql_string, arsizeof(sql_string), "UPDATE t%u SET idx=row_id", table_id);
 			if (SQLITE_OK != sqlite3_exec(pdb->tables.psqlite,
 				sql_string, NULL, NULL, NULL)) {
@@ -1265,10 +1361,51 @@ static BOOL table_load_content_table(db_item_ptr &pdb, uint32_t cpid,
 			}
 		}
 	}
+	/* index the content table */
+	if (NULL != psorts && psorts->ccategories > 0) {
+		snprintf(sql_string, arsizeof(sql_string), "SELECT row_id,"
+		        " row_type, row_stat, depth, prev_id FROM"
+		        " t%u ORDER BY row_id", table_id);
+		pstmt = gx_sql_prep(pdb->tables.psqlite, sql_string);
+		if (pstmt == nullptr)
+			return false;
+		snprintf(sql_string, arsizeof(sql_string), "UPDATE t%u SET "
+		        "idx=? WHERE row_id=?", table_id);
+		pstmt1 = gx_sql_prep(pdb->tables.psqlite, sql_string);
+		if (pstmt1 == nullptr)
+			return false;
+		size_t i = 1;
+		prev_id = 0;
+		while (SQLITE_ROW == sqlite3_step(pstmt)) {
+			if (0 != prev_id &&
+				depth < sqlite3_column_int64(pstmt, 3) &&
+			    gx_sql_col_uint64(pstmt, 4) != prev_id)
+				continue;
+			row_id = sqlite3_column_int64(pstmt, 0);
+			if (CONTENT_ROW_HEADER == sqlite3_column_int64(pstmt, 1)) {
+				if (0 == sqlite3_column_int64(pstmt, 2)) {
+					prev_id = row_id;
+					depth = sqlite3_column_int64(pstmt, 3);
+				} else {
+					prev_id = 0;
+				}
+			}
+			sqlite3_bind_int64(pstmt1, 1, i);
+			sqlite3_bind_int64(pstmt1, 2, row_id);
+			if (SQLITE_DONE != sqlite3_step(pstmt1)) {
+				return false;
+			}
+			sqlite3_reset(pstmt1);
+			i ++;
+		}
+		pstmt.finalize();
+		pstmt1.finalize();
+	}
 	all_ok = true;
 	sqlite3_exec(pdb->tables.psqlite,
 		"COMMIT TRANSACTION", NULL, NULL, NULL);
 	double_list_append_as_tail(&pdb->tables.table_list, &ptnode->node);
+	db_engine_account_scratch(pdb->tables.psqlite);
 	if (0 == *ptable_id) {
 		*ptable_id = table_id;
 	}
@@ -1410,8 +1547,7 @@ BOOL exmdb_server_load_permission_table(const char *dir,
 		return FALSE;
 	fid_val = rop_util_get_gc_value(folder_id);
 	if (NULL == pdb->tables.psqlite) {
-		if (SQLITE_OK != sqlite3_open_v2(":memory:", &pdb->tables.psqlite,
-			SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL)) {
+		if (!db_engine_open_scratch(dir, &pdb->tables.psqlite)) {
 			return FALSE;
 		}
 	}
@@ -1471,6 +1607,7 @@ BOOL exmdb_server_load_permission_table(const char *dir,
 	pstmt.finalize();
 	sqlite3_exec(pdb->tables.psqlite, "COMMIT TRANSACTION", NULL, NULL, NULL);
 	double_list_append_as_tail(&pdb->tables.table_list, &ptnode->node);
+	db_engine_account_scratch(pdb->tables.psqlite);
 	*ptable_id = ptnode->table_id;
 	return TRUE;
 }
@@ -1669,8 +1806,7 @@ BOOL exmdb_server_load_rule_table(const char *dir,
 		return FALSE;
 	fid_val = rop_util_get_gc_value(folder_id);
 	if (NULL == pdb->tables.psqlite) {
-		if (SQLITE_OK != sqlite3_open_v2(":memory:", &pdb->tables.psqlite,
-			SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL)) {
+		if (!db_engine_open_scratch(dir, &pdb->tables.psqlite)) {
 			return FALSE;
 		}
 	}
@@ -1747,6 +1883,7 @@ BOOL exmdb_server_load_rule_table(const char *dir,
 	pstmt.finalize();
 	sqlite3_exec(pdb->tables.psqlite, "COMMIT TRANSACTION", NULL, NULL, NULL);
 	double_list_append_as_tail(&pdb->tables.table_list, &ptnode->node);
+	db_engine_account_scratch(pdb->tables.psqlite);
 	*ptable_id = ptnode->table_id;
 	return TRUE;
 }
@@ -1771,8 +1908,15 @@ BOOL exmdb_server_unload_table(const char *dir, uint32_t table_id)
 		return TRUE;
 	}
 	ptnode = (TABLE_NODE*)pnode->pdata;
-	snprintf(sql_string, arsizeof(sql_string), "DROP TABLE t%u", table_id);
-	sqlite3_exec(pdb->tables.psqlite, sql_string, NULL, NULL, NULL);
+	if (0 == double_list_get_nodes_num(&pdb->tables.table_list)) {
+		/* a dropped table's pages stay on the freelist; release them all */
+		db_engine_close_scratch(pdb->tables.psqlite);
+		pdb->tables.psqlite = NULL;
+	} else {
+		snprintf(sql_string, arsizeof(sql_string), "DROP TABLE t%u", table_id);
+		sqlite3_exec(pdb->tables.psqlite, sql_string, NULL, NULL, NULL);
+	}
+	db_engine_account_scratch(pdb->tables.psqlite);
 	if (NULL != ptnode->remote_id) {
 		free(ptnode->remote_id);
 	}
@@ -3721,16 +3865,13 @@ BOOL exmdb_server_store_table_state(const char *dir,
 	void *pvalue;
 	uint16_t type;
 	uint64_t row_id;
-	uint64_t last_id;
-	sqlite3 *psqlite;
+	uint64_t row_count;
 	EXT_PUSH ext_push;
-	char tmp_path[256];
 	TABLE_NODE *ptnode;
 	char tmp_buff[1024];
-	uint32_t tmp_proptag;
 	char sql_string[1024];
-	struct stat node_stat;
 	DOUBLE_LIST_NODE *pnode;
+	TABLE_STATE *pstate = nullptr;
 	
 	auto pdb = db_engine_get_db(dir);
 	if (pdb == nullptr || pdb->psqlite == nullptr)
@@ -3749,264 +3890,91 @@ BOOL exmdb_server_store_table_state(const char *dir,
 	if (TABLE_TYPE_CONTENT != ptnode->type) {
 		return TRUE;
 	}
-	snprintf(tmp_path, arsizeof(tmp_path), "%s/tmp/state.sqlite3", exmdb_server_get_dir());
-	if (0 != stat(tmp_path, &node_stat)) {
-		auto ret = sqlite3_open_v2(tmp_path, &psqlite, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
-		if (ret != SQLITE_OK) {
-			fprintf(stderr, "E-1435: sqlite3_open %s: %s\n", tmp_path, sqlite3_errstr(ret));
-			return FALSE;
-		}
-		sqlite3_exec(psqlite, "PRAGMA journal_mode=OFF", NULL, NULL, NULL);
-		sqlite3_exec(psqlite, "PRAGMA synchronous=OFF", NULL, NULL, NULL);
-		sprintf(sql_string,
-			"CREATE TABLE state_info "
-			"(state_id INTEGER PRIMARY KEY AUTOINCREMENT, "
-			"folder_id INTEGER NOT NULL, "
-			"table_flags INTEGER NOT NULL, "
-			"sorts BLOB, "
-			"message_id INTEGER DEFAULT NULL, "
-			"inst_num INTEGER DEFAULT NULL, "
-			"header_id INTEGER DEFAULT NULL, "
-			"header_stat INTEGER DEFAULT NULL)");
-		if (SQLITE_OK != sqlite3_exec(psqlite,
-			sql_string, NULL, NULL, NULL)) {
-			sqlite3_close(psqlite);
-			if (remove(tmp_path) < 0 && errno != ENOENT)
-				fprintf(stderr, "W-1348: remove %s: %s\n", tmp_path, strerror(errno));
-			return FALSE;
-		}
-		snprintf(sql_string, arsizeof(sql_string), "CREATE UNIQUE INDEX state_index"
-			" ON state_info (folder_id, table_flags, sorts)");
-		if (SQLITE_OK != sqlite3_exec(psqlite,
-			sql_string, NULL, NULL, NULL)) {
-			sqlite3_close(psqlite);
-			remove(tmp_path);
-			return FALSE;
-		}
-	} else {
-		auto ret = sqlite3_open_v2(tmp_path, &psqlite, SQLITE_OPEN_READWRITE, nullptr);
-		if (ret != SQLITE_OK) {
-			fprintf(stderr, "E-1436: sqlite3_open %s: %s\n", tmp_path, sqlite3_errstr(ret));
-			return FALSE;
-		}
-		sqlite3_exec(psqlite, "PRAGMA journal_mode=OFF", NULL, NULL, NULL);
-		sqlite3_exec(psqlite, "PRAGMA synchronous=OFF", NULL, NULL, NULL);
-	}
-	if (NULL != ptnode->psorts && 0 != ptnode->psorts->ccategories) {
-		strcpy(sql_string, "SELECT state_id FROM "
-			"state_info WHERE folder_id=? AND table_flags=? "
-			"AND sorts=?");
-	} else {
-		strcpy(sql_string, "SELECT state_id FROM "
-			"state_info WHERE folder_id=? AND table_flags=? "
-			"AND sorts IS NULL");
-	}
-	auto pstmt = gx_sql_prep(psqlite, sql_string);
-	if (pstmt == nullptr) {
-		sqlite3_close(psqlite);
+	if (!db_engine_load_states(&*pdb, dir))
 		return FALSE;
-	}
-	sqlite3_bind_int64(pstmt, 1, ptnode->folder_id);
-	sqlite3_bind_int64(pstmt, 2, ptnode->table_flags);
-	if (NULL != ptnode->psorts && 0 != ptnode->psorts->ccategories) {
-		if (!ext_push.init(tmp_buff, sizeof(tmp_buff), 0) ||
-		    ext_push.p_sortorder_set(ptnode->psorts) != EXT_ERR_SUCCESS) {
-			pstmt.finalize();
-			sqlite3_close(psqlite);
-			return FALSE;
-		}
-		sqlite3_bind_blob(pstmt, 3, ext_push.m_udata, ext_push.m_offset, SQLITE_STATIC);
-	}
-	if (SQLITE_ROW == sqlite3_step(pstmt)) {
-		*pstate_id = sqlite3_column_int64(pstmt, 0);
-	}
-	pstmt.finalize();
-	sqlite3_exec(psqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
-	if (0 == *pstate_id) {
-		strcpy(sql_string, "INSERT INTO state_info"
-			"(folder_id, table_flags, sorts) VALUES (?, ?, ?)");
-		pstmt = gx_sql_prep(psqlite, sql_string);
-		if (pstmt == nullptr) {
-			sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-			sqlite3_close(psqlite);
-			return FALSE;
-		}
-		sqlite3_bind_int64(pstmt, 1, ptnode->folder_id);
-		sqlite3_bind_int64(pstmt, 2, ptnode->table_flags);
-		if (NULL == ptnode->psorts || 0 == ptnode->psorts->ccategories) {
-			sqlite3_bind_null(pstmt, 3);
-		} else {
-			sqlite3_bind_blob(pstmt, 3, ext_push.m_udata, ext_push.m_offset, SQLITE_STATIC);
-		}
-		if (SQLITE_DONE != sqlite3_step(pstmt)) {
-			pstmt.finalize();
-			sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-			sqlite3_close(psqlite);
-			return FALSE;
-		}
-		*pstate_id = sqlite3_last_insert_rowid(psqlite);
-		pstmt.finalize();
-	} else {
-		if (NULL != ptnode->psorts && 0 != ptnode->psorts->ccategories) {
-			snprintf(sql_string, arsizeof(sql_string), "DROP TABLE s%u", *pstate_id);
-			if (SQLITE_OK != sqlite3_exec(psqlite,
-				sql_string, NULL, NULL, NULL)) {
-				sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-				sqlite3_close(psqlite);
+	auto &ts = pdb->states;
+	auto b_categorized = NULL != ptnode->psorts && 0 != ptnode->psorts->ccategories;
+	std::string sorts;
+	try {
+		if (b_categorized) {
+			if (!ext_push.init(tmp_buff, sizeof(tmp_buff), 0) ||
+			    ext_push.p_sortorder_set(ptnode->psorts) != EXT_ERR_SUCCESS)
 				return FALSE;
+			sorts.assign(reinterpret_cast<char *>(ext_push.m_udata), ext_push.m_offset);
+		}
+		for (auto &e : ts.states) {
+			if (e.second.folder_id == ptnode->folder_id &&
+			    e.second.table_flags == ptnode->table_flags &&
+			    e.second.sorts == sorts) {
+				*pstate_id = e.first;
+				pstate = &e.second;
+				break;
 			}
 		}
-		if (1 != rop_util_get_replid(inst_id)) {
-			snprintf(sql_string, arsizeof(sql_string), "UPDATE "
-				"state_info SET message_id=NULL, "
-				"inst_num=NULL WHERE state_id=%u",
-				*pstate_id);
-			if (SQLITE_OK != sqlite3_exec(psqlite,
-				sql_string, NULL, NULL, NULL)) {
-				sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-				sqlite3_close(psqlite);
-				return FALSE;
-			}
+		if (NULL == pstate) {
+			*pstate_id = ++ts.last_id;
+			pstate = &ts.states[*pstate_id];
+			pstate->folder_id = ptnode->folder_id;
+			pstate->table_flags = ptnode->table_flags;
+			pstate->sorts = std::move(sorts);
 		}
+	} catch (const std::bad_alloc &) {
+		return FALSE;
 	}
 	if (1 == rop_util_get_replid(inst_id)) {
-		snprintf(sql_string, arsizeof(sql_string), "UPDATE "
-			"state_info SET message_id=%llu, "
-			"inst_num=%u WHERE state_id=%u",
-			LLU(rop_util_get_gc_value(inst_id)),
-			inst_num, *pstate_id);
-		if (SQLITE_OK != sqlite3_exec(psqlite,
-			sql_string, NULL, NULL, NULL)) {
-			sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-			sqlite3_close(psqlite);
-			return FALSE;
-		}
+		pstate->message_id = rop_util_get_gc_value(inst_id);
+		pstate->inst_num = inst_num;
+	} else {
+		pstate->message_id = 0;
+		pstate->inst_num = 0;
 	}
-	if (NULL == ptnode->psorts || 0 == ptnode->psorts->ccategories) {
-		sqlite3_exec(psqlite, "COMMIT TRANSACTION", NULL, NULL, NULL);
-		sqlite3_close(psqlite);
-		return TRUE;
+	pstate->header_id = 0;
+	pstate->header_stat = 0;
+	pstate->headers.clear();
+	pstate->b_dirty = true;
+	if (0 == ts.dirty_time) {
+		ts.dirty_time = time(nullptr);
 	}
-	auto sql_len = snprintf(sql_string, arsizeof(sql_string), "CREATE TABLE s%u "
-			"(depth INTEGER NOT NULL ", *pstate_id);
-	for (i=0; i<ptnode->psorts->ccategories; i++) {
-		tmp_proptag = PROP_TAG(ptnode->psorts->psort[i].type, ptnode->psorts->psort[i].propid);
-		type = ptnode->psorts->psort[i].type;
-		if (ptnode->instance_tag == tmp_proptag)
-			type &= ~MVI_FLAG;
-		switch (type) {
-		case PT_STRING8:
-		case PT_UNICODE:
-			sql_len += gx_snprintf(sql_string + sql_len,
-			           GX_ARRAY_SIZE(sql_string) - sql_len,
-						", v%x TEXT", tmp_proptag);
-			break;
-		case PT_FLOAT:
-		case PT_DOUBLE:
-		case PT_APPTIME:
-			sql_len += gx_snprintf(sql_string + sql_len,
-			           GX_ARRAY_SIZE(sql_string) - sql_len,
-						", v%x REAL", tmp_proptag);
-			break;
-		case PT_CURRENCY:
-		case PT_I8:
-		case PT_SYSTIME:
-		case PT_SHORT:
-		case PT_LONG:
-		case PT_BOOLEAN:
-			sql_len += gx_snprintf(sql_string + sql_len,
-			           GX_ARRAY_SIZE(sql_string) - sql_len,
-						", v%x INTEGER", tmp_proptag);
-			break;
-		case PT_CLSID:
-		case PT_SVREID:
-		case PT_OBJECT:
-		case PT_BINARY:
-			sql_len += gx_snprintf(sql_string + sql_len,
-			           GX_ARRAY_SIZE(sql_string) - sql_len,
-						", v%x BLOB", tmp_proptag);
-			break;
-		default:
-			sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-			sqlite3_close(psqlite);
-			return FALSE;
-		}
+	if (!b_categorized) {
+		return TRUE;
 	}
-	sql_string[sql_len] = ')';
-	sql_len ++;
-	sql_string[sql_len] = '\0';
-	if (SQLITE_OK != sqlite3_exec(psqlite,
-		sql_string, NULL, NULL, NULL)) {
-		sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-		sqlite3_close(psqlite);
+	/*
+	 * Header rows not in their default collapse state, each as the depth
+	 * followed by the category values from the top down.
+	 */
+	if (!ext_push.init(nullptr, 0, 0))
 		return FALSE;
-	}
 	snprintf(sql_string, GX_ARRAY_SIZE(sql_string), "SELECT row_id, inst_id,"
 			" row_stat, depth FROM t%u", ptnode->table_id);
-	pstmt = gx_sql_prep(pdb->tables.psqlite, sql_string);
+	auto pstmt = gx_sql_prep(pdb->tables.psqlite, sql_string);
 	if (pstmt == nullptr) {
-		sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-		sqlite3_close(psqlite);
-		return FALSE;
-	}
-	sql_len = snprintf(sql_string, arsizeof(sql_string), "INSERT"
-		" INTO s%u VALUES (?", *pstate_id);
-	for (i=0; i<ptnode->psorts->ccategories; i++) {
-		sql_len += gx_snprintf(sql_string + sql_len,
-		           GX_ARRAY_SIZE(sql_string) - sql_len, ", ?");
-	}
-	sql_string[sql_len] = ')';
-	sql_len ++;
-	sql_string[sql_len] = '\0';
-	auto pstmt1 = gx_sql_prep(psqlite, sql_string);
-	if (pstmt1 == nullptr) {
-		pstmt.finalize();
-		sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-		sqlite3_close(psqlite);
 		return FALSE;
 	}
 	snprintf(sql_string, GX_ARRAY_SIZE(sql_string), "SELECT parent_id FROM"
 			" t%u WHERE row_id=?", ptnode->table_id);
 	auto pstmt2 = gx_sql_prep(pdb->tables.psqlite, sql_string);
 	if (pstmt2 == nullptr) {
-		pstmt.finalize();
-		pstmt1.finalize();
-		sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-		sqlite3_close(psqlite);
 		return FALSE;
 	}
 	snprintf(sql_string, GX_ARRAY_SIZE(sql_string), "SELECT value FROM"
 			" t%u WHERE row_id=?", ptnode->table_id);
 	auto pstmt3 = gx_sql_prep(pdb->tables.psqlite, sql_string);
 	if (pstmt3 == nullptr) {
-		pstmt.finalize();
-		pstmt1.finalize();
-		pstmt2.finalize();
-		sqlite3_close(psqlite);
 		return FALSE;
 	}
 	uint64_t inst_id1 = rop_util_get_replid(inst_id) == 2 ?
 	                    rop_util_get_gc_value(inst_id) | 0x100000000000000ULL : 0;
+	/* collected deepest level first, written out top down */
+	void *pvalues[256];
+	row_count = 0;
 	while (SQLITE_ROW == sqlite3_step(pstmt)) {
 		depth = sqlite3_column_int64(pstmt, 3);
 		if (ptnode->psorts->ccategories == depth) {
 			continue;	
 		}
 		if (gx_sql_col_uint64(pstmt, 1) == inst_id1) {
-			last_id = sqlite3_last_insert_rowid(psqlite);
-			snprintf(sql_string, arsizeof(sql_string), "UPDATE state_info SET header_id=%llu,"
-				" header_stat=%llu WHERE state_id=%u", LLU(last_id + 1),
-				LLU(sqlite3_column_int64(pstmt, 2)), *pstate_id);
-			if (SQLITE_OK != sqlite3_exec(psqlite,
-				sql_string, NULL, NULL, NULL)) {
-				pstmt.finalize();
-				pstmt1.finalize();
-				pstmt2.finalize();
-				pstmt3.finalize();
-				sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-				sqlite3_close(psqlite);
-				return FALSE;
-			}
+			pstate->header_id = row_count + 1;
+			pstate->header_stat = sqlite3_column_int64(pstmt, 2);
 		} else {
 			if (0 == sqlite3_column_int64(pstmt, 2)) {
 				if (depth >= ptnode->psorts->cexpanded) {
@@ -4018,7 +3986,6 @@ BOOL exmdb_server_store_table_state(const char *dir,
 				}
 			}
 		}
-		sqlite3_bind_int64(pstmt1, 1, depth);
 		row_id = sqlite3_column_int64(pstmt, 0);
 		i = depth;
 		while (true) {
@@ -4027,67 +3994,37 @@ BOOL exmdb_server_store_table_state(const char *dir,
 			if ((type & MVI_FLAG) == MVI_FLAG)
 				type &= ~MVI_FLAG;
 			if (SQLITE_ROW != sqlite3_step(pstmt3)) {
-				pstmt.finalize();
-				pstmt1.finalize();
-				pstmt2.finalize();
-				pstmt3.finalize();
-				sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-				sqlite3_close(psqlite);
 				return FALSE;
 			}
-			pvalue = common_util_column_sqlite_statement(pstmt3, 0, type);
+			pvalues[i] = common_util_column_sqlite_statement(pstmt3, 0, type);
 			sqlite3_reset(pstmt3);
-			if (NULL == pvalue) {
-				sqlite3_bind_null(pstmt1, i + 2);
-			} else {
-				if (FALSE == common_util_bind_sqlite_statement(
-					pstmt1, i + 2, type, pvalue)) {
-					pstmt.finalize();
-					pstmt1.finalize();
-					pstmt2.finalize();
-					pstmt3.finalize();
-					sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-					sqlite3_close(psqlite);
-					return FALSE;	
-				}
-			}
 			if (0 == i) {
 				break;
 			}
 			i --;
 			sqlite3_bind_int64(pstmt2, 1, row_id);
 			if (SQLITE_ROW != sqlite3_step(pstmt2)) {
-				pstmt.finalize();
-				pstmt1.finalize();
-				pstmt2.finalize();
-				pstmt3.finalize();
-				sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-				sqlite3_close(psqlite);
 				return FALSE;
 			}
 			row_id = sqlite3_column_int64(pstmt2, 0);
 			sqlite3_reset(pstmt2);
 		}
-		for (i=depth+1; i<ptnode->psorts->ccategories; i++) {
-			sqlite3_bind_null(pstmt1, i + 2);
-		}
-		if (SQLITE_DONE != sqlite3_step(pstmt1)) {
-			pstmt.finalize();
-			pstmt1.finalize();
-			pstmt2.finalize();
-			pstmt3.finalize();
-			sqlite3_exec(psqlite, "ROLLBACK", NULL, NULL, NULL);
-			sqlite3_close(psqlite);
+		if (ext_push.p_uint8(depth) != EXT_ERR_SUCCESS)
 			return FALSE;
+		for (i=0; i<=depth; i++) {
+			type = ptnode->psorts->psort[i].type & ~MVI_FLAG;
+			pvalue = pvalues[i];
+			if (ext_push.p_uint8(NULL != pvalue) != EXT_ERR_SUCCESS ||
+			    (NULL != pvalue && ext_push.p_propval(type, pvalue) != EXT_ERR_SUCCESS))
+				return FALSE;
 		}
-		sqlite3_reset(pstmt1);
+		row_count ++;
+	}
+	try {
+		pstate->headers.assign(reinterpret_cast<char *>(ext_push.m_udata), ext_push.m_offset);
+	} catch (const std::bad_alloc &) {
+		return FALSE;
 	}
-	pstmt.finalize();
-	pstmt1.finalize();
-	pstmt2.finalize();
-	pstmt3.finalize();
-	sqlite3_exec(psqlite, "COMMIT TRANSACTION", NULL, NULL, NULL);
-	sqlite3_close(psqlite);
 	return TRUE;
 }
 
@@ -4097,25 +4034,22 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 	int i;
 	int depth;
 	void *pvalue;
+	uint8_t flag;
 	uint32_t idx;
 	uint16_t type;
+	uint8_t depth1;
 	uint64_t row_id;
 	uint64_t row_id1;
 	uint8_t row_stat;
-	sqlite3 *psqlite;
-	uint64_t inst_num;
+	EXT_PULL ext_pull;
 	EXT_PUSH ext_push;
-	char tmp_path[256];
 	TABLE_NODE *ptnode;
-	uint64_t header_id;
-	uint64_t message_id;
-	uint8_t header_stat;
 	uint64_t current_id;
-	xstmt pstmt1, pstmt2, pstmt3;
+	xstmt pstmt, pstmt1, pstmt2, pstmt3;
 	char tmp_buff[1024];
 	char sql_string[1024];
-	struct stat node_stat;
 	DOUBLE_LIST_NODE *pnode;
+	const TABLE_STATE *pstate;
 	
 	row_id1 = 0;
 	*pposition = -1;
@@ -4138,59 +4072,24 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 	if (TABLE_TYPE_CONTENT != ptnode->type) {
 		return TRUE;
 	}
-	snprintf(tmp_path, arsizeof(tmp_path), "%s/tmp/state.sqlite3", exmdb_server_get_dir());
-	if (0 != stat(tmp_path, &node_stat)) {
-		return TRUE;
-	}
-	auto ret = sqlite3_open_v2(tmp_path, &psqlite, SQLITE_OPEN_READWRITE, nullptr);
-	if (ret != SQLITE_OK) {
-		fprintf(stderr, "E-1437: sqlite3_open %s: %s\n", tmp_path, sqlite3_errstr(ret));
+	if (!db_engine_load_states(&*pdb, dir))
 		return FALSE;
-	}
-	sqlite3_exec(psqlite, "PRAGMA journal_mode=OFF", NULL, NULL, NULL);
-	sqlite3_exec(psqlite, "PRAGMA synchronous=OFF", NULL, NULL, NULL);
-	snprintf(sql_string, arsizeof(sql_string), "SELECT folder_id, table_flags,"
-			" sorts, message_id, inst_num, header_id, header_stat"
-			" FROM state_info WHERE state_id=%u", state_id);
-	auto pstmt = gx_sql_prep(psqlite, sql_string);
-	if (pstmt == nullptr) {
-		sqlite3_close(psqlite);
-		return FALSE;	
-	}
-	if (SQLITE_ROW != sqlite3_step(pstmt)) {
-		pstmt.finalize();
-		sqlite3_close(psqlite);
+	auto it = pdb->states.states.find(state_id);
+	if (it == pdb->states.states.end()) {
 		return TRUE;
 	}
-	message_id = sqlite3_column_int64(pstmt, 3);
-	inst_num = sqlite3_column_int64(pstmt, 4);
-	if (gx_sql_col_uint64(pstmt, 0) != ptnode->folder_id ||
-		ptnode->table_flags != sqlite3_column_int64(pstmt, 1)) {
-		pstmt.finalize();
+	pstate = &it->second;
+	if (pstate->folder_id != ptnode->folder_id ||
+	    pstate->table_flags != ptnode->table_flags) {
 		goto RESTORE_POSITION;
 	}
 	if (NULL == ptnode->psorts || 0 == ptnode->psorts->ccategories) {
-		if (SQLITE_NULL != sqlite3_column_type(pstmt, 2)) {
-			pstmt.finalize();
-			goto RESTORE_POSITION;
-		}
-	} else {
-		if (!ext_push.init(tmp_buff, sizeof(tmp_buff), 0) ||
-		    ext_push.p_sortorder_set(ptnode->psorts) != EXT_ERR_SUCCESS) {
-			pstmt.finalize();
-			goto RESTORE_POSITION;
-		}
-		if (static_cast<unsigned int>(sqlite3_column_bytes(pstmt, 2)) != ext_push.m_offset ||
-		    memcmp(sqlite3_column_blob(pstmt, 2), ext_push.m_udata, ext_push.m_offset) != 0) {
-			pstmt.finalize();
-			goto RESTORE_POSITION;
-		}
+		goto RESTORE_POSITION;
 	}
-	header_id = sqlite3_column_int64(pstmt, 5);
-	header_stat = sqlite3_column_int64(pstmt, 6);
-	pstmt.finalize();
-	if (NULL == ptnode->psorts || 0 == ptnode->psorts->ccategories) {
-		sqlite3_close(psqlite);
+	if (!ext_push.init(tmp_buff, sizeof(tmp_buff), 0) ||
+	    ext_push.p_sortorder_set(ptnode->psorts) != EXT_ERR_SUCCESS ||
+	    pstate->sorts.size() != ext_push.m_offset ||
+	    memcmp(pstate->sorts.data(), ext_push.m_udata, ext_push.m_offset) != 0) {
 		goto RESTORE_POSITION;
 	}
 	sqlite3_exec(pdb->tables.psqlite,
@@ -4201,7 +4100,6 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 		ptnode->table_id, CONTENT_ROW_HEADER);
 	pstmt = gx_sql_prep(pdb->tables.psqlite, sql_string);
 	if (pstmt == nullptr) {
-		sqlite3_close(psqlite);
 		sqlite3_exec(pdb->tables.psqlite,
 			"ROLLBACK", NULL, NULL, NULL);
 		return FALSE;
@@ -4210,8 +4108,7 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 		"row_stat=? WHERE row_id=?", ptnode->table_id);
 	pstmt1 = gx_sql_prep(pdb->tables.psqlite, sql_string);
 	if (pstmt1 == nullptr) {
-		pstmt1.finalize();
-		sqlite3_close(psqlite);
+		pstmt.finalize();
 		sqlite3_exec(pdb->tables.psqlite,
 			"ROLLBACK", NULL, NULL, NULL);
 		return FALSE;
@@ -4233,10 +4130,9 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 		}
 		sqlite3_bind_int64(pstmt1, 1, row_stat);
 		sqlite3_bind_int64(pstmt1, 2, row_id);
-		if (SQLITE_DONE != sqlite3_step(pstmt)) {
+		if (SQLITE_DONE != sqlite3_step(pstmt1)) {
 			pstmt.finalize();
 			pstmt1.finalize();
-			sqlite3_close(psqlite);
 			sqlite3_exec(pdb->tables.psqlite,
 				"ROLLBACK", NULL, NULL, NULL);
 			return FALSE;
@@ -4246,21 +4142,10 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 	pstmt.finalize();
 	pstmt1.finalize();
 	/* end of resetting table */
-	snprintf(sql_string, arsizeof(sql_string), "SELECT * FROM"
-			" s%u ORDER BY ROWID ASC", state_id);
-	pstmt = gx_sql_prep(psqlite, sql_string);
-	if (pstmt == nullptr) {
-		sqlite3_close(psqlite);
-		sqlite3_exec(pdb->tables.psqlite,
-			"ROLLBACK", NULL, NULL, NULL);
-		return FALSE;
-	}
 	snprintf(sql_string, arsizeof(sql_string), "SELECT row_id FROM t%u WHERE"
 			" parent_id=? AND value IS NULL", ptnode->table_id);
 	pstmt1 = gx_sql_prep(pdb->tables.psqlite, sql_string);
 	if (pstmt1 == nullptr) {
-		pstmt.finalize();
-		sqlite3_close(psqlite);
 		sqlite3_exec(pdb->tables.psqlite,
 			"ROLLBACK", NULL, NULL, NULL);
 		return FALSE;
@@ -4269,9 +4154,7 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 				" parent_id=? AND value=?", ptnode->table_id);
 	pstmt2 = gx_sql_prep(pdb->tables.psqlite, sql_string);
 	if (pstmt2 == nullptr) {
-		pstmt.finalize();
 		pstmt1.finalize();
-		sqlite3_close(psqlite);
 		sqlite3_exec(pdb->tables.psqlite,
 			"ROLLBACK", NULL, NULL, NULL);
 		return FALSE;
@@ -4280,58 +4163,62 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 		"row_stat=? WHERE row_id=?", ptnode->table_id);
 	pstmt3 = gx_sql_prep(pdb->tables.psqlite, sql_string);
 	if (pstmt3 == nullptr) {
-		pstmt.finalize();
 		pstmt1.finalize();
 		pstmt2.finalize();
-		sqlite3_close(psqlite);
 		sqlite3_exec(pdb->tables.psqlite,
 			"ROLLBACK", NULL, NULL, NULL);
 		return FALSE;
 	}
+	ext_pull.init(pstate->headers.data(), pstate->headers.size(),
+		common_util_alloc, 0);
 	current_id = 0;
-	while (SQLITE_ROW == sqlite3_step(pstmt)) {
+	while (ext_pull.m_offset < ext_pull.m_data_size) {
 		current_id ++;
-		depth = sqlite3_column_int64(pstmt, 0);
+		if (ext_pull.g_uint8(&depth1) != EXT_ERR_SUCCESS ||
+		    depth1 >= ptnode->psorts->ccategories)
+			break;
+		depth = depth1;
 		row_id = 0;
+		/* all values are pulled even if an earlier level is gone */
 		for (i=0; i<=depth; i++) {
-			type = ptnode->psorts->psort[i].type;
-			if ((type & MVI_FLAG) == MVI_FLAG)
-				type &= ~MVI_FLAG;
-			pvalue = common_util_column_sqlite_statement(pstmt, i + 1, type);
+			type = ptnode->psorts->psort[i].type & ~MVI_FLAG;
+			pvalue = nullptr;
+			if (ext_pull.g_uint8(&flag) != EXT_ERR_SUCCESS ||
+			    (0 != flag && ext_pull.g_propval(type, &pvalue) != EXT_ERR_SUCCESS))
+				break;
+			if (0 == row_id && 0 != i) {
+				continue;
+			}
 			if (NULL == pvalue) {
 				sqlite3_bind_int64(pstmt1, 1, row_id);
-				if (SQLITE_ROW != sqlite3_step(pstmt1)) {
-					sqlite3_reset(pstmt1);
-					break;
-				}
-				row_id = sqlite3_column_int64(pstmt1, 0);
+				row_id = SQLITE_ROW == sqlite3_step(pstmt1) ?
+				         sqlite3_column_int64(pstmt1, 0) : 0;
 				sqlite3_reset(pstmt1);
 			} else {
 				sqlite3_bind_int64(pstmt2, 1, row_id);
 				if (FALSE == common_util_bind_sqlite_statement(
 					pstmt2, 2, type, pvalue)) {
-					pstmt.finalize();
 					pstmt1.finalize();
 					pstmt2.finalize();
 					pstmt3.finalize();
-					sqlite3_close(psqlite);
 					sqlite3_exec(pdb->tables.psqlite,
 						"ROLLBACK", NULL, NULL, NULL);
 					return FALSE;
 				}
-				if (SQLITE_ROW != sqlite3_step(pstmt2)) {
-					sqlite3_reset(pstmt2);
-					break;
-				}
-				row_id = sqlite3_column_int64(pstmt2, 0);
+				row_id = SQLITE_ROW == sqlite3_step(pstmt2) ?
+				         sqlite3_column_int64(pstmt2, 0) : 0;
 				sqlite3_reset(pstmt2);
 			}
 		}
 		if (i <= depth) {
+			/* truncated state; keep what has been applied so far */
+			break;
+		}
+		if (0 == row_id) {
 			continue;
 		}
-		if (header_id == current_id) {
-			row_stat = header_stat;
+		if (pstate->header_id == current_id) {
+			row_stat = pstate->header_stat;
 			row_id1 = row_id;
 		} else {
 			row_stat = depth >= ptnode->psorts->cexpanded;
@@ -4339,22 +4226,18 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 		sqlite3_bind_int64(pstmt3, 1, row_stat);
 		sqlite3_bind_int64(pstmt3, 2, row_id);
 		if (SQLITE_DONE != sqlite3_step(pstmt3)) {
-			pstmt.finalize();
 			pstmt1.finalize();
 			pstmt2.finalize();
 			pstmt3.finalize();
-			sqlite3_close(psqlite);
 			sqlite3_exec(pdb->tables.psqlite,
 				"ROLLBACK", NULL, NULL, NULL);
 			return FALSE;
 		}
 		sqlite3_reset(pstmt3);
 	}
-	pstmt.finalize();
 	pstmt1.finalize();
 	pstmt2.finalize();
 	pstmt3.finalize();
-	sqlite3_close(psqlite);
 	snprintf(sql_string, arsizeof(sql_string), "UPDATE t%u SET idx=NULL", ptnode->table_id);
 	if (SQLITE_OK != sqlite3_exec(pdb->tables.psqlite,
 		sql_string, NULL, NULL, NULL)) {
@@ -4397,10 +4280,10 @@ BOOL exmdb_server_restore_table_state(const char *dir,
 	sqlite3_exec(pdb->tables.psqlite,
 		"COMMIT TRANSACTION", NULL, NULL, NULL);
  RESTORE_POSITION:
-	if (0 != message_id) {
+	if (0 != pstate->message_id) {
 		snprintf(sql_string, arsizeof(sql_string), "SELECT idx FROM t%u WHERE "
 				"inst_id=%llu AND inst_num=%llu", ptnode->table_id,
-				LLU(message_id), LLU(inst_num));
+				LLU(pstate->message_id), LLU(pstate->inst_num));
 	} else {
 		snprintf(sql_string, arsizeof(sql_string), "SELECT idx FROM t%u WHERE"
 		          " row_id=%llu", ptnode->table_id, LLU(row_id1));
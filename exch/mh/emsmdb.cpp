@@ -99,6 +99,8 @@ static int (*emsmdb_interface_connect_ex)(uint64_t, CONTEXT_HANDLE *, const char
 static int (*emsmdb_interface_rpc_ext2)(CONTEXT_HANDLE *, uint32_t *flags, const uint8_t *, uint32_t, uint8_t *, uint32_t *, const uint8_t *, uint32_t, uint8_t *, uint32_t *, uint32_t *);
 static int (*emsmdb_interface_disconnect)(CONTEXT_HANDLE *);
 static void (*emsmdb_interface_touch_handle)(CONTEXT_HANDLE *);
+static uint8_t *(*emsmdb_interface_get_rpcbuf)();
+static void (*emsmdb_interface_put_rpcbuf)(uint8_t *);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //Plugin structure declarations
@@ -127,7 +129,7 @@ struct execute_request {
 
 struct execute_response {
 	uint32_t status, result, flags, cb_out;
-	uint8_t out[0x40000];
+	uint8_t *out; /* from emsmdb_interface_get_rpcbuf */
 	uint32_t cb_auxout;
 	uint8_t auxout[0x1008];
 };
@@ -246,6 +248,8 @@ MhEmsmdbPlugin::MhEmsmdbPlugin(void** ppdata)
 	    !query_service1(emsmdb_interface_rpc_ext2) ||
 	    !query_service1(emsmdb_interface_disconnect) ||
 	    !query_service1(emsmdb_interface_touch_handle) ||
+	    !query_service1(emsmdb_interface_get_rpcbuf) ||
+	    !query_service1(emsmdb_interface_put_rpcbuf) ||
 	    !query_service1(asyncemsmdb_interface_async_wait) ||
 	    !query_service1(asyncemsmdb_interface_register_active) ||
 	    !query_service1(asyncemsmdb_interface_remove))
@@ -622,6 +626,10 @@ MhEmsmdbPlugin::ProcRes MhEmsmdbPlugin::execute(MhEmsmdbContext &ctx)
 	ctx.response.execute.flags = ctx.request.execute.flags;
 	ctx.response.execute.cb_out = ctx.request.execute.cb_out;
 	ctx.response.execute.status = 0;
+	ctx.response.execute.out = emsmdb_interface_get_rpcbuf();
+	if (ctx.response.execute.out == nullptr)
+		return ctx.failure_response(ecMAPIOOM);
+	auto cl_0 = make_scope_exit([&]() { emsmdb_interface_put_rpcbuf(ctx.response.execute.out); });
 	ctx.response.execute.result = emsmdb_bridge_execute(ctx.session_guid, ctx.request.execute, ctx.response.execute);
 	if (ctx.ext_push.p_execute_rsp(ctx.response.execute) != EXT_ERR_SUCCESS)
 		return ctx.failure_response(RPC_X_BAD_STUB_DATA);
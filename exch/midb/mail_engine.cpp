@@ -2978,6 +2978,17 @@ static int mail_engine_mping(int argc, char **argv, int sockd)
 	return 0;
 }
 
+static int mail_engine_mprew(int argc, char **argv, int sockd)
+{
+	if (2 != argc || strlen(argv[1]) >= 256) {
+		return MIDB_E_PARAMETER_ERROR;
+	}
+	/* exmdb queues the work and answers at once */
+	exmdb_client::prewarm_store(argv[1]);
+	cmd_write(sockd, "TRUE\r\n", 6);
+	return 0;
+}
+
 static int mail_engine_menum(int argc, char **argv, int sockd)
 {
 	int count;
@@ -6117,6 +6128,7 @@ int mail_engine_run()
 	cmd_parser_register_command("M-ENUM", mail_engine_menum);
 	cmd_parser_register_command("M-CKFL", mail_engine_mckfl);
 	cmd_parser_register_command("M-PING", mail_engine_mping);
+	cmd_parser_register_command("M-PREW", mail_engine_mprew);
 	cmd_parser_register_command("P-OFST", mail_engine_pofst);
 	cmd_parser_register_command("P-UNID", mail_engine_punid);
 	cmd_parser_register_command("P-FDDT", mail_engine_pfddt);
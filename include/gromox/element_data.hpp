@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 #include <gromox/common_types.hpp>
 #include <gromox/mapi_types.hpp>
@@ -12,6 +13,8 @@ struct PROPERTY_GROUPINFO {
 	uint32_t reserved;
 	uint32_t count;
 	PROPTAG_ARRAY *pgroups;
+	/* proptag -> index into pgroups, maintained by property_groupinfo_append_internal */
+	std::unordered_map<uint32_t, uint32_t> index;
 };
 
 struct ATTACHMENT_LIST {
@@ -62,6 +65,11 @@ struct ATTACHMENT_CONTENT {
 	MESSAGE_CONTENT *pembedded;
 };
 
+struct MESSAGE_LIST {
+	uint32_t count;
+	MESSAGE_CONTENT **pplist; /* NULL for messages that do not exist */
+};
+
 struct FOLDER_MESSAGES {
 	EID_ARRAY *pfai_msglst;
 	EID_ARRAY *pnormal_msglst;
@@ -115,7 +123,7 @@ BOOL property_groupinfo_init_internal(
 	PROPERTY_GROUPINFO *pgpinfo, uint32_t group_id);
 BOOL property_groupinfo_append_internal(
 	PROPERTY_GROUPINFO *pgpinfo, PROPTAG_ARRAY *pgroup);
-BOOL property_groupinfo_get_partial_index(PROPERTY_GROUPINFO *pgpinfo,
+BOOL property_groupinfo_get_partial_index(const PROPERTY_GROUPINFO *pgpinfo,
 	uint32_t proptag, uint32_t *pindex);
 void property_groupinfo_free(PROPERTY_GROUPINFO *pgpinfo);
 void property_groupinfo_free_internal(PROPERTY_GROUPINFO *pgpinfo);
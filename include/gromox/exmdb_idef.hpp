@@ -120,3 +120,7 @@ EXMIDL(transport_new_mail, (const char *dir, uint64_t folder_id, uint64_t messag
 EXMIDL(check_contact_address, (const char *dir, const char *paddress, IDLOUT BOOL *b_found))
 EXMIDL(get_public_folder_unread_count, (const char *dir, const char *username, uint64_t folder_id, IDLOUT uint32_t *count))
 EXMIDL(unload_store, (const char *dir))
+EXMIDL(backup_store, (const char *dir, const char *dest_dir))
+EXMIDL(read_instance_property_range, (const char *dir, uint32_t instance_id, uint32_t proptag, uint32_t offset, uint32_t length, IDLOUT BOOL *b_found, uint32_t *total, BINARY *data))
+EXMIDL(prewarm_store, (const char *dir))
+EXMIDL(read_messages, (const char *dir, const char *username, uint32_t cpid, const EID_ARRAY *pmessage_ids, uint32_t size_limit, IDLOUT MESSAGE_LIST *msglst))
@@ -146,6 +146,10 @@ enum {
 	CHECK_CONTACT_ADDRESS = 0x79,
 	GET_PUBLIC_FOLDER_UNREAD_COUNT = 0x7a,
 	UNLOAD_STORE = 0x80,
+	BACKUP_STORE = 0x81,
+	READ_INSTANCE_PROPERTY_RANGE = 0x82,
+	PREWARM_STORE = 0x83,
+	READ_MESSAGES = 0x84,
 };
 }
 
@@ -757,6 +761,13 @@ struct EXREQ_READ_MESSAGE {
 	uint64_t message_id;
 };
 
+struct EXREQ_READ_MESSAGES {
+	char *username;
+	uint32_t cpid;
+	EID_ARRAY *pmessage_ids;
+	uint32_t size_limit;
+};
+
 struct EXREQ_GET_CONTENT_SYNC {
 	uint64_t folder_id;
 	char *username;
@@ -807,6 +818,17 @@ struct EXREQ_GET_PUBLIC_FOLDER_UNREAD_COUNT {
 	uint64_t folder_id;
 };
 
+struct EXREQ_BACKUP_STORE {
+	char *dest_dir;
+};
+
+struct EXREQ_READ_INSTANCE_PROPERTY_RANGE {
+	uint32_t instance_id;
+	uint32_t proptag;
+	uint32_t offset;
+	uint32_t length;
+};
+
 union EXMDB_REQUEST_PAYLOAD {
 	EXREQ_CONNECT connect;
 	EXREQ_GET_NAMED_PROPIDS get_named_propids;
@@ -926,6 +948,9 @@ union EXMDB_REQUEST_PAYLOAD {
 	EXREQ_CHECK_CONTACT_ADDRESS check_contact_address;
 	EXREQ_TRANSPORT_NEW_MAIL transport_new_mail;
 	EXREQ_GET_PUBLIC_FOLDER_UNREAD_COUNT get_public_folder_unread_count;
+	EXREQ_BACKUP_STORE backup_store;
+	EXREQ_READ_INSTANCE_PROPERTY_RANGE read_instance_property_range;
+	EXREQ_READ_MESSAGES read_messages;
 };
 
 struct EXMDB_REQUEST {
@@ -1316,6 +1341,10 @@ struct EXRESP_READ_MESSAGE {
 	MESSAGE_CONTENT *pmsgctnt;
 };
 
+struct EXRESP_READ_MESSAGES {
+	MESSAGE_LIST msglst;
+};
+
 struct EXRESP_GET_CONTENT_SYNC {
 	uint32_t fai_count;
 	uint64_t fai_total;
@@ -1355,6 +1384,12 @@ struct EXRESP_GET_PUBLIC_FOLDER_UNREAD_COUNT {
 	uint32_t count;
 };
 
+struct EXRESP_READ_INSTANCE_PROPERTY_RANGE {
+	BOOL b_found;
+	uint32_t total;
+	BINARY data;
+};
+
 union EXMDB_RESPONSE_PAYLOAD {
 	EXRESP_GET_ALL_NAMED_PROPIDS get_all_named_propids;
 	EXRESP_GET_NAMED_PROPIDS get_named_propids;
@@ -1452,6 +1487,8 @@ union EXMDB_RESPONSE_PAYLOAD {
 	EXRESP_SUBSCRIBE_NOTIFICATION subscribe_notification;
 	EXRESP_CHECK_CONTACT_ADDRESS check_contact_address;
 	EXRESP_GET_PUBLIC_FOLDER_UNREAD_COUNT get_public_folder_unread_count;
+	EXRESP_READ_INSTANCE_PROPERTY_RANGE read_instance_property_range;
+	EXRESP_READ_MESSAGES read_messages;
 };
 
 struct EXMDB_RESPONSE {
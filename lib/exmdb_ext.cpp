@@ -2077,6 +2077,38 @@ static int exmdb_ext_push_read_message_request(
 	return pext->p_uint64(ppayload->read_message.message_id);
 }
 
+static int exmdb_ext_pull_read_messages_request(
+	EXT_PULL *pext, REQUEST_PAYLOAD *ppayload)
+{
+	uint8_t tmp_byte;
+	
+	TRY(pext->g_uint8(&tmp_byte));
+	if (tmp_byte == 0)
+		ppayload->read_messages.username = NULL;
+	else
+		TRY(pext->g_str(&ppayload->read_messages.username));
+	TRY(pext->g_uint32(&ppayload->read_messages.cpid));
+	ppayload->read_messages.pmessage_ids = cu_alloc<EID_ARRAY>();
+	if (ppayload->read_messages.pmessage_ids == nullptr)
+		return EXT_ERR_ALLOC;
+	TRY(pext->g_eid_a(ppayload->read_messages.pmessage_ids));
+	return pext->g_uint32(&ppayload->read_messages.size_limit);
+}
+
+static int exmdb_ext_push_read_messages_request(
+	EXT_PUSH *pext, const REQUEST_PAYLOAD *ppayload)
+{
+	if (NULL == ppayload->read_messages.username) {
+		TRY(pext->p_uint8(0));
+	} else {
+		TRY(pext->p_uint8(1));
+		TRY(pext->p_str(ppayload->read_messages.username));
+	}
+	TRY(pext->p_uint32(ppayload->read_messages.cpid));
+	TRY(pext->p_eid_a(ppayload->read_messages.pmessage_ids));
+	return pext->p_uint32(ppayload->read_messages.size_limit);
+}
+
 static int gcsr_failure(int status, EXMDB_REQUEST_PAYLOAD *p)
 {
 	idset_free(p->get_content_sync.pgiven);
@@ -2427,6 +2459,36 @@ static int exmdb_ext_push_get_public_folder_unread_count_request(
 	return pext->p_uint64(ppayload->get_public_folder_unread_count.folder_id);
 }
 
+static int exmdb_ext_pull_backup_store_request(
+	EXT_PULL *pext, REQUEST_PAYLOAD *ppayload)
+{
+	return pext->g_str(&ppayload->backup_store.dest_dir);
+}
+
+static int exmdb_ext_push_backup_store_request(
+	EXT_PUSH *pext, const REQUEST_PAYLOAD *ppayload)
+{
+	return pext->p_str(ppayload->backup_store.dest_dir);
+}
+
+static int exmdb_ext_pull_read_instance_property_range_request(
+	EXT_PULL *pext, REQUEST_PAYLOAD *ppayload)
+{
+	TRY(pext->g_uint32(&ppayload->read_instance_property_range.instance_id));
+	TRY(pext->g_uint32(&ppayload->read_instance_property_range.proptag));
+	TRY(pext->g_uint32(&ppayload->read_instance_property_range.offset));
+	return pext->g_uint32(&ppayload->read_instance_property_range.length);
+}
+
+static int exmdb_ext_push_read_instance_property_range_request(
+	EXT_PUSH *pext, const REQUEST_PAYLOAD *ppayload)
+{
+	TRY(pext->p_uint32(ppayload->read_instance_property_range.instance_id));
+	TRY(pext->p_uint32(ppayload->read_instance_property_range.proptag));
+	TRY(pext->p_uint32(ppayload->read_instance_property_range.offset));
+	return pext->p_uint32(ppayload->read_instance_property_range.length);
+}
+
 int exmdb_ext_pull_request(const BINARY *pbin_in,
 	EXMDB_REQUEST *prequest)
 {
@@ -2802,6 +2864,17 @@ int exmdb_ext_pull_request(const BINARY *pbin_in,
 										&ext_pull, &prequest->payload);
 	case exmdb_callid::UNLOAD_STORE:
 		return EXT_ERR_SUCCESS;
+	case exmdb_callid::BACKUP_STORE:
+		return exmdb_ext_pull_backup_store_request(
+						&ext_pull, &prequest->payload);
+	case exmdb_callid::READ_INSTANCE_PROPERTY_RANGE:
+		return exmdb_ext_pull_read_instance_property_range_request(
+									&ext_pull, &prequest->payload);
+	case exmdb_callid::PREWARM_STORE:
+		return EXT_ERR_SUCCESS;
+	case exmdb_callid::READ_MESSAGES:
+		return exmdb_ext_pull_read_messages_request(
+					&ext_pull, &prequest->payload);
 	default:
 		return EXT_ERR_BAD_SWITCH;
 	}
@@ -3313,6 +3386,21 @@ int exmdb_ext_push_request(const EXMDB_REQUEST *prequest,
 	case exmdb_callid::UNLOAD_STORE:
 		status = EXT_ERR_SUCCESS;
 		break;
+	case exmdb_callid::BACKUP_STORE:
+		status = exmdb_ext_push_backup_store_request(
+						&ext_push, &prequest->payload);
+		break;
+	case exmdb_callid::READ_INSTANCE_PROPERTY_RANGE:
+		status = exmdb_ext_push_read_instance_property_range_request(
+									&ext_push, &prequest->payload);
+		break;
+	case exmdb_callid::PREWARM_STORE:
+		status = EXT_ERR_SUCCESS;
+		break;
+	case exmdb_callid::READ_MESSAGES:
+		status = exmdb_ext_push_read_messages_request(
+					&ext_push, &prequest->payload);
+		break;
 	default:
 		return EXT_ERR_BAD_SWITCH;
 	}
@@ -4549,6 +4637,51 @@ static int exmdb_ext_push_read_message_response(
 	return pext->p_msgctnt(ppayload->read_message.pmsgctnt);
 }
 
+static int exmdb_ext_pull_read_messages_response(
+	EXT_PULL *pext, RESPONSE_PAYLOAD *ppayload)
+{
+	uint8_t tmp_byte;
+	auto &r = ppayload->read_messages.msglst;
+	
+	TRY(pext->g_uint32(&r.count));
+	if (0 == r.count) {
+		r.pplist = NULL;
+		return EXT_ERR_SUCCESS;
+	}
+	r.pplist = cu_alloc<MESSAGE_CONTENT *>(r.count);
+	if (r.pplist == nullptr)
+		return EXT_ERR_ALLOC;
+	for (size_t i = 0; i < r.count; ++i) {
+		TRY(pext->g_uint8(&tmp_byte));
+		if (0 == tmp_byte) {
+			r.pplist[i] = NULL;
+			continue;
+		}
+		r.pplist[i] = cu_alloc<MESSAGE_CONTENT>();
+		if (r.pplist[i] == nullptr)
+			return EXT_ERR_ALLOC;
+		TRY(pext->g_msgctnt(r.pplist[i]));
+	}
+	return EXT_ERR_SUCCESS;
+}
+
+static int exmdb_ext_push_read_messages_response(
+	EXT_PUSH *pext, const RESPONSE_PAYLOAD *ppayload)
+{
+	auto &r = ppayload->read_messages.msglst;
+	
+	TRY(pext->p_uint32(r.count));
+	for (size_t i = 0; i < r.count; ++i) {
+		if (r.pplist[i] == nullptr) {
+			TRY(pext->p_uint8(0));
+			continue;
+		}
+		TRY(pext->p_uint8(1));
+		TRY(pext->p_msgctnt(r.pplist[i]));
+	}
+	return EXT_ERR_SUCCESS;
+}
+
 static int exmdb_ext_pull_get_content_sync_response(
 	EXT_PULL *pext, RESPONSE_PAYLOAD *ppayload)
 {
@@ -4665,6 +4798,22 @@ static int exmdb_ext_push_get_public_folder_unread_count_response(
 	return pext->p_uint32(ppayload->get_public_folder_unread_count.count);
 }
 
+static int exmdb_ext_pull_read_instance_property_range_response(
+	EXT_PULL *pext, RESPONSE_PAYLOAD *ppayload)
+{
+	TRY(pext->g_bool(&ppayload->read_instance_property_range.b_found));
+	TRY(pext->g_uint32(&ppayload->read_instance_property_range.total));
+	return pext->g_bin(&ppayload->read_instance_property_range.data);
+}
+
+static int exmdb_ext_push_read_instance_property_range_response(
+	EXT_PUSH *pext, const RESPONSE_PAYLOAD *ppayload)
+{
+	TRY(pext->p_bool(ppayload->read_instance_property_range.b_found));
+	TRY(pext->p_uint32(ppayload->read_instance_property_range.total));
+	return pext->p_bin(&ppayload->read_instance_property_range.data);
+}
+
 /* exmdb_callid::CONNECT, exmdb_callid::LISTEN_NOTIFICATION not included */
 int exmdb_ext_pull_response(const BINARY *pbin_in,
 	EXMDB_RESPONSE *presponse)
@@ -5012,6 +5161,16 @@ int exmdb_ext_pull_response(const BINARY *pbin_in,
 										&ext_pull, &presponse->payload);
 	case exmdb_callid::UNLOAD_STORE:
 		return EXT_ERR_SUCCESS;
+	case exmdb_callid::BACKUP_STORE:
+		return EXT_ERR_SUCCESS;
+	case exmdb_callid::READ_INSTANCE_PROPERTY_RANGE:
+		return exmdb_ext_pull_read_instance_property_range_response(
+									&ext_pull, &presponse->payload);
+	case exmdb_callid::PREWARM_STORE:
+		return EXT_ERR_SUCCESS;
+	case exmdb_callid::READ_MESSAGES:
+		return exmdb_ext_pull_read_messages_response(
+					&ext_pull, &presponse->payload);
 	default:
 		return EXT_ERR_BAD_SWITCH;
 	}
@@ -5495,6 +5654,20 @@ int exmdb_ext_push_response(const EXMDB_RESPONSE *presponse,
 	case exmdb_callid::UNLOAD_STORE:
 		status = EXT_ERR_SUCCESS;
 		break;
+	case exmdb_callid::BACKUP_STORE:
+		status = EXT_ERR_SUCCESS;
+		break;
+	case exmdb_callid::READ_INSTANCE_PROPERTY_RANGE:
+		status = exmdb_ext_push_read_instance_property_range_response(
+									&ext_push, &presponse->payload);
+		break;
+	case exmdb_callid::PREWARM_STORE:
+		status = EXT_ERR_SUCCESS;
+		break;
+	case exmdb_callid::READ_MESSAGES:
+		status = exmdb_ext_push_read_messages_response(
+					&ext_push, &presponse->payload);
+		break;
 	default:
 		return EXT_ERR_BAD_SWITCH;
 	}
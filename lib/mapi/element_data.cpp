@@ -9,6 +9,7 @@
 #include <gromox/idset.hpp>
 #include <cstdlib>
 #include <cstring>
+#include <new>
 
 ATTACHMENT_CONTENT* attachment_content_init()
 {
@@ -358,6 +359,7 @@ BOOL property_groupinfo_init_internal(
 	pgpinfo->group_id = group_id;
 	pgpinfo->reserved = 0;
 	pgpinfo->count = 0;
+	pgpinfo->index.clear();
 	auto count = strange_roundup(pgpinfo->count, SR_GROW_PROPTAG_ARRAY);
 	pgpinfo->pgroups = static_cast<PROPTAG_ARRAY *>(malloc(sizeof(PROPTAG_ARRAY) * count));
 	if (NULL == pgpinfo->pgroups) {
@@ -368,12 +370,12 @@ BOOL property_groupinfo_init_internal(
 
 PROPERTY_GROUPINFO* property_groupinfo_init(uint32_t group_id)
 {
-	auto pgpinfo = static_cast<PROPERTY_GROUPINFO *>(malloc(sizeof(PROPERTY_GROUPINFO)));
+	auto pgpinfo = new(std::nothrow) PROPERTY_GROUPINFO;
 	if (NULL == pgpinfo) {
 		return NULL;
 	}
 	if (FALSE == property_groupinfo_init_internal(pgpinfo, group_id)) {
-		free(pgpinfo);
+		delete pgpinfo;
 		return NULL;
 	}
 	return pgpinfo;
@@ -393,6 +395,18 @@ BOOL property_groupinfo_append_internal(
 		}
 		pgpinfo->pgroups = pgroups;
 	}
+	try {
+		/* a tag listed in several groups belongs to the first one */
+		for (size_t i = 0; i < pgroup->count; ++i)
+			pgpinfo->index.emplace(pgroup->pproptag[i], pgpinfo->count);
+	} catch (const std::bad_alloc &) {
+		for (size_t i = 0; i < pgroup->count; ++i) {
+			auto it = pgpinfo->index.find(pgroup->pproptag[i]);
+			if (it != pgpinfo->index.end() && it->second == pgpinfo->count)
+				pgpinfo->index.erase(it);
+		}
+		return FALSE;
+	}
 	pgpinfo->pgroups[pgpinfo->count].count = pgroup->count;
 	pgpinfo->pgroups[pgpinfo->count].pproptag = pgroup->pproptag;
 	free(pgroup);
@@ -400,16 +414,14 @@ BOOL property_groupinfo_append_internal(
 	return TRUE;
 }
 
-BOOL property_groupinfo_get_partial_index(PROPERTY_GROUPINFO *pgpinfo,
+BOOL property_groupinfo_get_partial_index(const PROPERTY_GROUPINFO *pgpinfo,
 	uint32_t proptag, uint32_t *pindex)
 {
-	for (size_t i = 0; i < pgpinfo->count; ++i)
-		for (size_t j = 0; j < pgpinfo->pgroups[i].count; ++j)
-			if (proptag == pgpinfo->pgroups[i].pproptag[j]) {
-				*pindex = i;
-				return TRUE;
-			}
-	return FALSE;
+	auto it = pgpinfo->index.find(proptag);
+	if (it == pgpinfo->index.end())
+		return FALSE;
+	*pindex = it->second;
+	return TRUE;
 }
 
 void property_groupinfo_free_internal(PROPERTY_GROUPINFO *pgpinfo)
@@ -417,10 +429,11 @@ void property_groupinfo_free_internal(PROPERTY_GROUPINFO *pgpinfo)
 	for (size_t i = 0; i < pgpinfo->count; ++i)
 		proptag_array_free_internal(pgpinfo->pgroups + i);
 	free(pgpinfo->pgroups);
+	pgpinfo->index.clear();
 }
 
 void property_groupinfo_free(PROPERTY_GROUPINFO *pgpinfo)
 {
 	property_groupinfo_free_internal(pgpinfo);
-	free(pgpinfo);
+	delete pgpinfo;
 }
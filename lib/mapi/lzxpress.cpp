@@ -4,143 +4,211 @@
 #include <gromox/lzxpress.hpp>
 #include <gromox/common_types.hpp>
 #include <cstring>
-#define WINDOWS_SIZE				0x20
+#include <memory>
+#include <new>
+/*
+ * Plain LZ77 of MS-XCA §2.3/2.4 (the RPC_HEADER_EXT "LZ77" compression):
+ * offsets are 13 bits wide, and lengths are encoded in 3 bits, a shared
+ * nibble, a byte and finally a 16-bit word.
+ */
+#define LZX_WINDOW_SIZE				8192
+#define LZX_HASH_BITS				13
+#define LZX_MIN_MATCH				3
+#define LZX_MAX_MATCH				(0xFFFF + LZX_MIN_MATCH)
+/* literal or the longest match form, plus a new indicator word */
+#define LZX_MAX_STEP				(1 + 2 + 1 + 2 + sizeof(uint32_t))
+/*
+ * Once this much input has been coded, give up unless at least 1/8 of it
+ * has been saved so far. Compressed streams, images and the like are
+ * recognized for the price of a few KB instead of the whole buffer.
+ */
+#define LZX_PROBE_SIZE				4096
 
-#define CLASSIC_MATCH_LENGTH		9	/* 3 + 6 */
+namespace {
 
-#define MIDDLE_MATCH_LENGTH			24 /* 3 + 7 + 14 */
+struct lzx_level_param {
+	unsigned int max_chain; /* candidates examined per position */
+	unsigned int nice_length; /* stop searching once this is reached */
+	bool b_lazy;
+};
 
-#define MAX_MATCH_LENGTH			279  /* 254 + 15 + 7 + 3 */
+struct lzx_state {
+	const uint8_t *in;
+	uint32_t in_size;
+	const lzx_level_param *param;
+	uint32_t next_insert; /* positions below are in the hash chains */
+	int32_t head[1U << LZX_HASH_BITS];
+	int32_t prev[LZX_WINDOW_SIZE];
+};
 
-#define MIN(a,b)					((a)<(b)?(a):(b))
+}
+
+static constexpr lzx_level_param lzx_levels[] = {
+	/* LZXPRESS_FAST */ {4, 32, false},
+	/* LZXPRESS_DEFAULT */ {8, 64, true},
+	/* LZXPRESS_BEST */ {128, LZX_MAX_MATCH, true},
+};
+
+static inline uint32_t lzx_hash(const uint8_t *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 2654435761U) >> (32 - LZX_HASH_BITS);
+}
 
+static void lzx_insert(lzx_state *st, uint32_t end)
+{
+	if (end + LZX_MIN_MATCH > st->in_size)
+		end = st->in_size >= LZX_MIN_MATCH ? st->in_size - LZX_MIN_MATCH + 1 : 0;
+	for (auto pos = st->next_insert; pos < end; ++pos) {
+		auto h = lzx_hash(&st->in[pos]);
+		st->prev[pos % LZX_WINDOW_SIZE] = st->head[h];
+		st->head[h] = pos;
+	}
+	if (end > st->next_insert)
+		st->next_insert = end;
+}
 
+/*
+ * Longest match for the data at @pos, not reaching into the last input
+ * byte (the stream has to end with a literal). Returns the length, or 0.
+ */
+static uint32_t lzx_find_match(const lzx_state *st, uint32_t pos,
+	uint32_t *poffset)
+{
+	if (pos + LZX_MIN_MATCH >= st->in_size)
+		return 0;
+	uint32_t max_len = st->in_size - 1 - pos;
+	if (max_len > LZX_MAX_MATCH)
+		max_len = LZX_MAX_MATCH;
+	auto cur = &st->in[pos];
+	uint32_t best = LZX_MIN_MATCH - 1;
+	auto chain = st->param->max_chain;
+	int32_t cand = st->head[lzx_hash(cur)];
+	while (cand >= 0 && pos - cand <= LZX_WINDOW_SIZE && chain-- > 0) {
+		auto ref = &st->in[cand];
+		if (ref[best] == cur[best] && ref[0] == cur[0] &&
+		    ref[1] == cur[1] && ref[2] == cur[2]) {
+			uint32_t len = LZX_MIN_MATCH;
+			while (len < max_len && ref[len] == cur[len])
+				++len;
+			if (len > best) {
+				best = len;
+				*poffset = pos - cand;
+				if (len >= st->param->nice_length || len == max_len)
+					break;
+			}
+		}
+		auto next = st->prev[cand % LZX_WINDOW_SIZE];
+		if (next >= cand)
+			break;
+		cand = next;
+	}
+	return best >= LZX_MIN_MATCH ? best : 0;
+}
+
+/*
+ * Returns the compressed size, or 0 when the result would not fit into
+ * @max_output_size or the input turns out not to be worth compressing;
+ * callers then send the data uncompressed.
+ */
 uint32_t lzxpress_compress(const uint8_t *uncompressed,
-	uint32_t uncompressed_size, uint8_t *compressed)
+	uint32_t uncompressed_size, uint8_t *compressed,
+	uint32_t max_output_size, unsigned int level)
 {
-	BOOL b_found;
 	uint32_t indic;
 	uint32_t offset;
 	uint32_t length;
-	uint16_t *pdest;
-	uint32_t byte_left;
 	uint8_t *ptr_indic;
 	uint32_t indic_bit;
 	uint32_t coding_pos;
-	uint32_t match_offset;
 	uint32_t nibble_index;
-	uint32_t metadata_size;
 	uint32_t compressed_pos;
+	bool b_probed = false;
 	
-	
-	if (0 == uncompressed_size) {
+	if (0 == uncompressed_size || max_output_size < LZX_MAX_STEP +
+	    sizeof(uint32_t)) {
 		return 0;
 	}
+	if (level < LZXPRESS_FAST) {
+		level = LZXPRESS_FAST;
+	} else if (level > LZXPRESS_BEST) {
+		level = LZXPRESS_BEST;
+	}
+	std::unique_ptr<lzx_state> st(new(std::nothrow) lzx_state);
+	if (NULL == st) {
+		return 0;
+	}
+	st->in = uncompressed;
+	st->in_size = uncompressed_size;
+	st->param = &lzx_levels[level - LZXPRESS_FAST];
+	st->next_insert = 0;
+	memset(st->head, 0xFF, sizeof(st->head));
 	
 	coding_pos = 0;
 	indic = 0;
-	*(uint32_t *)compressed = 0;
+	memset(compressed, 0, sizeof(uint32_t));
 	compressed_pos = sizeof(uint32_t);
 	ptr_indic = compressed;
-	byte_left = uncompressed_size;
 	indic_bit = 0;
 	nibble_index = 0;
 	
-	do {
-		b_found = FALSE;
-		match_offset = 0;
-		offset = coding_pos - MIN(WINDOWS_SIZE, coding_pos);
-		if (0 == offset) {
-			offset ++;
+	while (coding_pos < uncompressed_size) {
+		if (compressed_pos + LZX_MAX_STEP > max_output_size) {
+			return 0;
 		}
-		while (offset < coding_pos) {
-			for (length = 0;
-				uncompressed[coding_pos + length]
-				== uncompressed[offset + length] &&
-				offset + length < coding_pos &&
-				length < MAX_MATCH_LENGTH &&
-				length < uncompressed_size - coding_pos - 1;
-				length ++);
-			if (length < 3) {
-				offset ++;
-				continue;
+		if (!b_probed && coding_pos >= LZX_PROBE_SIZE) {
+			if (compressed_pos > coding_pos - coding_pos / 8) {
+				return 0;
 			}
-			b_found = TRUE;
-			match_offset = coding_pos - offset;
-			break;
+			b_probed = true;
 		}
-		
-		if (TRUE == b_found) {
-			metadata_size = 0;
-			pdest = (uint16_t *)&compressed[compressed_pos];
-			if (length <= CLASSIC_MATCH_LENGTH) {
-				/* classical meta-data */
-				uint16_t metadata = ((match_offset - 1) << 3) | (length - 3);
-				metadata = cpu_to_le16(metadata);
-				memcpy(&pdest[metadata_size/sizeof(uint16_t)], &metadata, sizeof(metadata));
-				metadata_size += sizeof(uint16_t);
-			} else {
-				uint16_t metadata = ((match_offset - 1) << 3) | 7;
-				metadata = cpu_to_le16(metadata);
-				memcpy(&pdest[metadata_size/sizeof(uint16_t)], &metadata, sizeof(metadata));
-				metadata_size += sizeof(uint16_t);
-				if (length <= MIDDLE_MATCH_LENGTH) {
-					/* shared byte */
-					if (0 == nibble_index) {
-						compressed[compressed_pos + metadata_size] =
-											(length - (3 + 7)) & 0xF;
-						metadata_size += sizeof(uint8_t);
-					} else {
-						compressed[nibble_index] &= 0xF;
-						compressed[nibble_index] |= (length - (3 + 7)) * 16;
-					}
+		lzx_insert(st.get(), coding_pos);
+		length = lzx_find_match(st.get(), coding_pos, &offset);
+		if (0 != length && length < st->param->nice_length &&
+		    st->param->b_lazy) {
+			/* defer if the next position has a longer match */
+			uint32_t offset1;
+			lzx_insert(st.get(), coding_pos + 1);
+			if (lzx_find_match(st.get(), coding_pos + 1, &offset1) > length) {
+				length = 0;
+			}
+		}
+		if (0 != length) {
+			uint16_t metadata = ((offset - 1) << 3) |
+				(length - 3 < 7 ? length - 3 : 7);
+			metadata = cpu_to_le16(metadata);
+			memcpy(&compressed[compressed_pos], &metadata, sizeof(metadata));
+			compressed_pos += sizeof(uint16_t);
+			if (length - 3 >= 7) {
+				uint32_t nib = length - (3 + 7);
+				if (nib > 15)
+					nib = 15;
+				/* shared byte */
+				if (0 == nibble_index) {
+					nibble_index = compressed_pos;
+					compressed[compressed_pos++] = nib;
 				} else {
-					if (length <= MAX_MATCH_LENGTH) {
-						/* shared byte */
-						if (0 == nibble_index) {
-							compressed[compressed_pos + metadata_size] = 15;
-							metadata_size += sizeof(uint8_t);
-						} else {
-							compressed[nibble_index] &= 0xF;
-							compressed[nibble_index] |= (15 * 16);
-						}
-						/* additional length */
-						compressed[compressed_pos + metadata_size] =
-												length - (3 + 7 + 15);
-						metadata_size += sizeof(uint8_t);
+					compressed[nibble_index] |= nib << 4;
+					nibble_index = 0;
+				}
+				if (15 == nib) {
+					/* additional length */
+					if (length - (3 + 7 + 15) < 255) {
+						compressed[compressed_pos++] = length - (3 + 7 + 15);
 					} else {
-						if (0 == nibble_index) {
-							compressed[compressed_pos + metadata_size] |= 15;
-							metadata_size += sizeof(uint8_t);
-						} else {
-							compressed[nibble_index] |= 15 << 4;
-						}
-						compressed[compressed_pos + metadata_size] = 255;
-						metadata_size += sizeof(uint8_t);
-						compressed[compressed_pos + metadata_size] =
-													(length - 3) & 0xFF;
-						compressed[compressed_pos + metadata_size + 1] =
-												((length - 3) >> 8) & 0xFF;
-						metadata_size += sizeof(uint16_t);
+						compressed[compressed_pos++] = 255;
+						uint16_t enc2 = cpu_to_le16(length - 3);
+						memcpy(&compressed[compressed_pos], &enc2, sizeof(enc2));
+						compressed_pos += sizeof(uint16_t);
 					}
 				}
 			}
 			indic |= 1U << (32 - (indic_bit % 32 + 1));
-			if (length > CLASSIC_MATCH_LENGTH) {
-				if (nibble_index == 0) {
-					nibble_index = compressed_pos + sizeof(uint16_t);
-				} else {
-					nibble_index = 0;
-				}
-			}
-			compressed_pos += metadata_size;
 			coding_pos += length;
-			byte_left -= length;
 		} else {
 			compressed[compressed_pos] = uncompressed[coding_pos];
 			compressed_pos ++;
 			coding_pos ++;
-			byte_left --;
 		}
 		indic_bit ++;
 		if ((indic_bit - 1) % 32 > (indic_bit % 32)) {
@@ -150,22 +218,8 @@ uint32_t lzxpress_compress(const uint8_t *uncompressed,
 			ptr_indic = &compressed[compressed_pos];
 			compressed_pos += sizeof(uint32_t);
 		}
-	} while (byte_left > 3);
-	
-	do {
-		compressed[compressed_pos] = uncompressed[coding_pos];
-		indic_bit ++;
-		coding_pos ++;
-		compressed_pos ++;
-		if ((indic_bit - 1) % 32 > (indic_bit % 32)) {
-			uint32_t enc4 = cpu_to_le32(indic);
-			memcpy(ptr_indic, &enc4, sizeof(enc4));
-			indic = 0;
-			ptr_indic = &compressed[compressed_pos];
-			compressed_pos += sizeof(uint32_t);
-		}
-	} while (coding_pos < uncompressed_size);
-	
+	}
+	/* end marker */
 	indic |= 1U << (32 - (indic_bit % 32 + 1));
 	indic = cpu_to_le32(indic);
 	memcpy(ptr_indic, &indic, sizeof(indic));
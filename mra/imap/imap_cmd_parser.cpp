@@ -1533,6 +1533,15 @@ int imap_cmd_parser_username(int argc, char **argv, IMAP_CONTEXT *ctx)
 	       imap_cmd_parser_username2(argc, argv, ctx));
 }
 
+/* have the store loaded while the client issues LIST and SELECT */
+static void imap_cmd_parser_prewarm(IMAP_CONTEXT *pcontext)
+{
+	int errnum;
+	
+	if (system_services_prewarm_mailbox != nullptr)
+		system_services_prewarm_mailbox(pcontext->maildir, &errnum);
+}
+
 static int imap_cmd_parser_password2(int argc, char **argv, IMAP_CONTEXT *pcontext)
 {
 	size_t temp_len;
@@ -1560,6 +1569,7 @@ static int imap_cmd_parser_password2(int argc, char **argv, IMAP_CONTEXT *pconte
 			gx_strlcpy(pcontext->lang, resource_get_string("DEFAULT_LANG"), GX_ARRAY_SIZE(pcontext->lang));
 		}
 		pcontext->proto_stat = PROTO_STAT_AUTH;
+		imap_cmd_parser_prewarm(pcontext);
 		imap_parser_log_info(pcontext, LV_DEBUG, "login success");
 		return 1705 | DISPATCH_TAG;
 	}
@@ -1615,6 +1625,7 @@ int imap_cmd_parser_login(int argc, char **argv, IMAP_CONTEXT *pcontext)
 			gx_strlcpy(pcontext->lang, resource_get_string("DEFAULT_LANG"), GX_ARRAY_SIZE(pcontext->lang));
 		}
 		pcontext->proto_stat = PROTO_STAT_AUTH;
+		imap_cmd_parser_prewarm(pcontext);
 		imap_parser_log_info(pcontext, LV_DEBUG, "login success");
 		return 1705;
 	}
@@ -11,6 +11,7 @@ E(container_add_ip)
 E(container_remove_ip)
 E(add_user_into_temp_list)
 E(auth_login)
+E(prewarm_mailbox)
 E(get_id)
 E(get_uid)
 E(summary_folder)
@@ -63,6 +64,7 @@ int system_services_run()
 	E2(system_services_judge_user, "user_filter_judge");
 	E2(system_services_add_user_into_temp_list, "user_filter_add");
 	E(system_services_auth_login, "auth_login_pop3");
+	E2(system_services_prewarm_mailbox, "prewarm_mailbox");
 	E(system_services_get_id, "get_mail_id");
 	E(system_services_get_uid, "get_mail_uid");
 	E(system_services_summary_folder, "summary_folder");
@@ -109,6 +111,7 @@ void system_services_stop()
 	service_release("user_filter_add", "system");
 	service_release("log_info", "system");
 	service_release("auth_login_pop3", "system");
+	service_release("prewarm_mailbox", "system");
 	service_release("get_mail_id", "system");
 	service_release("get_mail_uid", "system");
 	service_release("summary_folder", "system");
@@ -22,6 +22,7 @@ extern int (*system_services_make_folder)(const char*, const char*, int*);
 extern int (*system_services_remove_folder)(const char*, const char*, int*);
 extern int (*system_services_rename_folder)(const char*, const char*, const char*, int*);
 extern int (*system_services_ping_mailbox)(const char*, int*);
+extern int (*system_services_prewarm_mailbox)(const char *, int *);
 extern int (*system_services_subscribe_folder)(const char*, const char*, int*);
 extern int (*system_services_unsubscribe_folder)(const char*, const char*, int*);
 extern int (*system_services_enum_folders)(const char*, MEM_FILE*, int*);
@@ -1,11 +1,14 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 #define DECLARE_API_STATIC
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <csignal>
 #include <cstdint>
 #include <deque>
 #include <mutex>
+#include <string>
 #include <libHX/string.h>
 #include <gromox/defs.h>
 #include <gromox/fileio.h>
@@ -33,6 +36,7 @@
 #include <sys/ioctl.h>
 #include <poll.h>
 #define SOCKET_TIMEOUT			60
+#define MAX_PREWARM_QUEUE		1024
 
 #define MIDB_RESULT_OK			0
 #define MIDB_NO_SERVER			1
@@ -87,6 +91,7 @@ struct BACK_CONN {
 }
 
 static void *midbag_scanwork(void *);
+static void *midbag_prewarmwork(void *);
 static BOOL read_line(int sockd, char *buff, int length);
 
 static int connect_midb(const char *host, uint16_t port);
@@ -100,6 +105,8 @@ static int summary_folder(const char *path, const char *folder, int *exists, int
 static int make_folder(const char *path, const char *folder, int *perrno);
 static int remove_folder(const char *path, const char *folder, int *perrno);
 static int ping_mailbox(const char *path, int *perrno);
+static int prewarm_mailbox(const char *path, int *perrno);
+static int prewarm_send(const char *path, int *perrno);
 static int rename_folder(const char *path, const char *src_name, const char *dst_name, int *perrno);
 static int subscribe_folder(const char *path, const char *folder, int *perrno);
 static int unsubscribe_folder(const char *path, const char *folder, int *perrno);
@@ -126,12 +133,16 @@ static void console_talk(int argc, char **argv, char *result, int length);
 
 static int g_conn_num;
 static std::atomic<bool> g_notify_stop{false};
-static pthread_t g_scan_id;
+static pthread_t g_scan_id, g_prewarm_id;
 static DOUBLE_LIST g_lost_list;
 static DOUBLE_LIST g_server_list;
 static std::mutex g_server_lock;
 static LIB_BUFFER *g_file_allocator;
 static int g_file_ratio;
+/* mailboxes waiting for M-PREW, see prewarm_mailbox */
+static std::mutex g_prewarm_lock;
+static std::condition_variable g_prewarm_cond;
+static std::deque<std::string> g_prewarm_queue;
 
 static bool list_file_read_midb(const char *filename)
 {
@@ -261,11 +272,20 @@ static BOOL svc_midb_agent(int reason, void **ppdata)
 			return FALSE;
 		}
 		pthread_setname_np(g_scan_id, "midb_agent");
+		ret = pthread_create(&g_prewarm_id, nullptr, midbag_prewarmwork, nullptr);
+		if (ret != 0) {
+			printf("[midb_agent]: failed to create prewarm thread: %s\n", strerror(ret));
+			g_notify_stop = true;
+			pthread_kill(g_scan_id, SIGALRM);
+			pthread_join(g_scan_id, nullptr);
+			return FALSE;
+		}
+		pthread_setname_np(g_prewarm_id, "midb_prewarm");
 
 #define E(f) register_service(#f, f)
 		if (!E(list_mail) || !E(delete_mail) || !E(get_mail_id) ||
 		    !E(get_mail_uid) || !E(summary_folder) || !E(make_folder) ||
-		    !E(remove_folder) || !E(ping_mailbox) ||
+		    !E(remove_folder) || !E(ping_mailbox) || !E(prewarm_mailbox) ||
 		    !E(rename_folder) || !E(subscribe_folder) ||
 		    !E(unsubscribe_folder) || !E(enum_folders) ||
 		    !E(enum_subscriptions) || !E(insert_mail) ||
@@ -292,7 +312,13 @@ static BOOL svc_midb_agent(int reason, void **ppdata)
 			g_notify_stop = true;
 			pthread_kill(g_scan_id, SIGALRM);
 			pthread_join(g_scan_id, NULL);
+			{
+				std::lock_guard pw_hold(g_prewarm_lock);
+				g_prewarm_cond.notify_one();
+			}
+			pthread_join(g_prewarm_id, nullptr);
 		}
+		g_prewarm_queue.clear();
 
 		while ((pnode = double_list_pop_front(&g_lost_list)) != nullptr)
 			free(pnode->pdata);
@@ -1048,6 +1074,79 @@ static int ping_mailbox(const char *path, int *perrno)
 	return MIDB_RDWR_ERROR;
 }
 
+/*
+ * Logins only ask for the store to be loaded; the M-PREW round trip is
+ * made by midbag_prewarmwork, so that the client gets its answer without
+ * waiting for midb. The queue is bounded, and a mailbox already waiting
+ * in it is not queued twice.
+ */
+static int prewarm_mailbox(const char *path, int *perrno)
+{
+	std::lock_guard pw_hold(g_prewarm_lock);
+	if (g_prewarm_queue.size() >= MAX_PREWARM_QUEUE ||
+	    std::find(g_prewarm_queue.cbegin(), g_prewarm_queue.cend(), path) !=
+	    g_prewarm_queue.cend())
+		return MIDB_RESULT_OK;
+	try {
+		g_prewarm_queue.emplace_back(path);
+	} catch (const std::bad_alloc &) {
+		return MIDB_RESULT_OK;
+	}
+	g_prewarm_cond.notify_one();
+	return MIDB_RESULT_OK;
+}
+
+static void *midbag_prewarmwork(void *param)
+{
+	int errnum;
+	std::unique_lock pw_hold(g_prewarm_lock);
+
+	while (!g_notify_stop) {
+		if (g_prewarm_queue.empty()) {
+			g_prewarm_cond.wait(pw_hold);
+			continue;
+		}
+		auto path = std::move(g_prewarm_queue.front());
+		g_prewarm_queue.pop_front();
+		pw_hold.unlock();
+		prewarm_send(path.c_str(), &errnum);
+		pw_hold.lock();
+	}
+	return nullptr;
+}
+
+static int prewarm_send(const char *path, int *perrno)
+{
+	char buff[1024];
+	
+	auto pback = get_connection(path);
+	if (NULL == pback) {
+		return MIDB_NO_SERVER;
+	}
+	auto length = gx_snprintf(buff, arsizeof(buff), "M-PREW %s\r\n", path);
+	if (rw_command(pback->sockd, buff, length, arsizeof(buff)) < 0)
+		goto RDWR_ERROR;
+	if (0 == strncmp(buff, "TRUE", 4)) {
+		std::unique_lock sv_hold(g_server_lock);
+		double_list_append_as_tail(&pback->psvr->conn_list,
+			&pback->node);
+		return MIDB_RESULT_OK;
+	} else if (0 == strncmp(buff, "FALSE ", 6)) {
+		std::unique_lock sv_hold(g_server_lock);
+		double_list_append_as_tail(&pback->psvr->conn_list, &pback->node);
+		*perrno = atoi(buff + 6);
+		return MIDB_RESULT_ERROR;
+	} else {
+		goto RDWR_ERROR;
+	}
+ RDWR_ERROR:
+	close(pback->sockd);
+	pback->sockd = -1;
+	std::unique_lock sv_hold(g_server_lock);
+	double_list_append_as_tail(&g_lost_list, &pback->node);
+	return MIDB_RDWR_ERROR;
+}
+
 static int rename_folder(const char *path, const char *src_name,
     const char *dst_name, int *perrno)
 {
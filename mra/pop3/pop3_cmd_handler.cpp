@@ -167,7 +167,6 @@ int pop3_cmd_handler_pass(const char* cmd_line, int line_length,
 		if ('\0' == pcontext->maildir[0]) {
 			return 1715;
 		}
-		
 		switch (system_services_list_mail(pcontext->maildir, "inbox",
 			pcontext->array, &pcontext->total_mail, &pcontext->total_size)) {
 		case MIDB_RESULT_OK:
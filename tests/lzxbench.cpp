@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+/*
+ * Compress EcDoRpcExt2-sized buffers of different kinds at each LZXpress
+ * effort level, check that they decompress to the original, and report
+ * the ratio and throughput.
+ * Usage: lzxbench [iterations]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <gromox/lzxpress.hpp>
+
+using namespace std::chrono;
+
+static std::vector<uint8_t> make_text(size_t size, std::mt19937 &rng)
+{
+	static const char *const words[] = {
+		"the ", "meeting ", "Subject: ", "report ", "<td>", "</td>",
+		"quarterly ", "invoice ", "please ", "find ", "attached ",
+		"regards,\r\n", "<br>", "status ", "update ", "\r\n",
+	};
+	std::vector<uint8_t> v;
+	while (v.size() < size) {
+		auto w = words[rng() % std::size(words)];
+		v.insert(v.end(), w, w + strlen(w));
+	}
+	v.resize(size);
+	return v;
+}
+
+static std::vector<uint8_t> make_utf16_rows(size_t size, std::mt19937 &rng)
+{
+	/* PropertyRow-like: tags, little integers and UTF-16 strings */
+	std::vector<uint8_t> v;
+	while (v.size() < size) {
+		uint8_t hdr[] = {0x1f, 0x00, 0x37, 0x00, 0x03, 0x00, 0x08, 0x0e,
+			uint8_t(rng()), uint8_t(rng() % 8), 0, 0};
+		v.insert(v.end(), std::begin(hdr), std::end(hdr));
+		auto n = 8 + rng() % 24;
+		for (size_t i = 0; i < n; ++i) {
+			v.push_back('a' + rng() % 12);
+			v.push_back(0);
+		}
+		v.push_back(0);
+		v.push_back(0);
+	}
+	v.resize(size);
+	return v;
+}
+
+static std::vector<uint8_t> make_random(size_t size, std::mt19937 &rng)
+{
+	std::vector<uint8_t> v(size);
+	for (auto &c : v)
+		c = rng();
+	return v;
+}
+
+static std::vector<uint8_t> make_zeros(size_t size, std::mt19937 &)
+{
+	return std::vector<uint8_t>(size);
+}
+
+int main(int argc, const char **argv)
+{
+	static const struct {
+		const char *name;
+		std::vector<uint8_t> (*gen)(size_t, std::mt19937 &);
+	} corpora[] = {
+		{"text", make_text}, {"utf16 rows", make_utf16_rows},
+		{"random", make_random}, {"zeros", make_zeros},
+	};
+	static const char *const levels[] = {"", "fast", "default", "best"};
+	unsigned int iter = argc > 1 ? strtoul(argv[1], nullptr, 0) : 200;
+	std::mt19937 rng(42);
+	std::vector<uint8_t> out(0x10000), back(0x10000);
+	int ret = EXIT_SUCCESS;
+
+	for (const auto &c : corpora) {
+		auto in = c.gen(0x8000, rng);
+		for (unsigned int lv = LZXPRESS_FAST; lv <= LZXPRESS_BEST; ++lv) {
+			uint32_t clen = 0;
+			auto t0 = steady_clock::now();
+			for (unsigned int i = 0; i < iter; ++i)
+				clen = lzxpress_compress(in.data(), in.size(),
+				       out.data(), in.size(), lv);
+			auto t1 = steady_clock::now();
+			double secs = duration<double>(t1 - t0).count();
+			printf("%-10s %-7s ", c.name, levels[lv]);
+			if (clen == 0) {
+				printf("not compressed       %8.1f MB/s\n",
+				       in.size() * iter / secs / 1048576);
+				continue;
+			}
+			printf("%6u -> %6u (%5.1f%%) %8.1f MB/s", static_cast<unsigned int>(in.size()),
+			       clen, 100.0 * clen / in.size(),
+			       in.size() * iter / secs / 1048576);
+			auto dlen = lzxpress_decompress(out.data(), clen,
+			            back.data(), in.size());
+			if (dlen != in.size() || memcmp(back.data(), in.data(), dlen) != 0) {
+				printf("  FAIL: roundtrip mismatch\n");
+				ret = EXIT_FAILURE;
+				continue;
+			}
+			printf("\n");
+		}
+	}
+	return ret;
+}
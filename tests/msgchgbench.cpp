@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+/*
+ * Time the partial change computation of ICS (mapping every changed
+ * proptag of a message to its property group) with the former linear scan
+ * over PROPERTY_GROUPINFO and with its proptag index.
+ * Usage: msgchgbench [datadir [messages]]
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <gromox/element_data.hpp>
+#include <gromox/mapidefs.h>
+#include <gromox/paths.h>
+#include "../exch/exchange_emsmdb/msgchg_grouping.h"
+
+using namespace std::chrono;
+
+static BOOL fake_named_propid(void *, BOOL, const PROPERTY_NAME *, uint16_t *ppropid)
+{
+	static uint16_t next_propid = 0x8000;
+	*ppropid = next_propid++;
+	return TRUE;
+}
+
+static BOOL linear_partial_index(const PROPERTY_GROUPINFO *pgpinfo,
+    uint32_t proptag, uint32_t *pindex)
+{
+	for (size_t i = 0; i < pgpinfo->count; ++i)
+		for (size_t j = 0; j < pgpinfo->pgroups[i].count; ++j)
+			if (proptag == pgpinfo->pgroups[i].pproptag[j]) {
+				*pindex = i;
+				return TRUE;
+			}
+	return FALSE;
+}
+
+/*
+ * Changed proptags of each message: mostly grouped ones, some that are in
+ * no group (those go into the ungrouped list of a partial change).
+ */
+static std::vector<std::vector<uint32_t>>
+make_changes(const PROPERTY_GROUPINFO *pgpinfo, size_t count)
+{
+	std::vector<uint32_t> all;
+	for (size_t i = 0; i < pgpinfo->count; ++i)
+		for (size_t j = 0; j < pgpinfo->pgroups[i].count; ++j)
+			all.push_back(pgpinfo->pgroups[i].pproptag[j]);
+	std::mt19937 rng(42);
+	std::vector<std::vector<uint32_t>> msgs(count);
+	for (auto &m : msgs) {
+		auto n = 5 + rng() % 25;
+		for (size_t i = 0; i < n; ++i)
+			m.push_back(rng() % 8 == 0 ? PROP_TAG(PT_LONG, 0x6600 + rng() % 0x100) :
+			            all[rng() % all.size()]);
+	}
+	return msgs;
+}
+
+template<typename F> static uint64_t run(const PROPERTY_GROUPINFO *pgpinfo,
+    const std::vector<std::vector<uint32_t>> &msgs, F &&lookup)
+{
+	uint64_t sum = 0;
+	for (const auto &m : msgs) {
+		for (auto proptag : m) {
+			uint32_t index;
+			sum = sum * 31 + (lookup(pgpinfo, proptag, &index) ? index + 1 : 0);
+		}
+	}
+	return sum;
+}
+
+int main(int argc, const char **argv)
+{
+	msgchg_grouping_init(argc > 1 ? argv[1] : PKGDATADIR);
+	if (msgchg_grouping_run() != 0)
+		return EXIT_FAILURE;
+	size_t count = argc > 2 ? strtoul(argv[2], nullptr, 0) : 200000;
+	auto pgpinfo = msgchg_grouping_get_groupinfo(fake_named_propid,
+	               nullptr, msgchg_grouping_get_last_group_id());
+	if (pgpinfo == nullptr) {
+		printf("FAIL: msgchg_grouping_get_groupinfo\n");
+		return EXIT_FAILURE;
+	}
+	auto msgs = make_changes(pgpinfo, count);
+
+	auto t0 = steady_clock::now();
+	auto a = run(pgpinfo, msgs, linear_partial_index);
+	auto t1 = steady_clock::now();
+	auto b = run(pgpinfo, msgs, property_groupinfo_get_partial_index);
+	auto t2 = steady_clock::now();
+	printf("%zu messages, %u groups\n", count, pgpinfo->count);
+	printf("linear scan: %8.2f ms\n", duration<double, std::milli>(t1 - t0).count());
+	printf("index:       %8.2f ms\n", duration<double, std::milli>(t2 - t1).count());
+	property_groupinfo_free(pgpinfo);
+	msgchg_grouping_stop();
+	msgchg_grouping_free();
+	if (a != b) {
+		printf("FAIL: group indices differ\n");
+		return EXIT_FAILURE;
+	}
+	printf("group indices match\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+/*
+ * Read the same tag set twice through the property cache of
+ * exchange_emsmdb, the way MESSAGE_OBJECT::get_properties does, and check
+ * that tags computed after the exmdb query (PR_SOURCE_KEY and such) are
+ * not answered from the cache as "not found" the second time.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <gromox/mapidefs.h>
+#include <gromox/proptags.hpp>
+#include "../exch/exchange_emsmdb/property_cache.h"
+
+void *common_util_alloc(size_t z)
+{
+	/* leaked on purpose, like the per-RPC allocations in emsmdb */
+	return malloc(z);
+}
+
+static uint32_t g_importance = 1;
+static const uint32_t g_computed[] =
+	{PR_SOURCE_KEY, PR_MESSAGE_LOCALE_ID, PR_MESSAGE_CODEPAGE};
+
+/* exmdb has a subject and an importance, nothing else */
+static void fake_exmdb(const PROPTAG_ARRAY *ptags, TPROPVAL_ARRAY *pvals)
+{
+	static char subject[] = "hello";
+	pvals->count = 0;
+	pvals->ppropval = static_cast<TAGGED_PROPVAL *>(malloc(sizeof(TAGGED_PROPVAL) * ptags->count));
+	for (size_t i = 0; i < ptags->count; ++i) {
+		auto &pv = pvals->ppropval[pvals->count];
+		if (ptags->pproptag[i] == PR_SUBJECT)
+			pv.pvalue = subject;
+		else if (ptags->pproptag[i] == PROP_TAG_IMPORTANCE)
+			pv.pvalue = &g_importance;
+		else
+			continue;
+		pv.proptag = ptags->pproptag[i];
+		++pvals->count;
+	}
+}
+
+/* returns the tags that had to go to exmdb */
+static PROPTAG_ARRAY read_props(PROP_CACHE &cache, const PROPTAG_ARRAY &tags,
+    TPROPVAL_ARRAY *pvals)
+{
+	PROPTAG_ARRAY miss;
+	miss.count = 0;
+	miss.pproptag = static_cast<uint32_t *>(malloc(sizeof(uint32_t) * tags.count));
+	pvals->count = 0;
+	pvals->ppropval = static_cast<TAGGED_PROPVAL *>(malloc(sizeof(TAGGED_PROPVAL) * tags.count));
+	for (size_t i = 0; i < tags.count; ++i)
+		if (!cache.lookup(tags.pproptag[i], 0, pvals))
+			miss.pproptag[miss.count++] = tags.pproptag[i];
+	if (miss.count > 0) {
+		TPROPVAL_ARRAY fetched;
+		fake_exmdb(&miss, &fetched);
+		cache.store(&miss, &fetched, g_computed, sizeof(g_computed) / sizeof(g_computed[0]));
+		memcpy(pvals->ppropval + pvals->count, fetched.ppropval,
+		       sizeof(TAGGED_PROPVAL) * fetched.count);
+		pvals->count += fetched.count;
+	}
+	return miss;
+}
+
+static bool has_tag(const PROPTAG_ARRAY &a, uint32_t tag)
+{
+	for (size_t i = 0; i < a.count; ++i)
+		if (a.pproptag[i] == tag)
+			return true;
+	return false;
+}
+
+int main()
+{
+	uint32_t taglist[] = {PR_SUBJECT, PR_SOURCE_KEY, PROP_TAG_IMPORTANCE,
+	                      PR_MESSAGE_LOCALE_ID, PR_BODY, PR_MESSAGE_CODEPAGE};
+	PROPTAG_ARRAY tags = {sizeof(taglist) / sizeof(taglist[0]), taglist};
+	PROP_CACHE cache;
+	TPROPVAL_ARRAY vals;
+	int ret = EXIT_SUCCESS;
+
+	auto miss1 = read_props(cache, tags, &vals);
+	if (miss1.count != tags.count) {
+		printf("FAIL: first read answered %u tags from an empty cache\n",
+		       tags.count - miss1.count);
+		ret = EXIT_FAILURE;
+	}
+	auto miss2 = read_props(cache, tags, &vals);
+	for (auto tag : g_computed) {
+		if (!has_tag(miss2, tag)) {
+			printf("FAIL: %08x taken from the cache as missing\n", tag);
+			ret = EXIT_FAILURE;
+		}
+	}
+	static const uint32_t cached[] = {PR_SUBJECT, PROP_TAG_IMPORTANCE, PR_BODY};
+	for (auto tag : cached) {
+		if (has_tag(miss2, tag)) {
+			printf("FAIL: %08x not cached\n", tag);
+			ret = EXIT_FAILURE;
+		}
+	}
+	if (vals.count != 2) {
+		printf("FAIL: second read returned %u values, expected 2\n", vals.count);
+		ret = EXIT_FAILURE;
+	}
+	if (ret == EXIT_SUCCESS)
+		printf("second read ok\n");
+	return ret;
+}
@@ -0,0 +1,432 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+/*
+ * Load content table views with SORT_TABLE::write, as exmdb_provider does,
+ * and compare the resulting t<id> rows (headers, counters, expansion,
+ * ordering, prev_id chain) with those of the former stbl path, which ran
+ * the GROUP BY and ORDER BY queries of table_load_content over a scratch
+ * SQLite table.
+ * Usage: tblsort [rows]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+#include "../exch/exmdb_provider/db_engine.h"
+#include "../exch/exmdb_provider/sort_table.h"
+
+using namespace std::chrono;
+
+namespace {
+struct ROW {
+	uint64_t mid;
+	int64_t delivery_time, importance, size;
+	std::string sender, subject;
+	bool b_null_subject, b_read;
+};
+
+struct VIEW_COL {
+	int field; /* 0: delivery_time, 1: importance, 2: size, 3: sender, 4: subject */
+	int role;
+	bool b_desc;
+};
+
+struct VIEW {
+	const char *name;
+	size_t ccategories, cexpanded;
+	std::vector<VIEW_COL> cols;
+};
+}
+
+static const char *const g_tbl_schema = "CREATE TABLE t%u "
+	"(row_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	"idx INTEGER UNIQUE DEFAULT NULL, "
+	"prev_id INTEGER UNIQUE DEFAULT NULL, "
+	"inst_id INTEGER NOT NULL, "
+	"row_type INTEGER NOT NULL, "
+	"row_stat INTEGER DEFAULT NULL, "
+	"parent_id INTEGER DEFAULT NULL, "
+	"depth INTEGER NOT NULL, "
+	"count INTEGER DEFAULT NULL, "
+	"unread INTEGER DEFAULT NULL, "
+	"inst_num INTEGER NOT NULL, "
+	"value NONE DEFAULT NULL, "
+	"extremum NONE DEFAULT NULL)";
+
+static std::vector<ROW> make_rows(size_t count)
+{
+	static const char *const words[] = {
+		"Re: ", "Fwd: ", "Meeting", "report", "Quarterly", "invoice",
+		"lunch", "Status", "update", "PROJECT", "review", "draft",
+	};
+	static const char *const senders[] = {
+		"alice", "Alice", "ALICE", "bob", "Bob", "carol", "dave", "Erin",
+	};
+	std::mt19937_64 rng(42);
+	std::vector<ROW> rows(count);
+	for (size_t i = 0; i < count; ++i) {
+		auto &r = rows[i];
+		r.mid = i + 1;
+		/* plenty of duplicates, to exercise the secondary keys */
+		r.delivery_time = 132000000000000000LL + (rng() % (count / 4 + 1)) * 10000000LL;
+		r.importance = rng() % 3;
+		r.size = rng() % 5000000;
+		r.sender = senders[rng() % std::size(senders)];
+		r.b_null_subject = rng() % 50 == 0;
+		for (int j = 0; j < 3; ++j)
+			r.subject += words[rng() % std::size(words)];
+		r.b_read = rng() % 3 != 0;
+	}
+	return rows;
+}
+
+static bool is_text(int field)
+{
+	return field >= 3;
+}
+
+static void bind_field(sqlite3_stmt *stmt, int idx, const ROW &r, int field)
+{
+	switch (field) {
+	case 0: sqlite3_bind_int64(stmt, idx, r.delivery_time); break;
+	case 1: sqlite3_bind_int64(stmt, idx, r.importance); break;
+	case 2: sqlite3_bind_int64(stmt, idx, r.size); break;
+	case 3: sqlite3_bind_text(stmt, idx, r.sender.c_str(), -1, SQLITE_STATIC); break;
+	default:
+		if (r.b_null_subject)
+			sqlite3_bind_null(stmt, idx);
+		else
+			sqlite3_bind_text(stmt, idx, r.subject.c_str(), -1, SQLITE_STATIC);
+		break;
+	}
+}
+
+static bool exec(sqlite3 *db, const std::string &sql)
+{
+	char *err = nullptr;
+	if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err) == SQLITE_OK)
+		return true;
+	fprintf(stderr, "%s: %s\n", sql.c_str(), err);
+	sqlite3_free(err);
+	return false;
+}
+
+static sqlite3_stmt *prep(sqlite3 *db, const std::string &sql)
+{
+	sqlite3_stmt *stmt = nullptr;
+	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+		fprintf(stderr, "%s: %s\n", sql.c_str(), sqlite3_errmsg(db));
+	return stmt;
+}
+
+static bool create_table(sqlite3 *db, uint32_t table_id)
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf), g_tbl_schema, table_id);
+	return exec(db, buf);
+}
+
+namespace {
+struct STBL_LOAD {
+	sqlite3 *db, *sdb;
+	const VIEW *view;
+	sqlite3_stmt *ins, *upd;
+	uint32_t header_id = 0;
+	std::vector<sqlite3_value *> conds;
+};
+}
+
+/* table_load_content, minus multi-value instances */
+static bool stbl_level(STBL_LOAD &l, size_t depth, int64_t parent_id,
+    uint32_t *punread)
+{
+	auto &v = *l.view;
+	int64_t prev_id = -parent_id;
+	std::string where;
+	for (size_t i = 0; i < l.conds.size(); ++i) {
+		where += where.empty() ? " WHERE " : " AND ";
+		where += "v" + std::to_string(i) + (l.conds[i] == nullptr ? " IS NULL" : "=?");
+	}
+	auto bind_conds = [&](sqlite3_stmt *stmt) {
+		int idx = 1;
+		for (auto c : l.conds)
+			if (c != nullptr)
+				sqlite3_bind_value(stmt, idx++, c);
+	};
+	if (depth == v.ccategories) {
+		std::string sql = "SELECT message_id, read_state FROM stbl" + where;
+		std::string order;
+		for (size_t i = v.ccategories; i < v.cols.size(); ++i) {
+			if (v.cols[i].role != SORT_ROLE_KEY)
+				continue;
+			order += order.empty() ? " ORDER BY " : ", ";
+			order += "v" + std::to_string(i) + (v.cols[i].b_desc ? " DESC" : " ASC");
+		}
+		/* ties are broken by insertion order in SORT_TABLE */
+		sql += order + (order.empty() ? " ORDER BY " : ", ") + "message_id";
+		auto stmt = prep(l.sdb, sql);
+		if (stmt == nullptr)
+			return false;
+		bind_conds(stmt);
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			if (v.ccategories > 0) {
+				if (sqlite3_column_int64(stmt, 1) == 0)
+					++*punread;
+				sqlite3_bind_int64(l.ins, 9, sqlite3_column_int64(stmt, 1));
+			} else {
+				sqlite3_bind_null(l.ins, 9);
+			}
+			sqlite3_bind_int64(l.ins, 1, sqlite3_column_int64(stmt, 0));
+			sqlite3_bind_int64(l.ins, 2, CONTENT_ROW_MESSAGE);
+			sqlite3_bind_null(l.ins, 3);
+			sqlite3_bind_int64(l.ins, 4, parent_id);
+			sqlite3_bind_int64(l.ins, 5, depth);
+			sqlite3_bind_null(l.ins, 6);
+			sqlite3_bind_int64(l.ins, 7, 0);
+			sqlite3_bind_null(l.ins, 8);
+			sqlite3_bind_int64(l.ins, 10, prev_id);
+			if (sqlite3_step(l.ins) != SQLITE_DONE)
+				return false;
+			prev_id = sqlite3_last_insert_rowid(l.db);
+			sqlite3_reset(l.ins);
+		}
+		sqlite3_finalize(stmt);
+		return true;
+	}
+	auto col = "v" + std::to_string(depth);
+	auto dir = v.cols[depth].b_desc ? " DESC" : " ASC";
+	bool b_extremum = depth + 1 == v.ccategories && v.cols.size() > depth + 1 &&
+	                  v.cols[depth+1].role != SORT_ROLE_KEY;
+	std::string sql;
+	if (b_extremum) {
+		auto ext = "v" + std::to_string(depth + 1);
+		sql = "SELECT " + col + ", count(*), " +
+		      (v.cols[depth+1].role == SORT_ROLE_MAXIMUM ? "max(" : "min(") +
+		      ext + ") AS max_field FROM stbl" + where + " GROUP BY " + col +
+		      " ORDER BY max_field" + dir + ", " + col + " ASC";
+	} else {
+		sql = "SELECT " + col + ", count(*) FROM stbl" + where +
+		      " GROUP BY " + col + " ORDER BY " + col + dir;
+	}
+	auto stmt = prep(l.sdb, sql);
+	if (stmt == nullptr)
+		return false;
+	bind_conds(stmt);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		uint64_t header_id = ++l.header_id | 0x100000000000000ULL;
+		sqlite3_bind_int64(l.ins, 1, header_id);
+		sqlite3_bind_int64(l.ins, 2, CONTENT_ROW_HEADER);
+		sqlite3_bind_int64(l.ins, 3, depth < v.cexpanded);
+		sqlite3_bind_int64(l.ins, 4, parent_id);
+		sqlite3_bind_int64(l.ins, 5, depth);
+		sqlite3_bind_int64(l.ins, 6, sqlite3_column_int64(stmt, 1));
+		sqlite3_bind_int64(l.ins, 7, 0);
+		sqlite3_bind_value(l.ins, 8, sqlite3_column_value(stmt, 0));
+		if (b_extremum)
+			sqlite3_bind_value(l.ins, 9, sqlite3_column_value(stmt, 2));
+		else
+			sqlite3_bind_null(l.ins, 9);
+		sqlite3_bind_int64(l.ins, 10, prev_id);
+		if (sqlite3_step(l.ins) != SQLITE_DONE)
+			return false;
+		prev_id = sqlite3_last_insert_rowid(l.db);
+		sqlite3_reset(l.ins);
+		auto val = sqlite3_column_type(stmt, 0) == SQLITE_NULL ? nullptr :
+		           sqlite3_value_dup(sqlite3_column_value(stmt, 0));
+		l.conds.push_back(val);
+		uint32_t unread = 0;
+		auto ok = stbl_level(l, depth + 1, prev_id, &unread);
+		l.conds.pop_back();
+		sqlite3_value_free(val);
+		if (!ok)
+			return false;
+		sqlite3_bind_int64(l.upd, 1, unread);
+		sqlite3_bind_int64(l.upd, 2, prev_id);
+		if (sqlite3_step(l.upd) != SQLITE_DONE)
+			return false;
+		sqlite3_reset(l.upd);
+		*punread += unread;
+	}
+	sqlite3_finalize(stmt);
+	return true;
+}
+
+static bool load_stbl(sqlite3 *db, uint32_t table_id, const VIEW &v,
+    const std::vector<ROW> &rows)
+{
+	sqlite3 *sdb = nullptr;
+	sqlite3_open_v2(":memory:", &sdb, SQLITE_OPEN_READWRITE |
+		SQLITE_OPEN_CREATE, nullptr);
+	std::string sql = "CREATE TABLE stbl (message_id INTEGER";
+	for (size_t i = 0; i < v.cols.size(); ++i)
+		sql += ", v" + std::to_string(i) + (is_text(v.cols[i].field) ?
+		       " TEXT COLLATE NOCASE" : " INTEGER");
+	sql += ", read_state INTEGER)";
+	if (!exec(sdb, "BEGIN TRANSACTION") || !exec(sdb, sql))
+		return false;
+	for (size_t i = 0; i < v.cols.size(); ++i)
+		if (!exec(sdb, "CREATE INDEX stbl_" + std::to_string(i) +
+		    " ON stbl (v" + std::to_string(i) + ")"))
+			return false;
+	sql = "INSERT INTO stbl VALUES (?";
+	for (size_t i = 0; i <= v.cols.size(); ++i)
+		sql += ", ?";
+	auto stmt = prep(sdb, sql + ")");
+	if (stmt == nullptr)
+		return false;
+	for (const auto &r : rows) {
+		sqlite3_bind_int64(stmt, 1, r.mid);
+		for (size_t i = 0; i < v.cols.size(); ++i)
+			bind_field(stmt, i + 2, r, v.cols[i].field);
+		sqlite3_bind_int64(stmt, v.cols.size() + 2, r.b_read);
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			return false;
+		sqlite3_reset(stmt);
+	}
+	sqlite3_finalize(stmt);
+	exec(sdb, "COMMIT TRANSACTION");
+
+	STBL_LOAD l;
+	l.db = db;
+	l.sdb = sdb;
+	l.view = &v;
+	l.ins = prep(db, "INSERT INTO t" + std::to_string(table_id) +
+	        " (inst_id, row_type, row_stat, parent_id, depth, count, "
+	        "inst_num, value, extremum, prev_id) VALUES "
+	        "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+	l.upd = prep(db, "UPDATE t" + std::to_string(table_id) +
+	        " SET unread=? WHERE row_id=?");
+	uint32_t unread = 0;
+	bool ok = l.ins != nullptr && l.upd != nullptr &&
+	          stbl_level(l, 0, 0, &unread);
+	sqlite3_finalize(l.ins);
+	sqlite3_finalize(l.upd);
+	sqlite3_close(sdb);
+	if (ok && v.ccategories == 0)
+		ok = exec(db, "UPDATE t" + std::to_string(table_id) + " SET idx=row_id");
+	return ok;
+}
+
+static bool load_memory(sqlite3 *db, uint32_t table_id, const VIEW &v,
+    const std::vector<ROW> &rows, size_t *pmem)
+{
+	SORT_TABLE stbl;
+	uint32_t header_id = 0;
+
+	for (const auto &c : v.cols)
+		stbl.add_column(is_text(c.field) ? SORT_COL_TEXT :
+			SORT_COL_INTEGER, c.role, c.b_desc);
+	for (const auto &r : rows) {
+		stbl.add_row(r.mid, r.b_read);
+		for (size_t i = 0; i < v.cols.size(); ++i) {
+			switch (v.cols[i].field) {
+			case 0: stbl.push_int(i, r.delivery_time); break;
+			case 1: stbl.push_int(i, r.importance); break;
+			case 2: stbl.push_int(i, r.size); break;
+			case 3: stbl.push_text(i, r.sender.c_str()); break;
+			default:
+				if (r.b_null_subject)
+					stbl.push_null(i);
+				else
+					stbl.push_text(i, r.subject.c_str());
+				break;
+			}
+		}
+	}
+	*pmem = stbl.mem_used();
+	return stbl.write(db, table_id, v.ccategories, v.cexpanded,
+	       &header_id) != FALSE;
+}
+
+/* the header value of a NOCASE group may come from any of its rows */
+static std::vector<std::string> dump_table(sqlite3 *db, uint32_t table_id)
+{
+	std::vector<std::string> out;
+	auto stmt = prep(db, "SELECT row_id, idx, prev_id, inst_id, row_type, "
+	            "row_stat, parent_id, depth, count, unread, inst_num, "
+	            "lower(value), lower(extremum) FROM t" +
+	            std::to_string(table_id) + " ORDER BY row_id");
+	if (stmt == nullptr)
+		return out;
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		std::string line;
+		for (int i = 0; i < sqlite3_column_count(stmt); ++i) {
+			auto s = sqlite3_column_text(stmt, i);
+			line += s != nullptr ? reinterpret_cast<const char *>(s) : "NULL";
+			line += '|';
+		}
+		out.push_back(std::move(line));
+	}
+	sqlite3_finalize(stmt);
+	return out;
+}
+
+int main(int argc, const char **argv)
+{
+	size_t count = argc > 1 ? strtoul(argv[1], nullptr, 0) : 20000;
+	auto rows = make_rows(count);
+	static const VIEW views[] = {
+		{"sorted", 0, 0, {{0, SORT_ROLE_KEY, true}, {4, SORT_ROLE_KEY, false},
+		 {2, SORT_ROLE_KEY, true}}},
+		{"by sender", 1, 1, {{3, SORT_ROLE_CATEGORY, false},
+		 {0, SORT_ROLE_KEY, true}, {4, SORT_ROLE_KEY, false}}},
+		{"by importance, sender, newest", 2, 1,
+		 {{1, SORT_ROLE_CATEGORY, true}, {3, SORT_ROLE_CATEGORY, false},
+		 {0, SORT_ROLE_MAXIMUM, true}, {0, SORT_ROLE_KEY, true},
+		 {2, SORT_ROLE_KEY, false}}},
+		{"by subject", 1, 0, {{4, SORT_ROLE_CATEGORY, true},
+		 {0, SORT_ROLE_MINIMUM, false}, {2, SORT_ROLE_KEY, true}}},
+	};
+	sqlite3 *db = nullptr;
+	sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READWRITE |
+		SQLITE_OPEN_CREATE, nullptr);
+	int ret = EXIT_SUCCESS;
+	uint32_t table_id = 0;
+
+	printf("%zu rows\n", count);
+	for (const auto &v : views) {
+		uint32_t t_stbl = ++table_id, t_mem = ++table_id;
+		size_t mem = 0;
+		if (!create_table(db, t_stbl) || !create_table(db, t_mem) ||
+		    !exec(db, "BEGIN TRANSACTION"))
+			return EXIT_FAILURE;
+		auto t0 = steady_clock::now();
+		if (!load_stbl(db, t_stbl, v, rows)) {
+			printf("FAIL: %s: stbl load\n", v.name);
+			return EXIT_FAILURE;
+		}
+		auto t1 = steady_clock::now();
+		if (!load_memory(db, t_mem, v, rows, &mem)) {
+			printf("FAIL: %s: SORT_TABLE::write\n", v.name);
+			return EXIT_FAILURE;
+		}
+		auto t2 = steady_clock::now();
+		exec(db, "COMMIT TRANSACTION");
+		auto a = dump_table(db, t_stbl), b = dump_table(db, t_mem);
+		printf("%s: %zu table rows, stbl %.2f ms, SORT_TABLE %.2f ms (%zu KB)\n",
+		       v.name, a.size(),
+		       duration<double, std::milli>(t1 - t0).count(),
+		       duration<double, std::milli>(t2 - t1).count(), mem / 1024);
+		if (a.size() != b.size()) {
+			printf("FAIL: %s: %zu rows vs %zu\n", v.name, a.size(), b.size());
+			ret = EXIT_FAILURE;
+			continue;
+		}
+		for (size_t i = 0; i < a.size(); ++i) {
+			if (a[i] == b[i])
+				continue;
+			printf("FAIL: %s: row %zu differs:\n  stbl:       %s\n"
+			       "  SORT_TABLE: %s\n", v.name, i + 1,
+			       a[i].c_str(), b[i].c_str());
+			ret = EXIT_FAILURE;
+			break;
+		}
+	}
+	sqlite3_close(db);
+	if (ret == EXIT_SUCCESS)
+		printf("tables match\n");
+	return ret;
+}
@@ -386,6 +386,7 @@ int main(int argc, const char **argv)
 	auto cl_1 = make_scope_exit([&]() { sqlite3_close(psqlite); });
 	if (chmod(temp_path.c_str(), 0666) < 0)
 		fprintf(stderr, "W-1400: chmod %s: %s\n", temp_path.c_str(), strerror(errno));
+	sqlite3_exec(psqlite, "PRAGMA auto_vacuum=INCREMENTAL", NULL, NULL, NULL);
 	/* begin the transaction */
 	sqlite3_exec(psqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
 	
@@ -256,6 +256,7 @@ int main(int argc, const char **argv)
 	auto cl_1 = make_scope_exit([&]() { sqlite3_close(psqlite); });
 	if (chmod(temp_path1, 0666) < 0)
 		fprintf(stderr, "W-1397: chmod %s: %s\n", temp_path1, strerror(errno));
+	sqlite3_exec(psqlite, "PRAGMA auto_vacuum=INCREMENTAL", NULL, NULL, NULL);
 	sqlite3_exec(psqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
 	if (sqlite3_exec(psqlite, sql_string.c_str(), nullptr, nullptr,
 	    &err_msg) != SQLITE_OK) {